@@ -29,6 +29,7 @@
 #include "core/FlexibleBin.h"
 #include "tools/Matrix.h"
 #include "tools/Random.h"
+#include "tools/OpenMP.h"
 #include <string>
 #include <cstring>
 #include "tools/File.h"
@@ -36,8 +37,12 @@
 #include <limits>
 #include <ctime>
 #include <memory>
+#include <map>
+#include <algorithm>
 
 #define DP2CUTOFF 6.25
+// the cell list is rebuilt when the hills are this many cells wide
+#define CELL_REBUILD_FACTOR 2.0
 
 using namespace std;
 
@@ -409,6 +414,18 @@ private:
   bool storeOldGrids_;
   int wgridstride_;
   bool grid_;
+  // cell list over the centers of the hills, used without grid
+  bool cell_list_;
+  vector<double> cell_width_;
+  vector<int> cell_nperiodic_;
+  vector<double> hills_max_width_;
+  std::map<vector<int>,vector<unsigned> > cells_;
+  vector<vector<double> > hills_center_;
+  vector<vector<double> > hills_invsigma_;
+  vector<double> hills_height_;
+  vector<unsigned> candidates_;
+  vector<double> candidates_dp_;
+  vector<double> candidates_dp2_;
   double height0_;
   double biasf_;
   static const size_t n_tempering_options_ = 1;
@@ -464,6 +481,12 @@ private:
   void   readGaussians(IFile*);
   void   writeGaussian(const Gaussian&,OFile&);
   void   addGaussian(const Gaussian&);
+  void   addGaussianToCellList(const Gaussian&, unsigned);
+  void   setupCellList(const vector<double>&);
+  void   clearGaussians();
+  void   getCell(const double*, vector<int>&);
+  double getBiasAndDerivativesFromCellList(const vector<double>&, double* der);
+  void   stampGaussian(const Gaussian&);
   double getHeight(const vector<double>&);
   void   temperHeight(double &height, const TemperingSpecs &t_specs, const double tempering_bias);
   double getBiasAndDerivatives(const vector<double>&,double* der=NULL);
@@ -520,6 +543,7 @@ void MetaD::registerKeywords(Keywords& keys) {
   keys.add("optional","RCT_USTRIDE","the update stride for calculating the \\f$c(t)\\f$ reweighting factor."
            "The default 1, so \\f$c(t)\\f$ is updated every time the bias is updated.");
   keys.addFlag("GRID_SPARSE",false,"use a sparse grid to store hills");
+  keys.addFlag("CELL_LIST",false,"without a grid, use a cell list of the hill centers such that only the hills close to the current point are evaluated");
   keys.addFlag("GRID_NOSPLINE",false,"don't use spline interpolation with grids");
   keys.add("optional","GRID_WSTRIDE","write the grid to a file every N steps");
   keys.add("optional","GRID_WFILE","the file on which to write the grid");
@@ -561,6 +585,7 @@ MetaD::MetaD(const ActionOptions& ao):
   PLUMED_BIAS_INIT(ao),
 // Grid stuff initialization
   wgridstride_(0), grid_(false),
+  cell_list_(false),
 // Metadynamics basic parameters
   height0_(std::numeric_limits<double>::max()), biasf_(-1.0), dampfactor_(0.0),
   tt_specs_(false, "TT", "Transition Tempered", -1.0, 0.0, 1.0),
@@ -785,6 +810,9 @@ MetaD::MetaD(const ActionOptions& ao):
   string gridreadfilename_;
   parse("GRID_RFILE",gridreadfilename_);
 
+  parseFlag("CELL_LIST",cell_list_);
+  if(grid_ && cell_list_) error("CELL_LIST is only used without a grid");
+
   if(!grid_&&gridfilename_.length()> 0) error("To write a grid you need first to define it!");
   if(!grid_&&gridreadfilename_.length()>0) error("To read a grid you need first to define it!");
 
@@ -941,6 +969,7 @@ MetaD::MetaD(const ActionOptions& ao):
     if(sparsegrid) {log.printf("  Grid uses sparse grid\n");}
     if(wgridstride_>0) {log.printf("  Grid is written on file %s with stride %d\n",gridfilename_.c_str(),wgridstride_);}
   }
+  if(cell_list_) log.printf("  Using a cell list of the hill centers to evaluate the bias\n");
 
   if(mw_n_>1) {
     if(walkers_mpi) error("MPI version of multiple walkers is not compatible with filesystem version of multiple walkers");
@@ -1409,7 +1438,11 @@ void MetaD::writeGaussian(const Gaussian& hill, OFile&file)
 
 void MetaD::addGaussian(const Gaussian& hill)
 {
-  if(!grid_) hills_.push_back(hill);
+  if(!grid_) {
+    hills_.push_back(hill);
+    if(cell_list_) addGaussianToCellList(hill,hills_.size()-1);
+  }
+  else if(!hill.multivariate && !doInt_) stampGaussian(hill);
   else {
     unsigned ncv=getNumberOfArguments();
     vector<unsigned> nneighb=getGaussianSupport(hill);
@@ -1445,6 +1478,90 @@ void MetaD::addGaussian(const Gaussian& hill)
   }
 }
 
+// A diagonal Gaussian is the product of one-dimensional Gaussians, so the
+// exponentials are only computed along each dimension of the support and the
+// hill is added to the grid as their outer product. The stamp is cheap enough
+// that every rank computes all of it, so no communication is needed.
+void MetaD::stampGaussian(const Gaussian& hill)
+{
+  const unsigned ncv=getNumberOfArguments();
+  const vector<unsigned> nneighb=getGaussianSupport(hill);
+  const vector<unsigned> nbin=BiasGrid_->getNbin();
+  const vector<bool> pbc=BiasGrid_->getIsPeriodic();
+  const vector<unsigned> center=BiasGrid_->getIndices(hill.center);
+  // tables along each dimension with the contribution to the grid index,
+  // the scaled distance from the center, its square and the Gaussian
+  vector<vector<Grid::index_t> > offset(ncv);
+  vector<vector<double> > dp(ncv), dp2(ncv), gauss(ncv);
+  vector<unsigned> indices(center);
+  vector<double> xx(ncv);
+  Grid::index_t stride=1;
+  bool repeated_bins=false;
+  for(unsigned i=0; i<ncv; ++i) {
+    const int n=static_cast<int>(nbin[i]);
+    for(int k=-static_cast<int>(nneighb[i]); k<=static_cast<int>(nneighb[i]); ++k) {
+      int i0=static_cast<int>(center[i])+k;
+      if(!pbc[i] && (i0<0 || i0>=n)) continue;
+      if(pbc[i]) i0=((i0%n)+n)%n;
+      indices[i]=static_cast<unsigned>(i0);
+      BiasGrid_->getPoint(indices,xx);
+      const double d=difference(i,hill.center[i],xx[i])*hill.invsigma[i];
+      offset[i].push_back(static_cast<Grid::index_t>(i0)*stride);
+      dp[i].push_back(d);
+      dp2[i].push_back(d*d);
+      gauss[i].push_back(exp(-0.5*d*d));
+    }
+    // a periodic support wider than the grid visits some bins more than once
+    if(offset[i].size()>nbin[i]) repeated_bins=true;
+    indices[i]=center[i];
+    stride*=nbin[i];
+  }
+  for(unsigned i=0; i<ncv; ++i) if(offset[i].empty()) return;
+
+  // the slices along the last dimension are distributed among the threads,
+  // this is only safe when they are different bins of a dense grid
+  const unsigned last=ncv-1;
+  const unsigned nslices=offset[last].size();
+  unsigned nt=OpenMP::getNumThreads();
+  if(nt*2>nslices || repeated_bins || !dynamic_cast<Grid*>(BiasGrid_.get())) nt=1;
+  #pragma omp parallel num_threads(nt)
+  {
+    vector<unsigned> k(ncv);
+    vector<double> der(ncv);
+    #pragma omp for
+    for(unsigned s=0; s<nslices; ++s) {
+      for(unsigned i=0; i<last; ++i) k[i]=0;
+      k[last]=s;
+      while(true) {
+        Grid::index_t index=0;
+        double q=0.0;
+        for(unsigned i=0; i<ncv; ++i) {
+          index+=offset[i][k[i]];
+          q+=dp2[i][k[i]];
+        }
+        q*=0.5;
+        // all the points of the support are added, also the ones beyond the
+        // cutoff, such that a sparse grid has the same bins as before
+        double bias=0.0;
+        for(unsigned i=0; i<ncv; ++i) der[i]=0.0;
+        if(q<DP2CUTOFF) {
+          bias=hill.height;
+          for(unsigned i=0; i<ncv; ++i) bias*=gauss[i][k[i]];
+          for(unsigned i=0; i<ncv; ++i) der[i]=-bias*dp[i][k[i]]*hill.invsigma[i];
+        }
+        BiasGrid_->addValueAndDerivatives(index,bias,der);
+        // move to the next point of the slice, the first dimension is the fastest
+        unsigned i=0;
+        for(; i<last; ++i) {
+          if(++k[i]<offset[i].size()) break;
+          k[i]=0;
+        }
+        if(i==last) break;
+      }
+    }
+  }
+}
+
 vector<unsigned> MetaD::getGaussianSupport(const Gaussian& hill)
 {
   vector<unsigned> nneigh;
@@ -1503,13 +1620,14 @@ double MetaD::getBiasAndDerivatives(const vector<double>& cv, double* der)
 {
   double bias=0.0;
   if(!grid_) {
-    if(hills_.size()>10000 && (getStep()-last_step_warn_grid)>10000) {
+    if(!cell_list_ && hills_.size()>10000 && (getStep()-last_step_warn_grid)>10000) {
       std::string msg;
       Tools::convert(hills_.size(),msg);
       msg="You have accumulated "+msg+" hills, you should enable GRIDs to avoid serious performance hits";
       warning(msg);
       last_step_warn_grid=getStep();
     }
+    if(cell_list_) return getBiasAndDerivativesFromCellList(cv,der);
     unsigned stride=comm.Get_size();
     unsigned rank=comm.Get_rank();
     for(unsigned i=rank; i<hills_.size(); i+=stride) {
@@ -1530,6 +1648,214 @@ double MetaD::getBiasAndDerivatives(const vector<double>& cv, double* der)
   return bias;
 }
 
+// The cells have the width of the largest support of the hills along each
+// argument, along periodic arguments they are rounded such that the period
+// is an integer number of cells. A hill is stored in the cell of its center,
+// so the hills that contribute at a point are all in the cells within the
+// largest support of the hills. When the hills grow wider than a few cells,
+// e.g. with adaptive hills, the cell list is rebuilt with the new widths.
+void MetaD::addGaussianToCellList(const Gaussian& hill, unsigned index)
+{
+  const unsigned ncv=getNumberOfArguments();
+  plumed_dbg_assert(index==hills_height_.size());
+  // half width of the support of the hill along each argument
+  vector<double> width(ncv);
+  if(hill.multivariate) {
+    unsigned k=0;
+    Matrix<double> mymatrix(ncv,ncv);
+    for(unsigned i=0; i<ncv; i++) {
+      for(unsigned j=i; j<ncv; j++) {
+        // recompose the full inverse matrix
+        mymatrix(i,j)=mymatrix(j,i)=hill.sigma[k];
+        k++;
+      }
+    }
+    Matrix<double> myinv(ncv,ncv);
+    Invert(mymatrix,myinv);
+    for(unsigned i=0; i<ncv; i++) width[i]=sqrt(2.0*DP2CUTOFF*myinv(i,i));
+  } else {
+    for(unsigned i=0; i<ncv; i++) width[i]=sqrt(2.0*DP2CUTOFF)*abs(hill.sigma[i]);
+  }
+  // a small margin such that no hill within the cutoff is missed
+  for(unsigned i=0; i<ncv; i++) {
+    width[i]*=1.0+1.e-8;
+    plumed_massert(width[i]>0.0,"CELL_LIST cannot be used with hills of zero width");
+  }
+
+  if(cell_width_.empty()) {
+    hills_max_width_.assign(ncv,0.0);
+    hills_center_.resize(ncv);
+    hills_invsigma_.resize(ncv);
+    setupCellList(width);
+  }
+  bool rebuild=false;
+  for(unsigned i=0; i<ncv; i++) {
+    hills_max_width_[i]=std::max(hills_max_width_[i],width[i]);
+    if(hills_max_width_[i]>CELL_REBUILD_FACTOR*cell_width_[i] && cell_nperiodic_[i]!=1) rebuild=true;
+    hills_center_[i].push_back(hill.center[i]);
+    hills_invsigma_[i].push_back(hill.multivariate ? 0.0 : hill.invsigma[i]);
+  }
+  hills_height_.push_back(hill.height);
+  if(rebuild) {
+    setupCellList(hills_max_width_);
+  } else {
+    vector<int> cell(ncv);
+    getCell(&hill.center[0],cell);
+    cells_[cell].push_back(index);
+  }
+}
+
+void MetaD::setupCellList(const vector<double>& width)
+{
+  const unsigned ncv=getNumberOfArguments();
+  cell_width_=width;
+  cell_nperiodic_.assign(ncv,0);
+  for(unsigned i=0; i<ncv; i++) {
+    if(getPntrToArgument(i)->isPeriodic()) {
+      double min,max;
+      getPntrToArgument(i)->getDomain(min,max);
+      cell_nperiodic_[i]=std::max(1,static_cast<int>(floor((max-min)/width[i])));
+      cell_width_[i]=(max-min)/cell_nperiodic_[i];
+    }
+  }
+  // put the hills that are already there in the new cells
+  cells_.clear();
+  vector<double> center(ncv);
+  vector<int> cell(ncv);
+  for(unsigned h=0; h<hills_height_.size(); h++) {
+    for(unsigned i=0; i<ncv; i++) center[i]=hills_center_[i][h];
+    getCell(&center[0],cell);
+    cells_[cell].push_back(h);
+  }
+}
+
+void MetaD::clearGaussians()
+{
+  hills_.clear();
+  cells_.clear();
+  for(unsigned i=0; i<hills_center_.size(); i++) {
+    hills_center_[i].clear();
+    hills_invsigma_[i].clear();
+  }
+  hills_height_.clear();
+  // the cells are set up again from the next hill
+  cell_width_.clear();
+}
+
+void MetaD::getCell(const double* x, vector<int>& cell)
+{
+  for(unsigned i=0; i<cell.size(); i++) {
+    if(cell_nperiodic_[i]>0) {
+      double min,max;
+      getPntrToArgument(i)->getDomain(min,max);
+      double s=(x[i]-min)/(max-min);
+      s-=floor(s);
+      cell[i]=std::min(static_cast<int>(floor(s*cell_nperiodic_[i])),cell_nperiodic_[i]-1);
+    } else {
+      cell[i]=static_cast<int>(floor(x[i]/cell_width_[i]));
+    }
+  }
+}
+
+double MetaD::getBiasAndDerivativesFromCellList(const vector<double>& cv, double* der)
+{
+  const unsigned ncv=getNumberOfArguments();
+  double bias=0.0;
+  candidates_.clear();
+  // the point where the hills are evaluated, see evaluateGaussian for INTERVAL
+  vector<double> x(cv);
+  if(doInt_) x[0]=std::min(std::max(x[0],lowI_),uppI_);
+
+  // collect the hills in the cells around the point
+  if(!cell_width_.empty()) {
+    vector<int> center(ncv), first(ncv), count(ncv), cell(ncv), k(ncv,0);
+    getCell(&x[0],center);
+    for(unsigned i=0; i<ncv; i++) {
+      const int w=static_cast<int>(ceil(hills_max_width_[i]/cell_width_[i]));
+      first[i]=center[i]-w;
+      count[i]=2*w+1;
+      // all the cells along a periodic argument, each visited once
+      if(cell_nperiodic_[i]>0 && count[i]>=cell_nperiodic_[i]) {first[i]=0; count[i]=cell_nperiodic_[i];}
+    }
+    // when there are fewer occupied cells than cells to visit, the occupied
+    // cells are checked instead
+    double nvisit=1.0;
+    for(unsigned i=0; i<ncv; i++) nvisit*=count[i];
+    if(nvisit>cells_.size()) {
+      for(const auto& c : cells_) {
+        bool inside=true;
+        for(unsigned i=0; i<ncv && inside; i++) {
+          int d=c.first[i]-first[i];
+          if(cell_nperiodic_[i]>0) d=((d%cell_nperiodic_[i])+cell_nperiodic_[i])%cell_nperiodic_[i];
+          inside=(d>=0 && d<count[i]);
+        }
+        if(inside) candidates_.insert(candidates_.end(),c.second.begin(),c.second.end());
+      }
+    } else {
+      while(true) {
+        for(unsigned i=0; i<ncv; i++) {
+          cell[i]=first[i]+k[i];
+          if(cell_nperiodic_[i]>0) cell[i]=((cell[i]%cell_nperiodic_[i])+cell_nperiodic_[i])%cell_nperiodic_[i];
+        }
+        const auto it=cells_.find(cell);
+        if(it!=cells_.end()) candidates_.insert(candidates_.end(),it->second.begin(),it->second.end());
+        unsigned i=0;
+        for(; i<ncv; i++) {
+          if(++k[i]<count[i]) break;
+          k[i]=0;
+        }
+        if(i==ncv) break;
+      }
+    }
+  }
+  // the hills are summed in the order in which they were added and split
+  // among the ranks as when all the hills are evaluated
+  std::sort(candidates_.begin(),candidates_.end());
+  const unsigned stride=comm.Get_size();
+  const unsigned rank=comm.Get_rank();
+  if(stride>1) {
+    candidates_.erase(std::remove_if(candidates_.begin(),candidates_.end(),
+    [stride,rank](unsigned h) {return h%stride!=rank;}),candidates_.end());
+  }
+
+  // scaled distances from the centers, stored by argument
+  const unsigned nc=candidates_.size();
+  candidates_dp_.resize(ncv*nc);
+  candidates_dp2_.assign(nc,0.0);
+  for(unsigned i=0; i<ncv && nc>0; i++) {
+    const double* center=hills_center_[i].data();
+    const double* invsigma=hills_invsigma_[i].data();
+    double* dp=candidates_dp_.data()+i*nc;
+    for(unsigned j=0; j<nc; j++) {
+      const unsigned h=candidates_[j];
+      dp[j]=difference(i,center[h],x[i])*invsigma[h];
+      candidates_dp2_[j]+=dp[j]*dp[j];
+    }
+  }
+  for(unsigned j=0; j<nc; j++) {
+    const unsigned h=candidates_[j];
+    if(hills_[h].multivariate) {
+      bias+=evaluateGaussian(cv,hills_[h],der);
+      continue;
+    }
+    const double dp2=0.5*candidates_dp2_[j];
+    if(dp2<DP2CUTOFF) {
+      const double b=hills_height_[h]*exp(-dp2);
+      bias+=b;
+      if(der) {
+        for(unsigned i=0; i<ncv; i++) der[i]+=-b*candidates_dp_[i*nc+j]*hills_invsigma_[i][h];
+      }
+    }
+  }
+  if(doInt_ && der && (cv[0]<lowI_ || cv[0]>uppI_)) {
+    for(unsigned i=0; i<ncv; i++) der[i]=0.0;
+  }
+
+  comm.Sum(bias);
+  if(der) comm.Sum(der,ncv);
+  return bias;
+}
+
 double MetaD::getGaussianNormalization( const Gaussian& hill )
 {
   double norm=1;
@@ -1762,7 +2088,7 @@ void MetaD::update() {
 
       // Flying Gaussian
       if (flying) {
-        hills_.clear();
+        clearGaussians();
         comm.Barrier();
       }
 
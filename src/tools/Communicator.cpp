@@ -133,6 +133,26 @@ void Communicator::Sum(Data data) {
 #endif
 }
 
+Communicator::Request Communicator::Isum(ConstData in,Data out) {
+  Request req;
+#if defined(__PLUMED_HAS_MPI)
+  plumed_massert(initialized(),"you are trying to use an MPI function, but MPI is not initialized");
+  plumed_massert(in.size==out.size,"the input and output buffers of Isum should have the same size");
+  void*s=const_cast<void*>((const void*)in.pointer);
+#if MPI_VERSION>=3
+  MPI_Iallreduce(s,out.pointer,out.size,out.type,MPI_SUM,communicator,&req.r);
+#else
+  MPI_Allreduce(s,out.pointer,out.size,out.type,MPI_SUM,communicator);
+  req.r=MPI_REQUEST_NULL;
+#endif
+#else
+  (void) in;
+  (void) out;
+  plumed_merror("you are trying to use an MPI function, but PLUMED has been compiled without MPI support");
+#endif
+  return req;
+}
+
 void Communicator::Prod(Data data) {
 #if defined(__PLUMED_HAS_MPI)
   if(initialized()) MPI_Allreduce(MPI_IN_PLACE,data.pointer,data.size,data.type,MPI_PROD,communicator);
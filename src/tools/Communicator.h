@@ -177,6 +177,13 @@ public:
   template <class T> void Sum(T*buf,int count) {Sum(Data(buf,count));}
 /// Wrapper for MPI_Allreduce with MPI_SUM (reference)
   template <class T> void Sum(T&buf) {Sum(Data(buf));}
+/// Wrapper for MPI_Iallreduce with MPI_SUM (data struct).
+/// The result is available in out after the returned request has been waited for,
+/// in and out should not be touched before that.
+/// With MPI libraries older than MPI-3 the reduction is done when calling this function.
+  Request Isum(ConstData in,Data out);
+/// Wrapper for MPI_Iallreduce with MPI_SUM (reference)
+  template <class T,class S> Request Isum(const T&in,S&out) {return Isum(ConstData(in),Data(out));}
 /// Wrapper for MPI_Allreduce with MPI_PROD (data struct)
   void Prod(Data);
 /// Wrapper for MPI_Allreduce with MPI_PROD (pointer)
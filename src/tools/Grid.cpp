@@ -36,6 +36,7 @@
 #include <cstdio>
 #include <cfloat>
 #include <array>
+#include <algorithm>
 
 using namespace std;
 namespace PLMD {
@@ -403,8 +404,8 @@ double GridBase::getValue(const vector<double> & x) const {
   if(!dospline_) {
     return getValue(getIndex(x));
   } else {
-    vector<double> der(dimension_);
-    return getValueAndDerivatives(x,der);
+    std::array<double,maxdim> der;
+    return getSplineValueAndDerivatives(x,der.data());
   }
 }
 
@@ -418,52 +419,58 @@ double GridBase::getValueAndDerivatives
   plumed_dbg_assert(der.size()==dimension_ && usederiv_);
 
   if(dospline_) {
-    double X,X2,X3,value;
-    std::array<double,maxdim> fd, C, D;
-    std::vector<double> dder(dimension_);
+    return getSplineValueAndDerivatives(x,der.data());
+  } else {
+    return getValueAndDerivatives(getIndex(x),der);
+  }
+}
+
+double GridBase::getSplineValueAndDerivatives
+(const vector<double> & x, double* der) const {
+  plumed_dbg_assert(x.size()==dimension_ && usederiv_);
+  double X,X2,X3,value;
+  std::array<double,maxdim> fd, C, D;
+  std::vector<double> dder(dimension_);
 // reset
-    value=0.0;
-    for(unsigned int i=0; i<dimension_; ++i) der[i]=0.0;
+  value=0.0;
+  for(unsigned int i=0; i<dimension_; ++i) der[i]=0.0;
 
-    vector<unsigned> indices(dimension_);
-    getIndices(x, indices);
-    vector<double> xfloor(dimension_);
-    getPoint(indices, xfloor);
-    vector<index_t> neigh; unsigned nneigh; getSplineNeighbors(indices, neigh, nneigh);
+  vector<unsigned> indices(dimension_);
+  getIndices(x, indices);
+  vector<double> xfloor(dimension_);
+  getPoint(indices, xfloor);
+  vector<index_t> neigh; unsigned nneigh; getSplineNeighbors(indices, neigh, nneigh);
 
 // loop over neighbors
-    vector<unsigned> nindices;
-    for(unsigned int ipoint=0; ipoint<nneigh; ++ipoint) {
-      double grid=getValueAndDerivatives(neigh[ipoint],dder);
-      getIndices(neigh[ipoint], nindices);
-      double ff=1.0;
-
-      for(unsigned j=0; j<dimension_; ++j) {
-        int x0=1;
-        if(nindices[j]==indices[j]) x0=0;
-        double dx=getDx(j);
-        X=fabs((x[j]-xfloor[j])/dx-(double)x0);
-        X2=X*X;
-        X3=X2*X;
-        double yy;
-        if(fabs(grid)<0.0000001) yy=0.0;
-        else yy=-dder[j]/grid;
-        C[j]=(1.0-3.0*X2+2.0*X3) - (x0?-1.0:1.0)*yy*(X-2.0*X2+X3)*dx;
-        D[j]=( -6.0*X +6.0*X2) - (x0?-1.0:1.0)*yy*(1.0-4.0*X +3.0*X2)*dx;
-        D[j]*=(x0?-1.0:1.0)/dx;
-        ff*=C[j];
-      }
-      for(unsigned j=0; j<dimension_; ++j) {
-        fd[j]=D[j];
-        for(unsigned i=0; i<dimension_; ++i) if(i!=j) fd[j]*=C[i];
-      }
-      value+=grid*ff;
-      for(unsigned j=0; j<dimension_; ++j) der[j]+=grid*fd[j];
+  vector<unsigned> nindices;
+  for(unsigned int ipoint=0; ipoint<nneigh; ++ipoint) {
+    double grid=getValueAndDerivatives(neigh[ipoint],dder);
+    getIndices(neigh[ipoint], nindices);
+    double ff=1.0;
+
+    for(unsigned j=0; j<dimension_; ++j) {
+      int x0=1;
+      if(nindices[j]==indices[j]) x0=0;
+      double dx=getDx(j);
+      X=fabs((x[j]-xfloor[j])/dx-(double)x0);
+      X2=X*X;
+      X3=X2*X;
+      double yy;
+      if(fabs(grid)<0.0000001) yy=0.0;
+      else yy=-dder[j]/grid;
+      C[j]=(1.0-3.0*X2+2.0*X3) - (x0?-1.0:1.0)*yy*(X-2.0*X2+X3)*dx;
+      D[j]=( -6.0*X +6.0*X2) - (x0?-1.0:1.0)*yy*(1.0-4.0*X +3.0*X2)*dx;
+      D[j]*=(x0?-1.0:1.0)/dx;
+      ff*=C[j];
     }
-    return value;
-  } else {
-    return getValueAndDerivatives(getIndex(x),der);
+    for(unsigned j=0; j<dimension_; ++j) {
+      fd[j]=D[j];
+      for(unsigned i=0; i<dimension_; ++i) if(i!=j) fd[j]*=C[i];
+    }
+    value+=grid*ff;
+    for(unsigned j=0; j<dimension_; ++j) der[j]+=grid*fd[j];
   }
+  return value;
 }
 
 void GridBase::setValue(const vector<unsigned> & indices, double value) {
@@ -744,6 +751,77 @@ double Grid::getValueAndDerivatives
   return grid_[index];
 }
 
+template<unsigned DIM>
+double Grid::getSplineValueAndDerivativesDim
+(const vector<double> & x, double* der) const {
+// the same arithmetic as in GridBase::getSplineValueAndDerivatives, but with
+// fixed-size arrays and the values and derivatives read directly from grid_ and der_
+  std::array<unsigned,DIM> indices;
+  std::array<double,DIM> xfloor;
+  for(unsigned j=0; j<DIM; ++j) {
+    indices[j]=unsigned(floor((x[j]-min_[j])/dx_[j]));
+// outside of the grid, the generic version gives the error
+    if(indices[j]>=nbin_[j]) return GridBase::getSplineValueAndDerivatives(x,der);
+    xfloor[j]=min_[j]+(double)(indices[j])*dx_[j];
+  }
+  double value=0.0;
+  for(unsigned j=0; j<DIM; ++j) der[j]=0.0;
+// loop over neighbors
+  for(unsigned ipoint=0; ipoint<(1u<<DIM); ++ipoint) {
+    std::array<unsigned,DIM> nindices;
+    bool inside=true;
+    for(unsigned j=0; j<DIM; ++j) {
+      unsigned i0=((ipoint>>j)&1u)+indices[j];
+      if(i0==nbin_[j]) {
+        if(!pbc_[j]) {inside=false; break;}
+        i0=0;
+      }
+      nindices[j]=i0;
+    }
+    if(!inside) continue;
+    index_t index=nindices[DIM-1];
+    for(unsigned i=DIM-1; i>0; --i) index=index*nbin_[i-1]+nindices[i-1];
+    const double grid=grid_[index];
+    const double* dder=&der_[DIM*index];
+    std::array<double,DIM> C, D;
+    double ff=1.0;
+    for(unsigned j=0; j<DIM; ++j) {
+      int x0=1;
+      if(nindices[j]==indices[j]) x0=0;
+      double dx=dx_[j];
+      double X=fabs((x[j]-xfloor[j])/dx-(double)x0);
+      double X2=X*X;
+      double X3=X2*X;
+      double yy;
+      if(fabs(grid)<0.0000001) yy=0.0;
+      else yy=-dder[j]/grid;
+      C[j]=(1.0-3.0*X2+2.0*X3) - (x0?-1.0:1.0)*yy*(X-2.0*X2+X3)*dx;
+      D[j]=( -6.0*X +6.0*X2) - (x0?-1.0:1.0)*yy*(1.0-4.0*X +3.0*X2)*dx;
+      D[j]*=(x0?-1.0:1.0)/dx;
+      ff*=C[j];
+    }
+    value+=grid*ff;
+    for(unsigned j=0; j<DIM; ++j) {
+      double fd=D[j];
+      for(unsigned i=0; i<DIM; ++i) if(i!=j) fd*=C[i];
+      der[j]+=grid*fd;
+    }
+  }
+  return value;
+}
+
+double Grid::getSplineValueAndDerivatives
+(const vector<double> & x, double* der) const {
+  plumed_dbg_assert(x.size()==dimension_ && usederiv_);
+  switch(dimension_) {
+  case 1: return getSplineValueAndDerivativesDim<1>(x,der);
+  case 2: return getSplineValueAndDerivativesDim<2>(x,der);
+  case 3: return getSplineValueAndDerivativesDim<3>(x,der);
+  case 4: return getSplineValueAndDerivativesDim<4>(x,der);
+  default: return GridBase::getSplineValueAndDerivatives(x,der);
+  }
+}
+
 void Grid::setValue(index_t index, double value) {
   plumed_dbg_assert(index<maxsize_ && !usederiv_);
   grid_[index]=value;
@@ -768,8 +846,112 @@ void Grid::addValueAndDerivatives
   for(unsigned int i=0; i<dimension_; ++i) der_[index*dimension_+i]+=der[i];
 }
 
+constexpr GridBase::index_t SparseGrid::empty_slot;
+
+void SparseGrid::initTiles() {
+// tiles have 8 bins along each dimension, less in high dimension
+// such that a tile does not have more than 4096 bins
+  unsigned edge=8;
+  while(edge>1 && std::pow(static_cast<double>(edge),static_cast<double>(dimension_))>4096.0) edge/=2;
+  tile_nbin_.resize(dimension_);
+  ntiles_.resize(dimension_);
+  tile_size_=1;
+  for(unsigned i=0; i<dimension_; ++i) {
+    tile_nbin_[i]=std::min(edge,nbin_[i]);
+    ntiles_[i]=(nbin_[i]+tile_nbin_[i]-1)/tile_nbin_[i];
+    tile_size_*=tile_nbin_[i];
+  }
+  bin_stride_=(usederiv_ ? 1+dimension_ : 1);
+  ntouched_=0;
+}
+
+void SparseGrid::getTileIndex(index_t index, index_t& key, index_t& local) const {
+  key=0; local=0;
+  index_t kstride=1, lstride=1;
+  for(unsigned i=0; i<dimension_; ++i) {
+    const index_t j=index%nbin_[i];
+    index/=nbin_[i];
+    const index_t t=j/tile_nbin_[i];
+    key+=t*kstride;
+    local+=(j-t*tile_nbin_[i])*lstride;
+    kstride*=ntiles_[i];
+    lstride*=tile_nbin_[i];
+  }
+}
+
+GridBase::index_t SparseGrid::getIndexFromTile(const Tile& tile, index_t local) const {
+  index_t key=tile.key;
+  index_t index=0, stride=1;
+  for(unsigned i=0; i<dimension_; ++i) {
+    const index_t j=(key%ntiles_[i])*tile_nbin_[i]+local%tile_nbin_[i];
+    key/=ntiles_[i];
+    local/=tile_nbin_[i];
+    index+=j*stride;
+    stride*=nbin_[i];
+  }
+  return index;
+}
+
+namespace {
+inline GridBase::index_t hashTileKey(GridBase::index_t key) {
+  const uint64_t h=static_cast<uint64_t>(key)*0x9E3779B97F4A7C15ULL;
+  return static_cast<GridBase::index_t>(h^(h>>32));
+}
+}
+
+GridBase::index_t SparseGrid::findTile(index_t key) const {
+  if(table_.empty()) return empty_slot;
+  const index_t mask=table_.size()-1;
+  for(index_t slot=hashTileKey(key)&mask;; slot=(slot+1)&mask) {
+    const index_t pos=table_[slot];
+    if(pos==empty_slot || tiles_[pos].key==key) return pos;
+  }
+}
+
+void SparseGrid::insertTileInTable(index_t position) {
+  const index_t mask=table_.size()-1;
+  index_t slot=hashTileKey(tiles_[position].key)&mask;
+  while(table_[slot]!=empty_slot) slot=(slot+1)&mask;
+  table_[slot]=position;
+}
+
+const double* SparseGrid::findBin(index_t index) const {
+  index_t key,local;
+  getTileIndex(index,key,local);
+  const index_t pos=findTile(key);
+  if(pos==empty_slot) return NULL;
+  return tiles_[pos].data.data()+local*bin_stride_;
+}
+
+double* SparseGrid::getBin(index_t index) {
+  index_t key,local;
+  getTileIndex(index,key,local);
+  index_t pos=findTile(key);
+  if(pos==empty_slot) {
+    pos=tiles_.size();
+    tiles_.push_back(Tile());
+    tiles_[pos].key=key;
+    tiles_[pos].data.assign(tile_size_*bin_stride_,0.0);
+    tiles_[pos].touched.assign((tile_size_+63)/64,0);
+// keep the load of the hash table below one half
+    if(2*tiles_.size()>table_.size()) {
+      table_.assign(std::max(static_cast<index_t>(64),2*table_.size()),empty_slot);
+      for(index_t t=0; t<tiles_.size(); ++t) insertTileInTable(t);
+    } else {
+      insertTileInTable(pos);
+    }
+  }
+  Tile& tile=tiles_[pos];
+  const uint64_t bit=static_cast<uint64_t>(1)<<(local%64);
+  if(!(tile.touched[local/64]&bit)) {
+    tile.touched[local/64]|=bit;
+    ntouched_++;
+  }
+  return tile.data.data()+local*bin_stride_;
+}
+
 Grid::index_t SparseGrid::getSize() const {
-  return map_.size();
+  return ntouched_;
 }
 
 Grid::index_t SparseGrid::getMaxSize() const {
@@ -778,57 +960,64 @@ Grid::index_t SparseGrid::getMaxSize() const {
 
 double SparseGrid::getValue(index_t index)const {
   plumed_assert(index<maxsize_);
-  double value=0.0;
-  const auto it=map_.find(index);
-  if(it!=map_.end()) value=it->second;
-  return value;
+  const double* bin=findBin(index);
+  return (bin ? bin[0] : 0.0);
 }
 
 double SparseGrid::getValueAndDerivatives
 (index_t index, vector<double>& der)const {
   plumed_assert(index<maxsize_ && usederiv_ && der.size()==dimension_);
-  double value=0.0;
-  for(unsigned int i=0; i<dimension_; ++i) der[i]=0.0;
-  const auto it=map_.find(index);
-  if(it!=map_.end()) value=it->second;
-  const auto itder=der_.find(index);
-  if(itder!=der_.end()) der=itder->second;
-  return value;
+  const double* bin=findBin(index);
+  if(!bin) {
+    for(unsigned int i=0; i<dimension_; ++i) der[i]=0.0;
+    return 0.0;
+  }
+  for(unsigned int i=0; i<dimension_; ++i) der[i]=bin[1+i];
+  return bin[0];
 }
 
 void SparseGrid::setValue(index_t index, double value) {
   plumed_assert(index<maxsize_ && !usederiv_);
-  map_[index]=value;
+  getBin(index)[0]=value;
 }
 
 void SparseGrid::setValueAndDerivatives
 (index_t index, double value, vector<double>& der) {
   plumed_assert(index<maxsize_ && usederiv_ && der.size()==dimension_);
-  map_[index]=value;
-  der_[index]=der;
+  double* bin=getBin(index);
+  bin[0]=value;
+  for(unsigned int i=0; i<dimension_; ++i) bin[1+i]=der[i];
 }
 
 void SparseGrid::addValue(index_t index, double value) {
   plumed_assert(index<maxsize_ && !usederiv_);
-  map_[index]+=value;
+  getBin(index)[0]+=value;
 }
 
 void SparseGrid::addValueAndDerivatives
 (index_t index, double value, vector<double>& der) {
   plumed_assert(index<maxsize_ && usederiv_ && der.size()==dimension_);
-  map_[index]+=value;
-  der_[index].resize(dimension_);
-  for(unsigned int i=0; i<dimension_; ++i) der_[index][i]+=der[i];
+  double* bin=getBin(index);
+  bin[0]+=value;
+  for(unsigned int i=0; i<dimension_; ++i) bin[1+i]+=der[i];
 }
 
 void SparseGrid::writeToFile(OFile& ofile) {
+// the bins that have been set are written in the order of their index
+  vector<index_t> indices;
+  indices.reserve(ntouched_);
+  for(const auto & tile : tiles_) {
+    for(index_t l=0; l<tile_size_; ++l) {
+      if(tile.touched[l/64]&(static_cast<uint64_t>(1)<<(l%64))) indices.push_back(getIndexFromTile(tile,l));
+    }
+  }
+  std::sort(indices.begin(),indices.end());
   vector<double> xx(dimension_);
   vector<double> der(dimension_);
   double f;
   writeHeader(ofile);
   ofile.fmtField(" "+fmt_);
-  for(const auto & it : map_) {
-    index_t i=it.first;
+  for(const auto & i : indices) {
     xx=getPoint(i);
     if(usederiv_) {f=getValueAndDerivatives(i,der);}
     else {f=getValue(i);}
@@ -847,11 +1036,15 @@ void SparseGrid::writeToFile(OFile& ofile) {
   }
 }
 
+// the bins of the allocated tiles that have not been set are zero
+// so they do not change the minimum and the maximum
 double SparseGrid::getMinValue() const {
   double minval;
   minval=0.0;
-  for(auto const & i : map_) {
-    if(i.second<minval) minval=i.second;
+  for(const auto & tile : tiles_) {
+    for(index_t k=0; k<tile.data.size(); k+=bin_stride_) {
+      if(tile.data[k]<minval) minval=tile.data[k];
+    }
   }
   return minval;
 }
@@ -859,8 +1052,10 @@ double SparseGrid::getMinValue() const {
 double SparseGrid::getMaxValue() const {
   double maxval;
   maxval=0.0;
-  for(auto const & i : map_) {
-    if(i.second>maxval) maxval=i.second;
+  for(const auto & tile : tiles_) {
+    for(index_t k=0; k<tile.data.size(); k+=bin_stride_) {
+      if(tile.data[k]>maxval) maxval=tile.data[k];
+    }
   }
   return maxval;
 }
@@ -27,6 +27,7 @@
 #include <map>
 #include <cmath>
 #include <memory>
+#include <cstdint>
 
 namespace PLMD {
 
@@ -94,6 +95,9 @@ protected:
 /// get "neighbors" for spline
   void getSplineNeighbors(const std::vector<unsigned> & indices, std::vector<index_t>& neigh, unsigned& nneigh )const;
 // std::vector<index_t> getSplineNeighbors(const std::vector<unsigned> & indices)const;
+/// spline interpolation of the value and the derivatives at point x, this version works for
+/// any grid and dimension and derived classes can override it with faster versions
+  virtual double getSplineValueAndDerivatives(const std::vector<double> & x, double* der) const;
 
 
 public:
@@ -215,6 +219,10 @@ class Grid : public GridBase
   std::vector<double> grid_;
   std::vector<double> der_;
   double contour_location=0.0;
+/// spline interpolation for a fixed dimension that reads grid_ and der_ directly
+  template<unsigned DIM> double getSplineValueAndDerivativesDim(const std::vector<double> & x, double* der) const;
+protected:
+  double getSplineValueAndDerivatives(const std::vector<double> & x, double* der) const override;
 public:
   Grid(const std::string& funcl, const std::vector<Value*> & args, const std::vector<std::string> & gmin,
        const std::vector<std::string> & gmax,
@@ -287,17 +295,55 @@ public:
 };
 
 
+/// Sparse grid where only the regions that have been touched are stored.
+/// The grid is split in tiles with a fixed number of bins along each dimension,
+/// a tile is allocated the first time one of its bins is set and the tiles are
+/// found through an open-addressing hash table. The value and the derivatives
+/// of each bin are stored next to each other in the array of the tile.
 class SparseGrid : public GridBase
 {
-
-  std::map<index_t,double> map_;
-  std::map< index_t,std::vector<double> > der_;
+  struct Tile {
+/// linear index of the tile
+    index_t key;
+/// value and derivatives of each bin
+    std::vector<double> data;
+/// bins that have been set, one bit for each bin
+    std::vector<uint64_t> touched;
+  };
+/// marks an empty slot of the hash table
+  static constexpr index_t empty_slot=~index_t(0);
+/// number of bins of a tile along each dimension
+  std::vector<unsigned> tile_nbin_;
+/// number of tiles along each dimension
+  std::vector<index_t> ntiles_;
+/// number of bins in a tile
+  index_t tile_size_;
+/// number of doubles stored for each bin
+  unsigned bin_stride_;
+/// number of bins that have been set
+  index_t ntouched_;
+  std::vector<Tile> tiles_;
+/// hash table with the position of the tiles in tiles_
+  std::vector<index_t> table_;
+
+  void initTiles();
+/// get the linear index of the tile and the position in the tile of a bin
+  void getTileIndex(index_t index, index_t& key, index_t& local) const;
+/// get the index of a bin from the tile and the position in the tile
+  index_t getIndexFromTile(const Tile& tile, index_t local) const;
+/// get the position of the tile in tiles_, empty_slot if it is not allocated
+  index_t findTile(index_t key) const;
+  void insertTileInTable(index_t position);
+/// get the data of a bin if it has been allocated, NULL otherwise
+  const double* findBin(index_t index) const;
+/// get the data of a bin, allocating it if needed
+  double* getBin(index_t index);
 
 public:
   SparseGrid(const std::string& funcl, const std::vector<Value*> & args, const std::vector<std::string> & gmin,
              const std::vector<std::string> & gmax,
              const std::vector<unsigned> & nbin, bool dospline, bool usederiv):
-    GridBase(funcl,args,gmin,gmax,nbin,dospline,usederiv) {}
+    GridBase(funcl,args,gmin,gmax,nbin,dospline,usederiv) {initTiles();}
 
   index_t getSize() const override;
   index_t getMaxSize() const;
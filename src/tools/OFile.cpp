@@ -138,6 +138,13 @@ int OFile::printf(const char*fmt,...) {
   return r;
 }
 
+OFile& OFile::writeRaw(const void*ptr,size_t s) {
+  plumed_massert(actual_buffer_length==0,"file " + getPath() + ": raw output in the middle of a line");
+  size_t r=llwrite(static_cast<const char*>(ptr),s);
+  plumed_massert(r==s,"file " + getPath() + ": error while writing raw data");
+  return *this;
+}
+
 OFile& OFile::addConstantField(const std::string&name) {
   Field f;
   f.name=name;
@@ -251,6 +251,10 @@ public:
   OFile& clearFields();
 /// Formatted output with explicit format - a la printf
   int printf(const char*fmt,...);
+/// Unformatted output of raw bytes, e.g. for binary files.
+/// The bytes are written directly, without the line prefix,
+/// so it should not be mixed with formatted output on the same line
+  OFile& writeRaw(const void*,size_t);
 /// Formatted output with << operator
   template <class T>
   friend OFile& operator<<(OFile&,const T &);
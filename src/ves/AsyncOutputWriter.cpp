@@ -0,0 +1,153 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+
+#include "AsyncOutputWriter.h"
+
+#include "core/Action.h"
+#include "core/PlumedMain.h"
+#include "tools/Communicator.h"
+#include "tools/Exception.h"
+#include "tools/File.h"
+
+
+namespace PLMD {
+namespace ves {
+
+
+AsyncOutputWriter::AsyncOutputWriter(const unsigned int max_queue_depth):
+  max_queue_depth_(max_queue_depth),
+  busy_(false),
+  stop_(false),
+  error_(nullptr)
+{
+  plumed_massert(max_queue_depth_>0,"the queue depth of the asynchronous output should be larger than zero");
+  worker_ = std::thread(&AsyncOutputWriter::run,this);
+}
+
+
+AsyncOutputWriter::~AsyncOutputWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_=true;
+  }
+  queue_changed_.notify_all();
+  // the worker drains the queue before it returns
+  worker_.join();
+}
+
+
+void AsyncOutputWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while(true) {
+    queue_changed_.wait(lock,[this] {return stop_ || !queue_.empty();});
+    if(queue_.empty()) {break;}
+    Task task = queue_.front();
+    queue_.pop_front();
+    busy_=true;
+    queue_changed_.notify_all();
+    lock.unlock();
+    //
+    std::exception_ptr error = nullptr;
+    try {
+      task.write(*task.ofile);
+      if(task.close_file) {task.ofile->close();}
+      else {task.ofile->flush();}
+    }
+    catch(...) {
+      error = std::current_exception();
+    }
+    if(task.close_file) {delete task.ofile;}
+    //
+    lock.lock();
+    if(error && !error_) {error_=error;}
+    busy_=false;
+    queue_changed_.notify_all();
+  }
+}
+
+
+void AsyncOutputWriter::rethrowError() {
+  std::exception_ptr error = error_;
+  error_ = nullptr;
+  if(error) {std::rethrow_exception(error);}
+}
+
+
+void AsyncOutputWriter::submit(OFile* ofile, const std::function<void(OFile&)>& write) {
+  plumed_massert(ofile!=NULL,"trying to submit asynchronous output without a file");
+  std::unique_lock<std::mutex> lock(mutex_);
+  queue_changed_.wait(lock,[this] {return queue_.size()<max_queue_depth_ || error_;});
+  if(error_) {
+    lock.unlock();
+    ofile->close(); delete ofile;
+    lock.lock();
+    rethrowError();
+  }
+  queue_.push_back({ofile,write,true});
+  queue_changed_.notify_all();
+}
+
+
+void AsyncOutputWriter::submitAppend(OFile* ofile, const std::function<void(OFile&)>& write) {
+  plumed_massert(ofile!=NULL,"trying to submit asynchronous output without a file");
+  std::unique_lock<std::mutex> lock(mutex_);
+  queue_changed_.wait(lock,[this] {return queue_.size()<max_queue_depth_ || error_;});
+  rethrowError();
+  queue_.push_back({ofile,write,false});
+  queue_changed_.notify_all();
+}
+
+
+void AsyncOutputWriter::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  queue_changed_.wait(lock,[this] {return queue_.empty() && !busy_;});
+}
+
+
+void AsyncOutputWriter::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  queue_changed_.wait(lock,[this] {return queue_.empty() && !busy_;});
+  rethrowError();
+}
+
+
+OFile* AsyncOutputWriter::openFile(Action& action, const std::string& filepath, const bool multi_sim_single_file, const bool enforce_backup) {
+  std::string suffix = action.plumed.getSuffix();
+  if(multi_sim_single_file) {
+    unsigned int r=0;
+    if(action.comm.Get_rank()==0) {r=action.multi_sim_comm.Get_rank();}
+    action.comm.Bcast(r,0);
+    if(r>0) {return NULL;}
+    suffix="";
+  }
+  if(action.comm.Get_rank()>0) {return NULL;}
+  OFile* ofile_pntr = new OFile();
+  ofile_pntr->enforceSuffix(suffix);
+  if(enforce_backup) {ofile_pntr->enforceBackup();}
+  else if(action.getRestart()) {ofile_pntr->enforceRestart();}
+  ofile_pntr->open(filepath);
+  return ofile_pntr;
+}
+
+
+}
+}
@@ -0,0 +1,95 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+#ifndef __PLUMED_ves_AsyncOutputWriter_h
+#define __PLUMED_ves_AsyncOutputWriter_h
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+namespace PLMD {
+
+class Action;
+class OFile;
+
+namespace ves {
+
+/*
+Background thread that formats and writes output files of the optimizer.
+
+The caller takes a snapshot of the data to be written (copied into the
+write functor) and submits it together with an OFile that has already been
+opened on the MD thread. The files given must not be linked to a
+Communicator or to PlumedMain, as OFile performs collective MPI calls when
+writing linked files, so they should be opened with openFile() which
+returns NULL on the ranks that do not write.
+
+Tasks are executed in the order they are submitted. At most
+max_queue_depth tasks are pending at any time, submit() blocks the MD
+thread when the queue is full. Exceptions thrown while writing are rethrown
+on the MD thread at the next call to submit() or flush().
+*/
+
+class AsyncOutputWriter {
+private:
+  struct Task {
+    OFile* ofile;
+    std::function<void(OFile&)> write;
+    bool close_file;
+  };
+  const unsigned int max_queue_depth_;
+  std::deque<Task> queue_;
+  bool busy_;
+  bool stop_;
+  std::exception_ptr error_;
+  std::mutex mutex_;
+  std::condition_variable queue_changed_;
+  std::thread worker_;
+  //
+  void run();
+  void rethrowError();
+public:
+  explicit AsyncOutputWriter(const unsigned int max_queue_depth=4);
+  ~AsyncOutputWriter();
+  unsigned int getMaxQueueDepth() const {return max_queue_depth_;}
+  // write and then close and delete the file
+  void submit(OFile*, const std::function<void(OFile&)>&);
+  // write and flush a file that stays open, it is owned by the caller
+  void submitAppend(OFile*, const std::function<void(OFile&)>&);
+  // wait until all pending tasks have been written, errors are not rethrown
+  void wait();
+  // wait until all pending tasks have been written
+  void flush();
+  // open a file for asynchronous output with the same suffix, backup and restart
+  // behavior as a file linked to the action, NULL on the ranks that do not write
+  static OFile* openFile(Action&, const std::string&, const bool multi_sim_single_file=false, const bool enforce_backup=false);
+};
+
+}
+}
+
+#endif
@@ -93,6 +93,7 @@ public:
   static void registerKeywords(Keywords&);
   explicit BF_Chebyshev(const ActionOptions&);
   void getAllValues(const double, double&, bool&, std::vector<double>&, std::vector<double>&) const;
+  void getAllValuesBatch(const std::vector<double>&, std::vector<double>&, std::vector<bool>&, std::vector<double>&, std::vector<double>&) const;
   double getInnerProductWeight(const double arg) const;
   std::string getInnerProductWeightStr() const {return "1/sqrt(1-x^2)";}
 };
@@ -126,23 +127,53 @@ void BF_Chebyshev::getAllValues(const double arg, double& argT, bool& inside_ran
   // plumed_assert(derivs.size()==numberOfBasisFunctions());
   inside_range=true;
   argT=translateArgument(arg, inside_range);
-  std::vector<double> derivsT(derivs.size());
-  //
+  // the derivatives with respect to argT are first stored in derivs
+  // and then scaled at the end to avoid a temporary vector
   values[0]=1.0;
-  derivsT[0]=0.0;
   derivs[0]=0.0;
   values[1]=argT;
-  derivsT[1]=1.0;
-  derivs[1]=intervalDerivf();
+  derivs[1]=1.0;
   for(unsigned int i=1; i < getOrder(); i++) {
     values[i+1]  = 2.0*argT*values[i]-values[i-1];
-    derivsT[i+1] = 2.0*values[i]+2.0*argT*derivsT[i]-derivsT[i-1];
-    derivs[i+1]  = intervalDerivf()*derivsT[i+1];
+    derivs[i+1]  = 2.0*values[i]+2.0*argT*derivs[i]-derivs[i-1];
   }
+  for(unsigned int i=1; i<derivs.size(); i++) {derivs[i]*=intervalDerivf();}
   if(!inside_range) {for(unsigned int i=0; i<derivs.size(); i++) {derivs[i]=0.0;}}
 }
 
 
+void BF_Chebyshev::getAllValuesBatch(const std::vector<double>& args, std::vector<double>& argsT, std::vector<bool>& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
+  setupBatch(args,argsT,inside_range,values,derivs);
+  const size_t nargs = args.size();
+  if(nargs==0) {return;}
+  const double* x = &argsT[0];
+  double* v = &values[0];
+  double* d = &derivs[0];
+  for(size_t k=0; k<nargs; k++) {
+    v[k]=1.0;
+    d[k]=0.0;
+    v[nargs+k]=x[k];
+    d[nargs+k]=1.0;
+  }
+  // same recurrence as in getAllValues, with the inner loop running over the arguments
+  for(unsigned int i=1; i < getOrder(); i++) {
+    const double* v0 = v+(i-1)*nargs;
+    const double* v1 = v+i*nargs;
+    const double* d0 = d+(i-1)*nargs;
+    const double* d1 = d+i*nargs;
+    double* v2 = v+(i+1)*nargs;
+    double* d2 = d+(i+1)*nargs;
+    for(size_t k=0; k<nargs; k++) {
+      v2[k] = 2.0*x[k]*v1[k]-v0[k];
+      d2[k] = 2.0*v1[k]+2.0*x[k]*d1[k]-d0[k];
+    }
+  }
+  const double derivf = intervalDerivf();
+  for(size_t j=nargs; j<derivs.size(); j++) {d[j]*=derivf;}
+  zeroDerivsOutsideBatch(inside_range,derivs);
+}
+
+
 void BF_Chebyshev::setupUniformIntegrals() {
   for(unsigned int i=0; i<numberOfBasisFunctions(); i++) {
     double io = i;
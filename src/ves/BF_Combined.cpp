@@ -103,12 +103,14 @@ BF_Combined::BF_Combined(const ActionOptions&ao):
 
   unsigned int nbasisf_total_ = 1;
   bool periodic = true;
+  bool thread_safe = true;
   for(unsigned int i=0; i<basisf_pntrs_.size(); i++) {
     nbasisf_total_ += basisf_pntrs_[i]->getNumberOfBasisFunctions() - 1;
     if(basisf_pntrs_[i]->intervalMinStr()!=basisf_pntrs_[0]->intervalMinStr() || basisf_pntrs_[i]->intervalMaxStr()!=basisf_pntrs_[0]->intervalMaxStr()) {
       plumed_merror("all the basis functions to be combined should have same MINIMUM and MAXIMUM");
     }
     if(!basisf_pntrs_[i]->arePeriodic()) {periodic=false;}
+    if(!basisf_pntrs_[i]->areThreadSafe()) {thread_safe=false;}
   }
   setOrder(nbasisf_total_-1);
   setNumberOfBasisFunctions(nbasisf_total_);
@@ -116,6 +118,7 @@ BF_Combined::BF_Combined(const ActionOptions&ao):
   setIntrinsicInterval("-1.0","+1.0");
   if(periodic) {setPeriodic();}
   else {setNonPeriodic();}
+  if(!thread_safe) {setNonThreadSafe();}
   setIntervalBounded();
   setType("combined");
   setDescription("Combined");
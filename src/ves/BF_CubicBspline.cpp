@@ -24,6 +24,8 @@
 
 #include "core/ActionRegister.h"
 
+#include <cmath>
+
 
 namespace PLMD {
 namespace ves {
@@ -32,6 +34,12 @@ namespace ves {
 /*
 Cubic B spline basis functions
 
+For any given argument only the constant and four of the splines are non-zero.
+When these basis functions are used in a \ref VES_LINEAR_EXPANSION only the corresponding
+block of coefficients is evaluated at each step, such that the cost does not grow
+with the order. The sampled averages are also only updated for this block
+if the DEFERRED_AVERAGES flag is used.
+
 \par Examples
 
 \par Test
@@ -48,6 +56,8 @@ public:
   static void registerKeywords( Keywords&);
   explicit BF_CubicBspline(const ActionOptions&);
   void getAllValues(const double, double&, bool&, std::vector<double>&, std::vector<double>&) const;
+  void getAllValuesBatch(const std::vector<double>&, std::vector<double>&, std::vector<bool>&, std::vector<double>&, std::vector<double>&) const;
+  void getSupport(const double, std::vector<unsigned int>&) const;
 };
 
 
@@ -76,6 +86,8 @@ BF_CubicBspline::BF_CubicBspline(const ActionOptions&ao):
   setNonPeriodic();
   setNonOrthogonal();
   setIntervalBounded();
+  // the constant and the four splines overlapping the argument
+  setCompactSupport(5);
   setType("splines_2nd-order");
   setDescription("Cubic B-splines (2nd order splines)");
   setLabelPrefix("S");
@@ -103,6 +115,44 @@ void BF_CubicBspline::getAllValues(const double arg, double& argT, bool& inside_
 }
 
 
+void BF_CubicBspline::getAllValuesBatch(const std::vector<double>& args, std::vector<double>& argsT, std::vector<bool>& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
+  setupBatch(args,argsT,inside_range,values,derivs,false);
+  const size_t nargs = args.size();
+  if(nargs==0) {return;}
+  double* v = &values[0];
+  double* d = &derivs[0];
+  // the scaled argument only needs to be computed once for each argument
+  std::vector<double> argx(nargs);
+  for(size_t k=0; k<nargs; k++) {
+    argx[k] = (argsT[k]-intervalMin())*inv_spacing_;
+    v[k]=1.0;
+    d[k]=0.0;
+  }
+  for(unsigned int i=1; i < getNumberOfBasisFunctions(); i++) {
+    const double shift = static_cast<double>(i)-2.0;
+    double* vi = v+i*nargs;
+    double* di = d+i*nargs;
+    for(size_t k=0; k<nargs; k++) {
+      vi[k] = spline(argx[k]-shift, di[k]);
+      di[k] *= inv_spacing_;
+    }
+  }
+  zeroDerivsOutsideBatch(inside_range,derivs);
+}
+
+
+void BF_CubicBspline::getSupport(const double arg, std::vector<unsigned int>& indices) const {
+  bool inside_range=true;
+  double argT=checkIfArgumentInsideInterval(arg,inside_range);
+  // spline i is non-zero for (i-2)-2 < argx < (i-2)+2
+  double argx = (argT-intervalMin())*inv_spacing_;
+  unsigned int first = static_cast<unsigned int>(std::floor(argx))+1;
+  if(first>getOrder()) {first=getOrder();}
+  indices[0]=0;
+  for(unsigned int i=0; i<4; i++) {indices[i+1]=first+i;}
+}
+
+
 double BF_CubicBspline::spline(const double arg, double& deriv) const {
   double value=0.0;
   double x=arg;
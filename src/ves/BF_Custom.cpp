@@ -24,6 +24,11 @@
 
 #include "core/ActionRegister.h"
 #include "lepton/Lepton.h"
+#include "tools/OpenMP.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
 
 
 namespace PLMD {
@@ -102,25 +107,175 @@ BF_CUSTOM ...
 */
 //+ENDPLUMEDOC
 
+namespace {
+
+// A set of lepton expressions of a single variable compiled into one program.
+// Subexpressions that are identical, also between different expressions, are
+// only evaluated once. The steps are the operations that lepton::CompiledExpression
+// would evaluate, so the results are identical to evaluating each expression
+// on its own. The workspace is given by the caller, such that the program can
+// be evaluated concurrently.
+class ExpressionSetProgram {
+private:
+  std::vector<std::unique_ptr<lepton::Operation> > operations_;
+  // workspace slots of the arguments of each step, slot 0 is the variable and
+  // step s writes to slot s+1
+  std::vector<std::vector<unsigned int> > arguments_;
+  std::vector<unsigned int> outputs_;
+  std::vector<std::pair<lepton::ExpressionTreeNode,unsigned int> > temps_;
+  unsigned int max_arguments_;
+  unsigned int compileNode(const lepton::ExpressionTreeNode&);
+public:
+  ExpressionSetProgram(): max_arguments_(0) {}
+  static void getVariables(const lepton::ExpressionTreeNode&, std::set<std::string>&);
+  // compile an expression and return the index of its output
+  unsigned int addExpression(const lepton::ParsedExpression&);
+  void finalize() {temps_.clear();}
+  unsigned int getWorkspaceSize() const {return operations_.size()+1+max_arguments_;}
+  unsigned int getBatchWorkspaceSize(const size_t nargs) const {return (operations_.size()+1)*nargs+max_arguments_;}
+  void evaluate(const double, std::vector<double>&) const;
+  double getOutput(const unsigned int k, const std::vector<double>& workspace) const {return workspace[outputs_[k]];}
+  void evaluateBatch(const std::vector<double>&, std::vector<double>&) const;
+  const double* getBatchOutput(const unsigned int k, const size_t nargs, const std::vector<double>& workspace) const {return &workspace[outputs_[k]*nargs];}
+};
+
+
+void ExpressionSetProgram::getVariables(const lepton::ExpressionTreeNode& node, std::set<std::string>& variables) {
+  if(node.getOperation().getId()==lepton::Operation::VARIABLE) {variables.insert(node.getOperation().getName());}
+  for(unsigned int i=0; i<node.getChildren().size(); i++) {getVariables(node.getChildren()[i],variables);}
+}
+
+
+unsigned int ExpressionSetProgram::compileNode(const lepton::ExpressionTreeNode& node) {
+  for(unsigned int i=0; i<temps_.size(); i++) {
+    if(temps_[i].first==node) {return temps_[i].second;}
+  }
+  unsigned int slot=0;
+  if(node.getOperation().getId()!=lepton::Operation::VARIABLE) {
+    std::vector<unsigned int> args(node.getChildren().size());
+    for(unsigned int i=0; i<node.getChildren().size(); i++) {args[i]=compileNode(node.getChildren()[i]);}
+    if(args.size()>max_arguments_) {max_arguments_=args.size();}
+    operations_.emplace_back(node.getOperation().clone());
+    arguments_.push_back(args);
+    slot=operations_.size();
+  }
+  temps_.push_back(std::make_pair(node,slot));
+  return slot;
+}
+
+
+unsigned int ExpressionSetProgram::addExpression(const lepton::ParsedExpression& expression) {
+  // lepton::CompiledExpression optimizes the expression once more before compiling it
+  outputs_.push_back(compileNode(expression.optimize().getRootNode()));
+  return outputs_.size()-1;
+}
+
+
+void ExpressionSetProgram::evaluate(const double x, std::vector<double>& workspace) const {
+  static const std::map<std::string,double> no_variables;
+  double* ws = &workspace[0];
+  double* a = ws+operations_.size()+1;
+  ws[0]=x;
+  for(unsigned int s=0; s<operations_.size(); s++) {
+    const std::vector<unsigned int>& args = arguments_[s];
+    for(unsigned int i=0; i<args.size(); i++) {a[i]=ws[args[i]];}
+    ws[s+1] = operations_[s]->evaluate(a,no_variables);
+  }
+}
+
+
+void ExpressionSetProgram::evaluateBatch(const std::vector<double>& x, std::vector<double>& workspace) const {
+  static const std::map<std::string,double> no_variables;
+  const size_t n = x.size();
+  if(n==0) {return;}
+  double* ws = &workspace[0];
+  double* a = ws+(operations_.size()+1)*n;
+  for(size_t k=0; k<n; k++) {ws[k]=x[k];}
+  for(unsigned int s=0; s<operations_.size(); s++) {
+    const std::vector<unsigned int>& args = arguments_[s];
+    const lepton::Operation* op = operations_[s].get();
+    double* r = ws+(s+1)*n;
+    const double* a0 = args.size()>0 ? ws+args[0]*n : NULL;
+    const double* a1 = args.size()>1 ? ws+args[1]*n : NULL;
+    // the common operations are evaluated in tight loops, the same arithmetic as in lepton
+    switch(op->getId()) {
+    case lepton::Operation::CONSTANT: {
+      const double c = dynamic_cast<const lepton::Operation::Constant*>(op)->getValue();
+      for(size_t k=0; k<n; k++) {r[k]=c;}
+      break;
+    }
+    case lepton::Operation::ADD:
+      for(size_t k=0; k<n; k++) {r[k]=a0[k]+a1[k];}
+      break;
+    case lepton::Operation::SUBTRACT:
+      for(size_t k=0; k<n; k++) {r[k]=a0[k]-a1[k];}
+      break;
+    case lepton::Operation::MULTIPLY:
+      for(size_t k=0; k<n; k++) {r[k]=a0[k]*a1[k];}
+      break;
+    case lepton::Operation::DIVIDE:
+      for(size_t k=0; k<n; k++) {r[k]=a0[k]/a1[k];}
+      break;
+    case lepton::Operation::NEGATE:
+      for(size_t k=0; k<n; k++) {r[k]=-a0[k];}
+      break;
+    case lepton::Operation::SQUARE:
+      for(size_t k=0; k<n; k++) {r[k]=a0[k]*a0[k];}
+      break;
+    case lepton::Operation::CUBE:
+      for(size_t k=0; k<n; k++) {r[k]=a0[k]*a0[k]*a0[k];}
+      break;
+    case lepton::Operation::RECIPROCAL:
+      for(size_t k=0; k<n; k++) {r[k]=1.0/a0[k];}
+      break;
+    case lepton::Operation::ADD_CONSTANT: {
+      const double c = dynamic_cast<const lepton::Operation::AddConstant*>(op)->getValue();
+      for(size_t k=0; k<n; k++) {r[k]=a0[k]+c;}
+      break;
+    }
+    case lepton::Operation::MULTIPLY_CONSTANT: {
+      const double c = dynamic_cast<const lepton::Operation::MultiplyConstant*>(op)->getValue();
+      for(size_t k=0; k<n; k++) {r[k]=a0[k]*c;}
+      break;
+    }
+    default:
+      for(size_t k=0; k<n; k++) {
+        for(unsigned int i=0; i<args.size(); i++) {a[i]=ws[args[i]*n+k];}
+        r[k] = op->evaluate(a,no_variables);
+      }
+    }
+  }
+}
+
+}
+
+
 class BF_Custom : public BasisFunctions {
 private:
-  lepton::CompiledExpression transf_value_expression_;
-  lepton::CompiledExpression transf_deriv_expression_;
-  double* transf_value_lepton_ref_;
-  double* transf_deriv_lepton_ref_;
-  std::vector<lepton::CompiledExpression> bf_values_expressions_;
-  std::vector<lepton::CompiledExpression> bf_derivs_expressions_;
-  std::vector<double*> bf_values_lepton_ref_;
-  std::vector<double*> bf_derivs_lepton_ref_;
+  // all the basis functions and their derivatives are evaluated by a single
+  // program, and the transform and its derivative by another one
+  ExpressionSetProgram transf_program_;
+  ExpressionSetProgram bf_program_;
+  unsigned int transf_value_output_;
+  unsigned int transf_deriv_output_;
+  std::vector<unsigned int> bf_values_outputs_;
+  std::vector<unsigned int> bf_derivs_outputs_;
   std::string variable_str_;
   std::string transf_variable_str_;
   bool do_transf_;
   bool check_nan_inf_;
+  // scratch space of the programs, one for each OpenMP thread, such that
+  // the values can be calculated concurrently without allocating memory
+  mutable std::vector<std::vector<double> > transf_workspaces_;
+  mutable std::vector<std::vector<double> > workspaces_;
+  mutable std::vector<std::vector<double> > transf_derivfs_;
+  static std::vector<double>& getThreadScratch(std::vector<std::vector<double> >&, const size_t);
 public:
   static void registerKeywords( Keywords&);
   explicit BF_Custom(const ActionOptions&);
   ~BF_Custom() {};
   void getAllValues(const double, double&, bool&, std::vector<double>&, std::vector<double>&) const;
+  void getAllValuesBatch(const std::vector<double>&, std::vector<double>&, std::vector<bool>&, std::vector<double>&, std::vector<double>&) const;
 };
 
 PLUMED_REGISTER_ACTION(BF_Custom,"BF_CUSTOM")
@@ -138,12 +293,10 @@ void BF_Custom::registerKeywords(Keywords& keys) {
 
 BF_Custom::BF_Custom(const ActionOptions&ao):
   PLUMED_VES_BASISFUNCTIONS_INIT(ao),
-  transf_value_lepton_ref_(nullptr),
-  transf_deriv_lepton_ref_(nullptr),
-  bf_values_expressions_(0),
-  bf_derivs_expressions_(0),
-  bf_values_lepton_ref_(0,nullptr),
-  bf_derivs_lepton_ref_(0,nullptr),
+  transf_value_output_(0),
+  transf_deriv_output_(0),
+  bf_values_outputs_(0),
+  bf_derivs_outputs_(0),
   variable_str_("x"),
   transf_variable_str_("t"),
   do_transf_(false),
@@ -178,27 +331,24 @@ BF_Custom::BF_Custom(const ActionOptions&ao):
   bf_values_parsed[0] = "1";
   bf_derivs_parsed[0] = "0";
   //
-  bf_values_expressions_.resize(getNumberOfBasisFunctions());
-  bf_derivs_expressions_.resize(getNumberOfBasisFunctions());
-  bf_values_lepton_ref_.resize(getNumberOfBasisFunctions());
-  bf_derivs_lepton_ref_.resize(getNumberOfBasisFunctions());
+  bf_values_outputs_.resize(getNumberOfBasisFunctions());
+  bf_derivs_outputs_.resize(getNumberOfBasisFunctions());
   //
   for(unsigned int i=1; i<getNumberOfBasisFunctions(); i++) {
     std::string is; Tools::convert(i,is);
+    std::set<std::string> var_set;
     try {
       lepton::ParsedExpression pe_value = lepton::Parser::parse(bf_str[i]).optimize(lepton::Constants());
       std::ostringstream tmp_stream; tmp_stream << pe_value;
       bf_values_parsed[i] = tmp_stream.str();
-      bf_values_expressions_[i] = pe_value.createCompiledExpression();
+      ExpressionSetProgram::getVariables(pe_value.getRootNode(),var_set);
+      bf_values_outputs_[i] = bf_program_.addExpression(pe_value);
     }
     catch(PLMD::lepton::Exception& exc) {
       plumed_merror("There was some problem in parsing the function "+bf_str[i]+" given in FUNC"+is + " with lepton");
     }
 
-    std::vector<std::string> var_str;
-    for(auto &p: bf_values_expressions_[i].getVariables()) {
-      var_str.push_back(p);
-    }
+    std::vector<std::string> var_str(var_set.begin(),var_set.end());
     if(var_str.size()!=1) {
       plumed_merror("Problem with function "+bf_str[i]+" given in FUNC"+is+": there should only be one variable");
     }
@@ -210,21 +360,13 @@ BF_Custom::BF_Custom(const ActionOptions&ao):
       lepton::ParsedExpression pe_deriv = lepton::Parser::parse(bf_str[i]).differentiate(variable_str_).optimize(lepton::Constants());
       std::ostringstream tmp_stream2; tmp_stream2 << pe_deriv;
       bf_derivs_parsed[i] = tmp_stream2.str();
-      bf_derivs_expressions_[i] = pe_deriv.createCompiledExpression();
+      bf_derivs_outputs_[i] = bf_program_.addExpression(pe_deriv);
     }
     catch(PLMD::lepton::Exception& exc) {
       plumed_merror("There was some problem in parsing the derivative of the function "+bf_str[i]+" given in FUNC"+is + " with lepton");
     }
-
-    try {
-      bf_values_lepton_ref_[i] = &bf_values_expressions_[i].getVariableReference(variable_str_);
-    } catch(PLMD::lepton::Exception& exc) {}
-
-    try {
-      bf_derivs_lepton_ref_[i] = &bf_derivs_expressions_[i].getVariableReference(variable_str_);
-    } catch(PLMD::lepton::Exception& exc) {}
-
   }
+  bf_program_.finalize();
 
   std::string transf_value_parsed;
   std::string transf_deriv_parsed;
@@ -242,20 +384,19 @@ BF_Custom::BF_Custom(const ActionOptions&ao):
       else {break;}
     }
 
+    std::set<std::string> var_set;
     try {
       lepton::ParsedExpression pe_value = lepton::Parser::parse(transf_str).optimize(lepton::Constants());;
       std::ostringstream tmp_stream; tmp_stream << pe_value;
       transf_value_parsed = tmp_stream.str();
-      transf_value_expression_ = pe_value.createCompiledExpression();
+      ExpressionSetProgram::getVariables(pe_value.getRootNode(),var_set);
+      transf_value_output_ = transf_program_.addExpression(pe_value);
     }
     catch(PLMD::lepton::Exception& exc) {
       plumed_merror("There was some problem in parsing the function "+transf_str+" given in TRANSFORM with lepton");
     }
 
-    std::vector<std::string> var_str;
-    for(auto &p: transf_value_expression_.getVariables()) {
-      var_str.push_back(p);
-    }
+    std::vector<std::string> var_str(var_set.begin(),var_set.end());
     if(var_str.size()!=1) {
       plumed_merror("Problem with function "+transf_str+" given in TRANSFORM: there should only be one variable");
     }
@@ -267,20 +408,12 @@ BF_Custom::BF_Custom(const ActionOptions&ao):
       lepton::ParsedExpression pe_deriv = lepton::Parser::parse(transf_str).differentiate(transf_variable_str_).optimize(lepton::Constants());;
       std::ostringstream tmp_stream2; tmp_stream2 << pe_deriv;
       transf_deriv_parsed = tmp_stream2.str();
-      transf_deriv_expression_ = pe_deriv.createCompiledExpression();
+      transf_deriv_output_ = transf_program_.addExpression(pe_deriv);
     }
     catch(PLMD::lepton::Exception& exc) {
       plumed_merror("There was some problem in parsing the derivative of the function "+transf_str+" given in TRANSFORM with lepton");
     }
-
-    try {
-      transf_value_lepton_ref_ = &transf_value_expression_.getVariableReference(transf_variable_str_);
-    } catch(PLMD::lepton::Exception& exc) {}
-
-    try {
-      transf_deriv_lepton_ref_ = &transf_deriv_expression_.getVariableReference(transf_variable_str_);
-    } catch(PLMD::lepton::Exception& exc) {}
-
+    transf_program_.finalize();
   }
   //
   log.printf("  Using the following functions [lepton parsed function and derivative]:\n");
@@ -306,23 +439,35 @@ BF_Custom::BF_Custom(const ActionOptions&ao):
     log.printf("  The code will NOT check that values given are numercially stable, e.g. do not result in a not a number (nan) or infinity (inf).\n");
   }
 
+  const unsigned int nthreads = OpenMP::getNumThreads();
+  transf_workspaces_.resize(nthreads,std::vector<double>(transf_program_.getWorkspaceSize()));
+  workspaces_.resize(nthreads,std::vector<double>(bf_program_.getWorkspaceSize()));
+  transf_derivfs_.resize(nthreads);
+  //
   setupBF();
   checkRead();
 }
 
 
+std::vector<double>& BF_Custom::getThreadScratch(std::vector<std::vector<double> >& scratch, const size_t size) {
+  const unsigned int t = OpenMP::getThreadNum();
+  plumed_massert(t<scratch.size(),"BF_CUSTOM: more OpenMP threads than given when the basis functions were setup");
+  // only the calling thread touches its own buffer, which is only ever enlarged
+  if(scratch[t].size()<size) {scratch[t].resize(size);}
+  return scratch[t];
+}
+
+
 void BF_Custom::getAllValues(const double arg, double& argT, bool& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
   inside_range=true;
   argT=checkIfArgumentInsideInterval(arg,inside_range);
   double transf_derivf=1.0;
   //
   if(do_transf_) {
-
-    if(transf_value_lepton_ref_) {*transf_value_lepton_ref_ = argT;}
-    if(transf_deriv_lepton_ref_) {*transf_deriv_lepton_ref_ = argT;}
-
-    argT = transf_value_expression_.evaluate();
-    transf_derivf = transf_deriv_expression_.evaluate();
+    std::vector<double>& transf_workspace = getThreadScratch(transf_workspaces_,transf_program_.getWorkspaceSize());
+    transf_program_.evaluate(argT,transf_workspace);
+    argT = transf_program_.getOutput(transf_value_output_,transf_workspace);
+    transf_derivf = transf_program_.getOutput(transf_deriv_output_,transf_workspace);
 
     if(check_nan_inf_ && (std::isnan(argT) || std::isinf(argT)) ) {
       std::string vs; Tools::convert(argT,vs);
@@ -335,15 +480,13 @@ void BF_Custom::getAllValues(const double arg, double& argT, bool& inside_range,
     }
   }
   //
+  std::vector<double>& workspace = getThreadScratch(workspaces_,bf_program_.getWorkspaceSize());
+  bf_program_.evaluate(argT,workspace);
   values[0]=1.0;
   derivs[0]=0.0;
   for(unsigned int i=1; i < getNumberOfBasisFunctions(); i++) {
-
-    if(bf_values_lepton_ref_[i]) {*bf_values_lepton_ref_[i] = argT;}
-    if(bf_derivs_lepton_ref_[i]) {*bf_derivs_lepton_ref_[i] = argT;}
-
-    values[i] = bf_values_expressions_[i].evaluate();
-    derivs[i] = bf_derivs_expressions_[i].evaluate();
+    values[i] = bf_program_.getOutput(bf_values_outputs_[i],workspace);
+    derivs[i] = bf_program_.getOutput(bf_derivs_outputs_[i],workspace);
 
     if(do_transf_) {derivs[i]*=transf_derivf;}
     // NaN checks
@@ -363,6 +506,71 @@ void BF_Custom::getAllValues(const double arg, double& argT, bool& inside_range,
 }
 
 
+void BF_Custom::getAllValuesBatch(const std::vector<double>& args, std::vector<double>& argsT, std::vector<bool>& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
+  setupBatch(args,argsT,inside_range,values,derivs,false);
+  const size_t nargs = args.size();
+  if(nargs==0) {return;}
+  std::vector<double>& transf_derivf = getThreadScratch(transf_derivfs_,nargs);
+  if(do_transf_) {
+    std::vector<double>& transf_workspace = getThreadScratch(transf_workspaces_,transf_program_.getBatchWorkspaceSize(nargs));
+    transf_program_.evaluateBatch(argsT,transf_workspace);
+    const double* tv = transf_program_.getBatchOutput(transf_value_output_,nargs,transf_workspace);
+    const double* td = transf_program_.getBatchOutput(transf_deriv_output_,nargs,transf_workspace);
+    argsT.assign(tv,tv+nargs);
+    std::copy(td,td+nargs,transf_derivf.begin());
+    if(check_nan_inf_) {
+      for(size_t k=0; k<nargs; k++) {
+        if(std::isnan(argsT[k]) || std::isinf(argsT[k])) {
+          std::string vs; Tools::convert(argsT[k],vs);
+          plumed_merror(getName()+" with label "+getLabel()+": problem with the transform function, it gives " + vs);
+        }
+        if(std::isnan(transf_derivf[k]) || std::isinf(transf_derivf[k])) {
+          std::string vs; Tools::convert(transf_derivf[k],vs);
+          plumed_merror(getName()+" with label "+getLabel()+": problem with the transform function, its derivative gives " + vs);
+        }
+      }
+    }
+  }
+  //
+  std::vector<double>& workspace = getThreadScratch(workspaces_,bf_program_.getBatchWorkspaceSize(nargs));
+  bf_program_.evaluateBatch(argsT,workspace);
+  double* v = &values[0];
+  double* d = &derivs[0];
+  for(size_t k=0; k<nargs; k++) {
+    v[k]=1.0;
+    d[k]=0.0;
+  }
+  for(unsigned int i=1; i < getNumberOfBasisFunctions(); i++) {
+    const double* bv = bf_program_.getBatchOutput(bf_values_outputs_[i],nargs,workspace);
+    const double* bd = bf_program_.getBatchOutput(bf_derivs_outputs_[i],nargs,workspace);
+    double* vi = v+i*nargs;
+    double* di = d+i*nargs;
+    for(size_t k=0; k<nargs; k++) {
+      vi[k] = bv[k];
+      di[k] = bd[k];
+    }
+    if(do_transf_) {
+      for(size_t k=0; k<nargs; k++) {di[k]*=transf_derivf[k];}
+    }
+    if(check_nan_inf_) {
+      for(size_t k=0; k<nargs; k++) {
+        if(std::isnan(vi[k]) || std::isinf(vi[k])) {
+          std::string vs; Tools::convert(vi[k],vs);
+          std::string is; Tools::convert(i,is);
+          plumed_merror(getName()+" with label "+getLabel()+": problem with the basis function given in FUNC"+is+", it gives "+vs);
+        }
+        if(std::isnan(di[k]) || std::isinf(di[k])) {
+          std::string vs; Tools::convert(di[k],vs);
+          std::string is; Tools::convert(i,is);
+          plumed_merror(getName()+" with label "+getLabel()+": problem with derivative of the basis function given in FUNC"+is+", it gives "+vs);
+        }
+      }
+    }
+  }
+  zeroDerivsOutsideBatch(inside_range,derivs);
+}
+
+
 
 
 }
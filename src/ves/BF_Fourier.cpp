@@ -89,6 +89,7 @@ public:
   static void registerKeywords(Keywords&);
   explicit BF_Fourier(const ActionOptions&);
   void getAllValues(const double, double&, bool&, std::vector<double>&, std::vector<double>&) const;
+  void getAllValuesBatch(const std::vector<double>&, std::vector<double>&, std::vector<bool>&, std::vector<double>&, std::vector<double>&) const;
 };
 
 
@@ -137,6 +138,39 @@ void BF_Fourier::getAllValues(const double arg, double& argT, bool& inside_range
 }
 
 
+void BF_Fourier::getAllValuesBatch(const std::vector<double>& args, std::vector<double>& argsT, std::vector<bool>& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
+  setupBatch(args,argsT,inside_range,values,derivs);
+  const size_t nargs = args.size();
+  if(nargs==0) {return;}
+  const double* x = &argsT[0];
+  double* v = &values[0];
+  double* d = &derivs[0];
+  const double derivf = intervalDerivf();
+  for(size_t k=0; k<nargs; k++) {
+    v[k]=1.0;
+    d[k]=0.0;
+  }
+  // the harmonics are evaluated directly rather than by the angle-addition
+  // recurrence as the error of the recurrence grows with the order
+  for(unsigned int i=1; i < getOrder()+1; i++) {
+    double io = i;
+    double* vc = v+(2*i-1)*nargs;
+    double* dc = d+(2*i-1)*nargs;
+    double* vs = v+2*i*nargs;
+    double* ds = d+2*i*nargs;
+    for(size_t k=0; k<nargs; k++) {
+      double cos_tmp = cos(io*x[k]);
+      double sin_tmp = sin(io*x[k]);
+      vc[k] = cos_tmp;
+      dc[k] = -io*sin_tmp*derivf;
+      vs[k] = sin_tmp;
+      ds[k] = io*cos_tmp*derivf;
+    }
+  }
+  zeroDerivsOutsideBatch(inside_range,derivs);
+}
+
+
 void BF_Fourier::setupLabels() {
   setLabel(0,"1");
   for(unsigned int i=1; i < getOrder()+1; i++) {
@@ -99,18 +99,16 @@ void BF_Hermite::getAllValues(const double arg, double& argT, bool& inside_range
   argT=checkIfArgumentInsideInterval(arg,inside_range);
   argT = scalingf_*(argT-center_);
   //
-  std::vector<double> valuesH(getOrder()+1);
-  std::vector<double> derivsH(getOrder()+1);
-  //
-  // calculate the Hermite polynomials
-  valuesH[0]=1.0;
-  derivsH[0]=0.0;
-  valuesH[1]=2.0*argT;
-  derivsH[1]=2.0;
+  // calculate the Hermite polynomials, H_n is stored at index n+1
+  // in values and derivs to avoid temporary vectors
+  values[1]=1.0;
+  derivs[1]=0.0;
+  values[2]=2.0*argT;
+  derivs[2]=2.0;
   for(unsigned int i=1; i < getOrder(); i++) {
     double io = static_cast<double>(i);
-    valuesH[i+1]  = 2.0*argT*valuesH[i] - 2.0*io*valuesH[i-1];
-    derivsH[i+1]  = 2.0*argT*derivsH[i] + 2.0*valuesH[i] - 2.0*io*derivsH[i-1];
+    values[i+2]  = 2.0*argT*values[i+1] - 2.0*io*values[i];
+    derivs[i+2]  = 2.0*argT*derivs[i+1] + 2.0*values[i+1] - 2.0*io*derivs[i];
   }
   // calculate the Hermite functions, the constant has index 0, the index is then shifted
   // index 1: exp(-x^2/2)*H0(x) = exp(-x^2/2), index 2: exp(-x^2/2)*H1(x), etc.
@@ -118,8 +116,10 @@ void BF_Hermite::getAllValues(const double arg, double& argT, bool& inside_range
   derivs[0]=0.0;
   double vexp = exp(-0.5*argT*argT);
   for(unsigned int i=1; i < getNumberOfBasisFunctions(); i++) {
-    values[i] = normf_[i-1] * vexp*valuesH[i-1];
-    derivs[i] = normf_[i-1] * scalingf_*vexp*(-argT*valuesH[i-1]+derivsH[i-1]);
+    double valueH = values[i];
+    double derivH = derivs[i];
+    values[i] = normf_[i-1] * vexp*valueH;
+    derivs[i] = normf_[i-1] * scalingf_*vexp*(-argT*valueH+derivH);
   }
   if(!inside_range) {for(unsigned int i=0; i<derivs.size(); i++) {derivs[i]=0.0;}}
 }
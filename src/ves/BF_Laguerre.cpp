@@ -82,18 +82,16 @@ void BF_Laguerre::getAllValues(const double arg, double& argT, bool& inside_rang
   argT=checkIfArgumentInsideInterval(arg,inside_range);
   argT = scalingf_*(argT-intervalMin());
   //
-  std::vector<double> valuesL(getOrder()+1);
-  std::vector<double> derivsL(getOrder()+1);
-  //
-  // calculate the Laguerre polynomials
-  valuesL[0]=1.0;
-  derivsL[0]=0.0;
-  valuesL[1]=1.0-argT;
-  derivsL[1]=-1.0;
+  // calculate the Laguerre polynomials, L_n is stored at index n+1
+  // in values and derivs to avoid temporary vectors
+  values[1]=1.0;
+  derivs[1]=0.0;
+  values[2]=1.0-argT;
+  derivs[2]=-1.0;
   for(unsigned int i=1; i < getOrder(); i++) {
     double io = static_cast<double>(i);
-    valuesL[i+1]  = ((2.0*io+1.0-argT)/(io+1.0))*valuesL[i] - (io/(io+1.0))*valuesL[i-1];
-    derivsL[i+1]  = ((2.0*io+1.0-argT)/(io+1.0))*derivsL[i] - (1.0/(io+1.0))*valuesL[i] - (io/(io+1.0))*derivsL[i-1];
+    values[i+2]  = ((2.0*io+1.0-argT)/(io+1.0))*values[i+1] - (io/(io+1.0))*values[i];
+    derivs[i+2]  = ((2.0*io+1.0-argT)/(io+1.0))*derivs[i+1] - (1.0/(io+1.0))*values[i+1] - (io/(io+1.0))*derivs[i];
   }
   // calculate the Laguerre functions, the constant has index 0, the index is then shifted
   // index 1: exp(-x/2)*L0(x) = exp(-x/2), index 2: exp(-x/2)*L1(x), etc.
@@ -101,8 +99,10 @@ void BF_Laguerre::getAllValues(const double arg, double& argT, bool& inside_rang
   derivs[0]=0.0;
   double vexp = exp(-0.5*argT);
   for(unsigned int i=1; i < getNumberOfBasisFunctions(); i++) {
-    values[i] = vexp*valuesL[i-1];
-    derivs[i] = scalingf_*vexp*(-0.5*valuesL[i-1]+derivsL[i-1]);
+    double valueL = values[i];
+    double derivL = derivs[i];
+    values[i] = vexp*valueL;
+    derivs[i] = scalingf_*vexp*(-0.5*valueL+derivL);
   }
   if(!inside_range) {for(unsigned int i=0; i<derivs.size(); i++) {derivs[i]=0.0;}}
 }
@@ -100,6 +100,7 @@ public:
   static void registerKeywords(Keywords&);
   explicit BF_Legendre(const ActionOptions&);
   void getAllValues(const double, double&, bool&, std::vector<double>&, std::vector<double>&) const;
+  void getAllValuesBatch(const std::vector<double>&, std::vector<double>&, std::vector<bool>&, std::vector<double>&, std::vector<double>&) const;
 };
 
 
@@ -134,20 +135,18 @@ void BF_Legendre::getAllValues(const double arg, double& argT, bool& inside_rang
   // plumed_assert(derivs.size()==numberOfBasisFunctions());
   inside_range=true;
   argT=translateArgument(arg, inside_range);
-  std::vector<double> derivsT(derivs.size());
-  //
+  // the derivatives with respect to argT are first stored in derivs
+  // and then scaled at the end to avoid a temporary vector
   values[0]=1.0;
-  derivsT[0]=0.0;
   derivs[0]=0.0;
   values[1]=argT;
-  derivsT[1]=1.0;
-  derivs[1]=intervalDerivf();
+  derivs[1]=1.0;
   for(unsigned int i=1; i < getOrder(); i++) {
     double io = static_cast<double>(i);
     values[i+1]  = ((2.0*io+1.0)/(io+1.0))*argT*values[i] - (io/(io+1.0))*values[i-1];
-    derivsT[i+1] = ((2.0*io+1.0)/(io+1.0))*(values[i]+argT*derivsT[i])-(io/(io+1.0))*derivsT[i-1];
-    derivs[i+1]  = intervalDerivf()*derivsT[i+1];
+    derivs[i+1]  = ((2.0*io+1.0)/(io+1.0))*(values[i]+argT*derivs[i])-(io/(io+1.0))*derivs[i-1];
   }
+  for(unsigned int i=1; i<derivs.size(); i++) {derivs[i]*=intervalDerivf();}
   if(scaled_) {
     // L0 is also scaled!
     for(unsigned int i=0; i<values.size(); i++) {
@@ -161,6 +160,51 @@ void BF_Legendre::getAllValues(const double arg, double& argT, bool& inside_rang
 }
 
 
+void BF_Legendre::getAllValuesBatch(const std::vector<double>& args, std::vector<double>& argsT, std::vector<bool>& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
+  setupBatch(args,argsT,inside_range,values,derivs);
+  const size_t nargs = args.size();
+  if(nargs==0) {return;}
+  const double* x = &argsT[0];
+  double* v = &values[0];
+  double* d = &derivs[0];
+  for(size_t k=0; k<nargs; k++) {
+    v[k]=1.0;
+    d[k]=0.0;
+    v[nargs+k]=x[k];
+    d[nargs+k]=1.0;
+  }
+  // same recurrence as in getAllValues, with the inner loop running over the arguments
+  for(unsigned int i=1; i < getOrder(); i++) {
+    double io = static_cast<double>(i);
+    const double c1 = (2.0*io+1.0)/(io+1.0);
+    const double c2 = io/(io+1.0);
+    const double* v0 = v+(i-1)*nargs;
+    const double* v1 = v+i*nargs;
+    const double* d0 = d+(i-1)*nargs;
+    const double* d1 = d+i*nargs;
+    double* v2 = v+(i+1)*nargs;
+    double* d2 = d+(i+1)*nargs;
+    for(size_t k=0; k<nargs; k++) {
+      v2[k] = c1*x[k]*v1[k] - c2*v0[k];
+      d2[k] = c1*(v1[k]+x[k]*d1[k])-c2*d0[k];
+    }
+  }
+  const double derivf = intervalDerivf();
+  for(size_t j=nargs; j<derivs.size(); j++) {d[j]*=derivf;}
+  if(scaled_) {
+    for(unsigned int i=0; i<numberOfBasisFunctions(); i++) {
+      double io = static_cast<double>(i);
+      double sf = sqrt(io+0.5);
+      for(size_t k=0; k<nargs; k++) {
+        v[i*nargs+k] *= sf;
+        d[i*nargs+k] *= sf;
+      }
+    }
+  }
+  zeroDerivsOutsideBatch(inside_range,derivs);
+}
+
+
 void BF_Legendre::setupUniformIntegrals() {
   setAllUniformIntegralsToZero();
   double L0_int = 1.0;
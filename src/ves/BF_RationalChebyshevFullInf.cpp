@@ -92,19 +92,17 @@ void BF_RationalChebyshevFullInf::getAllValues(const double arg, double& argT, b
   double derivf = (mapf_*mapf_)/pow(sqtmp,3);
   argT = argT/sqtmp;
   //
-  std::vector<double> derivsT(derivs.size());
-  //
+  // the derivatives with respect to argT are first stored in derivs
+  // and then scaled at the end to avoid a temporary vector
   values[0]=1.0;
-  derivsT[0]=0.0;
   derivs[0]=0.0;
   values[1]=argT;
-  derivsT[1]=1.0;
-  derivs[1]=derivf;
+  derivs[1]=1.0;
   for(unsigned int i=1; i < getOrder(); i++) {
     values[i+1]  = 2.0*argT*values[i]-values[i-1];
-    derivsT[i+1] = 2.0*values[i]+2.0*argT*derivsT[i]-derivsT[i-1];
-    derivs[i+1]  = derivf*derivsT[i+1];
+    derivs[i+1]  = 2.0*values[i]+2.0*argT*derivs[i]-derivs[i-1];
   }
+  for(unsigned int i=1; i<derivs.size(); i++) {derivs[i]*=derivf;}
   if(!inside_range) {for(unsigned int i=0; i<derivs.size(); i++) {derivs[i]=0.0;}}
 }
 
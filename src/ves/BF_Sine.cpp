@@ -87,6 +87,7 @@ public:
   static void registerKeywords(Keywords&);
   explicit BF_Sine(const ActionOptions&);
   void getAllValues(const double, double&, bool&, std::vector<double>&, std::vector<double>&) const;
+  void getAllValuesBatch(const std::vector<double>&, std::vector<double>&, std::vector<bool>&, std::vector<double>&, std::vector<double>&) const;
 };
 
 
@@ -133,6 +134,31 @@ void BF_Sine::getAllValues(const double arg, double& argT, bool& inside_range, s
 }
 
 
+void BF_Sine::getAllValuesBatch(const std::vector<double>& args, std::vector<double>& argsT, std::vector<bool>& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
+  setupBatch(args,argsT,inside_range,values,derivs);
+  const size_t nargs = args.size();
+  if(nargs==0) {return;}
+  const double* x = &argsT[0];
+  double* v = &values[0];
+  double* d = &derivs[0];
+  const double derivf = intervalDerivf();
+  for(size_t k=0; k<nargs; k++) {
+    v[k]=1.0;
+    d[k]=0.0;
+  }
+  for(unsigned int i=1; i < getOrder()+1; i++) {
+    double io = i;
+    double* vi = v+i*nargs;
+    double* di = d+i*nargs;
+    for(size_t k=0; k<nargs; k++) {
+      vi[k] = sin(io*x[k]);
+      di[k] = io*cos(io*x[k])*derivf;
+    }
+  }
+  zeroDerivsOutsideBatch(inside_range,derivs);
+}
+
+
 void BF_Sine::setupLabels() {
   setLabel(0,"1");
   for(unsigned int i=1; i < getOrder()+1; i++) {
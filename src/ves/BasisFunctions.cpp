@@ -57,6 +57,8 @@ BasisFunctions::BasisFunctions(const ActionOptions&ao):
   periodic_(false),
   orthogonal_(false),
   interval_bounded_(true),
+  thread_safe_(true),
+  support_size_(0),
   interval_intrinsic_min_str_("1.0"),
   interval_intrinsic_max_str_("-1.0"),
   interval_intrinsic_min_(1.0),
@@ -274,16 +276,25 @@ std::vector<double> BasisFunctions::numericalTargetDistributionIntegralsFromGrid
   std::vector<double> targetdist_integrals(nbasis_,0.0);
   std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(grid_pntr);
 
-  for(Grid::index_t k=0; k < grid_pntr->getSize(); k++) {
-    double arg = grid_pntr->getPoint(k)[0];
-    std::vector<double> bf_values(nbasis_);
-    std::vector<double> bf_derivs(nbasis_);
-    bool inside=true;
-    double argT=0.0;
-    getAllValues(arg,argT,inside,bf_values,bf_derivs);
-    for(unsigned int i=0; i < nbasis_; i++) {
-      targetdist_integrals[i] += (integration_weights[k] * grid_pntr->getValue(k)) * bf_values[i];
+  const size_t npoints = grid_pntr->getSize();
+  std::vector<double> args(npoints);
+  std::vector<double> weights(npoints);
+  for(Grid::index_t k=0; k < npoints; k++) {
+    args[k] = grid_pntr->getPoint(k)[0];
+    weights[k] = integration_weights[k] * grid_pntr->getValue(k);
+  }
+  std::vector<double> argsT;
+  std::vector<bool> inside_range;
+  std::vector<double> bf_values;
+  std::vector<double> bf_derivs;
+  getAllValuesBatch(args,argsT,inside_range,bf_values,bf_derivs);
+  for(unsigned int i=0; i < nbasis_; i++) {
+    const double* values_i = &bf_values[i*npoints];
+    double sum = 0.0;
+    for(size_t k=0; k < npoints; k++) {
+      sum += weights[k] * values_i[k];
     }
+    targetdist_integrals[i] = sum;
   }
   // assume that the first function is the constant
   bool inside=true;
@@ -321,6 +332,56 @@ double BasisFunctions::getValue(const double arg, const unsigned int n, double&
 }
 
 
+void BasisFunctions::getAllValuesBatch(const std::vector<double>& args, std::vector<double>& argsT, std::vector<bool>& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
+  const size_t nargs = args.size();
+  argsT.resize(nargs);
+  inside_range.resize(nargs);
+  values.resize(nbasis_*nargs);
+  derivs.resize(nbasis_*nargs);
+  std::vector<double> tmp_values(nbasis_);
+  std::vector<double> tmp_derivs(nbasis_);
+  for(size_t i=0; i<nargs; i++) {
+    bool inside=true;
+    getAllValues(args[i],argsT[i],inside,tmp_values,tmp_derivs);
+    inside_range[i]=inside;
+    for(unsigned int n=0; n<nbasis_; n++) {
+      values[n*nargs+i]=tmp_values[n];
+      derivs[n*nargs+i]=tmp_derivs[n];
+    }
+  }
+}
+
+
+void BasisFunctions::getSupport(const double arg, std::vector<unsigned int>& indices) const {
+  // without compact support all the basis functions can be non-zero
+  for(unsigned int i=0; i<nbasis_; i++) {indices[i]=i;}
+}
+
+
+void BasisFunctions::setupBatch(const std::vector<double>& args, std::vector<double>& argsT, std::vector<bool>& inside_range, std::vector<double>& values, std::vector<double>& derivs, const bool translate) const {
+  const size_t nargs = args.size();
+  argsT.resize(nargs);
+  inside_range.resize(nargs);
+  values.resize(nbasis_*nargs);
+  derivs.resize(nbasis_*nargs);
+  for(size_t i=0; i<nargs; i++) {
+    bool inside=true;
+    if(translate) {argsT[i]=translateArgument(args[i],inside);}
+    else {argsT[i]=checkIfArgumentInsideInterval(args[i],inside);}
+    inside_range[i]=inside;
+  }
+}
+
+
+void BasisFunctions::zeroDerivsOutsideBatch(const std::vector<bool>& inside_range, std::vector<double>& derivs) const {
+  const size_t nargs = inside_range.size();
+  for(size_t i=0; i<nargs; i++) {
+    if(inside_range[i]) {continue;}
+    for(unsigned int n=0; n<nbasis_; n++) {derivs[n*nargs+i]=0.0;}
+  }
+}
+
+
 void BasisFunctions::getAllValuesNumericalDerivs(const double arg, double& argT, bool& inside_range, std::vector<double>& values, std::vector<double>& derivs) const {
   // use forward difference, unless very close to the boundary
   double delta = sqrt(epsilon);
@@ -342,15 +403,27 @@ void BasisFunctions::getMultipleValue(const std::vector<double>& args, std::vect
   argsT.resize(args.size());
   values.clear();
   derivs.clear();
+  if(!numerical_deriv) {
+    const size_t nargs = args.size();
+    std::vector<bool> inside_interval;
+    std::vector<double> batch_values;
+    std::vector<double> batch_derivs;
+    getAllValuesBatch(args,argsT,inside_interval,batch_values,batch_derivs);
+    values.assign(nargs,std::vector<double>(nbasis_));
+    derivs.assign(nargs,std::vector<double>(nbasis_));
+    for(size_t i=0; i<nargs; i++) {
+      for(unsigned int n=0; n<nbasis_; n++) {
+        values[i][n] = batch_values[n*nargs+i];
+        derivs[i][n] = batch_derivs[n*nargs+i];
+      }
+    }
+    return;
+  }
   for(unsigned int i=0; i<args.size(); i++) {
     std::vector<double> tmp_values(getNumberOfBasisFunctions());
     std::vector<double> tmp_derivs(getNumberOfBasisFunctions());
     bool inside_interval=true;
-    if(!numerical_deriv) {
-      getAllValues(args[i],argsT[i],inside_interval,tmp_values,tmp_derivs);
-    } else {
-      getAllValuesNumericalDerivs(args[i],argsT[i],inside_interval,tmp_values,tmp_derivs);
-    }
+    getAllValuesNumericalDerivs(args[i],argsT[i],inside_interval,tmp_values,tmp_derivs);
     values.push_back(tmp_values);
     derivs.push_back(tmp_derivs);
   }
@@ -439,10 +512,31 @@ std::vector<std::vector<double> > BasisFunctions::getAllInnerProducts() const {
 
 std::vector<std::vector<double> > BasisFunctions::getAllInnerProducts(const Grid* grid_pntr) const {
 
+  plumed_massert(grid_pntr->getDimension()==1,"the grid must be one-dimensional");
+  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(grid_pntr);
+  // evaluate all the basis functions once on the grid rather than for each pair
+  const size_t npoints = grid_pntr->getSize();
+  std::vector<double> args(npoints);
+  for(Grid::index_t k=0; k < npoints; k++) {args[k] = grid_pntr->getPoint(k)[0];}
+  std::vector<double> argsT;
+  std::vector<bool> inside_range;
+  std::vector<double> values;
+  std::vector<double> derivs;
+  getAllValuesBatch(args,argsT,inside_range,values,derivs);
+  for(size_t k=0; k < npoints; k++) {
+    plumed_massert(inside_range[k],"the basis functions values must be inside the range of the defined interval!");
+  }
+  //
   std::vector<std::vector<double> > inner_products(numberOfBasisFunctions(), std::vector<double>(numberOfBasisFunctions()));
   for(unsigned int i=0; i<numberOfBasisFunctions(); i++) {
+    const double* values_i = &values[i*npoints];
     for(unsigned int j=i; j<numberOfBasisFunctions(); j++) {
-      inner_products[i][j] = inner_products[j][i] = getInnerProduct(i,j,grid_pntr);
+      const double* values_j = &values[j*npoints];
+      double sum = 0.0;
+      for(size_t k=0; k < npoints; k++) {
+        sum += integration_weights[k]*values_i[k]*values_j[k];
+      }
+      inner_products[i][j] = inner_products[j][i] = sum;
     }
   }
   return inner_products;
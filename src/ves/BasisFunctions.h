@@ -74,6 +74,10 @@ private:
   bool orthogonal_;
   // if the basis functions are defined on a bounded interval or not
   bool interval_bounded_;
+  // if getAllValues can be called concurrently from several threads
+  bool thread_safe_;
+  // number of basis functions that can be non-zero for a given argument, zero if all of them
+  unsigned int support_size_;
   // the intrinsic interval of the basis functions
   std::string interval_intrinsic_min_str_;
   std::string interval_intrinsic_max_str_;
@@ -106,6 +110,10 @@ protected:
   void setupBF();
   void setupInterval();
   void setNumericalIntegrationBins(const unsigned int nbins) {nbins_=nbins;}
+  // resize the output of getAllValuesBatch and translate or check all arguments
+  void setupBatch(const std::vector<double>&, std::vector<double>&, std::vector<bool>&, std::vector<double>&, std::vector<double>&, const bool translate=true) const;
+  // set the derivatives of arguments outside the interval to zero
+  void zeroDerivsOutsideBatch(const std::vector<bool>&, std::vector<double>&) const;
   void numericalUniformIntegrals();
   std::vector<double> numericalTargetDistributionIntegralsFromGrid(const Grid*) const ;
   virtual void setupLabels();
@@ -122,6 +130,9 @@ protected:
   void setNonOrthogonal() {orthogonal_=false;}
   void setIntervalBounded() {interval_bounded_=true;}
   void setIntervalNonBounded() {interval_bounded_=false;}
+  void setThreadSafe() {thread_safe_=true;}
+  void setNonThreadSafe() {thread_safe_=false;}
+  void setCompactSupport(const unsigned int support_size) {support_size_=support_size;}
   void setType(const std::string& type_in) {type_=type_in;}
   void setDescription(const std::string& description_in) {description_=description_in;}
   //
@@ -158,6 +169,9 @@ public:
   bool arePeriodic() const {return periodic_;}
   bool areOrthogonal() const {return orthogonal_;}
   bool intervalBounded() const {return interval_bounded_;}
+  bool areThreadSafe() const {return thread_safe_;}
+  bool haveCompactSupport() const {return support_size_>0;}
+  unsigned int getSupportSize() const {return support_size_>0 ? support_size_ : nbasis_;}
   double intervalMin() const {return interval_min_;}
   double intervalMax() const {return interval_max_;}
   double intervalRange() const {return interval_range_;}
@@ -188,6 +202,11 @@ public:
   double getValue(const double, const unsigned int, double&, bool&) const;
   // calcuate the values for all basis functions
   virtual void getAllValues(const double, double&, bool&, std::vector<double>&, std::vector<double>&) const = 0;
+  // calculate the values for all basis functions for a batch of arguments, the values and
+  // derivatives are stored function by function, i.e. values[n*args.size()+i] for argument i
+  virtual void getAllValuesBatch(const std::vector<double>&, std::vector<double>&, std::vector<bool>&, std::vector<double>&, std::vector<double>&) const;
+  // get the indices of the getSupportSize() basis functions that can be non-zero for a given argument
+  virtual void getSupport(const double, std::vector<unsigned int>&) const;
   //virtual void get2ndDerivatives(const double, std::vector<double>&)=0;
   void printInfo() const;
   //
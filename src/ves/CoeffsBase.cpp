@@ -314,6 +314,22 @@ void CoeffsBase::setType(const CoeffsType coeffs_type) {
 }
 
 
+void CoeffsBase::setTypeFromStr(const std::string& type_str) {
+  if(type_str=="Generic") {
+    coeffs_type_ = Generic;
+  }
+  else if(type_str=="LinearBasisSet") {
+    coeffs_type_ = LinearBasisSet;
+  }
+  else if(type_str=="MultiCoeffs_LinearBasisSet") {
+    coeffs_type_ = MultiCoeffs_LinearBasisSet;
+  }
+  else {
+    plumed_merror("unknown type of coeffs " + type_str);
+  }
+}
+
+
 void CoeffsBase::linkVesBias(VesBias* vesbias_pntr_in) {
   vesbias_pntr_ = vesbias_pntr_in;
   action_pntr_ = static_cast<Action*>(vesbias_pntr_in);
@@ -122,6 +122,7 @@ public:
   CoeffsType getType() const {return coeffs_type_;}
   std::string getTypeStr() const;
   void setType(const CoeffsType coeffs_type);
+  void setTypeFromStr(const std::string&);
   void linkVesBias(VesBias*);
   void linkAction(Action*);
   VesBias* getPntrToVesBias() const {return vesbias_pntr_;}
@@ -0,0 +1,315 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+
+#include "CoeffsBinaryFile.h"
+#include "CoeffsBase.h"
+
+#include "tools/Exception.h"
+#include "tools/File.h"
+#include "tools/Tools.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define __PLUMED_ves_coeffs_mmap
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace PLMD {
+namespace ves {
+
+
+const char CoeffsBinaryFile::magic_[8] = {'V','E','S','C','O','E','F','F'};
+const unsigned int CoeffsBinaryFile::version_ = 1;
+
+
+namespace {
+
+// size of the fixed part of the header
+const size_t fixed_header_size = 72;
+
+
+bool littleEndianHost() {
+  const uint32_t one = 1;
+  char c;
+  std::memcpy(&c,&one,1);
+  return c==1;
+}
+
+
+void putUInt32(std::vector<char>& buffer, const uint32_t value) {
+  for(unsigned int k=0; k<4; k++) {buffer.push_back(static_cast<char>((value>>(8*k)) & 0xff));}
+}
+
+
+void putUInt64(std::vector<char>& buffer, const uint64_t value) {
+  for(unsigned int k=0; k<8; k++) {buffer.push_back(static_cast<char>((value>>(8*k)) & 0xff));}
+}
+
+
+void putDouble(std::vector<char>& buffer, const double value) {
+  uint64_t u;
+  std::memcpy(&u,&value,8);
+  putUInt64(buffer,u);
+}
+
+
+void putString(std::vector<char>& buffer, const std::string& str) {
+  putUInt32(buffer,static_cast<uint32_t>(str.size()));
+  buffer.insert(buffer.end(),str.begin(),str.end());
+}
+
+
+uint32_t getUInt32(const char* p) {
+  uint32_t value = 0;
+  for(unsigned int k=0; k<4; k++) {value |= static_cast<uint32_t>(static_cast<unsigned char>(p[k])) << (8*k);}
+  return value;
+}
+
+
+uint64_t getUInt64(const char* p) {
+  uint64_t value = 0;
+  for(unsigned int k=0; k<8; k++) {value |= static_cast<uint64_t>(static_cast<unsigned char>(p[k])) << (8*k);}
+  return value;
+}
+
+
+double getDouble(const char* p) {
+  uint64_t u = getUInt64(p);
+  double value;
+  std::memcpy(&value,&u,8);
+  return value;
+}
+
+}
+
+
+CoeffsBinaryFile::CoeffsBinaryFile(const std::string& path):
+  path_(path),
+  data_(NULL),
+  size_(0),
+  mapped_(false),
+  buffer_(0),
+  records_(0)
+{
+#ifdef __PLUMED_ves_coeffs_mmap
+  int fd = open(path_.c_str(),O_RDONLY);
+  plumed_massert(fd>=0,"cannot open binary coefficient file " + path_);
+  struct stat st;
+  if(fstat(fd,&st)==0 && st.st_size>0) {
+    void* p = mmap(NULL,static_cast<size_t>(st.st_size),PROT_READ,MAP_PRIVATE,fd,0);
+    if(p!=MAP_FAILED) {
+      data_ = static_cast<const char*>(p);
+      size_ = static_cast<size_t>(st.st_size);
+      mapped_ = true;
+    }
+  }
+  close(fd);
+#endif
+  if(!mapped_) {
+    std::ifstream ifs(path_.c_str(),std::ios::binary);
+    plumed_massert(ifs,"cannot open binary coefficient file " + path_);
+    buffer_.assign(std::istreambuf_iterator<char>(ifs),std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+  parseRecords();
+}
+
+
+CoeffsBinaryFile::~CoeffsBinaryFile() {
+#ifdef __PLUMED_ves_coeffs_mmap
+  if(mapped_) {munmap(const_cast<char*>(data_),size_);}
+#endif
+}
+
+
+void CoeffsBinaryFile::parseRecords() {
+  const std::string msg_header = "Error when reading binary coefficient file " + path_ + ": ";
+  size_t offset = 0;
+  while(offset<size_) {
+    const char* p = data_+offset;
+    const size_t remaining = size_-offset;
+    if(remaining<fixed_header_size || std::memcmp(p,magic_,8)!=0) {
+      plumed_merror(msg_header + "not a binary coefficient file or the file is corrupted");
+    }
+    if(getUInt32(p+8)>version_) {
+      std::string s1; Tools::convert(getUInt32(p+8),s1);
+      plumed_merror(msg_header + "the version " + s1 + " of the format is not supported");
+    }
+    Record record;
+    record.storage = static_cast<Storage>(getUInt32(p+12));
+    const unsigned int ndimensions = getUInt32(p+16);
+    const unsigned int ndata = getUInt32(p+20);
+    record.ncoeffs = getUInt64(p+24);
+    record.nvalues = getUInt64(p+32);
+    record.iteration_and_time_active = getUInt32(p+40)!=0;
+    record.iteration = getUInt32(p+44);
+    record.time = getDouble(p+48);
+    const size_t values_offset = getUInt64(p+56);
+    const size_t record_size = getUInt64(p+64);
+    if(record_size>remaining || values_offset>record_size || values_offset+ndata*record.nvalues*sizeof(double)>record_size) {
+      plumed_merror(msg_header + "the last record is incomplete");
+    }
+    //
+    size_t pos = fixed_header_size;
+    auto readString = [&]() -> std::string {
+      plumed_massert(pos+4<=values_offset,msg_header + "the header of a record is corrupted");
+      size_t len = getUInt32(p+pos); pos += 4;
+      plumed_massert(pos+len<=values_offset,msg_header + "the header of a record is corrupted");
+      std::string str(p+pos,len); pos += len;
+      return str;
+    };
+    plumed_massert(pos+4*ndimensions<=values_offset,msg_header + "the header of a record is corrupted");
+    record.shape.resize(ndimensions);
+    for(unsigned int k=0; k<ndimensions; k++) {
+      record.shape[k] = getUInt32(p+pos); pos += 4;
+    }
+    record.type = readString();
+    record.label = readString();
+    record.dimension_labels.resize(ndimensions);
+    for(unsigned int k=0; k<ndimensions; k++) {
+      record.dimension_labels[k] = readString();
+    }
+    record.data_labels.resize(ndata);
+    for(unsigned int l=0; l<ndata; l++) {
+      record.data_labels[l] = readString();
+    }
+    record.storage_parameter = 0;
+    if(record.storage==BandedMatrix || record.storage==BlockDiagonalMatrix) {
+      plumed_massert(pos+4<=values_offset,msg_header + "the header of a record is corrupted");
+      record.storage_parameter = getUInt32(p+pos); pos += 4;
+    }
+    record.values_offset = offset+values_offset;
+    records_.push_back(record);
+    offset += record_size;
+  }
+  plumed_massert(records_.size()>0,msg_header + "the file is empty");
+}
+
+
+int CoeffsBinaryFile::getDataIndex(const Record& record, const std::string& data_label) {
+  for(unsigned int l=0; l<record.data_labels.size(); l++) {
+    if(record.data_labels[l]==data_label) {return static_cast<int>(l);}
+  }
+  return -1;
+}
+
+
+void CoeffsBinaryFile::getValues(const Record& record, const unsigned int data_index, std::vector<double>& values) const {
+  plumed_massert(data_index<record.data_labels.size(),"data set is not present in the record");
+  values.resize(record.nvalues);
+  const char* p = data_+record.values_offset+data_index*record.nvalues*sizeof(double);
+  if(littleEndianHost()) {
+    std::memcpy(values.data(),p,record.nvalues*sizeof(double));
+  }
+  else {
+    for(size_t i=0; i<record.nvalues; i++) {
+      values[i] = getDouble(p+i*sizeof(double));
+    }
+  }
+}
+
+
+bool CoeffsBinaryFile::isBinaryFile(const std::string& path) {
+  FILE* fp = std::fopen(path.c_str(),"rb");
+  if(fp==NULL) {return false;}
+  char buffer[8];
+  size_t nread = std::fread(buffer,1,8,fp);
+  std::fclose(fp);
+  return nread==8 && std::memcmp(buffer,magic_,8)==0;
+}
+
+
+void CoeffsBinaryFile::writeRecord(OFile& ofile, const CoeffsBase& coeffs, const Storage storage, const std::vector<std::string>& data_labels, const std::vector<const std::vector<double>*>& values, const unsigned int storage_parameter) {
+  plumed_massert(data_labels.size()==values.size(),"the number of data labels and data sets should be the same");
+  plumed_massert(values.size()>0,"no data sets given");
+  const size_t nvalues = values[0]->size();
+  for(unsigned int l=1; l<values.size(); l++) {
+    plumed_massert(values[l]->size()==nvalues,"all data sets in a record should have the same size");
+  }
+  //
+  std::vector<char> header;
+  header.reserve(256);
+  header.insert(header.end(),magic_,magic_+8);
+  putUInt32(header,version_);
+  putUInt32(header,static_cast<uint32_t>(storage));
+  putUInt32(header,coeffs.numberOfDimensions());
+  putUInt32(header,static_cast<uint32_t>(values.size()));
+  putUInt64(header,coeffs.numberOfCoeffs());
+  putUInt64(header,nvalues);
+  putUInt32(header,coeffs.isIterationCounterActive() ? 1 : 0);
+  putUInt32(header,coeffs.getIterationCounter());
+  putDouble(header,coeffs.getTimeValue());
+  // the offset and the size of the record are set below
+  putUInt64(header,0);
+  putUInt64(header,0);
+  plumed_dbg_assert(header.size()==fixed_header_size);
+  for(unsigned int k=0; k<coeffs.numberOfDimensions(); k++) {
+    putUInt32(header,coeffs.shapeOfIndices(k));
+  }
+  putString(header,coeffs.getTypeStr());
+  putString(header,coeffs.getLabel());
+  for(unsigned int k=0; k<coeffs.numberOfDimensions(); k++) {
+    putString(header,coeffs.getDimensionLabel(k));
+  }
+  for(unsigned int l=0; l<data_labels.size(); l++) {
+    putString(header,data_labels[l]);
+  }
+  if(storage==BandedMatrix || storage==BlockDiagonalMatrix) {
+    putUInt32(header,storage_parameter);
+  }
+  while(header.size()%sizeof(double)!=0) {header.push_back(0);}
+  const uint64_t values_offset = header.size();
+  const uint64_t record_size = values_offset + values.size()*nvalues*sizeof(double);
+  std::vector<char> tmp;
+  putUInt64(tmp,values_offset);
+  putUInt64(tmp,record_size);
+  std::copy(tmp.begin(),tmp.end(),header.begin()+56);
+  //
+  ofile.writeRaw(header.data(),header.size());
+  const bool little_endian = littleEndianHost();
+  std::vector<char> converted;
+  for(unsigned int l=0; l<values.size(); l++) {
+    if(little_endian) {
+      ofile.writeRaw(values[l]->data(),nvalues*sizeof(double));
+    }
+    else {
+      converted.clear();
+      for(size_t i=0; i<nvalues; i++) {putDouble(converted,(*values[l])[i]);}
+      ofile.writeRaw(converted.data(),converted.size());
+    }
+  }
+}
+
+
+}
+}
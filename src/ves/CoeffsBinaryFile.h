@@ -0,0 +1,132 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+#ifndef __PLUMED_ves_CoeffsBinaryFile_h
+#define __PLUMED_ves_CoeffsBinaryFile_h
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+
+namespace PLMD {
+
+class OFile;
+
+namespace ves {
+
+class CoeffsBase;
+
+/*
+Binary files of coefficients, gradients and Hessians.
+
+A file is a sequence of records, one record is appended each time the
+coefficients are written out. Each record has a small self-describing
+header followed by the values as raw little-endian doubles:
+
+  offset  type       content
+       0  char[8]    magic string VESCOEFF
+       8  uint32     version of the format
+      12  uint32     storage of the values (see Storage)
+      16  uint32     number of dimensions
+      20  uint32     number of data sets (columns) in the record
+      24  uint64     total number of coefficients
+      32  uint64     number of values in each data set
+      40  uint32     1 if the iteration counter and time are given
+      44  uint32     iteration counter
+      48  float64    time
+      56  uint64     offset of the values from the start of the record
+      64  uint64     size of the record in bytes
+      72  uint32[]   shape of the indices for each dimension
+          string[]   type, label, dimension labels and data labels of the
+                     data sets, each given as an uint32 length and the
+                     characters
+          uint32     bandwidth of a banded matrix or the dimension of the
+                     blocks of a block-diagonal matrix, only given for
+                     these two storages
+
+The values of a vector are given in the order of the index of the
+coefficients, a diagonal matrix has the diagonal elements in the same order
+and a symmetric matrix the upper triangle stored row by row. A banded or
+block-diagonal matrix has the values as they are stored in CoeffsMatrix.
+
+The header is padded with zeros such that the values and the next record
+start at an offset that is a multiple of eight bytes, so a file can be read
+by mapping it into memory.
+*/
+
+class CoeffsBinaryFile {
+public:
+  enum Storage {
+    Vector=0,
+    DiagonalMatrix=1,
+    SymmetricMatrix=2,
+    BandedMatrix=3,
+    BlockDiagonalMatrix=4
+  };
+  struct Record {
+    Storage storage;
+    std::string type;
+    std::string label;
+    std::vector<std::string> dimension_labels;
+    std::vector<unsigned int> shape;
+    std::vector<std::string> data_labels;
+    unsigned int storage_parameter;
+    size_t ncoeffs;
+    size_t nvalues;
+    bool iteration_and_time_active;
+    unsigned int iteration;
+    double time;
+    size_t values_offset;
+  };
+private:
+  static const char magic_[8];
+  static const unsigned int version_;
+  std::string path_;
+  const char* data_;
+  size_t size_;
+  bool mapped_;
+  std::vector<char> buffer_;
+  std::vector<Record> records_;
+  //
+  void parseRecords();
+  CoeffsBinaryFile(const CoeffsBinaryFile&);
+  CoeffsBinaryFile& operator=(const CoeffsBinaryFile&);
+public:
+  explicit CoeffsBinaryFile(const std::string&);
+  ~CoeffsBinaryFile();
+  std::string getPath() const {return path_;}
+  size_t numberOfRecords() const {return records_.size();}
+  const Record& getRecord(const size_t i) const {return records_[i];}
+  const Record& getLastRecord() const {return records_.back();}
+  // index of the data set with the given data label, -1 if not present
+  static int getDataIndex(const Record&, const std::string&);
+  void getValues(const Record&, const unsigned int, std::vector<double>&) const;
+  // check for the magic string at the start of the file
+  static bool isBinaryFile(const std::string&);
+  static void writeRecord(OFile&, const CoeffsBase&, const Storage, const std::vector<std::string>&, const std::vector<const std::vector<double>*>&, const unsigned int storage_parameter=0);
+};
+
+
+}
+}
+
+#endif
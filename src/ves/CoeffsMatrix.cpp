@@ -22,6 +22,7 @@
 
 #include "CoeffsMatrix.h"
 #include "CoeffsVector.h"
+#include "CoeffsBinaryFile.h"
 #include "BasisFunctions.h"
 
 #include "tools/Tools.h"
@@ -55,6 +56,11 @@ CoeffsMatrix::CoeffsMatrix(
   nrows_(0),
   ncolumns_(0),
   diagonal_(diagonal),
+  storage_type_(diagonal ? Diagonal : Full),
+  bandwidth_(0),
+  block_dimension_(0),
+  block_stride_(1),
+  block_size_(1),
   averaging_counter(0),
   averaging_exp_decay_(0),
   mycomm(cc)
@@ -76,6 +82,11 @@ CoeffsMatrix::CoeffsMatrix(
   nrows_(0),
   ncolumns_(0),
   diagonal_(diagonal),
+  storage_type_(diagonal ? Diagonal : Full),
+  bandwidth_(0),
+  block_dimension_(0),
+  block_stride_(1),
+  block_size_(1),
   averaging_counter(0),
   averaging_exp_decay_(0),
   mycomm(cc)
@@ -98,6 +109,11 @@ CoeffsMatrix::CoeffsMatrix(
   nrows_(0),
   ncolumns_(0),
   diagonal_(diagonal),
+  storage_type_(diagonal ? Diagonal : Full),
+  bandwidth_(0),
+  block_dimension_(0),
+  block_stride_(1),
+  block_size_(1),
   averaging_counter(0),
   averaging_exp_decay_(0),
   mycomm(cc)
@@ -117,6 +133,11 @@ CoeffsMatrix::CoeffsMatrix(
   nrows_(0),
   ncolumns_(0),
   diagonal_(diagonal),
+  storage_type_(diagonal ? Diagonal : Full),
+  bandwidth_(0),
+  block_dimension_(0),
+  block_stride_(1),
+  block_size_(1),
   averaging_counter(0),
   averaging_exp_decay_(0),
   mycomm(cc)
@@ -132,9 +153,15 @@ CoeffsMatrix::~CoeffsMatrix() {}
 void CoeffsMatrix::setupMatrix() {
   nrows_=numberOfCoeffs();
   ncolumns_=nrows_;
-  if(diagonal_) {
+  if(storage_type_==Diagonal) {
     size_=nrows_;
   }
+  else if(storage_type_==Banded) {
+    size_=nrows_*(bandwidth_+1);
+  }
+  else if(storage_type_==BlockDiagonal) {
+    size_=(nrows_/block_size_)*((block_size_*block_size_-block_size_)/2+block_size_);
+  }
   else {
     size_=(nrows_*nrows_-nrows_)/2+nrows_;
   }
@@ -142,6 +169,78 @@ void CoeffsMatrix::setupMatrix() {
 }
 
 
+std::string CoeffsMatrix::getStorageTypeStr() const {
+  std::string str;
+  if(storage_type_==Diagonal) {str="diagonal";}
+  else if(storage_type_==Full) {str="full";}
+  else if(storage_type_==Banded) {str="banded";}
+  else if(storage_type_==BlockDiagonal) {str="block-diagonal";}
+  return str;
+}
+
+
+void CoeffsMatrix::setBandedStorage(const unsigned int bandwidth) {
+  plumed_massert(nrows_>0,"CoeffsMatrix: cannot setup a banded matrix without coefficients");
+  storage_type_=Banded;
+  diagonal_=false;
+  bandwidth_=bandwidth;
+  if(bandwidth_>nrows_-1) {bandwidth_=nrows_-1;}
+  setupMatrix();
+}
+
+
+void CoeffsMatrix::setBlockDiagonalStorage(const unsigned int dim_index) {
+  plumed_massert(dim_index<numberOfDimensions(),"CoeffsMatrix: the dimension of the blocks is out of range");
+  storage_type_=BlockDiagonal;
+  diagonal_=false;
+  block_dimension_=dim_index;
+  // the index of the first dimension runs the fastest
+  block_stride_=1;
+  for(unsigned int k=0; k<dim_index; k++) {block_stride_*=shapeOfIndices(k);}
+  block_size_=shapeOfIndices(dim_index);
+  setupMatrix();
+}
+
+
+bool CoeffsMatrix::isStoredElement(const size_t index1, const size_t index2) const {
+  bool stored=true;
+  if(storage_type_==Diagonal) {
+    stored = index1==index2;
+  }
+  else if(storage_type_==Banded) {
+    stored = (index1<=index2 ? index2-index1 : index1-index2) <= bandwidth_;
+  }
+  else if(storage_type_==BlockDiagonal) {
+    // same block if the indices only differ in the block dimension
+    stored = index1%block_stride_==index2%block_stride_ && index1/(block_stride_*block_size_)==index2/(block_stride_*block_size_);
+  }
+  return stored;
+}
+
+
+size_t CoeffsMatrix::getRowLength(const size_t index) const {
+  size_t length;
+  if(storage_type_==Diagonal) {
+    length=1;
+  }
+  else if(storage_type_==Banded) {
+    length = bandwidth_+1 < nrows_-index ? bandwidth_+1 : nrows_-index;
+  }
+  else if(storage_type_==BlockDiagonal) {
+    length=block_size_-(index/block_stride_)%block_size_;
+  }
+  else {
+    length=nrows_-index;
+  }
+  return length;
+}
+
+
+size_t CoeffsMatrix::getRowStride() const {
+  return storage_type_==BlockDiagonal ? block_stride_ : 1;
+}
+
+
 size_t CoeffsMatrix::getSize() const {
   return size_;
 }
@@ -205,6 +304,18 @@ size_t CoeffsMatrix::getMatrixIndex(const size_t index1, const size_t index2) co
     // plumed_massert(index1==index2,"CoeffsMatrix: you trying to access a off-diagonal element of a diagonal coeffs matrix");
     matrix_idx=index1;
   }
+  else if(storage_type_==Banded) {
+    plumed_dbg_massert(isStoredElement(index1,index2),"CoeffsMatrix: the element is outside the band of the matrix");
+    matrix_idx = index1<=index2 ? index1*(bandwidth_+1)+(index2-index1) : index2*(bandwidth_+1)+(index1-index2);
+  }
+  else if(storage_type_==BlockDiagonal) {
+    plumed_dbg_massert(isStoredElement(index1,index2),"CoeffsMatrix: the element is outside the blocks of the matrix");
+    size_t p1=(index1/block_stride_)%block_size_;
+    size_t p2=(index2/block_stride_)%block_size_;
+    if(p1>p2) {size_t tmp=p1; p1=p2; p2=tmp;}
+    size_t block = index1%block_stride_ + (index1/(block_stride_*block_size_))*block_stride_;
+    matrix_idx = block*((block_size_*block_size_-block_size_)/2+block_size_) + p2+p1*(block_size_-1)-p1*(p1-1)/2;
+  }
   else if (index1<=index2) {
     matrix_idx=index2+index1*(nrows_-1)-index1*(index1-1)/2;
   }
@@ -231,6 +342,7 @@ void CoeffsMatrix::setAllValuesToZero() {
 
 
 double CoeffsMatrix::getValue(const size_t index1, const size_t index2) const {
+  if(!diagonal_ && !isStoredElement(index1,index2)) {return 0.0;}
   return data[getMatrixIndex(index1,index2)];
 }
 
@@ -280,13 +392,26 @@ CoeffsVector operator*(const CoeffsMatrix& coeffs_matrix, const CoeffsVector& co
       new_coeffs_vector(i) = coeffs_matrix(i,i)*coeffs_vector(i);
     }
   }
-  else {
+  else if(coeffs_matrix.getStorageType()==CoeffsMatrix::Full) {
     for(size_t i=0; i<numcoeffs; i++) {
       for(size_t j=0; j<numcoeffs; j++) {
         new_coeffs_vector(i) += coeffs_matrix(i,j)*coeffs_vector(j);
       }
     }
   }
+  else {
+    // only loop over the stored elements of the upper triangle
+    size_t stride = coeffs_matrix.getRowStride();
+    for(size_t i=0; i<numcoeffs; i++) {
+      const double* row = &coeffs_matrix.data[coeffs_matrix.getMatrixIndex(i,i)];
+      new_coeffs_vector(i) += row[0]*coeffs_vector(i);
+      for(size_t k=1; k<coeffs_matrix.getRowLength(i); k++) {
+        size_t j = i+k*stride;
+        new_coeffs_vector(i) += row[k]*coeffs_vector(j);
+        new_coeffs_vector(j) += row[k]*coeffs_vector(i);
+      }
+    }
+  }
   return new_coeffs_vector;
 }
 
@@ -622,9 +747,38 @@ void CoeffsMatrix::writeToFile(const std::string& filepath, const bool append_fi
 }
 
 
+void CoeffsMatrix::writeToBinaryFile(OFile& ofile) {
+  // the values are written as they are stored, the upper triangle for a full matrix
+  std::vector<std::string> data_labels(1,getDataLabel());
+  std::vector<const std::vector<double>*> values(1,&data);
+  CoeffsBinaryFile::Storage storage = CoeffsBinaryFile::SymmetricMatrix;
+  unsigned int storage_parameter = 0;
+  if(storage_type_==Diagonal) {
+    storage = CoeffsBinaryFile::DiagonalMatrix;
+  }
+  else if(storage_type_==Banded) {
+    storage = CoeffsBinaryFile::BandedMatrix;
+    storage_parameter = bandwidth_;
+  }
+  else if(storage_type_==BlockDiagonal) {
+    storage = CoeffsBinaryFile::BlockDiagonalMatrix;
+    storage_parameter = block_dimension_;
+  }
+  CoeffsBinaryFile::writeRecord(ofile,*this,storage,data_labels,values,storage_parameter);
+}
+
+
 void CoeffsMatrix::writeMatrixInfoToFile(OFile& ofile) {
   std::string field_diagonal = "diagonal_matrix";
   ofile.addConstantField(field_diagonal).printField(field_diagonal,isDiagonal());
+  if(storage_type_==Banded) {
+    std::string field_bandwidth = "bandwidth";
+    ofile.addConstantField(field_bandwidth).printField(field_bandwidth,static_cast<int>(bandwidth_));
+  }
+  else if(storage_type_==BlockDiagonal) {
+    std::string field_block = "block_dimension";
+    ofile.addConstantField(field_block).printField(field_block,getDimensionLabel(block_dimension_));
+  }
 }
 
 
@@ -639,12 +793,15 @@ void CoeffsMatrix::writeHeaderToFile(OFile& ofile) {
 
 
 void CoeffsMatrix::writeDataToFile(OFile& ofile) {
-  if(diagonal_) {
+  if(storage_type_==Diagonal) {
     writeDataDiagonalToFile(ofile);
   }
-  else {
+  else if(storage_type_==Full) {
     writeDataFullToFile(ofile);
   }
+  else {
+    writeDataSparseToFile(ofile);
+  }
 }
 
 
@@ -713,5 +870,49 @@ void CoeffsMatrix::writeDataFullToFile(OFile& ofile) {
 }
 
 
+
+void CoeffsMatrix::writeDataSparseToFile(OFile& ofile) {
+  // same as writeDataFullToFile but only the stored elements are written
+  std::string field_index_row = "idx_row";
+  std::string field_index_column = "idx_column";
+  std::string field_coeffs = getDataLabel();
+  //
+  std::string int_fmt = "%8d";
+  std::string str_separate = "#!-------------------";
+  //
+  char* s1 = new char[20];
+  size_t stride = getRowStride();
+  //
+  for(size_t i=0; i<nrows_; i++) {
+    // columns to the left of the diagonal are taken from the rows above
+    size_t nleft = 0;
+    if(storage_type_==Banded) {nleft = i<bandwidth_ ? i : bandwidth_;}
+    else {nleft = (i/stride)%block_size_;}
+    for(size_t k=nleft; k>0; k--) {
+      sprintf(s1,int_fmt.c_str(),i);
+      ofile.printField(field_index_row,s1);
+      sprintf(s1,int_fmt.c_str(),i-k*stride);
+      ofile.printField(field_index_column,s1);
+      ofile.fmtField(" "+getOutputFmt()).printField(field_coeffs,getValue(i,i-k*stride));
+      ofile.printField();
+    }
+    for(size_t k=0; k<getRowLength(i); k++) {
+      sprintf(s1,int_fmt.c_str(),i);
+      ofile.printField(field_index_row,s1);
+      sprintf(s1,int_fmt.c_str(),i+k*stride);
+      ofile.printField(field_index_column,s1);
+      ofile.fmtField(" "+getOutputFmt()).printField(field_coeffs,getValue(i,i+k*stride));
+      ofile.printField();
+    }
+  }
+  ofile.fmtField();
+  // blank line between iterations to allow proper plotting with gnuplot
+  ofile.printf("%s\n",str_separate.c_str());
+  ofile.printf("\n");
+  ofile.printf("\n");
+  delete [] s1;
+}
+
+
 }
 }
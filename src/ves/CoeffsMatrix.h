@@ -47,6 +47,14 @@ class CoeffsMatrix:
   public CoeffsBase
 {
 public:
+  // layout of the stored elements, the non-diagonal layouts store the
+  // upper triangle of a symmetric matrix
+  enum StorageType {
+    Diagonal,
+    Full,
+    Banded,
+    BlockDiagonal
+  };
 private:
   std::vector<double> data;
   //
@@ -55,6 +63,13 @@ private:
   size_t ncolumns_;
   //
   bool diagonal_;
+  StorageType storage_type_;
+  // number of off-diagonal elements stored on each side of the diagonal
+  size_t bandwidth_;
+  // the blocks couple coefficients that only differ in the index of this dimension
+  unsigned int block_dimension_;
+  size_t block_stride_;
+  size_t block_size_;
   //
   unsigned int averaging_counter;
   unsigned int averaging_exp_decay_;
@@ -103,6 +118,22 @@ public:
   bool isSymmetric() const;
   bool isDiagonal() const;
   //
+  StorageType getStorageType() const {return storage_type_;}
+  std::string getStorageTypeStr() const;
+  // banded matrix with the given number of off-diagonal elements on each side of the diagonal
+  void setBandedStorage(const unsigned int);
+  // block-diagonal matrix with one block for each set of coefficients that only differ in the index of the given dimension
+  void setBlockDiagonalStorage(const unsigned int);
+  size_t getBandwidth() const {return bandwidth_;}
+  unsigned int getBlockDimension() const {return block_dimension_;}
+  //
+  bool isStoredElement(const size_t, const size_t) const;
+  // the stored elements of row i in the upper triangle are the columns
+  // j=i+k*getRowStride() for k<getRowLength(i), they are contiguous in
+  // memory starting at getMatrixIndex(i,i)
+  size_t getRowLength(const size_t) const;
+  size_t getRowStride() const;
+  //
   bool sameShape(CoeffsVector&) const;
   bool sameShape(CoeffsMatrix&) const;
   static bool sameShape(CoeffsMatrix&, CoeffsMatrix&);
@@ -194,12 +225,15 @@ public:
   // file input/output stuff
   void writeToFile(OFile&);
   void writeToFile(const std::string&, const bool append_file=false, Action* action_pntr=NULL);
+  // binary output, see CoeffsBinaryFile
+  void writeToBinaryFile(OFile&);
 private:
   void writeDataToFile(OFile&);
   void writeMatrixInfoToFile(OFile&);
   void writeHeaderToFile(OFile&);
   void writeDataDiagonalToFile(OFile&);
   void writeDataFullToFile(OFile&);
+  void writeDataSparseToFile(OFile&);
 public:
   Communicator& getCommunicator() const {return mycomm;}
 
@@ -22,6 +22,7 @@
 
 #include "CoeffsVector.h"
 #include "CoeffsMatrix.h"
+#include "CoeffsBinaryFile.h"
 #include "BasisFunctions.h"
 
 #include "tools/Tools.h"
@@ -717,6 +718,33 @@ void CoeffsVector::writeToFile(OFile& ofile, const std::vector<CoeffsVector*>& c
 }
 
 
+void CoeffsVector::writeToBinaryFile(OFile& ofile) {
+  std::vector<CoeffsVector*> CoeffsSetTmp;
+  CoeffsSetTmp.push_back(this);
+  writeToBinaryFile(ofile,CoeffsSetTmp);
+}
+
+
+void CoeffsVector::writeToBinaryFile(OFile& ofile, CoeffsVector* aux_coeffsvector) {
+  std::vector<CoeffsVector*> CoeffsSetTmp;
+  CoeffsSetTmp.push_back(this);
+  CoeffsSetTmp.push_back(aux_coeffsvector);
+  writeToBinaryFile(ofile,CoeffsSetTmp);
+}
+
+
+void CoeffsVector::writeToBinaryFile(OFile& ofile, const std::vector<CoeffsVector*>& coeffsvecSet) {
+  std::vector<std::string> data_labels(coeffsvecSet.size());
+  std::vector<const std::vector<double>*> values(coeffsvecSet.size());
+  for(unsigned int k=0; k<coeffsvecSet.size(); k++) {
+    plumed_massert(coeffsvecSet[k]->sameShape(*coeffsvecSet[0]),"Error in writing a set of coeffs to file: The coeffs do not have the same shape and size");
+    data_labels[k] = coeffsvecSet[k]->getDataLabel();
+    values[k] = &coeffsvecSet[k]->data;
+  }
+  CoeffsBinaryFile::writeRecord(ofile,*coeffsvecSet[0],CoeffsBinaryFile::Vector,data_labels,values);
+}
+
+
 void CoeffsVector::writeHeaderToFile(OFile& ofile) const {
   ofile.clearFields();
   if(isIterationCounterActive()) {
@@ -808,6 +836,26 @@ size_t CoeffsVector::readFromFile(const std::string& filepath, const bool ignore
 }
 
 
+size_t CoeffsVector::readFromBinaryFile(const std::string& filepath) {
+  CoeffsBinaryFile binfile(filepath);
+  const CoeffsBinaryFile::Record& record = binfile.getLastRecord();
+  std::string msg_header="Error when reading in coeffs from file " + filepath + ": ";
+  if(record.storage!=CoeffsBinaryFile::Vector) {
+    plumed_merror(msg_header + "the file does not contain a vector of coeffs");
+  }
+  checkCoeffsInfo(msg_header, record.type, record.shape.size(), record.ncoeffs, record.shape);
+  int data_index = CoeffsBinaryFile::getDataIndex(record,getDataLabel());
+  if(data_index<0) {
+    plumed_merror(msg_header + "no field with name " + getDataLabel());
+  }
+  binfile.getValues(record,data_index,data);
+  if(isIterationCounterActive() && record.iteration_and_time_active) {
+    setIterationCounterAndTime(record.iteration,record.time);
+  }
+  return record.nvalues;
+}
+
+
 void CoeffsVector::readHeaderFromFile(IFile& ifile, const bool ignore_coeffs_info) {
   if(ifile && isIterationCounterActive()) {
     getIterationCounterAndTimeFromFile(ifile);
@@ -187,6 +187,8 @@ public:
   void randomizeValuesGaussian(int);
   //
   void resetAveragingCounter() {averaging_counter=0;}
+  unsigned int getAveragingCounter() const {return averaging_counter;}
+  void setAveragingCounter(const unsigned int averaging_counter_in) {averaging_counter=averaging_counter_in;}
   void setupExponentiallyDecayingAveraging(const unsigned int averaging_exp_decay_in) {averaging_exp_decay_=averaging_exp_decay_in;}
   void turnOffExponentiallyDecayingAveraging() {averaging_exp_decay_=0;}
   void resetAveraging();
@@ -200,6 +202,10 @@ public:
   void writeToFile(OFile& ofile, CoeffsVector*, const bool print_coeffs_descriptions=false);
   static void writeToFile(const std::string&, const std::vector<CoeffsVector*>&, const bool print_description=false, const bool append_file=false, Action* action_pntr=NULL);
   static void writeToFile(OFile&, const std::vector<CoeffsVector*>&, const bool print_description=false);
+  // binary output, see CoeffsBinaryFile
+  void writeToBinaryFile(OFile&);
+  void writeToBinaryFile(OFile&, CoeffsVector*);
+  static void writeToBinaryFile(OFile&, const std::vector<CoeffsVector*>&);
 private:
   void writeHeaderToFile(OFile&) const;
   static void writeDataToFile(OFile&, const std::vector<CoeffsVector*>&, const bool print_description=false);
@@ -207,6 +213,8 @@ public:
   size_t readFromFile(IFile&, const bool ignore_missing_coeffs=false, const bool ignore_header=false);
   size_t readFromFile(const std::string&, const bool ignore_missing_coeffs=false, const bool ignore_header=false);
   size_t readOneSetFromFile(IFile& ifile, const bool ignore_header=false);
+  // read the last record of a binary file
+  size_t readFromBinaryFile(const std::string&);
 private:
   void readHeaderFromFile(IFile&, const bool ignore_coeffs_info=false);
   size_t readDataFromFile(IFile&, const bool ignore_missing_coeffs=false);
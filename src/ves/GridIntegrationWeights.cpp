@@ -31,20 +31,7 @@ namespace PLMD {
 namespace ves {
 
 std::vector<double> GridIntegrationWeights::getIntegrationWeights(const Grid* grid_pntr, const std::string& fname_weights_grid, const std::string& weights_type) {
-  std::vector<double> dx = grid_pntr->getDx();
-  std::vector<bool> isPeriodic = grid_pntr->getIsPeriodic();
-  std::vector<unsigned int> nbins = grid_pntr->getNbin();
-  std::vector<std::vector<double> > weights_perdim;
-  for(unsigned int k=0; k<grid_pntr->getDimension(); k++) {
-    std::vector<double> weights_tmp;
-    if(weights_type=="trapezoidal") {
-      weights_tmp = getOneDimensionalTrapezoidalWeights(nbins[k],dx[k],isPeriodic[k]);
-    }
-    else {
-      plumed_merror("getIntegrationWeights: unknown weight type, the available type is trapezoidal");
-    }
-    weights_perdim.push_back(weights_tmp);
-  }
+  std::vector<std::vector<double> > weights_perdim = getIntegrationWeightsPerDimension(grid_pntr,weights_type);
 
   std::vector<double> weights_vector(grid_pntr->getSize(),0.0);
   for(Grid::index_t l=0; l<grid_pntr->getSize(); l++) {
@@ -72,6 +59,25 @@ std::vector<double> GridIntegrationWeights::getIntegrationWeights(const Grid* gr
 }
 
 
+std::vector< std::vector<double> > GridIntegrationWeights::getIntegrationWeightsPerDimension(const Grid* grid_pntr, const std::string& weights_type) {
+  std::vector<double> dx = grid_pntr->getDx();
+  std::vector<bool> isPeriodic = grid_pntr->getIsPeriodic();
+  std::vector<unsigned int> nbins = grid_pntr->getNbin();
+  std::vector<std::vector<double> > weights_perdim;
+  for(unsigned int k=0; k<grid_pntr->getDimension(); k++) {
+    std::vector<double> weights_tmp;
+    if(weights_type=="trapezoidal") {
+      weights_tmp = getOneDimensionalTrapezoidalWeights(nbins[k],dx[k],isPeriodic[k]);
+    }
+    else {
+      plumed_merror("getIntegrationWeights: unknown weight type, the available type is trapezoidal");
+    }
+    weights_perdim.push_back(weights_tmp);
+  }
+  return weights_perdim;
+}
+
+
 void GridIntegrationWeights::getOneDimensionalIntegrationPointsAndWeights(std::vector<double>& points, std::vector<double>& weights, const unsigned int nbins, const double min, const double max, const std::string& weights_type) {
   double dx = (max-min)/(static_cast<double>(nbins)-1.0);
   points.resize(nbins);
@@ -39,6 +39,8 @@ private:
   static std::vector<double> getOneDimensionalTrapezoidalWeights(const unsigned int, const double, const bool periodic=false);
 public:
   static std::vector<double> getIntegrationWeights(const Grid*, const std::string& fname_weights_grid="", const std::string& weights_type="trapezoidal");
+  // the weights are a product of one dimensional weights, these are given for each dimension
+  static std::vector< std::vector<double> > getIntegrationWeightsPerDimension(const Grid*, const std::string& weights_type="trapezoidal");
   static void getOneDimensionalIntegrationPointsAndWeights(std::vector<double>&, std::vector<double>&, const unsigned int, const double, const double, const std::string& weights_type="trapezoidal");
 };
 
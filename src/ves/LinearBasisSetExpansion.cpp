@@ -32,9 +32,12 @@
 #include "tools/Keywords.h"
 #include "tools/Grid.h"
 #include "tools/Communicator.h"
+#include "tools/OpenMP.h"
 
 #include "GridProjWeights.h"
 
+#include <limits>
+
 namespace PLMD {
 namespace ves {
 
@@ -70,11 +73,13 @@ LinearBasisSetExpansion::LinearBasisSetExpansion(
   step_of_last_biasgrid_update(-1000),
   step_of_last_biaswithoutcutoffgrid_update(-1000),
   step_of_last_fesgrid_update(-1000),
+  iteration_of_last_biasinterpolationgrid_update(-1),
   bias_grid_pntr_(NULL),
   bias_withoutcutoff_grid_pntr_(NULL),
   fes_grid_pntr_(NULL),
   log_targetdist_grid_pntr_(NULL),
   targetdist_grid_pntr_(NULL),
+  bias_interpolation_grid_pntr_(NULL),
   targetdist_pntr_(NULL)
 {
   plumed_massert(args_pntrs_.size()==basisf_pntrs_.size(),"number of arguments and basis functions do not match");
@@ -97,6 +102,13 @@ LinearBasisSetExpansion::LinearBasisSetExpansion(
   }
   targetdist_averages_pntr_->setLabels(targetdist_averages_label);
   //
+  bool sparse = false;
+  for(unsigned int k=0; k<nargs_; k++) {
+    if(basisf_pntrs_[k]->haveCompactSupport()) {sparse=true;}
+  }
+  workspace_.setup(basisf_pntrs_,ncoeffs_,OpenMP::getNumThreads(),sparse);
+  workspace_.nreallocations = 0;
+  //
   for(unsigned int k=0; k<nargs_; k++) {
     grid_min_[k] = basisf_pntrs_[k]->intervalMinStr();
     grid_max_[k] = basisf_pntrs_[k]->intervalMaxStr();
@@ -116,6 +128,9 @@ LinearBasisSetExpansion::~LinearBasisSetExpansion() {
   if(fes_grid_pntr_!=NULL) {
     delete fes_grid_pntr_;
   }
+  if(bias_interpolation_grid_pntr_!=NULL) {
+    delete bias_interpolation_grid_pntr_;
+  }
 }
 
 
@@ -154,8 +169,7 @@ void LinearBasisSetExpansion::setGridBins(const unsigned int nbins) {
 }
 
 
-Grid* LinearBasisSetExpansion::setupGeneralGrid(const std::string& label_suffix, const bool usederiv) {
-  bool use_spline = false;
+Grid* LinearBasisSetExpansion::setupGeneralGrid(const std::string& label_suffix, const bool usederiv, const bool use_spline) {
   Grid* grid_pntr = new Grid(label_+"."+label_suffix,args_pntrs_,grid_min_,grid_max_,grid_bins_,use_spline,usederiv);
   return grid_pntr;
 }
@@ -191,26 +205,28 @@ void LinearBasisSetExpansion::updateBiasGrid() {
   if(action_pntr_!=NULL &&  getStepOfLastBiasGridUpdate()==action_pntr_->getStep()) {
     return;
   }
-  for(Grid::index_t l=0; l<bias_grid_pntr_->getSize(); l++) {
+  std::vector<double> bias_values;
+  std::vector<double> forces_values;
+  calculateBiasOnGrid(bias_grid_pntr_,bias_values,forces_values,biasCutoffActive());
+  // the maximum of the bias is found while the values are set
+  double bias_max = -std::numeric_limits<double>::max();
+  #pragma omp parallel num_threads(OpenMP::getNumThreads())
+  {
     std::vector<double> forces(nargs_);
-    std::vector<double> args = bias_grid_pntr_->getPoint(l);
-    bool all_inside=true;
-    double bias=getBiasAndForces(args,all_inside,forces);
-    //
-    if(biasCutoffActive()) {
-      vesbias_pntr_->applyBiasCutoff(bias,forces);
-    }
-    //
-    if(bias_grid_pntr_->hasDerivatives()) {
-      bias_grid_pntr_->setValueAndDerivatives(l,bias,forces);
-    }
-    else {
-      bias_grid_pntr_->setValue(l,bias);
+    #pragma omp for reduction(max:bias_max)
+    for(Grid::index_t l=0; l<bias_grid_pntr_->getSize(); l++) {
+      if(bias_grid_pntr_->hasDerivatives()) {
+        std::copy(forces_values.begin()+l*nargs_,forces_values.begin()+(l+1)*nargs_,forces.begin());
+        bias_grid_pntr_->setValueAndDerivatives(l,bias_values[l],forces);
+      }
+      else {
+        bias_grid_pntr_->setValue(l,bias_values[l]);
+      }
+      if(bias_values[l]>bias_max) {bias_max=bias_values[l];}
     }
-    //
   }
   if(vesbias_pntr_!=NULL) {
-    vesbias_pntr_->setCurrentBiasMaxValue(bias_grid_pntr_->getMaxValue());
+    vesbias_pntr_->setCurrentBiasMaxValue(bias_max);
   }
   if(action_pntr_!=NULL) {
     setStepOfLastBiasGridUpdate(action_pntr_->getStep());
@@ -226,16 +242,17 @@ void LinearBasisSetExpansion::updateBiasWithoutCutoffGrid() {
     return;
   }
   //
+  std::vector<double> bias_values;
+  std::vector<double> forces_values;
+  calculateBiasOnGrid(bias_withoutcutoff_grid_pntr_,bias_values,forces_values,false);
+  std::vector<double> forces(nargs_);
   for(Grid::index_t l=0; l<bias_withoutcutoff_grid_pntr_->getSize(); l++) {
-    std::vector<double> forces(nargs_);
-    std::vector<double> args = bias_withoutcutoff_grid_pntr_->getPoint(l);
-    bool all_inside=true;
-    double bias=getBiasAndForces(args,all_inside,forces);
     if(bias_withoutcutoff_grid_pntr_->hasDerivatives()) {
-      bias_withoutcutoff_grid_pntr_->setValueAndDerivatives(l,bias,forces);
+      std::copy(forces_values.begin()+l*nargs_,forces_values.begin()+(l+1)*nargs_,forces.begin());
+      bias_withoutcutoff_grid_pntr_->setValueAndDerivatives(l,bias_values[l],forces);
     }
     else {
-      bias_withoutcutoff_grid_pntr_->setValue(l,bias);
+      bias_withoutcutoff_grid_pntr_->setValue(l,bias_values[l]);
     }
   }
   //
@@ -285,20 +302,165 @@ void LinearBasisSetExpansion::updateFesGrid() {
   }
   //
   double bias2fes_scalingf = -1.0;
+  double fes_min = std::numeric_limits<double>::max();
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads()) reduction(min:fes_min)
   for(Grid::index_t l=0; l<fes_grid_pntr_->getSize(); l++) {
     double fes_value = bias2fes_scalingf*bias_grid_pntr_->getValue(l);
     if(log_targetdist_grid_pntr_!=NULL) {
       fes_value += kBT()*log_targetdist_grid_pntr_->getValue(l);
     }
     fes_grid_pntr_->setValue(l,fes_value);
+    if(fes_value<fes_min) {fes_min=fes_value;}
+  }
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads())
+  for(Grid::index_t l=0; l<fes_grid_pntr_->getSize(); l++) {
+    fes_grid_pntr_->setValue(l,fes_grid_pntr_->getValue(l)-fes_min);
   }
-  fes_grid_pntr_->setMinToZero();
   if(action_pntr_!=NULL) {
     setStepOfLastFesGridUpdate(action_pntr_->getStep());
   }
 }
 
 
+/*
+Calculates the bias and the forces on all the points of the grid. The grid points
+are the tensor product of the grid coordinates in each dimension, so the values
+of the basis functions on the grid are tabulated once for each dimension and the
+coefficients tensor is then contracted one dimension at a time with these tables.
+The derivative along dimension k uses the same contractions as the bias for the
+dimensions before k. The points along the last dimension are split between the
+MPI ranks. The forces are stored with the arguments as the fastest running index.
+*/
+void LinearBasisSetExpansion::calculateBiasOnGrid(const Grid* grid_pntr, std::vector<double>& bias_values, std::vector<double>& forces_values, const bool apply_bias_cutoff) {
+  const GridBasisTable& table = getGridBasisTable(grid_pntr);
+  const std::vector<unsigned int> nbins = grid_pntr->getNbin();
+  const Grid::index_t size = grid_pntr->getSize();
+  bias_values.assign(size,0.0);
+  forces_values.assign(size*nargs_,0.0);
+  //
+  const unsigned int klast = nargs_-1;
+  const size_t stride = mycomm_.Get_size();
+  const size_t rank = mycomm_.Get_rank();
+  const size_t first = (rank*nbins[klast])/stride;
+  const size_t last = ((rank+1)*nbins[klast])/stride;
+  // partial[k] is the coefficients tensor where the first k dimensions are contracted
+  std::vector< std::vector<double> > partial(nargs_+1);
+  partial[0].assign(&BiasCoeffs()[0],&BiasCoeffs()[0]+ncoeffs_);
+  std::vector< std::vector<double> > derivs(nargs_);
+  std::vector<double> tmp;
+  size_t nbefore = 1;
+  size_t nafter = ncoeffs_;
+  for(unsigned int k=0; k<nargs_; k++) {
+    nafter /= nbasisf_[k];
+    const size_t row_first = k==klast ? first : 0;
+    const size_t row_last = k==klast ? last : nbins[k];
+    contractWithTable(partial[k].data(),partial[k+1],table.values[k],nbefore,nbasisf_[k],row_first,row_last,nafter);
+    contractWithTable(partial[k].data(),derivs[k],table.derivs[k],nbefore,nbasisf_[k],row_first,row_last,nafter);
+    size_t nbefore_t = nbefore*nbins[k];
+    size_t nafter_t = nafter;
+    for(unsigned int t=k+1; t<nargs_; t++) {
+      nafter_t /= nbasisf_[t];
+      const size_t row_first_t = t==klast ? first : 0;
+      const size_t row_last_t = t==klast ? last : nbins[t];
+      contractWithTable(derivs[k].data(),tmp,table.values[t],nbefore_t,nbasisf_[t],row_first_t,row_last_t,nafter_t);
+      derivs[k].swap(tmp);
+      nbefore_t *= nbins[t];
+    }
+    nbefore *= nbins[k];
+  }
+  // the points of this rank are contiguous in the grid
+  const Grid::index_t offset = (size/nbins[klast])*first;
+  const Grid::index_t nlocal = partial[nargs_].size();
+  std::vector<double> forces(nargs_);
+  for(Grid::index_t l=0; l<nlocal; l++) {
+    double bias = partial[nargs_][l];
+    for(unsigned int k=0; k<nargs_; k++) {
+      forces[k] = -derivs[k][l];
+    }
+    if(apply_bias_cutoff) {
+      vesbias_pntr_->applyBiasCutoff(bias,forces);
+    }
+    bias_values[offset+l] = bias;
+    std::copy(forces.begin(),forces.end(),forces_values.begin()+(offset+l)*nargs_);
+  }
+  mycomm_.Sum(bias_values);
+  mycomm_.Sum(forces_values);
+}
+
+
+/*
+Contracts one dimension of the tensor in, of shape (nbefore,nbasis,nafter), with the
+rows first to last of the table, of shape (nrows,nbasis). The result is of shape
+(nbefore,last-first,nafter). The sums are done in the same order as in contractCoeffs.
+*/
+void LinearBasisSetExpansion::contractWithTable(const double* in, std::vector<double>& out, const std::vector<double>& table, const size_t nbefore, const size_t nbasis, const size_t first, const size_t last, const size_t nafter) {
+  const size_t nrows = last-first;
+  out.assign(nbefore*nrows*nafter,0.0);
+  const unsigned int nthreads = getNumberOfThreads(out.size()*nbasis,OpenMP::getNumThreads());
+  #pragma omp parallel for num_threads(nthreads) if(nthreads>1)
+  for(size_t r=0; r<nrows*nafter; r++) {
+    const size_t j = r/nrows;
+    const double* table_row = table.data()+(first+r%nrows)*nbasis;
+    double* out_row = out.data()+r*nbefore;
+    for(size_t n=0; n<nbasis; n++) {
+      const double t = table_row[n];
+      const double* in_row = in+(n+nbasis*j)*nbefore;
+      for(size_t i=0; i<nbefore; i++) {
+        out_row[i] += t*in_row[i];
+      }
+    }
+  }
+}
+
+
+// the basis functions and their derivatives at the grid coordinates of each dimension
+const LinearBasisSetExpansion::GridBasisTable& LinearBasisSetExpansion::getGridBasisTable(const Grid* grid_pntr) {
+  for(unsigned int i=0; i<grid_basis_tables_.size(); i++) {
+    if(grid_basis_tables_[i].grid_pntr==grid_pntr) {return grid_basis_tables_[i];}
+  }
+  GridBasisTable table;
+  table.grid_pntr = grid_pntr;
+  table.values.resize(nargs_);
+  table.derivs.resize(nargs_);
+  const std::vector<unsigned int> nbins = grid_pntr->getNbin();
+  std::vector<unsigned int> indices(nargs_,0);
+  for(unsigned int k=0; k<nargs_; k++) {
+    const size_t nbasis = nbasisf_[k];
+    std::vector<double> args(nbins[k]);
+    for(unsigned int g=0; g<nbins[k]; g++) {
+      indices[k] = g;
+      args[g] = grid_pntr->getPoint(indices)[k];
+    }
+    indices[k] = 0;
+    std::vector<double> argsT;
+    std::vector<bool> inside;
+    std::vector<double> bf_values;
+    std::vector<double> bf_derivs;
+    basisf_pntrs_[k]->getAllValuesBatch(args,argsT,inside,bf_values,bf_derivs);
+    // the batch output is stored function by function, the table point by point
+    table.values[k].assign(nbins[k]*nbasis,0.0);
+    table.derivs[k].assign(nbins[k]*nbasis,0.0);
+    for(size_t n=0; n<nbasis; n++) {
+      for(unsigned int g=0; g<nbins[k]; g++) {
+        table.values[k][g*nbasis+n] = bf_values[n*nbins[k]+g];
+        table.derivs[k][g*nbasis+n] = bf_derivs[n*nbins[k]+g];
+      }
+    }
+  }
+  grid_basis_tables_.push_back(table);
+  return grid_basis_tables_.back();
+}
+
+
+unsigned int LinearBasisSetExpansion::getNumberOfGridThreads() const {
+  unsigned int nthreads = OpenMP::getNumThreads();
+  for(unsigned int k=0; k<nargs_; k++) {
+    if(!basisf_pntrs_[k]->areThreadSafe()) {nthreads=1;}
+  }
+  return nthreads;
+}
+
+
 void LinearBasisSetExpansion::writeBiasGridToFile(OFile& ofile, const bool append_file) const {
   plumed_massert(bias_grid_pntr_!=NULL,"the bias grid is not defined");
   if(append_file) {ofile.enforceRestart();}
@@ -367,28 +529,101 @@ void LinearBasisSetExpansion::writeTargetDistributionToFile(const std::string& f
 }
 
 
+void LinearBasisSetExpansion::Workspace::setup(const std::vector<BasisFunctions*>& basisf_pntrs_in, const size_t ncoeffs, const unsigned int nthreads_in, const bool sparse_in) {
+  const unsigned int nargs = basisf_pntrs_in.size();
+  const size_t contraction_size = nthreads_in*getContractionBufferSize(basisf_pntrs_in);
+  bool reallocated = false;
+  if(args_values_trsfrm.size()!=nargs) {
+    args_values_trsfrm.assign(nargs,0.0);
+    args_inside.assign(nargs,true);
+    forces.assign(nargs,0.0);
+    bf_values.resize(nargs);
+    bf_derivs.resize(nargs);
+    reallocated = true;
+  }
+  for(unsigned int k=0; k<nargs; k++) {
+    if(bf_values[k].size()!=basisf_pntrs_in[k]->getNumberOfBasisFunctions()) {
+      bf_values[k].assign(basisf_pntrs_in[k]->getNumberOfBasisFunctions(),0.0);
+      bf_derivs[k].assign(basisf_pntrs_in[k]->getNumberOfBasisFunctions(),0.0);
+      reallocated = true;
+    }
+  }
+  if(nthreads!=nthreads_in || contraction.size()<contraction_size) {
+    contraction.assign(contraction_size,0.0);
+    nthreads = nthreads_in;
+    reallocated = true;
+  }
+  if(partials.size()!=nthreads*(nargs+1)) {
+    partials.assign(nthreads*(nargs+1),0.0);
+    reallocated = true;
+  }
+  if(coeffsderivs_values.size()!=ncoeffs) {
+    coeffsderivs_values.assign(ncoeffs,0.0);
+    reallocated = true;
+  }
+  sparse = sparse_in;
+  if(sparse && support.size()!=nargs) {
+    support.resize(nargs);
+    block_values.resize(nargs);
+    block_derivs.resize(nargs);
+    block_counters.assign(nargs,0);
+    block_strides.assign(nargs,1);
+    size_t block_size = 1;
+    for(unsigned int k=0; k<nargs; k++) {
+      if(k>0) {block_strides[k] = block_strides[k-1]*basisf_pntrs_in[k-1]->getNumberOfBasisFunctions();}
+      const unsigned int nsupport = basisf_pntrs_in[k]->getSupportSize();
+      support[k].assign(nsupport,0);
+      block_values[k].assign(nsupport,0.0);
+      block_derivs[k].assign(nsupport,0.0);
+      block_size *= nsupport;
+    }
+    block_coeffs.assign(block_size,0.0);
+    block_tensor.assign(block_size,0.0);
+    active_indices.assign(block_size,0);
+    reallocated = true;
+  }
+  if(reallocated) {nreallocations++;}
+}
+
+
 double LinearBasisSetExpansion::getBiasAndForces(const std::vector<double>& args_values, bool& all_inside, std::vector<double>& forces, std::vector<double>& coeffsderivs_values, std::vector<BasisFunctions*>& basisf_pntrs_in, CoeffsVector* coeffs_pntr_in, Communicator* comm_in) {
+  Workspace ws;
+  ws.setup(basisf_pntrs_in,0,1);
+  return getBiasAndForces(args_values,all_inside,forces,coeffsderivs_values,basisf_pntrs_in,coeffs_pntr_in,comm_in,ws);
+}
+
+
+double LinearBasisSetExpansion::getBiasAndForces(const std::vector<double>& args_values, bool& all_inside, std::vector<double>& forces, std::vector<double>& coeffsderivs_values, std::vector<BasisFunctions*>& basisf_pntrs_in, CoeffsVector* coeffs_pntr_in, Communicator* comm_in, Workspace& ws) {
   unsigned int nargs = args_values.size();
   plumed_assert(coeffs_pntr_in->numberOfDimensions()==nargs);
   plumed_assert(basisf_pntrs_in.size()==nargs);
   plumed_assert(forces.size()==nargs);
   plumed_assert(coeffsderivs_values.size()==coeffs_pntr_in->numberOfCoeffs());
-
-  std::vector<double> args_values_trsfrm(nargs);
-  // std::vector<bool>   inside_interval(nargs,true);
-  all_inside = true;
-  //
-  std::vector< std::vector <double> > bf_values(nargs);
-  std::vector< std::vector <double> > bf_derivs(nargs);
+  // only reallocates if the workspace has not been setup correctly
+  ws.setup(basisf_pntrs_in,ws.coeffsderivs_values.size(),ws.nthreads,ws.sparse);
   //
+  all_inside = true;
   for(unsigned int k=0; k<nargs; k++) {
-    bf_values[k].assign(basisf_pntrs_in[k]->getNumberOfBasisFunctions(),0.0);
-    bf_derivs[k].assign(basisf_pntrs_in[k]->getNumberOfBasisFunctions(),0.0);
     bool curr_inside=true;
-    basisf_pntrs_in[k]->getAllValues(args_values[k],args_values_trsfrm[k],curr_inside,bf_values[k],bf_derivs[k]);
-    // inside_interval[k]=curr_inside;
+    basisf_pntrs_in[k]->getAllValues(args_values[k],ws.args_values_trsfrm[k],curr_inside,ws.bf_values[k],ws.bf_derivs[k]);
     if(!curr_inside) {all_inside=false;}
-    forces[k]=0.0;
+  }
+  //
+  if(ws.sparse) {
+    // only the active block is contracted, it is small enough to be done in
+    // full on each rank so there is no MPI sum, the derivatives with respect to
+    // the coeffs are only set for the active block and are not touched elsewhere
+    setupActiveBlock(args_values,basisf_pntrs_in,coeffs_pntr_in,ws);
+    getTensorProduct(ws.block_values,ws.block_tensor);
+    for(size_t j=0; j<ws.active_indices.size(); j++) {
+      coeffsderivs_values[ws.active_indices[j]] = ws.block_tensor[j];
+    }
+    const size_t work_size = ws.contraction.size()/ws.nthreads;
+    contractSlabs(ws.block_coeffs.data(),ws.block_values,ws.block_derivs,ws.partials.data(),ws.contraction.data(),work_size/2,0,ws.block_values[nargs-1].size(),1);
+    for(unsigned int k=0; k<nargs; k++) {
+      forces[k] = -ws.partials[k+1];
+    }
+    return ws.partials[0];
   }
   //
   size_t stride=1;
@@ -398,31 +633,18 @@ double LinearBasisSetExpansion::getBiasAndForces(const std::vector<double>& args
     stride=comm_in->Get_size();
     rank=comm_in->Get_rank();
   }
-  // loop over coeffs
-  double bias=0.0;
-  for(size_t i=rank; i<coeffs_pntr_in->numberOfCoeffs(); i+=stride) {
-    std::vector<unsigned int> indices=coeffs_pntr_in->getIndices(i);
-    double coeff = coeffs_pntr_in->getValue(i);
-    double bf_curr=1.0;
-    for(unsigned int k=0; k<nargs; k++) {
-      bf_curr*=bf_values[k][indices[k]];
-    }
-    bias+=coeff*bf_curr;
-    coeffsderivs_values[i] = bf_curr;
-    for(unsigned int k=0; k<nargs; k++) {
-      double der = 1.0;
-      for(unsigned int l=0; l<nargs; l++) {
-        if(l!=k) {der*=bf_values[l][indices[l]];}
-        else {der*=bf_derivs[l][indices[l]];}
-      }
-      forces[k]-=coeff*der;
-      // maybe faster but dangerous
-      // forces[k]-=coeff*bf_curr*(bf_derivs[k][indices[k]]/bf_values[k][indices[k]]);
-    }
+  // the derivatives with respect to the coeffs are given by the tensor
+  // product of the 1D basis functions, this is cheap so it is done in
+  // full on each rank
+  getTensorProduct(ws.bf_values,coeffsderivs_values,ws.nthreads);
+  //
+  double bias = contractCoeffs(&(*coeffs_pntr_in)[0],ws.bf_values,ws.bf_derivs,forces,ws,rank,stride);
+  for(unsigned int k=0; k<nargs; k++) {
+    forces[k] = -forces[k];
   }
   //
   if(comm_in!=NULL) {
-    // coeffsderivs_values is not summed as the mpi Sum is done later on for the averages
+    // coeffsderivs_values is not summed as it is already complete on each rank
     comm_in->Sum(bias);
     comm_in->Sum(forces);
   }
@@ -431,41 +653,173 @@ double LinearBasisSetExpansion::getBiasAndForces(const std::vector<double>& args
 
 
 void LinearBasisSetExpansion::getBasisSetValues(const std::vector<double>& args_values, std::vector<double>& basisset_values, std::vector<BasisFunctions*>& basisf_pntrs_in, CoeffsVector* coeffs_pntr_in, Communicator* comm_in) {
+  plumed_assert(coeffs_pntr_in->numberOfDimensions()==args_values.size());
+  // the tensor product is cheap enough to be done in full on each rank
+  // so there is no need for the MPI sum, comm_in is thus not used.
+  Workspace ws;
+  ws.setup(basisf_pntrs_in,0,1);
+  getBasisSetValues(args_values,basisset_values,basisf_pntrs_in,ws);
+}
+
+
+void LinearBasisSetExpansion::getBasisSetValues(const std::vector<double>& args_values, std::vector<double>& basisset_values, std::vector<BasisFunctions*>& basisf_pntrs_in, Workspace& ws) {
   unsigned int nargs = args_values.size();
-  plumed_assert(coeffs_pntr_in->numberOfDimensions()==nargs);
   plumed_assert(basisf_pntrs_in.size()==nargs);
-
-  std::vector<double> args_values_trsfrm(nargs);
-  std::vector< std::vector <double> > bf_values;
+  ws.setup(basisf_pntrs_in,ws.coeffsderivs_values.size(),ws.nthreads,ws.sparse);
   //
   for(unsigned int k=0; k<nargs; k++) {
-    std::vector<double> tmp_val(basisf_pntrs_in[k]->getNumberOfBasisFunctions());
-    std::vector<double> tmp_der(tmp_val.size());
     bool inside=true;
-    basisf_pntrs_in[k]->getAllValues(args_values[k],args_values_trsfrm[k],inside,tmp_val,tmp_der);
-    bf_values.push_back(tmp_val);
+    basisf_pntrs_in[k]->getAllValues(args_values[k],ws.args_values_trsfrm[k],inside,ws.bf_values[k],ws.bf_derivs[k]);
   }
-  //
-  size_t stride=1;
-  size_t rank=0;
-  if(comm_in!=NULL)
-  {
-    stride=comm_in->Get_size();
-    rank=comm_in->Get_rank();
+  if(ws.sparse) {
+    setupActiveBlock(args_values,basisf_pntrs_in,NULL,ws);
+    getTensorProduct(ws.block_values,ws.block_tensor);
+    for(size_t j=0; j<ws.active_indices.size(); j++) {
+      basisset_values[ws.active_indices[j]] = ws.block_tensor[j];
+    }
+    return;
   }
-  // loop over basis set
-  for(size_t i=rank; i<coeffs_pntr_in->numberOfCoeffs(); i+=stride) {
-    std::vector<unsigned int> indices=coeffs_pntr_in->getIndices(i);
-    double bf_curr=1.0;
-    for(unsigned int k=0; k<nargs; k++) {
-      bf_curr*=bf_values[k][indices[k]];
+  getTensorProduct(ws.bf_values,basisset_values,ws.nthreads);
+}
+
+
+// we are flattening arrays using a column-major order, the first dimension
+// is thus the fastest running one
+void LinearBasisSetExpansion::getTensorProduct(const std::vector< std::vector<double> >& bf_values, std::vector<double>& tensor_values, const unsigned int nthreads) {
+  size_t size = bf_values[0].size();
+  for(size_t j=0; j<size; j++) {
+    tensor_values[j] = bf_values[0][j];
+  }
+  for(unsigned int k=1; k<bf_values.size(); k++) {
+    const size_t nk = bf_values[k].size();
+    const double* in = tensor_values.data();
+    // the first block is the input for all the other blocks so it is overwritten last
+    const unsigned int nt = getNumberOfThreads(size*nk,nthreads);
+    #pragma omp parallel for num_threads(nt) if(nt>1)
+    for(size_t m=1; m<nk; m++) {
+      const double bf = bf_values[k][m];
+      double* out = tensor_values.data()+m*size;
+      for(size_t j=0; j<size; j++) {
+        out[j] = in[j]*bf;
+      }
     }
-    basisset_values[i] = bf_curr;
+    const double bf = bf_values[k][0];
+    for(size_t j=0; j<size; j++) {
+      tensor_values[j] *= bf;
+    }
+    size *= nk;
   }
+}
+
+
+/*
+Sum-factorized contraction of the coefficients tensor with the basis functions,
+one dimension at a time. After contracting the first k dimensions we keep k+1
+tensors: one where all contracted dimensions have used the values of the basis
+functions and one for each contracted dimension where its derivatives are used.
+The MPI parallelization is done over the slabs of the last (slowest) dimension,
+the slabs of each rank are then split into contiguous blocks between the threads.
+The function returns the partial bias while gradient is set to the partial
+derivatives of the bias with respect to the arguments.
+*/
+double LinearBasisSetExpansion::contractCoeffs(const double* coeffs, const std::vector< std::vector<double> >& bf_values, const std::vector< std::vector<double> >& bf_derivs, std::vector<double>& gradient, Workspace& ws, const size_t rank, const size_t stride) {
+  const unsigned int nargs = bf_values.size();
+  const unsigned int klast = nargs-1;
+  size_t slab_size = 1;
+  for(unsigned int k=0; k<klast; k++) {slab_size *= bf_values[k].size();}
+  const size_t nslabs = bf_values[klast].size();
+  const size_t nslabs_rank = rank<nslabs ? (nslabs-rank+stride-1)/stride : 0;
   //
-  if(comm_in!=NULL) {
-    comm_in->Sum(basisset_values);
+  unsigned int nthreads = getNumberOfThreads(nslabs_rank*slab_size,ws.nthreads);
+  if(nslabs_rank>0 && nthreads>nslabs_rank) {nthreads=nslabs_rank;}
+  const size_t work_size = ws.contraction.size()/ws.nthreads;
+  const size_t npartials = nargs+1;
+  #pragma omp parallel for num_threads(nthreads) if(nthreads>1)
+  for(unsigned int t=0; t<nthreads; t++) {
+    const size_t first = rank + ((t*nslabs_rank)/nthreads)*stride;
+    const size_t last = rank + (((t+1)*nslabs_rank)/nthreads)*stride;
+    contractSlabs(coeffs,bf_values,bf_derivs,ws.partials.data()+t*npartials,ws.contraction.data()+t*work_size,work_size/2,first,last,stride);
+  }
+  // the partial sums of the threads are always added in the same order
+  double bias = 0.0;
+  for(unsigned int k=0; k<nargs; k++) {gradient[k]=0.0;}
+  for(unsigned int t=0; t<nthreads; t++) {
+    const double* partials = ws.partials.data()+t*npartials;
+    bias += partials[0];
+    for(unsigned int k=0; k<nargs; k++) {gradient[k] += partials[k+1];}
+  }
+  return bias;
+}
+
+
+// contracts the slabs first, first+stride, ... up to last (not included),
+// the bias is added to partials[0] and the gradient to partials[1..nargs]
+void LinearBasisSetExpansion::contractSlabs(const double* coeffs, const std::vector< std::vector<double> >& bf_values, const std::vector< std::vector<double> >& bf_derivs, double* partials, double* work, const size_t buffer_size, const size_t first, const size_t last, const size_t stride) {
+  const unsigned int nargs = bf_values.size();
+  const unsigned int klast = nargs-1;
+  size_t slab_size = 1;
+  for(unsigned int k=0; k<klast; k++) {slab_size *= bf_values[k].size();}
+  //
+  double* gradient = partials+1;
+  for(unsigned int k=0; k<nargs; k++) {gradient[k]=0.0;}
+  double bias = 0.0;
+  for(size_t m=first; m<last; m+=stride) {
+    const double* in = coeffs + m*slab_size;
+    size_t insize = slab_size;
+    for(unsigned int k=0; k<klast; k++) {
+      const size_t nk = bf_values[k].size();
+      const double* bfv = bf_values[k].data();
+      const double* bfd = bf_derivs[k].data();
+      const size_t outsize = insize/nk;
+      double* out = work + (k%2)*buffer_size;
+      // the values tensor gives both the new values tensor and
+      // the derivatives tensor for the k-th dimension
+      for(size_t r=0; r<outsize; r++) {
+        const double* row = in + r*nk;
+        double sv = 0.0;
+        double sd = 0.0;
+        for(size_t i=0; i<nk; i++) {
+          sv += bfv[i]*row[i];
+          sd += bfd[i]*row[i];
+        }
+        out[r] = sv;
+        out[(k+1)*outsize+r] = sd;
+      }
+      // the derivatives tensors for the previous dimensions
+      for(unsigned int t=1; t<=k; t++) {
+        const double* tin = in + t*insize;
+        double* tout = out + t*outsize;
+        for(size_t r=0; r<outsize; r++) {
+          const double* row = tin + r*nk;
+          double sv = 0.0;
+          for(size_t i=0; i<nk; i++) {
+            sv += bfv[i]*row[i];
+          }
+          tout[r] = sv;
+        }
+      }
+      in = out;
+      insize = outsize;
+    }
+    // in now holds nargs scalars
+    const double bfv = bf_values[klast][m];
+    bias += bfv*in[0];
+    gradient[klast] += bf_derivs[klast][m]*in[0];
+    for(unsigned int k=0; k<klast; k++) {
+      gradient[k] += bfv*in[k+1];
+    }
   }
+  partials[0] = bias;
+}
+
+
+unsigned int LinearBasisSetExpansion::getNumberOfThreads(const size_t nwork, const unsigned int nthreads_max) {
+  // the minimum number of coefficients for each thread
+  const size_t min_work_per_thread = 4096;
+  size_t nthreads = nwork/min_work_per_thread;
+  if(nthreads>nthreads_max) {nthreads=nthreads_max;}
+  if(nthreads<1) {nthreads=1;}
+  return nthreads;
 }
 
 
@@ -494,6 +848,47 @@ double LinearBasisSetExpansion::getBasisSetValue(const std::vector<double>& args
 }
 
 
+// the active block is the tensor product of the supports of the basis sets,
+// it is flattened in the same column-major order as the full coefficients
+void LinearBasisSetExpansion::setupActiveBlock(const std::vector<double>& args_values, std::vector<BasisFunctions*>& basisf_pntrs_in, const CoeffsVector* coeffs_pntr_in, Workspace& ws) {
+  const unsigned int nargs = args_values.size();
+  for(unsigned int k=0; k<nargs; k++) {
+    basisf_pntrs_in[k]->getSupport(args_values[k],ws.support[k]);
+    for(size_t j=0; j<ws.support[k].size(); j++) {
+      ws.block_values[k][j] = ws.bf_values[k][ws.support[k][j]];
+      ws.block_derivs[k][j] = ws.bf_derivs[k][ws.support[k][j]];
+    }
+  }
+  // odometer over the block, the first dimension is the fastest running one
+  std::vector<unsigned int>& counters = ws.block_counters;
+  std::fill(counters.begin(),counters.end(),0);
+  for(size_t j=0; j<ws.active_indices.size(); j++) {
+    size_t index = 0;
+    for(unsigned int k=0; k<nargs; k++) {index += ws.support[k][counters[k]]*ws.block_strides[k];}
+    ws.active_indices[j] = index;
+    if(coeffs_pntr_in!=NULL) {ws.block_coeffs[j] = (*coeffs_pntr_in)[index];}
+    for(unsigned int k=0; k<nargs; k++) {
+      if(++counters[k]<ws.support[k].size()) {break;}
+      counters[k] = 0;
+    }
+  }
+}
+
+
+size_t LinearBasisSetExpansion::getContractionBufferSize(const std::vector<BasisFunctions*>& basisf_pntrs_in) {
+  const unsigned int klast = basisf_pntrs_in.size()-1;
+  size_t rsize = 1;
+  for(unsigned int k=0; k<klast; k++) {rsize *= basisf_pntrs_in[k]->getNumberOfBasisFunctions();}
+  // after contracting the k-th dimension we have k+2 tensors
+  size_t buffer_size = 0;
+  for(unsigned int k=0; k<klast; k++) {
+    rsize /= basisf_pntrs_in[k]->getNumberOfBasisFunctions();
+    if((k+2)*rsize>buffer_size) {buffer_size=(k+2)*rsize;}
+  }
+  return 2*buffer_size;
+}
+
+
 void LinearBasisSetExpansion::setupUniformTargetDistribution() {
   std::vector< std::vector <double> > bf_integrals(0);
   std::vector<double> targetdist_averages(ncoeffs_,0.0);
@@ -502,14 +897,7 @@ void LinearBasisSetExpansion::setupUniformTargetDistribution() {
     bf_integrals.push_back(basisf_pntrs_[k]->getUniformIntegrals());
   }
   //
-  for(size_t i=0; i<ncoeffs_; i++) {
-    std::vector<unsigned int> indices=bias_coeffs_pntr_->getIndices(i);
-    double value = 1.0;
-    for(unsigned int k=0; k<nargs_; k++) {
-      value*=bf_integrals[k][indices[k]];
-    }
-    targetdist_averages[i]=value;
-  }
+  getTensorProduct(bf_integrals,targetdist_averages,workspace_.nthreads);
   TargetDistAverages() = targetdist_averages;
 }
 
@@ -568,26 +956,88 @@ void LinearBasisSetExpansion::restartTargetDistribution() {
 }
 
 
+void LinearBasisSetExpansion::restartTargetDistribution(const std::vector<double>& targetdist_values, const std::vector<double>& targetdist_averages) {
+  plumed_massert(targetdist_pntr_!=NULL,"the target distribution hasn't been setup!");
+  // the averages are taken as they are given so they do not need to be recalculated from the grid
+  targetdist_pntr_->restartTargetDistGrid(targetdist_values);
+  if(biasCutoffActive()) {
+    targetdist_pntr_->clearLogTargetDistGrid();
+    updateBiasWithoutCutoffGrid();
+  }
+  targetdist_averages_pntr_->setValues(targetdist_averages);
+}
+
+
+/*
+The averages are the integrals of the target distribution times each basis function.
+The integration weights are a product of one dimensional weights, so they are folded
+into the one dimensional basis tables and the integral is done as a sequence of
+contractions over one grid dimension at a time. The MPI parallelization is done over
+contiguous slabs of the last grid dimension.
+*/
 void LinearBasisSetExpansion::calculateTargetDistAveragesFromGrid(const Grid* targetdist_grid_pntr) {
   plumed_assert(targetdist_grid_pntr!=NULL);
-  std::vector<double> targetdist_averages(ncoeffs_,0.0);
-  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(targetdist_grid_pntr);
-  Grid::index_t stride=mycomm_.Get_size();
-  Grid::index_t rank=mycomm_.Get_rank();
-  for(Grid::index_t l=rank; l<targetdist_grid_pntr->getSize(); l+=stride) {
-    std::vector<double> args_values = targetdist_grid_pntr->getPoint(l);
-    std::vector<double> basisset_values(ncoeffs_);
-    // parallelization done over the grid -> should NOT use parallel in getBasisSetValues!!
-    getBasisSetValues(args_values,basisset_values,false);
-    double weight = integration_weights[l]*targetdist_grid_pntr->getValue(l);
-    for(unsigned int i=0; i<ncoeffs_; i++) {
-      targetdist_averages[i] += weight*basisset_values[i];
+  const GridBasisTable& table = getGridBasisTable(targetdist_grid_pntr);
+  const std::vector< std::vector<double> > integration_weights = GridIntegrationWeights::getIntegrationWeightsPerDimension(targetdist_grid_pntr);
+  const std::vector<unsigned int> nbins = targetdist_grid_pntr->getNbin();
+  const Grid::index_t size = targetdist_grid_pntr->getSize();
+  //
+  const unsigned int klast = nargs_-1;
+  const size_t stride = mycomm_.Get_size();
+  const size_t rank = mycomm_.Get_rank();
+  const size_t first = (rank*nbins[klast])/stride;
+  const size_t last = ((rank+1)*nbins[klast])/stride;
+  const Grid::index_t offset = (size/nbins[klast])*first;
+  const Grid::index_t nlocal = (size/nbins[klast])*(last-first);
+  std::vector<double> projected(nlocal);
+  for(Grid::index_t l=0; l<nlocal; l++) {
+    projected[l] = targetdist_grid_pntr->getValue(offset+l);
+  }
+  std::vector<double> tmp;
+  std::vector<double> weighted_table;
+  size_t nbefore = 1;
+  for(unsigned int k=0; k<nargs_; k++) {
+    const size_t row_first = k==klast ? first : 0;
+    const size_t row_last = k==klast ? last : nbins[k];
+    size_t nafter = k==klast ? 1 : last-first;
+    for(unsigned int t=k+1; t<klast; t++) {nafter *= nbins[t];}
+    weighted_table = table.values[k];
+    for(size_t g=0; g<nbins[k]; g++) {
+      for(size_t n=0; n<nbasisf_[k]; n++) {weighted_table[g*nbasisf_[k]+n] *= integration_weights[k][g];}
     }
+    projectOntoTable(projected.data(),tmp,weighted_table,nbefore,nbasisf_[k],row_first,row_last,nafter);
+    projected.swap(tmp);
+    nbefore *= nbasisf_[k];
   }
-  mycomm_.Sum(targetdist_averages);
+  mycomm_.Sum(projected);
   // the overall constant;
-  targetdist_averages[0] = getBasisSetConstant();
-  TargetDistAverages() = targetdist_averages;
+  projected[0] = getBasisSetConstant();
+  TargetDistAverages() = projected;
+}
+
+
+/*
+Projects one grid dimension of the tensor in, of shape (nbefore,last-first,nafter), onto the
+basis functions using the rows first to last of the table, of shape (nrows,nbasis). The
+result is of shape (nbefore,nbasis,nafter). This is the transpose of contractWithTable.
+*/
+void LinearBasisSetExpansion::projectOntoTable(const double* in, std::vector<double>& out, const std::vector<double>& table, const size_t nbefore, const size_t nbasis, const size_t first, const size_t last, const size_t nafter) {
+  const size_t nrows = last-first;
+  out.assign(nbefore*nbasis*nafter,0.0);
+  const unsigned int nthreads = getNumberOfThreads(out.size()*nrows,OpenMP::getNumThreads());
+  #pragma omp parallel for num_threads(nthreads) if(nthreads>1)
+  for(size_t r=0; r<nbasis*nafter; r++) {
+    const size_t n = r%nbasis;
+    const size_t j = r/nbasis;
+    double* out_row = out.data()+r*nbefore;
+    for(size_t g=0; g<nrows; g++) {
+      const double t = table[(first+g)*nbasis+n];
+      const double* in_row = in+(g+nrows*j)*nbefore;
+      for(size_t i=0; i<nbefore; i++) {
+        out_row[i] += t*in_row[i];
+      }
+    }
+  }
 }
 
 
@@ -605,6 +1055,70 @@ void LinearBasisSetExpansion::setBiasMaximumToZero() {
 }
 
 
+void LinearBasisSetExpansion::setupBiasInterpolationGrid(const std::vector<unsigned int>& grid_bins_in) {
+  plumed_massert(grid_bins_in.size()==nargs_,"the number of grid bins given doesn't match the number of arguments");
+  plumed_massert(!biasCutoffActive(),"the interpolation of the bias cannot be used with the bias cutoff");
+  if(bias_interpolation_grid_pntr_!=NULL) {return;}
+  std::vector<unsigned int> grid_bins_tmp = grid_bins_;
+  grid_bins_ = grid_bins_in;
+  bias_interpolation_grid_pntr_ = setupGeneralGrid("bias_interpolation",true,true);
+  grid_bins_ = grid_bins_tmp;
+}
+
+
+/*
+Tabulates the bias and its derivatives on the interpolation grid, note that
+the derivatives are stored on the grid, not the forces, as needed by the spline.
+*/
+void LinearBasisSetExpansion::updateBiasInterpolationGrid() {
+  plumed_massert(bias_interpolation_grid_pntr_!=NULL,"the bias interpolation grid is not defined");
+  std::vector<double> bias_values;
+  std::vector<double> forces_values;
+  calculateBiasOnGrid(bias_interpolation_grid_pntr_,bias_values,forces_values,false);
+  std::vector<double> derivs(nargs_);
+  for(Grid::index_t l=0; l<bias_interpolation_grid_pntr_->getSize(); l++) {
+    for(unsigned int k=0; k<nargs_; k++) {
+      derivs[k] = -forces_values[l*nargs_+k];
+    }
+    bias_interpolation_grid_pntr_->setValueAndDerivatives(l,bias_values[l],derivs);
+  }
+  iteration_of_last_biasinterpolationgrid_update = BiasCoeffs().getIterationCounter();
+}
+
+
+bool LinearBasisSetExpansion::biasInterpolationGridOutdated() const {
+  return iteration_of_last_biasinterpolationgrid_update != static_cast<long int>(BiasCoeffs().getIterationCounter());
+}
+
+
+/*
+Same as getBiasAndForces but the bias and the forces are interpolated from the
+interpolation grid. As for the expansion, arguments outside the intervals of the
+basis functions are taken at the boundary and give zero forces.
+*/
+double LinearBasisSetExpansion::getBiasAndForcesFromInterpolationGrid(const std::vector<double>& args_values, bool& all_inside, std::vector<double>& forces) {
+  plumed_dbg_massert(bias_interpolation_grid_pntr_!=NULL,"the bias interpolation grid is not defined");
+  std::vector<double>& args_grid = workspace_.args_values_trsfrm;
+  std::vector<bool>& args_inside = workspace_.args_inside;
+  all_inside = true;
+  for(unsigned int k=0; k<nargs_; k++) {
+    bool curr_inside=true;
+    args_grid[k] = basisf_pntrs_[k]->checkIfArgumentInsideInterval(args_values[k],curr_inside);
+    args_inside[k] = curr_inside;
+    if(!curr_inside) {all_inside=false;}
+    // the upper boundary is the same grid point as the lower one for periodic grids
+    if(basisf_pntrs_[k]->arePeriodic() && args_grid[k]>=basisf_pntrs_[k]->intervalMax()) {
+      args_grid[k] = basisf_pntrs_[k]->intervalMin();
+    }
+  }
+  double bias = bias_interpolation_grid_pntr_->getValueAndDerivatives(args_grid,forces);
+  for(unsigned int k=0; k<nargs_; k++) {
+    forces[k] = args_inside[k] ? -forces[k] : 0.0;
+  }
+  return bias;
+}
+
+
 bool LinearBasisSetExpansion::biasCutoffActive() const {
   if(vesbias_pntr_!=NULL) {return vesbias_pntr_->biasCutoffActive();}
   else {return false;}
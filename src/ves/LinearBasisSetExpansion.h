@@ -46,6 +46,44 @@ class VesBias;
 
 class LinearBasisSetExpansion {
   LinearBasisSetExpansion& operator=(const LinearBasisSetExpansion&) = delete;
+public:
+  // values and derivatives of the basis functions at the grid coordinates
+  // of each dimension of a grid, stored as (grid coordinate, basis function)
+  struct GridBasisTable {
+    const Grid* grid_pntr;
+    std::vector< std::vector<double> > values;
+    std::vector< std::vector<double> > derivs;
+  };
+  // scratch buffers that are sized once and reused for every evaluation
+  // such that the per-step evaluation does not allocate any memory
+  struct Workspace {
+    std::vector<double> args_values_trsfrm;
+    std::vector<bool> args_inside;
+    std::vector< std::vector<double> > bf_values;
+    std::vector< std::vector<double> > bf_derivs;
+    // one contraction buffer and one set of partial sums for each thread
+    std::vector<double> contraction;
+    std::vector<double> partials;
+    std::vector<double> forces;
+    std::vector<double> coeffsderivs_values;
+    // if only the block of coefficients whose basis functions can be non-zero
+    // is evaluated, used when some of the basis sets have compact support
+    bool sparse;
+    std::vector< std::vector<unsigned int> > support;
+    std::vector< std::vector<double> > block_values;
+    std::vector< std::vector<double> > block_derivs;
+    std::vector<double> block_coeffs;
+    std::vector<double> block_tensor;
+    std::vector<size_t> active_indices;
+    std::vector<unsigned int> block_counters;
+    std::vector<size_t> block_strides;
+    // maximum number of threads used for one evaluation
+    unsigned int nthreads;
+    // number of times a buffer had to be (re)allocated after the setup
+    unsigned long int nreallocations;
+    Workspace(): sparse(false), nthreads(1), nreallocations(0) {}
+    void setup(const std::vector<BasisFunctions*>&, const size_t, const unsigned int, const bool sparse_in=false);
+  };
 private:
   std::string label_;
   //
@@ -76,14 +114,20 @@ private:
   long int step_of_last_biasgrid_update;
   long int step_of_last_biaswithoutcutoffgrid_update;
   long int step_of_last_fesgrid_update;
+  long int iteration_of_last_biasinterpolationgrid_update;
   //
   Grid* bias_grid_pntr_;
   Grid* bias_withoutcutoff_grid_pntr_;
   Grid* fes_grid_pntr_;
   Grid* log_targetdist_grid_pntr_;
   Grid* targetdist_grid_pntr_;
+  // spline grid with the bias and its derivatives that is used during MD instead of the expansion
+  Grid* bias_interpolation_grid_pntr_;
   //
   TargetDistribution* targetdist_pntr_;
+  //
+  Workspace workspace_;
+  std::vector<GridBasisTable> grid_basis_tables_;
 public:
   static void registerKeywords( Keywords& keys );
   // Constructor
@@ -105,6 +149,10 @@ public:
   std::vector<BasisFunctions*> getPntrsToBasisFunctions() const {return basisf_pntrs_;}
   CoeffsVector* getPntrToBiasCoeffs() const {return bias_coeffs_pntr_;}
   Grid* getPntrToBiasGrid() const {return bias_grid_pntr_;};
+  Grid* getPntrToBiasWithoutCutoffGrid() const {return bias_withoutcutoff_grid_pntr_;};
+  Grid* getPntrToFesGrid() const {return fes_grid_pntr_;};
+  Grid* getPntrToTargetDistGrid() const {return targetdist_grid_pntr_;};
+  Grid* getPntrToLogTargetDistGrid() const {return log_targetdist_grid_pntr_;};
   //
   unsigned int getNumberOfArguments() const {return nargs_;};
   std::vector<unsigned int> getNumberOfBasisFunctions() const {return nbasisf_;};
@@ -120,16 +168,26 @@ public:
   void linkAction(Action*);
   // calculate bias and derivatives
   static double getBiasAndForces(const std::vector<double>&, bool&, std::vector<double>&, std::vector<double>&, std::vector<BasisFunctions*>&, CoeffsVector*, Communicator* comm_in=NULL);
+  static double getBiasAndForces(const std::vector<double>&, bool&, std::vector<double>&, std::vector<double>&, std::vector<BasisFunctions*>&, CoeffsVector*, Communicator*, Workspace&);
   double getBiasAndForces(const std::vector<double>&, bool&, std::vector<double>&, std::vector<double>&);
   double getBiasAndForces(const std::vector<double>&, bool&, std::vector<double>&);
   double getBias(const std::vector<double>&, bool&, const bool parallel=true);
   //
   static void getBasisSetValues(const std::vector<double>&, std::vector<double>&, std::vector<BasisFunctions*>&, CoeffsVector*, Communicator* comm_in=NULL);
+  static void getBasisSetValues(const std::vector<double>&, std::vector<double>&, std::vector<BasisFunctions*>&, Workspace&);
   void getBasisSetValues(const std::vector<double>&, std::vector<double>&, const bool parallel=true);
   //
   static double getBasisSetValue(const std::vector<double>&, const size_t, std::vector<BasisFunctions*>&, CoeffsVector*);
   double getBasisSetValue(const std::vector<double>&, const size_t);
   double getBasisSetConstant();
+  // number of times the work buffers had to be reallocated after the setup, should stay zero
+  unsigned long int getWorkspaceReallocationCounter() const {return workspace_.nreallocations;}
+  // if only the coefficients of the basis functions that can be non-zero are evaluated,
+  // the other entries of the coefficient derivatives are then not touched
+  bool sparseEvaluation() const {return workspace_.sparse;}
+  size_t getNumberOfActiveCoeffs() const {return workspace_.active_indices.size();}
+  // indices of the coefficients evaluated in the last call to getBiasAndForces or getBasisSetValues
+  const std::vector<size_t>& getActiveCoeffsIndices() const {return workspace_.active_indices;}
   // Bias grid and output stuff
   void setupBiasGrid(const bool usederiv=false);
   void updateBiasGrid();
@@ -147,6 +205,11 @@ public:
   void setBiasMinimumToZero();
   void setBiasMaximumToZero();
   //
+  void setupBiasInterpolationGrid(const std::vector<unsigned int>&);
+  void updateBiasInterpolationGrid();
+  bool biasInterpolationGridOutdated() const;
+  double getBiasAndForcesFromInterpolationGrid(const std::vector<double>&, bool&, std::vector<double>&);
+  //
   void setupFesGrid();
   void updateFesGrid();
   void resetStepOfLastFesGridUpdate() {step_of_last_fesgrid_update = -1000;}
@@ -177,6 +240,7 @@ public:
   //
   void readInRestartTargetDistribution(const std::string&);
   void restartTargetDistribution();
+  void restartTargetDistribution(const std::vector<double>&, const std::vector<double>&);
   //
   bool biasCutoffActive() const;
   //
@@ -184,7 +248,22 @@ public:
   //
 private:
   //
-  Grid* setupGeneralGrid(const std::string&, const bool usederiv=false);
+  Grid* setupGeneralGrid(const std::string&, const bool usederiv=false, const bool use_spline=false);
+  // sum-factorized evaluation of the expansion
+  static void getTensorProduct(const std::vector< std::vector<double> >&, std::vector<double>&, const unsigned int nthreads=1);
+  static double contractCoeffs(const double*, const std::vector< std::vector<double> >&, const std::vector< std::vector<double> >&, std::vector<double>&, Workspace&, const size_t, const size_t);
+  static void contractSlabs(const double*, const std::vector< std::vector<double> >&, const std::vector< std::vector<double> >&, double*, double*, const size_t, const size_t, const size_t, const size_t);
+  static size_t getContractionBufferSize(const std::vector<BasisFunctions*>&);
+  // gather the basis functions and coefficients of the active block
+  static void setupActiveBlock(const std::vector<double>&, std::vector<BasisFunctions*>&, const CoeffsVector*, Workspace&);
+  // number of threads such that each thread gets enough work to make up for the overhead
+  static unsigned int getNumberOfThreads(const size_t, const unsigned int);
+  // number of threads for the loops over the grid points
+  unsigned int getNumberOfGridThreads() const;
+  void calculateBiasOnGrid(const Grid*, std::vector<double>&, std::vector<double>&, const bool);
+  const GridBasisTable& getGridBasisTable(const Grid*);
+  static void contractWithTable(const double*, std::vector<double>&, const std::vector<double>&, const size_t, const size_t, const size_t, const size_t, const size_t);
+  static void projectOntoTable(const double*, std::vector<double>&, const std::vector<double>&, const size_t, const size_t, const size_t, const size_t, const size_t);
   //
   void calculateTargetDistAveragesFromGrid(const Grid*);
   //
@@ -194,38 +273,31 @@ private:
 
 inline
 double LinearBasisSetExpansion::getBiasAndForces(const std::vector<double>& args_values, bool& all_inside, std::vector<double>& forces, std::vector<double>& coeffsderivs_values) {
-  return getBiasAndForces(args_values,all_inside,forces,coeffsderivs_values,basisf_pntrs_, bias_coeffs_pntr_, &mycomm_);
+  return getBiasAndForces(args_values,all_inside,forces,coeffsderivs_values,basisf_pntrs_, bias_coeffs_pntr_, &mycomm_, workspace_);
 }
 
 
 inline
 double LinearBasisSetExpansion::getBiasAndForces(const std::vector<double>& args_values, bool& all_inside, std::vector<double>& forces) {
-  std::vector<double> coeffsderivs_values_dummy(ncoeffs_);
-  return getBiasAndForces(args_values,all_inside,forces,coeffsderivs_values_dummy,basisf_pntrs_, bias_coeffs_pntr_, &mycomm_);
+  return getBiasAndForces(args_values,all_inside,forces,workspace_.coeffsderivs_values,basisf_pntrs_, bias_coeffs_pntr_, &mycomm_, workspace_);
 }
 
 
 inline
 double LinearBasisSetExpansion::getBias(const std::vector<double>& args_values, bool& all_inside, const bool parallel) {
-  std::vector<double> forces_dummy(nargs_);
-  std::vector<double> coeffsderivs_values_dummy(ncoeffs_);
   if(parallel) {
-    return getBiasAndForces(args_values,all_inside,forces_dummy,coeffsderivs_values_dummy,basisf_pntrs_, bias_coeffs_pntr_, &mycomm_);
+    return getBiasAndForces(args_values,all_inside,workspace_.forces,workspace_.coeffsderivs_values,basisf_pntrs_, bias_coeffs_pntr_, &mycomm_, workspace_);
   }
   else {
-    return getBiasAndForces(args_values,all_inside,forces_dummy,coeffsderivs_values_dummy,basisf_pntrs_, bias_coeffs_pntr_, NULL);
+    return getBiasAndForces(args_values,all_inside,workspace_.forces,workspace_.coeffsderivs_values,basisf_pntrs_, bias_coeffs_pntr_, NULL, workspace_);
   }
 }
 
 
 inline
 void LinearBasisSetExpansion::getBasisSetValues(const std::vector<double>& args_values, std::vector<double>& basisset_values, const bool parallel) {
-  if(parallel) {
-    getBasisSetValues(args_values,basisset_values,basisf_pntrs_, bias_coeffs_pntr_, &mycomm_);
-  }
-  else {
-    getBasisSetValues(args_values,basisset_values,basisf_pntrs_, bias_coeffs_pntr_, NULL);
-  }
+  // the tensor product is done in full on each rank so parallel is not needed
+  getBasisSetValues(args_values,basisset_values,basisf_pntrs_,workspace_);
 }
 
 
@@ -0,0 +1,360 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+
+#include "Optimizer.h"
+#include "CoeffsVector.h"
+#include "VesCheckpoint.h"
+
+#include "core/ActionRegister.h"
+#include "core/PlumedMain.h"
+#include "tools/File.h"
+
+#include <cmath>
+
+
+namespace PLMD {
+namespace ves {
+
+//+PLUMEDOC VES_OPTIMIZER OPT_ADAM
+/*
+Adaptive moment estimation (Adam) stochastic gradient decent.
+
+This optimizer updates the coefficients with the Adam algorithm
+(Kingma and Ba, arXiv:1412.6980) where each coefficient gets its own
+step size that is adapted from exponentially decaying averages of the
+gradient and of the squared gradient,
+\f[
+\begin{aligned}
+m_{i}^{(n)} &= \beta_1 m_{i}^{(n-1)} + (1-\beta_1) g_{i}^{(n)} \\
+v_{i}^{(n)} &= \beta_2 v_{i}^{(n-1)} + (1-\beta_2) \left[g_{i}^{(n)}\right]^2 \\
+\alpha_{i}^{(n)} &= \alpha_{i}^{(n-1)} - \mu \frac{m_{i}^{(n)}/(1-\beta_1^n)}{\sqrt{v_{i}^{(n)}/(1-\beta_2^n)}+\epsilon},
+\end{aligned}
+\f]
+where \f$g_{i}^{(n)}\f$ is the gradient of the coefficient \f$\alpha_{i}\f$ at
+iteration \f$n\f$ and \f$\mu\f$ is the fixed step size given by the STEPSIZE keyword.
+The decay rates \f$\beta_1\f$ and \f$\beta_2\f$ are given with the BETA1 and BETA2 keywords.
+As the step of each coefficient is normalized by the magnitude of its gradient, the
+step size is roughly the largest change of a coefficient in one iteration and
+the convergence does not depend on the scale of the different basis functions.
+No Hessian is needed and the memory is linear in the number of coefficients.
+
+By using the AMSGRAD flag the AMSGrad variant (Reddi, Kale, and Kumar, ICLR 2018)
+is used where the maximum of the second moment over all previous iterations is used
+for the normalization, such that the step of a coefficient can not grow due to a
+few iterations with small gradients.
+
+As for \ref OPT_STEEPEST_DECENT the bias acting on the system depends on the instantaneous
+coefficients, while the average of the coefficients over all iterations is also given in the
+coefficients file.
+
+The moments are needed to restart the optimization and are written to the file given
+by the MOMENTS_FILE keyword at the same time as the coefficients are written out. If
+the optimization is restarted without this file the moments start again from zero.
+
+The optimizer supports multiple walkers (MULTIPLE_WALKERS flag) and mask files (MASK_FILE keyword)
+in the same way as \ref OPT_AVERAGED_SGD.
+
+\par Examples
+
+In the following input the coefficients are updated every 1000 MD steps with the Adam
+algorithm using a step size of 0.1.
+\plumedfile
+phi:   TORSION ATOMS=5,7,9,15
+
+bf1: BF_FOURIER ORDER=5 MINIMUM=-pi MAXIMUM=pi
+
+VES_LINEAR_EXPANSION ...
+ ARG=phi
+ BASIS_FUNCTIONS=bf1
+ LABEL=ves1
+ TEMP=300.0
+ GRID_BINS=100
+... VES_LINEAR_EXPANSION
+
+OPT_ADAM ...
+  BIAS=ves1
+  STRIDE=1000
+  LABEL=o1
+  STEPSIZE=0.1
+  COEFFS_FILE=coefficients.data
+  COEFFS_OUTPUT=50
+  MOMENTS_FILE=moments.data
+  FES_OUTPUT=500
+  BIAS_OUTPUT=500
+... OPT_ADAM
+\endplumedfile
+
+*/
+//+ENDPLUMEDOC
+
+class Opt_Adam : public Optimizer {
+private:
+  double beta1_;
+  double beta2_;
+  double epsilon_;
+  bool amsgrad_;
+  // iteration at which the moments were last set to zero
+  unsigned int moments_start_iteration_;
+  std::vector<CoeffsVector*> first_moment_pntrs_;
+  std::vector<CoeffsVector*> second_moment_pntrs_;
+  std::vector<CoeffsVector*> max_second_moment_pntrs_;
+  std::vector<OFile*> momentsOFiles_;
+private:
+  CoeffsVector& FirstMoment(const unsigned int c_id) const {return *first_moment_pntrs_[c_id];}
+  CoeffsVector& SecondMoment(const unsigned int c_id) const {return *second_moment_pntrs_[c_id];}
+  CoeffsVector& MaxSecondMoment(const unsigned int c_id) const {return *max_second_moment_pntrs_[c_id];}
+  CoeffsVector* setupMomentVector(const unsigned int, const std::string&);
+  std::vector<CoeffsVector*> getMomentPntrs(const unsigned int) const;
+  bool readMomentsFromFiles(const std::vector<std::string>&);
+  void readMomentsFromCheckpoint(const VesCheckpoint&);
+  void writeStateToCheckpoint(VesCheckpoint&) const;
+public:
+  static void registerKeywords(Keywords&);
+  explicit Opt_Adam(const ActionOptions&);
+  ~Opt_Adam();
+  void coeffsUpdate(const unsigned int c_id = 0);
+};
+
+
+PLUMED_REGISTER_ACTION(Opt_Adam,"OPT_ADAM")
+
+
+void Opt_Adam::registerKeywords(Keywords& keys) {
+  Optimizer::registerKeywords(keys);
+  Optimizer::useFixedStepSizeKeywords(keys);
+  Optimizer::useMultipleWalkersKeywords(keys);
+  Optimizer::useMaskKeywords(keys);
+  Optimizer::useRestartKeywords(keys);
+  Optimizer::useMonitorAverageGradientKeywords(keys);
+  Optimizer::useDynamicTargetDistributionKeywords(keys);
+  keys.add("compulsory","BETA1","0.9","the decay rate of the exponentially decaying average of the gradient");
+  keys.add("compulsory","BETA2","0.999","the decay rate of the exponentially decaying average of the squared gradient");
+  keys.add("compulsory","EPSILON","1e-8","small number added to the normalization of the step to avoid division by zero");
+  keys.addFlag("AMSGRAD",false,"use the AMSGrad variant where the maximum of the second moment is used for the normalization");
+  keys.add("optional","MOMENTS_FILE","the name of output file for the first and second moments that are needed to restart the optimization. The moments are written out at the same time as the coefficients.");
+}
+
+
+Opt_Adam::~Opt_Adam() {
+  for(unsigned int i=0; i<first_moment_pntrs_.size(); i++) {
+    delete first_moment_pntrs_[i];
+    delete second_moment_pntrs_[i];
+  }
+  for(unsigned int i=0; i<max_second_moment_pntrs_.size(); i++) {
+    delete max_second_moment_pntrs_[i];
+  }
+  closeOFiles(momentsOFiles_);
+}
+
+
+Opt_Adam::Opt_Adam(const ActionOptions&ao):
+  PLUMED_VES_OPTIMIZER_INIT(ao),
+  beta1_(0.9),
+  beta2_(0.999),
+  epsilon_(1e-8),
+  amsgrad_(false),
+  moments_start_iteration_(0),
+  first_moment_pntrs_(0),
+  second_moment_pntrs_(0),
+  max_second_moment_pntrs_(0),
+  momentsOFiles_(0)
+{
+  parse("BETA1",beta1_);
+  parse("BETA2",beta2_);
+  if(beta1_<0.0 || beta1_>=1.0) {plumed_merror("the value given in BETA1 should be in the range [0,1)");}
+  if(beta2_<=0.0 || beta2_>=1.0) {plumed_merror("the value given in BETA2 should be in the range (0,1)");}
+  parse("EPSILON",epsilon_);
+  if(epsilon_<=0.0) {plumed_merror("the value given in EPSILON should be larger than zero");}
+  parseFlag("AMSGRAD",amsgrad_);
+  if(amsgrad_) {
+    log.printf("  AMSGrad variant of adaptive moment estimation, see and cite ");
+    log << plumed.cite("Reddi, Kale, and Kumar, International Conference on Learning Representations (2018)");
+    log.printf("\n");
+  }
+  else {
+    log.printf("  Adaptive moment estimation (Adam), see and cite ");
+    log << plumed.cite("Kingma and Ba, arXiv:1412.6980 (2014)");
+    log.printf("\n");
+  }
+  log.printf("  decay rates of the first and second moments: %f and %f\n",beta1_,beta2_);
+  log.printf("  using %e to avoid division by zero\n",epsilon_);
+  //
+  for(unsigned int i=0; i<numberOfCoeffsSets(); i++) {
+    first_moment_pntrs_.push_back(setupMomentVector(i,"first_moment"));
+    second_moment_pntrs_.push_back(setupMomentVector(i,"second_moment"));
+    if(amsgrad_) {max_second_moment_pntrs_.push_back(setupMomentVector(i,"max_second_moment"));}
+  }
+  //
+  std::vector<std::string> moments_fnames;
+  parseFilenames("MOMENTS_FILE",moments_fnames);
+  // START_OPTIMIZATION_AFRESH sets the iteration counter back to zero
+  if(getRestart() && getIterationCounter()>0) {
+    moments_start_iteration_ = getIterationCounter();
+    if(getRestartCheckpoint()!=NULL) {
+      readMomentsFromCheckpoint(*getRestartCheckpoint());
+    }
+    else if(moments_fnames.size()>0 && readMomentsFromFiles(moments_fnames)) {
+      moments_start_iteration_ = 0;
+    }
+    else {
+      log.printf("  the moments are not available for the restart, they start from zero at iteration %u\n",getIterationCounter());
+    }
+  }
+  setupOFiles(moments_fnames,momentsOFiles_,useMultipleWalkers());
+  if(moments_fnames.size()==1) {
+    log.printf("  Moments will be written out to file %s every %u iterations\n",momentsOFiles_[0]->getPath().c_str(),getCoeffsOutputStride());
+  }
+  else if(moments_fnames.size()>1) {
+    log.printf("  Moments will be written out to the following files every %u iterations:\n",getCoeffsOutputStride());
+    for(unsigned int i=0; i<momentsOFiles_.size(); i++) {
+      log.printf("   coefficient set %u: %s\n",i,momentsOFiles_[i]->getPath().c_str());
+    }
+  }
+  checkRead();
+}
+
+
+CoeffsVector* Opt_Adam::setupMomentVector(const unsigned int c_id, const std::string& name) {
+  CoeffsVector* moment_tmp = new CoeffsVector(Coeffs(c_id));
+  std::string label = Coeffs(c_id).getLabel();
+  if(label.find("coeffs")!=std::string::npos) {
+    label.replace(label.find("coeffs"), std::string("coeffs").length(), name);
+  }
+  else {
+    label += "_" + name;
+  }
+  moment_tmp->setLabels(label);
+  moment_tmp->setValues(0.0);
+  moment_tmp->turnOnIterationCounter();
+  moment_tmp->setIterationCounterAndTime(getIterationCounter(),getTime());
+  return moment_tmp;
+}
+
+
+std::vector<CoeffsVector*> Opt_Adam::getMomentPntrs(const unsigned int c_id) const {
+  std::vector<CoeffsVector*> pntrs;
+  pntrs.push_back(first_moment_pntrs_[c_id]);
+  pntrs.push_back(second_moment_pntrs_[c_id]);
+  if(amsgrad_) {pntrs.push_back(max_second_moment_pntrs_[c_id]);}
+  return pntrs;
+}
+
+
+void Opt_Adam::readMomentsFromCheckpoint(const VesCheckpoint& checkpoint) {
+  for(unsigned int i=0; i<numberOfCoeffsSets(); i++) {
+    std::vector<CoeffsVector*> pntrs = getMomentPntrs(i);
+    for(unsigned int k=0; k<pntrs.size(); k++) {
+      pntrs[k]->setValues(checkpoint.get(getCheckpointEntryName(pntrs[k]->getDataLabel(),i),pntrs[k]->numberOfCoeffs()));
+      pntrs[k]->setIterationCounterAndTime(getIterationCounter(),getTime());
+    }
+  }
+  moments_start_iteration_ = static_cast<unsigned int>(checkpoint.getScalar("moments_start_iteration"));
+  log.printf("  Read in moments from the checkpoint file\n");
+}
+
+
+void Opt_Adam::writeStateToCheckpoint(VesCheckpoint& checkpoint) const {
+  checkpoint.add("moments_start_iteration",static_cast<double>(moments_start_iteration_));
+  for(unsigned int i=0; i<numberOfCoeffsSets(); i++) {
+    std::vector<CoeffsVector*> pntrs = getMomentPntrs(i);
+    for(unsigned int k=0; k<pntrs.size(); k++) {
+      checkpoint.add(getCheckpointEntryName(pntrs[k]->getDataLabel(),i),pntrs[k]->getDataAsVector());
+    }
+  }
+}
+
+
+bool Opt_Adam::readMomentsFromFiles(const std::vector<std::string>& fnames) {
+  // the moments are read into copies and only set when all the files could
+  // be read, such that a failed restart leaves them untouched
+  std::vector<CoeffsVector> read_moments;
+  for(unsigned int i=0; i<fnames.size(); i++) {
+    std::vector<CoeffsVector*> pntrs = getMomentPntrs(i);
+    for(unsigned int k=0; k<pntrs.size(); k++) {
+      IFile ifile;
+      ifile.link(*this);
+      if(useMultipleWalkers()) {ifile.enforceSuffix("");}
+      if(!ifile.FileExist(fnames[i])) {return false;}
+      ifile.open(fnames[i]);
+      if(!ifile.FieldExist(pntrs[k]->getDataLabel())) {
+        std::string error_msg = "Problem with reading moments from file " + ifile.getPath() + ": no field with name " + pntrs[k]->getDataLabel() + "\n";
+        plumed_merror(error_msg);
+      }
+      read_moments.push_back(*pntrs[k]);
+      read_moments.back().readFromFile(ifile,false,false);
+      ifile.close();
+      // the moments should be from the same iteration as the coefficients
+      if(read_moments.back().getIterationCounter()!=getIterationCounter()) {return false;}
+    }
+  }
+  unsigned int l=0;
+  for(unsigned int i=0; i<fnames.size(); i++) {
+    std::vector<CoeffsVector*> pntrs = getMomentPntrs(i);
+    for(unsigned int k=0; k<pntrs.size(); k++, l++) {
+      pntrs[k]->setValues(read_moments[l]);
+      pntrs[k]->setIterationCounterAndTime(read_moments[l].getIterationCounter(),read_moments[l].getTimeValue());
+    }
+    log.printf("  Read in moments from file %s\n",fnames[i].c_str());
+  }
+  return true;
+}
+
+
+void Opt_Adam::coeffsUpdate(const unsigned int c_id) {
+  // getIterationCounter() gives n-1 as it is updated afterwards.
+  const double niter = static_cast<double>(getIterationCounter()+1-moments_start_iteration_);
+  const double bias_correction1 = 1.0 - std::pow(beta1_,niter);
+  const double bias_correction2 = 1.0 - std::pow(beta2_,niter);
+  const double stepsize = StepSize(c_id)/bias_correction1;
+  //
+  CoeffsVector& first_moment = FirstMoment(c_id);
+  CoeffsVector& second_moment = SecondMoment(c_id);
+  const CoeffsVector& gradient = Gradient(c_id);
+  const CoeffsVector& mask = CoeffsMask(c_id);
+  CoeffsVector& coeffs = Coeffs(c_id);
+  for(size_t i=0; i<coeffs.numberOfCoeffs(); i++) {
+    const double g = gradient(i);
+    first_moment(i) = beta1_*first_moment(i) + (1.0-beta1_)*g;
+    second_moment(i) = beta2_*second_moment(i) + (1.0-beta2_)*g*g;
+    double v = second_moment(i);
+    if(amsgrad_) {
+      if(v>MaxSecondMoment(c_id)(i)) {MaxSecondMoment(c_id)(i)=v;}
+      v = MaxSecondMoment(c_id)(i);
+    }
+    coeffs(i) += - stepsize * mask(i) * first_moment(i)/(std::sqrt(v/bias_correction2)+epsilon_);
+  }
+  //
+  double aver_decay = 1.0 / ( getIterationCounterDbl() + 1.0 );
+  AuxCoeffs(c_id) += aver_decay * ( Coeffs(c_id)-AuxCoeffs(c_id) );
+  //
+  if(momentsOFiles_.size()>0 && (getIterationCounter()+1)%getCoeffsOutputStride()==0) {
+    std::vector<CoeffsVector*> pntrs = getMomentPntrs(c_id);
+    for(unsigned int k=0; k<pntrs.size(); k++) {
+      pntrs[k]->setIterationCounterAndTime(getIterationCounter()+1,getTime());
+    }
+    writeCoeffsToFile(momentsOFiles_[c_id],pntrs);
+  }
+}
+
+
+}
+}
@@ -53,7 +53,12 @@ where \f$\mu\f$ is a fixed step size and the gradient \f$ \nabla\Omega(\bar{\bol
 \f]
 This means that the bias acting on the system depends on the averaged coefficients \f$\bar{\boldsymbol{\alpha}}^{(n)}\f$ which leads to a smooth convergence of the bias and the estimated free energy surface. Furthermore, this allows for a rather short sampling time for each iteration, for classical MD simulations typical sampling times are on the order of few ps (around 1000-4000 MD steps).
 
-Currently it is only supported to employ the diagonal part of the Hessian which is generally sufficient. Support for employing the full Hessian will be added later on.
+By default only the diagonal part of the Hessian is employed which is generally sufficient. More of the curvature
+can be included by using a banded Hessian, where the BANDED_HESSIAN keyword gives the number of off-diagonal
+elements on each side of the diagonal (with the coefficients ordered as in the coefficients file), or a
+block-diagonal Hessian, where the BLOCK_DIAGONAL_HESSIAN keyword gives the argument (counted from 1) such that
+the coefficients that only differ in the basis function of this argument are coupled. The memory and the
+cost of these Hessians scale linearly with the number of coefficients, in contrast to the full Hessian.
 
 The VES bias that is to be optimized should be specified using the
 BIAS keyword.
@@ -209,6 +214,8 @@ void Opt_BachAveragedSGD::registerKeywords(Keywords& keys) {
   Optimizer::useRestartKeywords(keys);
   Optimizer::useMonitorAverageGradientKeywords(keys);
   Optimizer::useDynamicTargetDistributionKeywords(keys);
+  keys.use("BANDED_HESSIAN");
+  keys.use("BLOCK_DIAGONAL_HESSIAN");
   keys.add("hidden","COMBINED_GRADIENT_FILE","the name of output file for the combined gradient (gradient + Hessian term)");
   keys.add("hidden","COMBINED_GRADIENT_OUTPUT","how often the combined gradient should be written to file. This parameter is given as the number of bias iterations. It is by default 100 if COMBINED_GRADIENT_FILE is specficed");
   keys.add("hidden","COMBINED_GRADIENT_FMT","specify format for combined gradient file(s) (useful for decrease the number of digits in regtests)");
@@ -220,10 +227,7 @@ Opt_BachAveragedSGD::~Opt_BachAveragedSGD() {
   for(unsigned int i=0; i<combinedgradient_pntrs_.size(); i++) {
     delete combinedgradient_pntrs_[i];
   }
-  for(unsigned int i=0; i<combinedgradientOFiles_.size(); i++) {
-    combinedgradientOFiles_[i]->close();
-    delete combinedgradientOFiles_[i];
-  }
+  closeOFiles(combinedgradientOFiles_);
 }
 
 
@@ -291,7 +295,7 @@ void Opt_BachAveragedSGD::coeffsUpdate(const unsigned int c_id) {
   if(combinedgradientOFiles_.size()>0 && (getIterationCounter()+1)%combinedgradient_wstride_==0) {
     CombinedGradient(c_id).setValues( ( Gradient(c_id) + Hessian(c_id)*(AuxCoeffs(c_id)-Coeffs(c_id)) ) );
     combinedgradient_pntrs_[c_id]->setIterationCounterAndTime(getIterationCounter()+1,getTime());
-    combinedgradient_pntrs_[c_id]->writeToFile(*combinedgradientOFiles_[c_id]);
+    writeCoeffsToFile(combinedgradientOFiles_[c_id],combinedgradient_pntrs_[c_id]);
   }
   //
   double aver_decay = getAverDecay();
@@ -92,6 +92,9 @@ void Opt_Dummy::registerKeywords(Keywords& keys) {
   Optimizer::useHessianKeywords(keys);
   Optimizer::useMonitorAverageGradientKeywords(keys);
   keys.addFlag("MONITOR_HESSIAN",false,"also monitor the Hessian");
+  keys.use("FULL_HESSIAN");
+  keys.use("BANDED_HESSIAN");
+  keys.use("BLOCK_DIAGONAL_HESSIAN");
 }
 
 
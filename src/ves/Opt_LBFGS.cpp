@@ -0,0 +1,309 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+
+#include "Optimizer.h"
+#include "CoeffsVector.h"
+#include "VesCheckpoint.h"
+
+#include "core/ActionRegister.h"
+#include "core/PlumedMain.h"
+
+#include <cmath>
+#include <deque>
+
+
+namespace PLMD {
+namespace ves {
+
+//+PLUMEDOC VES_OPTIMIZER OPT_LBFGS
+/*
+Stochastic limited-memory BFGS (L-BFGS) optimizer.
+
+This optimizer employs the quasi-Newton limited-memory BFGS algorithm
+(Nocedal, Math. Comput. 35, 773-782 (1980)) where the inverse Hessian is
+approximated from the changes of the coefficients,
+\f$\mathbf{s}^{(k)}=\boldsymbol{\alpha}^{(k+1)}-\boldsymbol{\alpha}^{(k)}\f$,
+and of the gradient,
+\f$\mathbf{y}^{(k)}=\nabla\Omega^{(k+1)}-\nabla\Omega^{(k)}\f$,
+over the last \f$m\f$ iterations. The coefficients are then updated as
+\f[
+\boldsymbol{\alpha}^{(n+1)} = \boldsymbol{\alpha}^{(n)} - \mu \mathbf{H}^{(n)} \nabla\Omega^{(n)},
+\f]
+where \f$\mathbf{H}^{(n)}\f$ is the approximate inverse Hessian, obtained with the two-loop recursion,
+and \f$\mu\f$ is the step size given by the STEPSIZE keyword. This gives curvature information
+without the need to calculate the Hessian from the covariance of the basis functions
+(as done by \ref OPT_AVERAGED_SGD) and the memory is \f$2m\f$ vectors with the size
+of the number of coefficients. The number of iterations \f$m\f$ is given by the MEMORY keyword.
+
+As the gradient is estimated from a finite sampling it is noisy and the differences of the
+gradients \f$\mathbf{y}^{(k)}\f$ can be dominated by the noise. Therefore a pair is only kept
+if it gives a positive curvature, \f$\mathbf{s}^{(k)}\cdot\mathbf{y}^{(k)}\f$ larger than
+the value given with the CURVATURE_THRESHOLD keyword times
+\f$|\mathbf{s}^{(k)}||\mathbf{y}^{(k)}|\f$. A step size smaller than 1.0 and a STRIDE that is
+long enough to sample the gradient reasonably are recommended. In the first iteration, and
+if no pair has been kept, the update is a steepest decent step with the step size \f$\mu\f$.
+A pair with a small curvature can still give a very large step, so the step is scaled down
+such that no coefficient changes by more than the value given with the MAX_STEP keyword
+(in energy units) in one iteration.
+
+As for \ref OPT_STEEPEST_DECENT the bias acting on the system depends on the instantaneous
+coefficients, while the average of the coefficients over all iterations is also given in the
+coefficients file. When the optimization is restarted the history of the changes is not available
+and is built up again over the first \f$m\f$ iterations.
+
+The optimizer supports multiple walkers (MULTIPLE_WALKERS flag) and mask files (MASK_FILE keyword)
+in the same way as \ref OPT_AVERAGED_SGD. The coefficients that are deactivated by the mask are not
+included in the curvature pairs.
+
+\par Examples
+
+In the following input the coefficients are updated every 2000 MD steps with the L-BFGS
+algorithm that uses the changes over the last 5 iterations and a step size of 0.5.
+\plumedfile
+phi:   TORSION ATOMS=5,7,9,15
+
+bf1: BF_FOURIER ORDER=5 MINIMUM=-pi MAXIMUM=pi
+
+VES_LINEAR_EXPANSION ...
+ ARG=phi
+ BASIS_FUNCTIONS=bf1
+ LABEL=ves1
+ TEMP=300.0
+ GRID_BINS=100
+... VES_LINEAR_EXPANSION
+
+OPT_LBFGS ...
+  BIAS=ves1
+  STRIDE=2000
+  LABEL=o1
+  STEPSIZE=0.5
+  MEMORY=5
+  COEFFS_FILE=coefficients.data
+  COEFFS_OUTPUT=50
+  FES_OUTPUT=500
+  BIAS_OUTPUT=500
+... OPT_LBFGS
+\endplumedfile
+
+*/
+//+ENDPLUMEDOC
+
+class Opt_LBFGS : public Optimizer {
+private:
+  unsigned int memory_;
+  double curvature_threshold_;
+  double max_step_;
+  // the last memory_ pairs of changes of the coefficients and of the gradient
+  std::vector<std::deque<std::vector<double> > > s_history_;
+  std::vector<std::deque<std::vector<double> > > y_history_;
+  std::vector<std::deque<double> > rho_history_;
+  std::vector<std::vector<double> > prev_coeffs_;
+  std::vector<std::vector<double> > prev_gradient_;
+  std::vector<bool> has_prev_;
+private:
+  void addCurvaturePair(const std::vector<double>&, const std::vector<double>&, const unsigned int);
+  void getSearchDirection(const std::vector<double>&, std::vector<double>&, const unsigned int) const;
+  void readHistoryFromCheckpoint(const VesCheckpoint&);
+  void writeStateToCheckpoint(VesCheckpoint&) const;
+public:
+  static void registerKeywords(Keywords&);
+  explicit Opt_LBFGS(const ActionOptions&);
+  void coeffsUpdate(const unsigned int c_id = 0);
+};
+
+
+PLUMED_REGISTER_ACTION(Opt_LBFGS,"OPT_LBFGS")
+
+
+void Opt_LBFGS::registerKeywords(Keywords& keys) {
+  Optimizer::registerKeywords(keys);
+  Optimizer::useFixedStepSizeKeywords(keys);
+  Optimizer::useMultipleWalkersKeywords(keys);
+  Optimizer::useMaskKeywords(keys);
+  Optimizer::useRestartKeywords(keys);
+  Optimizer::useMonitorAverageGradientKeywords(keys);
+  Optimizer::useDynamicTargetDistributionKeywords(keys);
+  keys.add("compulsory","MEMORY","10","the number of previous iterations that are used to approximate the inverse Hessian");
+  keys.add("compulsory","CURVATURE_THRESHOLD","1e-4","a pair of changes of the coefficients and of the gradient is only used if the cosine of the angle between them is larger than this value");
+  keys.add("compulsory","MAX_STEP","1.0","the largest change of a coefficient in one iteration, the step is scaled down if it is larger");
+}
+
+
+Opt_LBFGS::Opt_LBFGS(const ActionOptions&ao):
+  PLUMED_VES_OPTIMIZER_INIT(ao),
+  memory_(10),
+  curvature_threshold_(1e-4),
+  max_step_(1.0),
+  s_history_(numberOfCoeffsSets()),
+  y_history_(numberOfCoeffsSets()),
+  rho_history_(numberOfCoeffsSets()),
+  prev_coeffs_(numberOfCoeffsSets()),
+  prev_gradient_(numberOfCoeffsSets()),
+  has_prev_(numberOfCoeffsSets(),false)
+{
+  log.printf("  Limited-memory BFGS, see and cite ");
+  log << plumed.cite("Nocedal, Math. Comput. 35, 773-782 (1980)");
+  log.printf("\n");
+  parse("MEMORY",memory_);
+  if(memory_==0) {plumed_merror("the value given in MEMORY should be larger than zero");}
+  log.printf("  using the changes over the last %u iterations\n",memory_);
+  parse("CURVATURE_THRESHOLD",curvature_threshold_);
+  if(curvature_threshold_<0.0) {plumed_merror("the value given in CURVATURE_THRESHOLD should not be negative");}
+  log.printf("  the changes are only used if the cosine of the angle between them is larger than %e\n",curvature_threshold_);
+  parse("MAX_STEP",max_step_);
+  if(max_step_<=0.0) {plumed_merror("the value given in MAX_STEP should be larger than zero");}
+  log.printf("  the coefficients change by at most %f in one iteration\n",max_step_);
+  // without a checkpoint the history is built up again after a restart
+  if(getRestart() && getIterationCounter()>0 && getRestartCheckpoint()!=NULL) {
+    readHistoryFromCheckpoint(*getRestartCheckpoint());
+  }
+  checkRead();
+}
+
+
+void Opt_LBFGS::readHistoryFromCheckpoint(const VesCheckpoint& checkpoint) {
+  for(unsigned int c_id=0; c_id<numberOfCoeffsSets(); c_id++) {
+    const size_t ncoeffs = Coeffs(c_id).numberOfCoeffs();
+    const std::vector<double>& rho = checkpoint.get(getCheckpointEntryName("lbfgs_rho",c_id));
+    if(rho.size()>memory_) {plumed_merror("the checkpoint file has more changes than given in MEMORY");}
+    const std::vector<double>& s = checkpoint.get(getCheckpointEntryName("lbfgs_s",c_id),rho.size()*ncoeffs);
+    const std::vector<double>& y = checkpoint.get(getCheckpointEntryName("lbfgs_y",c_id),rho.size()*ncoeffs);
+    for(size_t k=0; k<rho.size(); k++) {
+      s_history_[c_id].push_back(std::vector<double>(s.begin()+k*ncoeffs,s.begin()+(k+1)*ncoeffs));
+      y_history_[c_id].push_back(std::vector<double>(y.begin()+k*ncoeffs,y.begin()+(k+1)*ncoeffs));
+      rho_history_[c_id].push_back(rho[k]);
+    }
+    const std::string prev_coeffs_name = getCheckpointEntryName("lbfgs_prev_coeffs",c_id);
+    if(checkpoint.has(prev_coeffs_name)) {
+      prev_coeffs_[c_id] = checkpoint.get(prev_coeffs_name,ncoeffs);
+      prev_gradient_[c_id] = checkpoint.get(getCheckpointEntryName("lbfgs_prev_gradient",c_id),ncoeffs);
+      has_prev_[c_id] = true;
+    }
+  }
+  log.printf("  Read in the changes of the coefficients and of the gradient from the checkpoint file\n");
+}
+
+
+void Opt_LBFGS::writeStateToCheckpoint(VesCheckpoint& checkpoint) const {
+  for(unsigned int c_id=0; c_id<numberOfCoeffsSets(); c_id++) {
+    std::vector<double> s;
+    std::vector<double> y;
+    for(size_t k=0; k<s_history_[c_id].size(); k++) {
+      s.insert(s.end(),s_history_[c_id][k].begin(),s_history_[c_id][k].end());
+      y.insert(y.end(),y_history_[c_id][k].begin(),y_history_[c_id][k].end());
+    }
+    checkpoint.add(getCheckpointEntryName("lbfgs_s",c_id),s);
+    checkpoint.add(getCheckpointEntryName("lbfgs_y",c_id),y);
+    checkpoint.add(getCheckpointEntryName("lbfgs_rho",c_id),std::vector<double>(rho_history_[c_id].begin(),rho_history_[c_id].end()));
+    if(has_prev_[c_id]) {
+      checkpoint.add(getCheckpointEntryName("lbfgs_prev_coeffs",c_id),prev_coeffs_[c_id]);
+      checkpoint.add(getCheckpointEntryName("lbfgs_prev_gradient",c_id),prev_gradient_[c_id]);
+    }
+  }
+}
+
+
+void Opt_LBFGS::addCurvaturePair(const std::vector<double>& coeffs, const std::vector<double>& gradient, const unsigned int c_id) {
+  const size_t ncoeffs = coeffs.size();
+  std::vector<double> s(ncoeffs);
+  std::vector<double> y(ncoeffs);
+  double sy=0.0; double ss=0.0; double yy=0.0;
+  for(size_t i=0; i<ncoeffs; i++) {
+    s[i] = coeffs[i]-prev_coeffs_[c_id][i];
+    y[i] = gradient[i]-prev_gradient_[c_id][i];
+    sy += s[i]*y[i]; ss += s[i]*s[i]; yy += y[i]*y[i];
+  }
+  if(sy<=0.0 || sy<=curvature_threshold_*std::sqrt(ss*yy)) {return;}
+  s_history_[c_id].push_back(s);
+  y_history_[c_id].push_back(y);
+  rho_history_[c_id].push_back(1.0/sy);
+  if(s_history_[c_id].size()>memory_) {
+    s_history_[c_id].pop_front();
+    y_history_[c_id].pop_front();
+    rho_history_[c_id].pop_front();
+  }
+}
+
+
+void Opt_LBFGS::getSearchDirection(const std::vector<double>& gradient, std::vector<double>& direction, const unsigned int c_id) const {
+  // two-loop recursion for the product of the inverse Hessian and the gradient
+  const std::deque<std::vector<double> >& s_hist = s_history_[c_id];
+  const std::deque<std::vector<double> >& y_hist = y_history_[c_id];
+  const std::deque<double>& rho_hist = rho_history_[c_id];
+  const size_t ncoeffs = gradient.size();
+  const size_t npairs = s_hist.size();
+  direction = gradient;
+  std::vector<double> a(npairs,0.0);
+  for(size_t k=npairs; k>0; k--) {
+    const size_t p = k-1;
+    double dot=0.0;
+    for(size_t i=0; i<ncoeffs; i++) {dot += s_hist[p][i]*direction[i];}
+    a[p] = rho_hist[p]*dot;
+    for(size_t i=0; i<ncoeffs; i++) {direction[i] -= a[p]*y_hist[p][i];}
+  }
+  // initial inverse Hessian from the most recent pair
+  double gamma = 1.0;
+  if(npairs>0) {
+    double yy=0.0;
+    for(size_t i=0; i<ncoeffs; i++) {yy += y_hist[npairs-1][i]*y_hist[npairs-1][i];}
+    gamma = 1.0/(rho_hist[npairs-1]*yy);
+  }
+  for(size_t i=0; i<ncoeffs; i++) {direction[i] *= gamma;}
+  for(size_t p=0; p<npairs; p++) {
+    double dot=0.0;
+    for(size_t i=0; i<ncoeffs; i++) {dot += y_hist[p][i]*direction[i];}
+    const double b = rho_hist[p]*dot;
+    for(size_t i=0; i<ncoeffs; i++) {direction[i] += (a[p]-b)*s_hist[p][i];}
+  }
+}
+
+
+void Opt_LBFGS::coeffsUpdate(const unsigned int c_id) {
+  // the coefficients that are deactivated by the mask do not enter the curvature pairs
+  std::vector<double> gradient = (CoeffsMask(c_id)*Gradient(c_id)).getDataAsVector();
+  std::vector<double> coeffs = Coeffs(c_id).getDataAsVector();
+  if(has_prev_[c_id]) {
+    addCurvaturePair(coeffs,gradient,c_id);
+  }
+  prev_coeffs_[c_id] = coeffs;
+  prev_gradient_[c_id] = gradient;
+  has_prev_[c_id] = true;
+  //
+  std::vector<double> direction;
+  getSearchDirection(gradient,direction,c_id);
+  double stepsize = StepSize(c_id);
+  double max_change = 0.0;
+  for(size_t i=0; i<direction.size(); i++) {
+    if(std::abs(stepsize*direction[i])>max_change) {max_change=std::abs(stepsize*direction[i]);}
+  }
+  if(max_change>max_step_) {stepsize *= max_step_/max_change;}
+  for(size_t i=0; i<coeffs.size(); i++) {
+    Coeffs(c_id)(i) += - stepsize * direction[i];
+  }
+  //
+  double aver_decay = 1.0 / ( getIterationCounterDbl() + 1.0 );
+  AuxCoeffs(c_id) += aver_decay * ( Coeffs(c_id)-AuxCoeffs(c_id) );
+}
+
+
+}
+}
@@ -21,9 +21,12 @@
 +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
 
 #include "Optimizer.h"
+#include "AsyncOutputWriter.h"
+#include "CoeffsBinaryFile.h"
 #include "CoeffsVector.h"
 #include "CoeffsMatrix.h"
 #include "VesBias.h"
+#include "VesCheckpoint.h"
 #include "VesTools.h"
 
 #include "tools/Exception.h"
@@ -33,6 +36,8 @@
 #include "tools/File.h"
 #include "tools/FileBase.h"
 
+#include <memory>
+
 namespace PLMD {
 namespace ves {
 
@@ -48,8 +53,11 @@ Optimizer::Optimizer(const ActionOptions&ao):
   iter_counter(0),
   use_hessian_(false),
   diagonal_hessian_(true),
+  hessian_bandwidth_(0),
+  hessian_block_dimension_(0),
   monitor_instantaneous_gradient_(false),
   use_mwalkers_mpi_(false),
+  mwalkers_nonblocking_(false),
   mwalkers_mpi_single_files_(true),
   dynamic_targetdists_(0),
   ustride_targetdist_(0),
@@ -58,15 +66,22 @@ Optimizer::Optimizer(const ActionOptions&ao):
   coeffs_wstride_(100),
   coeffsOFiles_(0),
   coeffs_output_fmt_(""),
+  coeffs_binary_output_(false),
   gradient_wstride_(100),
   gradientOFiles_(0),
   gradient_output_fmt_(""),
+  gradient_binary_output_(false),
   hessian_wstride_(100),
   hessianOFiles_(0),
   hessian_output_fmt_(""),
+  hessian_binary_output_(false),
   targetdist_averages_wstride_(0),
   targetdist_averagesOFiles_(0),
   targetdist_averages_output_fmt_(""),
+  targetdist_averages_binary_output_(false),
+  checkpoint_wstride_(100),
+  checkpoint_fname_(""),
+  restart_checkpoint_(NULL),
   nbiases_(0),
   bias_pntrs_(0),
   ncoeffssets_(0),
@@ -88,7 +103,9 @@ Optimizer::Optimizer(const ActionOptions&ao):
   targetdist_output_stride_(0),
   targetdist_proj_output_active_(false),
   targetdist_proj_output_stride_(0),
-  isFirstStep(true)
+  isFirstStep(true),
+  isFirstUpdate(true),
+  async_output_writer_(NULL)
 {
   std::vector<std::string> bias_labels(0);
   parseVector("BIAS",bias_labels);
@@ -194,11 +211,25 @@ Optimizer::Optimizer(const ActionOptions&ao):
   }
 
   //
+  bool full_hessian=false;
   if(keywords.exists("FULL_HESSIAN")) {
-    bool full_hessian=false;
     parseFlag("FULL_HESSIAN",full_hessian);
     diagonal_hessian_ = !full_hessian;
   }
+  if(keywords.exists("BANDED_HESSIAN")) {
+    parse("BANDED_HESSIAN",hessian_bandwidth_);
+    if(hessian_bandwidth_>0) {diagonal_hessian_=false;}
+  }
+  if(keywords.exists("BLOCK_DIAGONAL_HESSIAN")) {
+    parse("BLOCK_DIAGONAL_HESSIAN",hessian_block_dimension_);
+    if(hessian_block_dimension_>0) {diagonal_hessian_=false;}
+  }
+  if(hessian_bandwidth_>0 && hessian_block_dimension_>0) {
+    plumed_merror("BANDED_HESSIAN and BLOCK_DIAGONAL_HESSIAN cannot be used at the same time");
+  }
+  if(full_hessian && (hessian_bandwidth_>0 || hessian_block_dimension_>0)) {
+    plumed_merror("FULL_HESSIAN cannot be used together with BANDED_HESSIAN or BLOCK_DIAGONAL_HESSIAN");
+  }
   //
   bool mw_single_files = false;
   if(keywords.exists("MULTIPLE_WALKERS")) {
@@ -206,6 +237,10 @@ Optimizer::Optimizer(const ActionOptions&ao):
     if(use_mwalkers_mpi_) {
       mw_single_files=true;
     }
+    parseFlag("MULTIPLE_WALKERS_NONBLOCKING",mwalkers_nonblocking_);
+    if(mwalkers_nonblocking_ && !use_mwalkers_mpi_) {
+      plumed_merror("the MULTIPLE_WALKERS_NONBLOCKING keyword should only be used together with the MULTIPLE_WALKERS keyword");
+    }
   }
 
   int numwalkers=1;
@@ -226,6 +261,18 @@ Optimizer::Optimizer(const ActionOptions&ao):
     log.printf("   please see and cite ");
     log << plumed.cite("Raiteri, Laio, Gervasio, Micheletti, and Parrinello, J. Phys. Chem. B 110, 3533 (2006)");
     log.printf("\n");
+    if(mwalkers_nonblocking_) {
+      log.printf("   the averages are summed over the walkers with non-blocking MPI calls, the coefficients are updated with a lag of one iteration\n");
+    }
+  }
+
+  bool async_output = false;
+  parseFlag("ASYNC_OUTPUT",async_output);
+  unsigned int async_output_queue = 4;
+  parse("ASYNC_OUTPUT_QUEUE",async_output_queue);
+  if(async_output) {
+    async_output_writer_ = new AsyncOutputWriter(async_output_queue);
+    log.printf("  output files will be written asynchronously by a background thread (at most %u pending output tasks)\n",async_output_queue);
   }
 
   dynamic_targetdists_.resize(nbiases_,false);
@@ -337,6 +384,27 @@ Optimizer::Optimizer(const ActionOptions&ao):
   }
   //
 
+  if(keywords.exists("CHECKPOINT_FILE")) {
+    parse("CHECKPOINT_FILE",checkpoint_fname_);
+    parse("CHECKPOINT_OUTPUT",checkpoint_wstride_);
+    if(checkpoint_fname_.size()>0) {
+      if(checkpoint_wstride_==0) {
+        plumed_merror("the value given in CHECKPOINT_OUTPUT should be larger than zero");
+      }
+      // the walkers share a single checkpoint file when using multiple walkers
+      checkpoint_fname_ = FileBase::appendSuffix(checkpoint_fname_,use_mwalkers_mpi_ ? "" : plumed.getSuffix());
+      if(getRestart() && VesCheckpoint::isCheckpointFile(checkpoint_fname_)) {
+        restart_checkpoint_ = new VesCheckpoint();
+        restart_checkpoint_->read(checkpoint_fname_);
+        log.printf("  Restarting from checkpoint file %s\n",checkpoint_fname_.c_str());
+      }
+      else if(getRestart()) {
+        log.printf("  Checkpoint file %s not found, restarting from the coefficient files\n",checkpoint_fname_.c_str());
+      }
+      log.printf("  A checkpoint of the optimization will be written to file %s every %u iterations\n",checkpoint_fname_.c_str(),checkpoint_wstride_);
+    }
+  }
+
   std::vector<std::string> coeffs_fnames;
   if(keywords.exists("COEFFS_FILE")) {
     parseFilenames("COEFFS_FILE",coeffs_fnames,"coeffs.data");
@@ -347,7 +415,10 @@ Optimizer::Optimizer(const ActionOptions&ao):
         plumed_merror("the START_OPTIMIZATION_AFRESH keyword should only be used when a restart has been triggered by the RESTART keyword or the MD code");
       }
     }
-    if(getRestart()) {
+    if(getRestart() && restart_checkpoint_!=NULL) {
+      readCoeffsFromCheckpoint(*restart_checkpoint_);
+    }
+    else if(getRestart()) {
       for(unsigned int i=0; i<coeffs_fnames.size(); i++) {
         IFile ifile;
         ifile.link(*this);
@@ -363,6 +434,8 @@ Optimizer::Optimizer(const ActionOptions&ao):
       if(comm.Get_rank()==0 && use_mwalkers_mpi_) {
         multi_sim_comm.Barrier();
       }
+    }
+    if(getRestart()) {
       unsigned int iter_opt_tmp = coeffs_pntrs_[0]->getIterationCounter();
       for(unsigned int i=1; i<ncoeffssets_; i++) {
         plumed_massert(coeffs_pntrs_[i]->getIterationCounter()==iter_opt_tmp,"the iteraton counter should be the same for all files when restarting from previous coefficient files\n");
@@ -377,6 +450,14 @@ Optimizer::Optimizer(const ActionOptions&ao):
       else {
         setIterationCounter(coeffs_pntrs_[0]->getIterationCounter());
         log.printf("  Optimization restarted at iteration %u\n",getIterationCounter());
+        if(restart_checkpoint_!=NULL) {
+          readAveragesFromCheckpoint(*restart_checkpoint_);
+          if(mwalkers_nonblocking_) {
+            for(unsigned int i=0; i<nbiases_; i++) {
+              bias_pntrs_[i]->restartMultiWalkersSum(*restart_checkpoint_,bias_pntrs_[i]->getLabel()+".");
+            }
+          }
+        }
       }
       setAllCoeffsSetIterationCounters();
     }
@@ -391,6 +472,7 @@ Optimizer::Optimizer(const ActionOptions&ao):
     }
     setupOFiles(coeffs_fnames,coeffsOFiles_,mw_single_files);
     parse("COEFFS_FMT",coeffs_output_fmt_);
+    coeffs_binary_output_ = parseBinaryFileFormat("COEFFS_FILE_FORMAT");
     if(coeffs_output_fmt_.size()>0) {
       for(unsigned int i=0; i<ncoeffssets_; i++) {
         coeffs_pntrs_[i]->setOutputFmt(coeffs_output_fmt_);
@@ -398,7 +480,7 @@ Optimizer::Optimizer(const ActionOptions&ao):
     }
     if(!getRestart()) {
       for(unsigned int i=0; i<coeffsOFiles_.size(); i++) {
-        coeffs_pntrs_[i]->writeToFile(*coeffsOFiles_[i],aux_coeffs_pntrs_[i],false);
+        writeCoeffsToFile(coeffsOFiles_[i],coeffs_pntrs_[i],aux_coeffs_pntrs_[i],coeffs_binary_output_);
       }
     }
     if(coeffs_fnames.size()>0) {
@@ -429,6 +511,7 @@ Optimizer::Optimizer(const ActionOptions&ao):
     }
     setupOFiles(gradient_fnames,gradientOFiles_,mw_single_files);
     parse("GRADIENT_FMT",gradient_output_fmt_);
+    gradient_binary_output_ = parseBinaryFileFormat("GRADIENT_FILE_FORMAT");
     if(gradient_output_fmt_.size()>0) {
       for(unsigned int i=0; i<ncoeffssets_; i++) {
         gradient_pntrs_[i]->setOutputFmt(gradient_output_fmt_);
@@ -465,6 +548,7 @@ Optimizer::Optimizer(const ActionOptions&ao):
     }
     setupOFiles(hessian_fnames,hessianOFiles_,mw_single_files);
     parse("HESSIAN_FMT",hessian_output_fmt_);
+    hessian_binary_output_ = parseBinaryFileFormat("HESSIAN_FILE_FORMAT");
 
     if(hessian_fnames.size()>0) {
       if(ncoeffssets_==1) {
@@ -543,7 +627,10 @@ Optimizer::Optimizer(const ActionOptions&ao):
 
   if(getRestart() && ustride_targetdist_>0) {
     for(unsigned int i=0; i<nbiases_; i++) {
-      if(dynamic_targetdists_[i]) {
+      if(dynamic_targetdists_[i] && restart_checkpoint_!=NULL) {
+        bias_pntrs_[i]->restartTargetDistributions(*restart_checkpoint_,bias_pntrs_[i]->getLabel()+".");
+      }
+      else if(dynamic_targetdists_[i]) {
         bias_pntrs_[i]->restartTargetDistributions();
       }
     }
@@ -572,6 +659,7 @@ Optimizer::Optimizer(const ActionOptions&ao):
     }
     setupOFiles(targetdist_averages_fnames,targetdist_averagesOFiles_,mw_single_files);
     parse("TARGETDIST_AVERAGES_FMT",targetdist_averages_output_fmt_);
+    targetdist_averages_binary_output_ = parseBinaryFileFormat("TARGETDIST_AVERAGES_FILE_FORMAT");
     if(targetdist_averages_output_fmt_.size()>0) {
       for(unsigned int i=0; i<ncoeffssets_; i++) {
         targetdist_averages_pntrs_[i]->setOutputFmt(targetdist_averages_output_fmt_);
@@ -579,15 +667,11 @@ Optimizer::Optimizer(const ActionOptions&ao):
     }
 
     for(unsigned int i=0; i<targetdist_averagesOFiles_.size(); i++) {
-      targetdist_averages_pntrs_[i]->writeToFile(*targetdist_averagesOFiles_[i]);
+      writeCoeffsToFile(targetdist_averagesOFiles_[i],targetdist_averages_pntrs_[i],NULL,targetdist_averages_binary_output_);
     }
 
     if(targetdist_averages_wstride_==0) {
-      for(unsigned int i=0; i<targetdist_averagesOFiles_.size(); i++) {
-        targetdist_averagesOFiles_[i]->close();
-        delete targetdist_averagesOFiles_[i];
-      }
-      targetdist_averagesOFiles_.clear();
+      closeOFiles(targetdist_averagesOFiles_);
     }
 
     if(targetdist_averages_fnames.size()>0 && targetdist_averages_wstride_ > 0) {
@@ -788,26 +872,19 @@ Optimizer::~Optimizer() {
   }
   coeffs_mask_pntrs_.clear();
   //
-  for(unsigned int i=0; i<coeffsOFiles_.size(); i++) {
-    coeffsOFiles_[i]->close();
-    delete coeffsOFiles_[i];
-  }
-  coeffsOFiles_.clear();
-  for(unsigned int i=0; i<gradientOFiles_.size(); i++) {
-    gradientOFiles_[i]->close();
-    delete gradientOFiles_[i];
-  }
-  gradientOFiles_.clear();
-  for(unsigned int i=0; i<hessianOFiles_.size(); i++) {
-    hessianOFiles_[i]->close();
-    delete hessianOFiles_[i];
-  }
-  hessianOFiles_.clear();
-  for(unsigned int i=0; i<targetdist_averagesOFiles_.size(); i++) {
-    targetdist_averagesOFiles_[i]->close();
-    delete targetdist_averagesOFiles_[i];
+  closeOFiles(coeffsOFiles_);
+  closeOFiles(gradientOFiles_);
+  closeOFiles(hessianOFiles_);
+  closeOFiles(targetdist_averagesOFiles_);
+  if(restart_checkpoint_!=NULL) {
+    delete restart_checkpoint_;
+    restart_checkpoint_=NULL;
+  }
+  // waits for the pending output before the thread is stopped
+  if(async_output_writer_!=NULL) {
+    delete async_output_writer_;
+    async_output_writer_=NULL;
   }
-  targetdist_averagesOFiles_.clear();
 }
 
 
@@ -823,28 +900,38 @@ void Optimizer::registerKeywords( Keywords& keys ) {
   keys.add("compulsory","COEFFS_FILE","coeffs.data","the name of output file for the coefficients");
   keys.add("compulsory","COEFFS_OUTPUT","100","how often the coefficients should be written to file. This parameter is given as the number of iterations.");
   keys.add("optional","COEFFS_FMT","specify format for coefficient file(s) (useful for decrease the number of digits in regtests)");
+  keys.add("optional","COEFFS_FILE_FORMAT","the format of the coefficient file(s), either TEXT (default) or BINARY. Binary files are faster to write and read for a large number of coefficients, they are recognized automatically when restarting and can be converted to text by using \\ref ves_coeffs_to_text.");
   keys.add("optional","COEFFS_SET_ID_PREFIX","suffix to add to the filename given in FILE to identify the bias, should only be given if a single filename is given in FILE when optimizing multiple biases.");
   //
   keys.add("optional","INITIAL_COEFFS","the name(s) of file(s) with the initial coefficients");
+  keys.addFlag("ASYNC_OUTPUT",false,"write the output files (coefficients, gradient, Hessian, target distribution averages and the bias, FES and target distribution grids) in a background thread. The data is copied when an output is due and the MD code does not wait for the formatting and writing of the files.");
+  keys.add("optional","ASYNC_OUTPUT_QUEUE","the maximum number of output tasks that can be pending when using ASYNC_OUTPUT, if the queue is full the MD code waits for the background thread. By default 4.");
   // Hidden keywords to output the gradient to a file.
   keys.add("hidden","GRADIENT_FILE","the name of output file for the gradient");
   keys.add("hidden","GRADIENT_OUTPUT","how often the gradient should be written to file. This parameter is given as the number of bias iterations. It is by default 100 if GRADIENT_FILE is specficed");
   keys.add("hidden","GRADIENT_FMT","specify format for gradient file(s) (useful for decrease the number of digits in regtests)");
+  keys.add("hidden","GRADIENT_FILE_FORMAT","the format of the gradient file(s), either TEXT (default) or BINARY");
   // Either use a fixed stepsize (useFixedStepSizeKeywords) or changing stepsize (useDynamicsStepSizeKeywords)
   keys.reserve("compulsory","STEPSIZE","the step size used for the optimization");
   keys.reserve("compulsory","INITIAL_STEPSIZE","the initial step size used for the optimization");
   // Keywords related to the Hessian, actived with the useHessianKeywords function
   keys.reserveFlag("FULL_HESSIAN",false,"if the full Hessian matrix should be used for the optimization, otherwise only the diagonal part of the Hessian is used");
+  keys.reserve("optional","BANDED_HESSIAN","use a banded Hessian matrix for the optimization that includes the given number of off-diagonal elements on each side of the diagonal, where the coefficients are ordered as in the coefficients file");
+  keys.reserve("optional","BLOCK_DIAGONAL_HESSIAN","use a block-diagonal Hessian matrix for the optimization that includes the elements between coefficients that only differ in the basis function of the given argument (counted from 1)");
   keys.reserve("hidden","HESSIAN_FILE","the name of output file for the Hessian");
   keys.reserve("hidden","HESSIAN_OUTPUT","how often the Hessian should be written to file. This parameter is given as the number of bias iterations. It is by default 100 if HESSIAN_FILE is specficed");
   keys.reserve("hidden","HESSIAN_FMT","specify format for hessian file(s) (useful for decrease the number of digits in regtests)");
+  keys.reserve("hidden","HESSIAN_FILE_FORMAT","the format of the Hessian file(s), either TEXT (default) or BINARY");
   // Keywords related to the multiple walkers, actived with the useMultipleWalkersKeywords function
   keys.reserveFlag("MULTIPLE_WALKERS",false,"if optimization is to be performed using multiple walkers connected via MPI");
+  keys.reserveFlag("MULTIPLE_WALKERS_NONBLOCKING",false,"if the averages of the multiple walkers should be summed with non-blocking MPI calls. The sum started at one iteration is completed at the next one, so the walkers do not wait for the slowest one at every iteration but the coefficients are updated with a lag of one iteration (and not updated at the first iteration). Requires an MPI-3 library, otherwise the sum is blocking.");
   // Keywords related to the mask file, actived with the useMaskKeywords function
   keys.reserve("optional","MASK_FILE","read in a mask file which allows one to employ different step sizes for different coefficients and/or deactivate the optimization of certain coefficients (by putting values of 0.0). One can write out the resulting mask by using the OUTPUT_MASK_FILE keyword.");
   keys.reserve("optional","OUTPUT_MASK_FILE","Name of the file to write out the mask resulting from using the MASK_FILE keyword. Can also be used to generate a template mask file.");
   //
   keys.reserveFlag("START_OPTIMIZATION_AFRESH",false,"if the iterations should be started afresh when a restart has been triggered by the RESTART keyword or the MD code.");
+  keys.reserve("optional","CHECKPOINT_FILE","the name of a binary checkpoint file of the optimization. The file contains the full state that is needed to continue the optimization (the coefficients, the auxiliary coefficients, the running averages, the Hessian, the step sizes, the iteration counter and the dynamic target distributions). It is replaced atomically each time it is written out. When restarting, the optimization is continued from this file if it exists, otherwise from the coefficient files.");
+  keys.reserve("optional","CHECKPOINT_OUTPUT","how often the checkpoint file should be written out. This parameter is given as the number of iterations. By default 100.");
   //
   keys.addFlag("MONITOR_INSTANTANEOUS_GRADIENT",false,"if quantities related to the instantaneous gradient should be outputted.");
   //
@@ -857,6 +944,7 @@ void Optimizer::registerKeywords( Keywords& keys ) {
   //
   keys.add("optional","TARGETDIST_AVERAGES_FILE","the name of output file for the target distribution averages. By default it is targetdist-averages.data.");
   keys.add("optional","TARGETDIST_AVERAGES_OUTPUT","how often the target distribution averages should be written out to file. Note that the value is given in terms of coefficient iterations. If no value is given are the averages only written at the beginning of the optimization");
+  keys.add("hidden","TARGETDIST_AVERAGES_FILE_FORMAT","the format of the target distribution averages file(s), either TEXT (default) or BINARY");
   keys.add("hidden","TARGETDIST_AVERAGES_FMT","specify format for target distribution averages file(s) (useful for decrease the number of digits in regtests)");
   //
   keys.add("optional","BIAS_OUTPUT","how often the bias(es) should be written out to file. Note that the value is given in terms of coefficient iterations.");
@@ -882,11 +970,13 @@ void Optimizer::useHessianKeywords(Keywords& keys) {
   keys.use("HESSIAN_FILE");
   keys.use("HESSIAN_OUTPUT");
   keys.use("HESSIAN_FMT");
+  keys.use("HESSIAN_FILE_FORMAT");
 }
 
 
 void Optimizer::useMultipleWalkersKeywords(Keywords& keys) {
   keys.use("MULTIPLE_WALKERS");
+  keys.use("MULTIPLE_WALKERS_NONBLOCKING");
 }
 
 
@@ -909,6 +999,8 @@ void Optimizer::useMaskKeywords(Keywords& keys) {
 
 void Optimizer::useRestartKeywords(Keywords& keys) {
   keys.use("START_OPTIMIZATION_AFRESH");
+  keys.use("CHECKPOINT_FILE");
+  keys.use("CHECKPOINT_OUTPUT");
 }
 
 
@@ -945,9 +1037,20 @@ void Optimizer::turnOnHessian() {
     }
   }
   plumed_massert(hessian_pntrs_.size()==ncoeffssets_,"problems in linking Hessians");
+  if(restart_checkpoint_!=NULL && getIterationCounter()>0) {
+    for(unsigned int i=0; i<ncoeffssets_; i++) {
+      hessian_pntrs_[i]->setValues(restart_checkpoint_->get(getCheckpointEntryName("hessian",i),hessian_pntrs_[i]->getSize()));
+    }
+  }
   if(diagonal_hessian_) {
     log.printf("  Optimization performed using diagonal Hessian matrix\n");
   }
+  else if(hessian_bandwidth_>0) {
+    log.printf("  Optimization performed using banded Hessian matrix with %u off-diagonal elements on each side of the diagonal\n",hessian_bandwidth_);
+  }
+  else if(hessian_block_dimension_>0) {
+    log.printf("  Optimization performed using block-diagonal Hessian matrix with blocks along argument %u\n",hessian_block_dimension_);
+  }
   else {
     log.printf("  Optimization performed using full Hessian matrix\n");
   }
@@ -977,7 +1080,7 @@ void Optimizer::turnOffHessian() {
 
 std::vector<CoeffsMatrix*> Optimizer::enableHessian(VesBias* bias_pntr_in, const bool diagonal_hessian) {
   plumed_massert(use_hessian_,"the Hessian should not be used");
-  bias_pntr_in->enableHessian(diagonal_hessian);
+  bias_pntr_in->enableHessian(diagonal_hessian,hessian_bandwidth_,hessian_block_dimension_);
   std::vector<CoeffsMatrix*> hessian_pntrs_out = bias_pntr_in->getHessianPntrs();
   for(unsigned int k=0; k<hessian_pntrs_out.size(); k++) {
     plumed_massert(hessian_pntrs_out[k] != NULL,"Hessian is needed but not linked correctly");
@@ -1010,13 +1113,26 @@ std::vector<CoeffsMatrix*> Optimizer::enableHessian(VesBias* bias_pntr_in, const
 // }
 
 
+void Optimizer::beforeUpdate() {
+  if(async_output_writer_!=NULL && getCPT()) {
+    async_output_writer_->flush();
+  }
+}
+
+
 void Optimizer::update() {
   if(onStep() && !isFirstStep) {
     for(unsigned int i=0; i<nbiases_; i++) {
-      bias_pntrs_[i]->updateGradientAndHessian(use_mwalkers_mpi_);
+      bias_pntrs_[i]->updateGradientAndHessian(use_mwalkers_mpi_,mwalkers_nonblocking_);
     }
     for(unsigned int i=0; i<ncoeffssets_; i++) {
       if(gradient_pntrs_[i]->isActive()) {coeffsUpdate(i);}
+      else if(mwalkers_nonblocking_ && isFirstUpdate) {
+        std::string msg = "iteration " + getIterationCounterStr(+1) +
+                          " for " + bias_pntrs_[i]->getLabel() +
+                          " - the coefficients are not updated as the averages from the multiple walkers are only available at the next iteration";
+        warning(msg);
+      }
       else {
         std::string msg = "iteration " + getIterationCounterStr(+1) +
                           " for " + bias_pntrs_[i]->getLabel() +
@@ -1056,6 +1172,9 @@ void Optimizer::update() {
         bias_pntrs_[i]->updateReweightFactor();
       }
     }
+    if(checkpoint_fname_.size()>0 && getIterationCounter()%checkpoint_wstride_==0) {
+      writeCheckpoint();
+    }
 
 
     //
@@ -1074,9 +1193,22 @@ void Optimizer::update() {
     if(isTargetDistProjOutputActive() && getIterationCounter()%getTargetDistProjOutputStride()==0) {
       writeTargetDistProjOutputFiles();
     }
+    isFirstUpdate=false;
   }
   else {
     isFirstStep=false;
+    // the optimizer has been fully set up so the restart checkpoint is no longer needed
+    if(restart_checkpoint_!=NULL) {
+      delete restart_checkpoint_;
+      restart_checkpoint_=NULL;
+    }
+  }
+}
+
+
+void Optimizer::runFinalJobs() {
+  if(async_output_writer_!=NULL) {
+    async_output_writer_->flush();
   }
 }
 
@@ -1119,32 +1251,103 @@ void Optimizer::updateOutputComponents() {
 
 
 void Optimizer::turnOffCoeffsOutputFiles() {
-  for(unsigned int i=0; i<coeffsOFiles_.size(); i++) {
-    coeffsOFiles_[i]->close();
-    delete coeffsOFiles_[i];
-  }
-  coeffsOFiles_.clear();
+  closeOFiles(coeffsOFiles_);
 }
 
 
 void Optimizer::writeOutputFiles(const unsigned int coeffs_id) {
   if(coeffsOFiles_.size()>0 && iter_counter%coeffs_wstride_==0) {
-    coeffs_pntrs_[coeffs_id]->writeToFile(*coeffsOFiles_[coeffs_id],aux_coeffs_pntrs_[coeffs_id],false);
+    writeCoeffsToFile(coeffsOFiles_[coeffs_id],coeffs_pntrs_[coeffs_id],aux_coeffs_pntrs_[coeffs_id],coeffs_binary_output_);
   }
   if(gradientOFiles_.size()>0 && iter_counter%gradient_wstride_==0) {
     if(aver_gradient_pntrs_.size()==0) {
-      gradient_pntrs_[coeffs_id]->writeToFile(*gradientOFiles_[coeffs_id],false);
+      writeCoeffsToFile(gradientOFiles_[coeffs_id],gradient_pntrs_[coeffs_id],NULL,gradient_binary_output_);
     }
     else {
-      gradient_pntrs_[coeffs_id]->writeToFile(*gradientOFiles_[coeffs_id],aver_gradient_pntrs_[coeffs_id],false);
+      writeCoeffsToFile(gradientOFiles_[coeffs_id],gradient_pntrs_[coeffs_id],aver_gradient_pntrs_[coeffs_id],gradient_binary_output_);
     }
   }
   if(hessianOFiles_.size()>0 && iter_counter%hessian_wstride_==0) {
-    hessian_pntrs_[coeffs_id]->writeToFile(*hessianOFiles_[coeffs_id]);
+    writeCoeffsToFile(hessianOFiles_[coeffs_id],hessian_pntrs_[coeffs_id],hessian_binary_output_);
   }
   if(targetdist_averagesOFiles_.size()>0 && iter_counter%targetdist_averages_wstride_==0) {
-    targetdist_averages_pntrs_[coeffs_id]->writeToFile(*targetdist_averagesOFiles_[coeffs_id]);
+    writeCoeffsToFile(targetdist_averagesOFiles_[coeffs_id],targetdist_averages_pntrs_[coeffs_id],NULL,targetdist_averages_binary_output_);
+  }
+}
+
+
+void Optimizer::writeCoeffsToFile(OFile* ofile_pntr, CoeffsVector* coeffs_pntr, CoeffsVector* aux_coeffs_pntr, const bool binary_file) {
+  if(async_output_writer_==NULL) {
+    if(binary_file) {
+      if(aux_coeffs_pntr!=NULL) {coeffs_pntr->writeToBinaryFile(*ofile_pntr,aux_coeffs_pntr);}
+      else {coeffs_pntr->writeToBinaryFile(*ofile_pntr);}
+    }
+    else {
+      if(aux_coeffs_pntr!=NULL) {coeffs_pntr->writeToFile(*ofile_pntr,aux_coeffs_pntr,false);}
+      else {coeffs_pntr->writeToFile(*ofile_pntr,false);}
+    }
+    return;
+  }
+  // only the files of the writing rank are open
+  if(!ofile_pntr->isOpen()) {return;}
+  std::shared_ptr<CoeffsVector> coeffs_copy(new CoeffsVector(*coeffs_pntr));
+  std::shared_ptr<CoeffsVector> aux_coeffs_copy;
+  if(aux_coeffs_pntr!=NULL) {aux_coeffs_copy.reset(new CoeffsVector(*aux_coeffs_pntr));}
+  async_output_writer_->submitAppend(ofile_pntr,[coeffs_copy,aux_coeffs_copy,binary_file](OFile& ofile) {
+    if(binary_file) {
+      if(aux_coeffs_copy) {coeffs_copy->writeToBinaryFile(ofile,aux_coeffs_copy.get());}
+      else {coeffs_copy->writeToBinaryFile(ofile);}
+    }
+    else {
+      if(aux_coeffs_copy) {coeffs_copy->writeToFile(ofile,aux_coeffs_copy.get(),false);}
+      else {coeffs_copy->writeToFile(ofile,false);}
+    }
+  });
+}
+
+
+void Optimizer::writeCoeffsToFile(OFile* ofile_pntr, CoeffsMatrix* coeffs_pntr, const bool binary_file) {
+  if(async_output_writer_==NULL) {
+    if(binary_file) {coeffs_pntr->writeToBinaryFile(*ofile_pntr);}
+    else {coeffs_pntr->writeToFile(*ofile_pntr);}
+    return;
   }
+  if(!ofile_pntr->isOpen()) {return;}
+  std::shared_ptr<CoeffsMatrix> coeffs_copy(new CoeffsMatrix(*coeffs_pntr));
+  async_output_writer_->submitAppend(ofile_pntr,[coeffs_copy,binary_file](OFile& ofile) {
+    if(binary_file) {coeffs_copy->writeToBinaryFile(ofile);}
+    else {coeffs_copy->writeToFile(ofile);}
+  });
+}
+
+
+void Optimizer::writeCoeffsToFile(OFile* ofile_pntr, const std::vector<CoeffsVector*>& coeffs_set) {
+  if(async_output_writer_==NULL) {
+    CoeffsVector::writeToFile(*ofile_pntr,coeffs_set,false);
+    return;
+  }
+  if(!ofile_pntr->isOpen()) {return;}
+  std::vector<std::shared_ptr<CoeffsVector> > coeffs_copies(coeffs_set.size());
+  for(unsigned int k=0; k<coeffs_set.size(); k++) {
+    coeffs_copies[k].reset(new CoeffsVector(*coeffs_set[k]));
+  }
+  async_output_writer_->submitAppend(ofile_pntr,[coeffs_copies](OFile& ofile) {
+    std::vector<CoeffsVector*> pntrs(coeffs_copies.size());
+    for(unsigned int k=0; k<coeffs_copies.size(); k++) {pntrs[k]=coeffs_copies[k].get();}
+    CoeffsVector::writeToFile(ofile,pntrs,false);
+  });
+}
+
+
+void Optimizer::closeOFiles(std::vector<OFile*>& OFiles) {
+  if(async_output_writer_!=NULL) {
+    async_output_writer_->wait();
+  }
+  for(unsigned int i=0; i<OFiles.size(); i++) {
+    OFiles[i]->close();
+    delete OFiles[i];
+  }
+  OFiles.clear();
 }
 
 
@@ -1152,6 +1355,13 @@ void Optimizer::setupOFiles(std::vector<std::string>& fnames, std::vector<OFile*
   plumed_assert(ncoeffssets_>0);
   OFiles.resize(fnames.size(),NULL);
   for(unsigned int i=0; i<fnames.size(); i++) {
+    if(async_output_writer_!=NULL) {
+      // the ranks that do not write keep a file that is not opened
+      OFiles[i] = AsyncOutputWriter::openFile(*this,fnames[i],multi_sim_single_files);
+      if(OFiles[i]==NULL) {OFiles[i] = new OFile();}
+      OFiles[i]->setHeavyFlush();
+      continue;
+    }
     OFiles[i] = new OFile();
     OFiles[i]->link(*this);
     if(multi_sim_single_files) {
@@ -1183,11 +1393,19 @@ void Optimizer::readCoeffsFromFiles(const std::vector<std::string>& fnames, cons
       ifile.enforceSuffix("");
     }
     ifile.open(fnames[i]);
-    if(!ifile.FieldExist(coeffs_pntrs_[i]->getDataLabel())) {
-      std::string error_msg = "Problem with reading coefficients from file " + ifile.getPath() + ": no field with name " + coeffs_pntrs_[i]->getDataLabel() + "\n";
-      plumed_merror(error_msg);
+    // binary files are recognized from their content
+    const bool binary_file = CoeffsBinaryFile::isBinaryFile(ifile.getPath());
+    size_t ncoeffs_read = 0;
+    if(binary_file) {
+      ncoeffs_read = coeffs_pntrs_[i]->readFromBinaryFile(ifile.getPath());
+    }
+    else {
+      if(!ifile.FieldExist(coeffs_pntrs_[i]->getDataLabel())) {
+        std::string error_msg = "Problem with reading coefficients from file " + ifile.getPath() + ": no field with name " + coeffs_pntrs_[i]->getDataLabel() + "\n";
+        plumed_merror(error_msg);
+      }
+      ncoeffs_read = coeffs_pntrs_[i]->readFromFile(ifile,false,false);
     }
-    size_t ncoeffs_read = coeffs_pntrs_[i]->readFromFile(ifile,false,false);
     if(ncoeffssets_==1) {
       log.printf("%s (read %zu of %zu values)\n", ifile.getPath().c_str(),ncoeffs_read,coeffs_pntrs_[i]->numberOfCoeffs());
     }
@@ -1195,7 +1413,10 @@ void Optimizer::readCoeffsFromFiles(const std::vector<std::string>& fnames, cons
       log.printf("   coefficient set %u: %s (read %zu of %zu values)\n",i,ifile.getPath().c_str(),ncoeffs_read,coeffs_pntrs_[i]->numberOfCoeffs());
     }
     ifile.close();
-    if(read_aux_coeffs) {
+    if(read_aux_coeffs && binary_file) {
+      aux_coeffs_pntrs_[i]->readFromBinaryFile(ifile.getPath());
+    }
+    else if(read_aux_coeffs) {
       ifile.open(fnames[i]);
       if(!ifile.FieldExist(aux_coeffs_pntrs_[i]->getDataLabel())) {
         std::string error_msg = "Problem with reading coefficients from file " + ifile.getPath() + ": no field with name " + aux_coeffs_pntrs_[i]->getDataLabel() + "\n";
@@ -1211,6 +1432,87 @@ void Optimizer::readCoeffsFromFiles(const std::vector<std::string>& fnames, cons
 }
 
 
+std::string Optimizer::getCheckpointEntryName(const std::string& name, const unsigned int coeffs_id) const {
+  std::string is; Tools::convert(coeffs_id,is);
+  return "set" + is + "." + name;
+}
+
+
+void Optimizer::readCoeffsFromCheckpoint(const VesCheckpoint& checkpoint) {
+  const unsigned int iteration = static_cast<unsigned int>(checkpoint.getScalar("iteration"));
+  const double time = checkpoint.getScalar("time");
+  for(unsigned int i=0; i<ncoeffssets_; i++) {
+    const size_t ncoeffs = coeffs_pntrs_[i]->numberOfCoeffs();
+    coeffs_pntrs_[i]->setValues(checkpoint.get(getCheckpointEntryName("coeffs",i),ncoeffs));
+    coeffs_pntrs_[i]->setIterationCounterAndTime(iteration,time);
+    aux_coeffs_pntrs_[i]->setValues(checkpoint.get(getCheckpointEntryName("aux_coeffs",i),ncoeffs));
+    aux_coeffs_pntrs_[i]->setIterationCounterAndTime(iteration,time);
+  }
+  log.printf("  Read in coefficients from checkpoint file %s\n",checkpoint_fname_.c_str());
+}
+
+
+void Optimizer::readAveragesFromCheckpoint(const VesCheckpoint& checkpoint) {
+  for(unsigned int i=0; i<ncoeffssets_; i++) {
+    if(stepsizes_.size()>0) {
+      setCurrentStepSize(checkpoint.getScalar(getCheckpointEntryName("stepsize",i)),i);
+    }
+    const std::string aver_gradient_name = getCheckpointEntryName("aver_gradient",i);
+    if(aver_gradient_pntrs_.size()>0 && checkpoint.has(aver_gradient_name)) {
+      aver_gradient_pntrs_[i]->setValues(checkpoint.get(aver_gradient_name,aver_gradient_pntrs_[i]->numberOfCoeffs()));
+      aver_gradient_pntrs_[i]->setAveragingCounter(static_cast<unsigned int>(checkpoint.getScalar(aver_gradient_name+"_counter")));
+    }
+  }
+}
+
+
+void Optimizer::writeCheckpoint() {
+  if(comm.Get_rank()!=0) {return;}
+  if(use_mwalkers_mpi_ && multi_sim_comm.Get_rank()!=0) {return;}
+  VesCheckpoint checkpoint;
+  checkpoint.add("iteration",getIterationCounterDbl());
+  checkpoint.add("time",getTime());
+  for(unsigned int i=0; i<ncoeffssets_; i++) {
+    checkpoint.add(getCheckpointEntryName("coeffs",i),coeffs_pntrs_[i]->getDataAsVector());
+    checkpoint.add(getCheckpointEntryName("aux_coeffs",i),aux_coeffs_pntrs_[i]->getDataAsVector());
+    if(current_stepsizes.size()>0) {
+      checkpoint.add(getCheckpointEntryName("stepsize",i),current_stepsizes[i]);
+    }
+    if(aver_gradient_pntrs_.size()>0) {
+      checkpoint.add(getCheckpointEntryName("aver_gradient",i),aver_gradient_pntrs_[i]->getDataAsVector());
+      checkpoint.add(getCheckpointEntryName("aver_gradient_counter",i),static_cast<double>(aver_gradient_pntrs_[i]->getAveragingCounter()));
+    }
+    if(use_hessian_) {
+      checkpoint.add(getCheckpointEntryName("hessian",i),hessian_pntrs_[i]->getDataAsVector());
+    }
+  }
+  for(unsigned int i=0; i<nbiases_; i++) {
+    if(dynamic_targetdists_[i]) {
+      bias_pntrs_[i]->writeTargetDistributionsToCheckpoint(checkpoint,bias_pntrs_[i]->getLabel()+".");
+    }
+    if(mwalkers_nonblocking_) {
+      bias_pntrs_[i]->writeMultiWalkersSumToCheckpoint(checkpoint,bias_pntrs_[i]->getLabel()+".");
+    }
+  }
+  writeStateToCheckpoint(checkpoint);
+  checkpoint.write(checkpoint_fname_);
+}
+
+
+bool Optimizer::parseBinaryFileFormat(const std::string& keyword) {
+  std::string file_format="TEXT";
+  parse(keyword,file_format);
+  if(file_format=="BINARY") {
+    log.printf("  files given by %s will be written in binary format\n",keyword.substr(0,keyword.size()-std::string("_FORMAT").size()).c_str());
+    return true;
+  }
+  else if(file_format!="TEXT") {
+    plumed_merror("the value given in " + keyword + " should be either TEXT or BINARY");
+  }
+  return false;
+}
+
+
 void Optimizer::addCoeffsSetIDsToFilenames(std::vector<std::string>& fnames, std::string& coeffssetid_prefix) {
   if(ncoeffssets_==1) {return;}
   //
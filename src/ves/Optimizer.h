@@ -45,8 +45,10 @@ class OFile;
 
 namespace ves {
 
+class AsyncOutputWriter;
 class CoeffsVector;
 class VesBias;
+class VesCheckpoint;
 
 
 class Optimizer :
@@ -65,11 +67,14 @@ private:
   //
   bool use_hessian_;
   bool diagonal_hessian_;
+  unsigned int hessian_bandwidth_;
+  unsigned int hessian_block_dimension_;
   bool hessian_covariance_from_averages_;
   //
   bool monitor_instantaneous_gradient_;
   //
   bool use_mwalkers_mpi_;
+  bool mwalkers_nonblocking_;
   bool mwalkers_mpi_single_files_;
   //
   std::vector<bool> dynamic_targetdists_;
@@ -82,18 +87,26 @@ private:
   unsigned int coeffs_wstride_;
   std::vector<OFile*> coeffsOFiles_;
   std::string coeffs_output_fmt_;
+  bool coeffs_binary_output_;
   //
   unsigned int gradient_wstride_;
   std::vector<OFile*> gradientOFiles_;
   std::string gradient_output_fmt_;
+  bool gradient_binary_output_;
   //
   unsigned int hessian_wstride_;
   std::vector<OFile*> hessianOFiles_;
   std::string hessian_output_fmt_;
+  bool hessian_binary_output_;
   //
   unsigned int targetdist_averages_wstride_;
   std::vector<OFile*> targetdist_averagesOFiles_;
   std::string targetdist_averages_output_fmt_;
+  bool targetdist_averages_binary_output_;
+  //
+  unsigned int checkpoint_wstride_;
+  std::string checkpoint_fname_;
+  VesCheckpoint* restart_checkpoint_;
   //
   unsigned int nbiases_;
   std::vector<VesBias*> bias_pntrs_;
@@ -121,11 +134,18 @@ private:
   unsigned int targetdist_proj_output_stride_;
   //
   bool isFirstStep;
+  bool isFirstUpdate;
+  //
+  AsyncOutputWriter* async_output_writer_;
   //
 private:
   void updateOutputComponents();
   void writeOutputFiles(const unsigned int coeffs_id = 0);
   void readCoeffsFromFiles(const std::vector<std::string>&, const bool);
+  void readCoeffsFromCheckpoint(const VesCheckpoint&);
+  void readAveragesFromCheckpoint(const VesCheckpoint&);
+  void writeCheckpoint();
+  bool parseBinaryFileFormat(const std::string&);
   void setAllCoeffsSetIterationCounters();
 protected:
   void turnOnHessian();
@@ -147,6 +167,13 @@ protected:
   //
   void turnOffCoeffsOutputFiles();
   //
+  // the checkpoint that the optimization is restarted from, NULL if the
+  // restart is from the coefficient files or there is no restart
+  const VesCheckpoint* getRestartCheckpoint() const {return restart_checkpoint_;}
+  std::string getCheckpointEntryName(const std::string&, const unsigned int coeffs_id = 0) const;
+  // add the state that is specific to the optimization method to the checkpoint
+  virtual void writeStateToCheckpoint(VesCheckpoint&) const {};
+  //
   template<class T>
   bool parseMultipleValues(const std::string&, std::vector<T>&);
   template<class T>
@@ -155,6 +182,10 @@ protected:
   void parseFilenames(const std::string&, std::vector<std::string>&);
   void addCoeffsSetIDsToFilenames(std::vector<std::string>&, std::string&);
   void setupOFiles(std::vector<std::string>&, std::vector<OFile*>&, const bool multi_sim_single_files=false);
+  void closeOFiles(std::vector<OFile*>&);
+  void writeCoeffsToFile(OFile*, CoeffsVector*, CoeffsVector* aux_coeffs_pntr=NULL, const bool binary_file=false);
+  void writeCoeffsToFile(OFile*, CoeffsMatrix*, const bool binary_file=false);
+  void writeCoeffsToFile(OFile*, const std::vector<CoeffsVector*>&);
 public:
   static void registerKeywords(Keywords&);
   static void useMultipleWalkersKeywords(Keywords&);
@@ -190,7 +221,9 @@ public:
   //
   void apply() {};
   void calculate() {};
+  void beforeUpdate();
   void update();
+  void runFinalJobs();
   unsigned int getNumberOfDerivatives() {return 0;}
   //
   bool fixedStepSize() const {return fixed_stepsize_;}
@@ -201,6 +234,8 @@ public:
   //
   bool useMultipleWalkers() const {return use_mwalkers_mpi_;}
   //
+  AsyncOutputWriter* getAsyncOutputWriter() const {return async_output_writer_;}
+  //
   std::vector<VesBias*> getBiasPntrs() const {return bias_pntrs_;}
   std::vector<CoeffsVector*> getCoeffsPntrs() const {return coeffs_pntrs_;}
   std::vector<CoeffsVector*> getAuxCoeffsPntrs() const {return aux_coeffs_pntrs_;}
@@ -209,6 +244,8 @@ public:
   std::vector<CoeffsVector*> getCoeffsMaskPntrs() const {return coeffs_mask_pntrs_;}
   std::vector<CoeffsVector*> getTargetDistAveragesPntrs() const {return targetdist_averages_pntrs_;}
   //
+  unsigned int getCoeffsOutputStride() const {return coeffs_wstride_;}
+  //
   bool isBiasOutputActive() const {return bias_output_active_;}
   unsigned int getBiasOutputStride() const {return bias_output_stride_;}
   void setBiasOutputStride(unsigned int stride) {bias_output_stride_=stride;}
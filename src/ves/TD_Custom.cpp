@@ -28,6 +28,8 @@
 
 #include "lepton/Lepton.h"
 
+#include <limits>
+
 
 namespace PLMD {
 namespace ves {
@@ -263,11 +265,15 @@ void TD_Custom::updateGrid() {
     if(beta_var_lepton_ref_) {*beta_var_lepton_ref_= getBeta();}
   }
   //
-  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+  const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
   double norm = 0.0;
+  double log_min_value = std::numeric_limits<double>::max();
+  std::vector<unsigned int> indices(targetDistGrid().getDimension());
+  std::vector<double> point(targetDistGrid().getDimension());
   //
   for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
-    std::vector<double> point = targetDistGrid().getPoint(l);
+    targetDistGrid().getIndices(l,indices);
+    targetDistGrid().getPoint(indices,point);
     for(unsigned int k=0; k<cv_var_str_.size() ; k++) {
       if(cv_var_lepton_refs_[k]) {*cv_var_lepton_refs_[k] = point[cv_var_idx_[k]];}
     }
@@ -279,15 +285,14 @@ void TD_Custom::updateGrid() {
     if(value<0.0 && !isTargetDistGridShiftedToZero()) {plumed_merror(getName()+": The target distribution function gives negative values. You should change the definition of the function used for the target distribution to avoid this. You can also use the SHIFT_TO_ZERO keyword to avoid this problem.");}
     targetDistGrid().setValue(l,value);
     norm += integration_weights[l]*value;
-    logTargetDistGrid().setValue(l,-std::log(value));
-  }
-  if(norm>0.0) {
-    targetDistGrid().scaleAllValuesAndDerivatives(1.0/norm);
+    double log_value = -std::log(value);
+    logTargetDistGrid().setValue(l,log_value);
+    if(log_value<log_min_value) {log_min_value=log_value;}
   }
-  else if(!isTargetDistGridShiftedToZero()) {
+  if(norm<=0.0 && !isTargetDistGridShiftedToZero()) {
     plumed_merror(getName()+": The target distribution function cannot be normalized proberly. You should change the definition of the function used for the target distribution to avoid this. You can also use the SHIFT_TO_ZERO keyword to avoid this problem.");
   }
-  logTargetDistGrid().setMinToZero();
+  scaleTargetDistGridAndShiftLogGrid(norm>0.0 ? 1.0/norm : 1.0,log_min_value);
 }
 
 
@@ -28,6 +28,8 @@
 
 #include "GridProjWeights.h"
 
+#include <limits>
+
 
 namespace PLMD {
 namespace ves {
@@ -118,17 +120,18 @@ void TD_MarginalWellTempered::updateGrid() {
   plumed_massert(fes_proj.getSize()==targetDistGrid().getSize(),"problem with FES projection - inconsistent grids");
   plumed_massert(fes_proj.getDimension()==1,"problem with FES projection - projected grid is not one-dimensional");
   //
-  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+  const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
   double norm = 0.0;
+  double log_min_value = std::numeric_limits<double>::max();
   for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
     double value = beta_prime * fes_proj.getValue(l);
     logTargetDistGrid().setValue(l,value);
+    if(value<log_min_value) {log_min_value=value;}
     value = exp(-value);
     norm += integration_weights[l]*value;
     targetDistGrid().setValue(l,value);
   }
-  targetDistGrid().scaleAllValuesAndDerivatives(1.0/norm);
-  logTargetDistGrid().setMinToZero();
+  scaleTargetDistGridAndShiftLogGrid(1.0/norm,log_min_value);
 }
 
 }
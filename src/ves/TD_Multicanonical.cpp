@@ -22,10 +22,13 @@
 
 #include "TargetDistribution.h"
 #include "GridIntegrationWeights.h"
+#include "VesTools.h"
 #include "core/ActionRegister.h"
 #include "tools/Grid.h"
 #include "core/PlumedMain.h"
 #include "core/Atoms.h"
+#include "tools/OpenMP.h"
+#include <algorithm>
 #include <cfloat>
 
 
@@ -212,7 +215,7 @@ void TD_Multicanonical::updateGrid() {
     if(targetDistGrid().getDimension()>2 && targetDistGrid().getDimension()<1) plumed_merror(getName()+" works only with 1 or 2 arguments, i.e. energy, or energy and CV");
     if(sigma_.size()!=targetDistGrid().getDimension()) plumed_merror(getName()+": mismatch between SIGMA dimension and number of arguments");
     // Use uniform TD
-    std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+    const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
     double norm = 0.0;
     for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
       double value = 1.0;
@@ -232,13 +235,22 @@ void TD_Multicanonical::updateGrid() {
       double beta_prime_min = 1./(plumed.getAtoms().getKBoltzmann()*min_temp_);
       double beta_prime_max = 1./(plumed.getAtoms().getKBoltzmann()*max_temp_);
       plumed_massert(getFesGridPntr()!=NULL,"the FES grid has to be linked to use TD_Multicanonical!");
+      // The energies of the grid points
+      std::vector<double> energy(targetDistGrid().getSize());
+      std::vector<unsigned int> indices(1);
+      std::vector<double> point(1);
+      for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
+        targetDistGrid().getIndices(l,indices);
+        targetDistGrid().getPoint(indices,point);
+        energy[l] = point[0];
+      }
       // Find minimum of F(U) at temperature min
       double minval=DBL_MAX;
       Grid::index_t minindex = (targetDistGrid().getSize())/2;
-      double minpos = targetDistGrid().getPoint(minindex)[0];
+      double minpos = energy[minindex];
       for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
         double value = getFesGridPntr()->getValue(l);
-        double argument = targetDistGrid().getPoint(l)[0];
+        double argument = energy[l];
         value = beta*value + (beta_prime_min-beta)*argument;
         if(value<minval) {
           minval=value;
@@ -249,8 +261,8 @@ void TD_Multicanonical::updateGrid() {
       // Find minimum energy at low temperature
       double minimum_low = minpos;
       for(Grid::index_t l=minindex; l>1; l-=1) {
-        double argument = targetDistGrid().getPoint(l)[0];
-        double argument_next = targetDistGrid().getPoint(l-1)[0];
+        double argument = energy[l];
+        double argument_next = energy[l-1];
         double value = getFesGridPntr()->getValue(l);
         double value_next = getFesGridPntr()->getValue(l-1);
         value = beta*value + (beta_prime_min-beta)*argument - minval;
@@ -263,8 +275,8 @@ void TD_Multicanonical::updateGrid() {
       // Find maximum energy at low temperature
       double maximum_low = minpos;
       for(Grid::index_t l=minindex; l<(targetDistGrid().getSize()-1); l++) {
-        double argument = targetDistGrid().getPoint(l)[0];
-        double argument_next = targetDistGrid().getPoint(l+1)[0];
+        double argument = energy[l];
+        double argument_next = energy[l+1];
         double value = getFesGridPntr()->getValue(l);
         double value_next = getFesGridPntr()->getValue(l+1);
         value = beta*value + (beta_prime_min-beta)*argument - minval;
@@ -278,7 +290,7 @@ void TD_Multicanonical::updateGrid() {
       minval=DBL_MAX;
       for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
         double value = getFesGridPntr()->getValue(l);
-        double argument = targetDistGrid().getPoint(l)[0];
+        double argument = energy[l];
         value = beta*value + (beta_prime_max-beta)*argument;
         if(value<minval) {
           minval=value;
@@ -289,8 +301,8 @@ void TD_Multicanonical::updateGrid() {
       // Find minimum energy at high temperature
       double minimum_high = minpos;
       for(Grid::index_t l=minindex; l>1; l-=1) {
-        double argument = targetDistGrid().getPoint(l)[0];
-        double argument_next = targetDistGrid().getPoint(l-1)[0];
+        double argument = energy[l];
+        double argument_next = energy[l-1];
         double value = getFesGridPntr()->getValue(l);
         double value_next = getFesGridPntr()->getValue(l-1);
         value = beta*value + (beta_prime_max-beta)*argument - minval;
@@ -303,8 +315,8 @@ void TD_Multicanonical::updateGrid() {
       // Find maximum energy at high temperature
       double maximum_high = minpos;
       for(Grid::index_t l=minindex; l<(targetDistGrid().getSize()-1); l++) {
-        double argument = targetDistGrid().getPoint(l)[0];
-        double argument_next = targetDistGrid().getPoint(l+1)[0];
+        double argument = energy[l];
+        double argument_next = energy[l+1];
         double value = getFesGridPntr()->getValue(l);
         double value_next = getFesGridPntr()->getValue(l+1);
         value = beta*value + (beta_prime_max-beta)*argument - minval;
@@ -319,10 +331,10 @@ void TD_Multicanonical::updateGrid() {
       double maximum = maximum_low;
       if (maximum_high>maximum_low) maximum=maximum_high;
       // Construct uniform TD in the interval between minimum and maximum
-      std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+      const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
       double norm = 0.0;
       for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
-        double argument = targetDistGrid().getPoint(l)[0];
+        double argument = energy[l];
         double value = 1.0;
         double tmp;
         if(argument < minimum) {
@@ -348,86 +360,54 @@ void TD_Multicanonical::updateGrid() {
       double beta_prime_min = 1./(plumed.getAtoms().getKBoltzmann()*min_temp_);
       double beta_prime_max = 1./(plumed.getAtoms().getKBoltzmann()*max_temp_);
       plumed_massert(getFesGridPntr()!=NULL,"the FES grid has to be linked to use TD_MulticanonicalWithCV!");
-      // Set all to zero
-      for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
-        double value = 0.0;
-        targetDistGrid().setValue(l,value);
+      const Grid::index_t size = targetDistGrid().getSize();
+      // The energies and scaled free energies of the grid points
+      std::vector<double> energy(size), beta_fes(size);
+      #pragma omp parallel num_threads(OpenMP::getNumThreads())
+      {
+        std::vector<unsigned int> indices(targetDistGrid().getDimension());
+        std::vector<double> point(targetDistGrid().getDimension());
+        #pragma omp for
+        for(Grid::index_t l=0; l<size; l++) {
+          targetDistGrid().getIndices(l,indices);
+          targetDistGrid().getPoint(indices,point);
+          energy[l] = point[0];
+          beta_fes[l] = beta*getFesGridPntr()->getValue(l);
+        }
       }
-      // Loop over temperatures
+      // The coefficient of the energy for each temperature
+      std::vector<double> energy_coeff(steps_temp_);
       for(unsigned i=0; i<steps_temp_; i++) {
         double beta_prime=beta_prime_min + (beta_prime_max-beta_prime_min)*i/(steps_temp_-1);
-        // Find minimum for this temperature
-        double minval=DBL_MAX;
-        for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
-          double energy = targetDistGrid().getPoint(l)[0];
-          double value = getFesGridPntr()->getValue(l);
-          value = beta*value + (beta_prime-beta)*energy;
-          if(value<minval) {
-            minval=value;
-          }
-        }
-        // Now check which energies and volumes are below X kt
-        for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
-          double energy = targetDistGrid().getPoint(l)[0];
-          double value = getFesGridPntr()->getValue(l);
-          value = beta*value + (beta_prime-beta)*energy - minval;
-          if (value<threshold_) {
-            double value = 1.0;
-            targetDistGrid().setValue(l,value);
-          }
+        energy_coeff[i] = beta_prime-beta;
+      }
+      // Find minimum for each temperature
+      std::vector<double> minval(steps_temp_);
+      #pragma omp parallel for num_threads(OpenMP::getNumThreads())
+      for(unsigned int i=0; i<steps_temp_; i++) {
+        const double ce = energy_coeff[i];
+        double temp_minval=DBL_MAX;
+        for(Grid::index_t l=0; l<size; l++) {
+          temp_minval = std::min(temp_minval,beta_fes[l] + ce*energy[l]);
         }
+        minval[i] = temp_minval;
       }
-      std::vector<unsigned> nbin=targetDistGrid().getNbin();
-      std::vector<double> dx=targetDistGrid().getDx();
-      // Smoothening
-      for(unsigned i=0; i<nbin[0]; i++) {
-        for(unsigned j=0; j<nbin[1]; j++) {
-          std::vector<unsigned> indices(2);
-          indices[0]=i;
-          indices[1]=j;
-          Grid::index_t index = targetDistGrid().getIndex(indices);
-          double energy = targetDistGrid().getPoint(index)[0];
-          double volume = targetDistGrid().getPoint(index)[1];
-          double value = targetDistGrid().getValue(index);
-          if (value>(1-1.e-5)) { // Apply only if this grid point was 1.
-            // Apply gaussians around
-            std::vector<int> minBin(2), maxBin(2), deltaBin(2); // These cannot be unsigned
-            // Only consider contributions less than n*sigma bins apart from the actual distance
-            deltaBin[0]=std::floor(5*sigma_[0]/dx[0]);;
-            deltaBin[1]=std::floor(5*sigma_[1]/dx[1]);;
-            // For energy
-            minBin[0]=i - deltaBin[0];
-            if (minBin[0] < 0) minBin[0]=0;
-            if (minBin[0] > (nbin[0]-1)) minBin[0]=nbin[0]-1;
-            maxBin[0]=i +  deltaBin[0];
-            if (maxBin[0] > (nbin[0]-1)) maxBin[0]=nbin[0]-1;
-            // For volume
-            minBin[1]=j - deltaBin[1];
-            if (minBin[1] < 0) minBin[1]=0;
-            if (minBin[1] > (nbin[1]-1)) minBin[1]=nbin[1]-1;
-            maxBin[1]=j +  deltaBin[1];
-            if (maxBin[1] > (nbin[1]-1)) maxBin[1]=nbin[1]-1;
-            for(unsigned l=minBin[0]; l<maxBin[0]+1; l++) {
-              for(unsigned m=minBin[1]; m<maxBin[1]+1; m++) {
-                std::vector<unsigned> indices_prime(2);
-                indices_prime[0]=l;
-                indices_prime[1]=m;
-                Grid::index_t index_prime = targetDistGrid().getIndex(indices_prime);
-                double energy_prime = targetDistGrid().getPoint(index_prime)[0];
-                double volume_prime = targetDistGrid().getPoint(index_prime)[1];
-                double value_prime = targetDistGrid().getValue(index_prime);
-                // Apply gaussian
-                double gaussian_value = GaussianSwitchingFunc(energy_prime,energy,sigma_[0])*GaussianSwitchingFunc(volume_prime,volume,sigma_[1]);
-                if (value_prime<gaussian_value) {
-                  targetDistGrid().setValue(index_prime,gaussian_value);
-                }
-              }
-            }
+      // Now check which energies and order parameters are below X kt for any temperature
+      #pragma omp parallel for num_threads(OpenMP::getNumThreads())
+      for(Grid::index_t l=0; l<size; l++) {
+        double value = 0.0;
+        for(unsigned int i=0; i<steps_temp_; i++) {
+          if(beta_fes[l] + energy_coeff[i]*energy[l] - minval[i] < threshold_) {
+            value = 1.0;
+            break;
           }
         }
+        targetDistGrid().setValue(l,value);
       }
+      // Smoothening
+      VesTools::smoothGridWithGaussians(getTargetDistGridPntr(),sigma_);
       // Normalize
-      std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+      const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
       double norm = 0.0;
       for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
         double value = targetDistGrid().getValue(l);
@@ -22,10 +22,13 @@
 
 #include "TargetDistribution.h"
 #include "GridIntegrationWeights.h"
+#include "VesTools.h"
 #include "core/ActionRegister.h"
 #include "tools/Grid.h"
 #include "core/PlumedMain.h"
 #include "core/Atoms.h"
+#include "tools/OpenMP.h"
+#include <algorithm>
 #include <cfloat>
 
 
@@ -225,7 +228,6 @@ public:
   void updateGrid();
   double getValue(const std::vector<double>&) const;
   ~TD_MultithermalMultibaric() {}
-  double GaussianSwitchingFunc(const double, const double, const double) const;
 };
 
 
@@ -300,7 +302,7 @@ void TD_MultithermalMultibaric::updateGrid() {
     if(targetDistGrid().getDimension()>3 && targetDistGrid().getDimension()<2) plumed_merror(getName()+" works only with 2 or 3 arguments, i.e. energy and volume, or energy, volume, and CV");
     if(sigma_.size()!=targetDistGrid().getDimension()) plumed_merror(getName()+": mismatch between SIGMA dimension and number of arguments");
     // Use uniform TD
-    std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+    const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
     double norm = 0.0;
     for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
       double value = 1.0;
@@ -314,106 +316,61 @@ void TD_MultithermalMultibaric::updateGrid() {
     double beta_prime_min = 1./(plumed.getAtoms().getKBoltzmann()*min_temp_);
     double beta_prime_max = 1./(plumed.getAtoms().getKBoltzmann()*max_temp_);
     plumed_massert(getFesGridPntr()!=NULL,"the FES grid has to be linked to use TD_MultithermalMultibaric!");
-    // Set all to zero
-    for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
-      double value = 0.0;
-      targetDistGrid().setValue(l,value);
+    const Grid::index_t size = targetDistGrid().getSize();
+    // The energies, volumes and scaled free energies of the grid points
+    std::vector<double> energy(size), volume(size), beta_fes(size);
+    #pragma omp parallel num_threads(OpenMP::getNumThreads())
+    {
+      std::vector<unsigned int> indices(targetDistGrid().getDimension());
+      std::vector<double> point(targetDistGrid().getDimension());
+      #pragma omp for
+      for(Grid::index_t l=0; l<size; l++) {
+        targetDistGrid().getIndices(l,indices);
+        targetDistGrid().getPoint(indices,point);
+        energy[l] = point[0];
+        volume[l] = point[1];
+        beta_fes[l] = beta*getFesGridPntr()->getValue(l);
+      }
     }
-    // Loop over pressures and temperatures
+    // The coefficients of the energy and volume for each pair of temperature and pressure
+    const unsigned int npairs = steps_temp_*steps_pressure_;
+    std::vector<double> energy_coeff(npairs), volume_coeff(npairs);
     for(unsigned i=0; i<steps_temp_; i++) {
       double beta_prime=beta_prime_min + (beta_prime_max-beta_prime_min)*i/(steps_temp_-1);
       for(unsigned j=0; j<steps_pressure_; j++) {
         double pressure_prime=min_press_ + (max_press_-min_press_)*j/(steps_pressure_-1);
-        // Find minimum for this pressure and temperature
-        double minval=DBL_MAX;
-        for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
-          double energy = targetDistGrid().getPoint(l)[0];
-          double volume = targetDistGrid().getPoint(l)[1];
-          double value = getFesGridPntr()->getValue(l);
-          value = beta*value + (beta_prime-beta)*energy + (beta_prime*pressure_prime-beta*press_)*volume;
-          if(value<minval) {
-            minval=value;
-          }
-        }
-        // Now check which energies and volumes are below X kt
-        for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
-          double energy = targetDistGrid().getPoint(l)[0];
-          double volume = targetDistGrid().getPoint(l)[1];
-          double value = getFesGridPntr()->getValue(l);
-          value = beta*value + (beta_prime-beta)*energy + (beta_prime*pressure_prime-beta*press_)*volume - minval;
-          if (value<threshold_) {
-            double value = 1.0;
-            targetDistGrid().setValue(l,value);
-          }
-        }
+        energy_coeff[i*steps_pressure_+j] = beta_prime-beta;
+        volume_coeff[i*steps_pressure_+j] = beta_prime*pressure_prime-beta*press_;
       }
     }
-    std::vector<unsigned> nbin=targetDistGrid().getNbin();
-    std::vector<double> dx=targetDistGrid().getDx();
-    unsigned dim=targetDistGrid().getDimension();
-    // Smoothening
-    for(Grid::index_t index=0; index<targetDistGrid().getSize(); index++) {
-      std::vector<unsigned> indices = targetDistGrid().getIndices(index);
-      std::vector<double> point = targetDistGrid().getPoint(index);
-      double value = targetDistGrid().getValue(index);
-      if (value>(1-1.e-5)) { // Apply only if this grid point was 1.
-        // Apply gaussians around
-        std::vector<int> minBin(dim), maxBin(dim); // These cannot be unsigned
-        // Only consider contributions less than n*sigma bins apart from the actual distance
-        for(unsigned k=0; k<dim; k++) {
-          int deltaBin=std::floor(5*sigma_[k]/dx[k]);
-          minBin[k]=indices[k] - deltaBin;
-          if (minBin[k] < 0) minBin[k]=0;
-          if (minBin[k] > (nbin[k]-1)) minBin[k]=nbin[k]-1;
-          maxBin[k]=indices[k] + deltaBin;
-          if (maxBin[k] > (nbin[k]-1)) maxBin[k]=nbin[k]-1;
-        }
-        if (dim==2) {
-          for(unsigned l=minBin[0]; l<maxBin[0]+1; l++) {
-            for(unsigned m=minBin[1]; m<maxBin[1]+1; m++) {
-              std::vector<unsigned> indices_prime(dim);
-              indices_prime[0]=l;
-              indices_prime[1]=m;
-              Grid::index_t index_prime = targetDistGrid().getIndex(indices_prime);
-              std::vector<double> point_prime = targetDistGrid().getPoint(index_prime);
-              double value_prime = targetDistGrid().getValue(index_prime);
-              // Apply gaussian
-              double gaussian_value = 1;
-              for(unsigned k=0; k<dim; k++) {
-                gaussian_value *= GaussianSwitchingFunc(point_prime[k],point[k],sigma_[k]);
-              }
-              if (value_prime<gaussian_value) {
-                targetDistGrid().setValue(index_prime,gaussian_value);
-              }
-            }
-          }
-        } else if (dim==3) {
-          for(unsigned l=minBin[0]; l<maxBin[0]+1; l++) {
-            for(unsigned m=minBin[1]; m<maxBin[1]+1; m++) {
-              for(unsigned n=minBin[2]; n<maxBin[2]+1; n++) {
-                std::vector<unsigned> indices_prime(dim);
-                indices_prime[0]=l;
-                indices_prime[1]=m;
-                indices_prime[2]=n;
-                Grid::index_t index_prime = targetDistGrid().getIndex(indices_prime);
-                std::vector<double> point_prime = targetDistGrid().getPoint(index_prime);
-                double value_prime = targetDistGrid().getValue(index_prime);
-                // Apply gaussian
-                double gaussian_value = 1;
-                for(unsigned k=0; k<dim; k++) {
-                  gaussian_value *= GaussianSwitchingFunc(point_prime[k],point[k],sigma_[k]);
-                }
-                if (value_prime<gaussian_value) {
-                  targetDistGrid().setValue(index_prime,gaussian_value);
-                }
-              }
-            }
-          }
+    // Find minimum for each pressure and temperature
+    std::vector<double> minval(npairs);
+    #pragma omp parallel for num_threads(OpenMP::getNumThreads())
+    for(unsigned int p=0; p<npairs; p++) {
+      const double ce = energy_coeff[p];
+      const double cv = volume_coeff[p];
+      double pair_minval=DBL_MAX;
+      for(Grid::index_t l=0; l<size; l++) {
+        pair_minval = std::min(pair_minval,beta_fes[l] + ce*energy[l] + cv*volume[l]);
+      }
+      minval[p] = pair_minval;
+    }
+    // Now check which energies and volumes are below X kt for any pressure and temperature
+    #pragma omp parallel for num_threads(OpenMP::getNumThreads())
+    for(Grid::index_t l=0; l<size; l++) {
+      double value = 0.0;
+      for(unsigned int p=0; p<npairs; p++) {
+        if(beta_fes[l] + energy_coeff[p]*energy[l] + volume_coeff[p]*volume[l] - minval[p] < threshold_) {
+          value = 1.0;
+          break;
         }
       }
+      targetDistGrid().setValue(l,value);
     }
+    // Smoothening
+    VesTools::smoothGridWithGaussians(getTargetDistGridPntr(),sigma_);
     // Normalize
-    std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+    const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
     double norm = 0.0;
     for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
       double value = targetDistGrid().getValue(l);
@@ -424,17 +381,6 @@ void TD_MultithermalMultibaric::updateGrid() {
   }
 }
 
-inline
-double TD_MultithermalMultibaric::GaussianSwitchingFunc(const double argument, const double center, const double sigma) const {
-  if(sigma>0.0) {
-    double arg=(argument-center)/sigma;
-    return exp(-0.5*arg*arg);
-  }
-  else {
-    return 0.0;
-  }
-}
-
 
 }
 }
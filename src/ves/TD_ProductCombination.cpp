@@ -31,6 +31,8 @@
 
 #include "GridIntegrationWeights.h"
 
+#include <limits>
+
 
 namespace PLMD {
 
@@ -197,8 +199,9 @@ void TD_ProductCombination::updateGrid() {
   for(unsigned int i=0; i<ndist_; i++) {
     distribution_pntrs_[i]->updateTargetDist();
   }
-  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+  const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
   double norm = 0.0;
+  double log_min_value = std::numeric_limits<double>::max();
   for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
     double value = 1.0;
     for(unsigned int i=0; i<ndist_; i++) {
@@ -207,16 +210,15 @@ void TD_ProductCombination::updateGrid() {
     if(value<0.0 && !isTargetDistGridShiftedToZero()) {plumed_merror(getName()+": The target distribution function gives negative values. You should change the definition of the target distribution to avoid this. You can also use the SHIFT_TO_ZERO keyword to avoid this problem.");}
     norm += integration_weights[l]*value;
     targetDistGrid().setValue(l,value);
-    logTargetDistGrid().setValue(l,-std::log(value));
+    double log_value = -std::log(value);
+    logTargetDistGrid().setValue(l,log_value);
+    if(log_value<log_min_value) {log_min_value=log_value;}
   }
 
-  if(norm>0.0) {
-    targetDistGrid().scaleAllValuesAndDerivatives(1.0/norm);
-  }
-  else if(!isTargetDistGridShiftedToZero()) {
+  if(norm<=0.0 && !isTargetDistGridShiftedToZero()) {
     plumed_merror(getName()+": The target distribution function cannot be normalized proberly. You should change the definition of the target distribution to avoid this. You can also use the SHIFT_TO_ZERO keyword to avoid this problem.");
   }
-  logTargetDistGrid().setMinToZero();
+  scaleTargetDistGridAndShiftLogGrid(norm>0.0 ? 1.0/norm : 1.0,log_min_value);
 }
 
 
@@ -25,8 +25,11 @@
 
 #include "core/ActionRegister.h"
 #include "tools/Grid.h"
+#include "tools/OpenMP.h"
 #include "core/PlumedMain.h"
 
+#include <limits>
+
 
 
 namespace PLMD {
@@ -146,17 +149,19 @@ double TD_WellTempered::getValue(const std::vector<double>& argument) const {
 void TD_WellTempered::updateGrid() {
   double beta_prime = getBeta()/bias_factor_;
   plumed_massert(getFesGridPntr()!=NULL,"the FES grid has to be linked to use TD_WellTempered!");
-  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(getTargetDistGridPntr());
+  const std::vector<double>& integration_weights = getTargetDistGridIntegrationWeights();
   double norm = 0.0;
+  double log_min_value = std::numeric_limits<double>::max();
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads()) reduction(+:norm) reduction(min:log_min_value)
   for(Grid::index_t l=0; l<targetDistGrid().getSize(); l++) {
     double value = beta_prime * getFesGridPntr()->getValue(l);
     logTargetDistGrid().setValue(l,value);
+    if(value<log_min_value) {log_min_value=value;}
     value = exp(-value);
     norm += integration_weights[l]*value;
     targetDistGrid().setValue(l,value);
   }
-  targetDistGrid().scaleAllValuesAndDerivatives(1.0/norm);
-  logTargetDistGrid().setMinToZero();
+  scaleTargetDistGridAndShiftLogGrid(1.0/norm,log_min_value);
 }
 
 
@@ -31,9 +31,13 @@
 #include "tools/Grid.h"
 #include "tools/File.h"
 #include "tools/Keywords.h"
+#include "tools/OpenMP.h"
 
 #include "GridProjWeights.h"
 
+#include <exception>
+#include <limits>
+
 namespace PLMD {
 namespace ves {
 
@@ -57,6 +61,7 @@ TargetDistribution::TargetDistribution(const ActionOptions&ao):
   grid_args_(0),
   targetdist_grid_pntr_(NULL),
   log_targetdist_grid_pntr_(NULL),
+  targetdist_grid_weights_(0),
   targetdist_modifer_pntrs_(0),
   action_pntr_(NULL),
   vesbias_pntr_(NULL),
@@ -184,6 +189,7 @@ void TargetDistribution::setupGrids(const std::vector<Value*>& arguments, const
   grid_args_=arguments;
   targetdist_grid_pntr_ =     new Grid("targetdist",arguments,min,max,nbins,false,false);
   log_targetdist_grid_pntr_ = new Grid("log_targetdist",arguments,min,max,nbins,false,false);
+  targetdist_grid_weights_ = GridIntegrationWeights::getIntegrationWeights(targetdist_grid_pntr_);
   setupAdditionalGrids(arguments,min,max,nbins);
 }
 
@@ -193,21 +199,47 @@ void TargetDistribution::calculateStaticDistributionGrid() {
   // plumed_massert(isStatic(),"this should only be used for static distributions");
   plumed_massert(targetdist_grid_pntr_!=NULL,"the grids have not been setup using setupGrids");
   plumed_massert(log_targetdist_grid_pntr_!=NULL,"the grids have not been setup using setupGrids");
-  for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++)
+  double log_min_value = std::numeric_limits<double>::max();
+  // an error in getValue() cannot leave the parallel region, so the first
+  // one is stored and thrown again after the region
+  std::exception_ptr error = nullptr;
+  #pragma omp parallel num_threads(OpenMP::getNumThreads())
   {
-    std::vector<double> argument = targetdist_grid_pntr_->getPoint(l);
-    double value = getValue(argument);
-    targetdist_grid_pntr_->setValue(l,value);
-    log_targetdist_grid_pntr_->setValue(l,-std::log(value));
+    std::vector<unsigned int> indices(targetdist_grid_pntr_->getDimension());
+    std::vector<double> argument(targetdist_grid_pntr_->getDimension());
+    #pragma omp for reduction(min:log_min_value)
+    for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++)
+    {
+      try {
+        targetdist_grid_pntr_->getIndices(l,indices);
+        targetdist_grid_pntr_->getPoint(indices,argument);
+        double value = getValue(argument);
+        targetdist_grid_pntr_->setValue(l,value);
+        double log_value = -std::log(value);
+        log_targetdist_grid_pntr_->setValue(l,log_value);
+        if(log_value<log_min_value) {log_min_value=log_value;}
+      }
+      catch(...) {
+        #pragma omp critical
+        if(!error) {error = std::current_exception();}
+      }
+    }
   }
-  log_targetdist_grid_pntr_->setMinToZero();
+  if(error) {std::rethrow_exception(error);}
+  scaleTargetDistGridAndShiftLogGrid(1.0,log_min_value);
   static_grid_calculated = true;
 }
 
 
 double TargetDistribution::integrateGrid(const Grid* grid_pntr) {
-  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(grid_pntr);
+  return integrateGrid(grid_pntr,GridIntegrationWeights::getIntegrationWeights(grid_pntr));
+}
+
+
+double TargetDistribution::integrateGrid(const Grid* grid_pntr, const std::vector<double>& integration_weights) {
+  plumed_massert(integration_weights.size()==grid_pntr->getSize(),"the integration weights do not match the grid");
   double sum = 0.0;
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads()) reduction(+:sum)
   for(Grid::index_t l=0; l<grid_pntr->getSize(); l++) {
     sum += integration_weights[l]*grid_pntr->getValue(l);
   }
@@ -216,7 +248,12 @@ double TargetDistribution::integrateGrid(const Grid* grid_pntr) {
 
 
 double TargetDistribution::normalizeGrid(Grid* grid_pntr) {
-  double normalization = TargetDistribution::integrateGrid(grid_pntr);
+  return normalizeGrid(grid_pntr,GridIntegrationWeights::getIntegrationWeights(grid_pntr));
+}
+
+
+double TargetDistribution::normalizeGrid(Grid* grid_pntr, const std::vector<double>& integration_weights) {
+  double normalization = TargetDistribution::integrateGrid(grid_pntr,integration_weights);
   grid_pntr->scaleAllValuesAndDerivatives(1.0/normalization);
   return normalization;
 }
@@ -269,9 +306,31 @@ void TargetDistribution::updateTargetDist() {
   if(shift_targetdist_to_zero_ && !(bias_cutoff_active_)) {setMinimumOfTargetDistGridToZero();}
   if(force_normalization_ && !(bias_cutoff_active_) ) {normalizeTargetDistGrid();}
   //
-  // if(check_normalization_ && !force_normalization_ && !shift_targetdist_to_zero_){
-  if(check_normalization_ && !(bias_cutoff_active_)) {
-    double normalization = integrateGrid(targetdist_grid_pntr_);
+  checkTargetDistGrid();
+  //
+}
+
+
+/*
+The checks of the normalization, of negative values and of NaN and Inf values
+of the target distribution grid are done in a single pass over the grid.
+*/
+void TargetDistribution::checkTargetDistGrid() {
+  const bool check_normalization = check_normalization_ && !(bias_cutoff_active_);
+  if(!check_normalization && !check_nonnegative_ && !check_nan_inf_) {return;}
+  //
+  double normalization = 0.0;
+  double grid_min_value = std::numeric_limits<double>::max();
+  bool nan_inf_found = false;
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads()) reduction(+:normalization) reduction(min:grid_min_value) reduction(||:nan_inf_found)
+  for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++) {
+    double value = targetdist_grid_pntr_->getValue(l);
+    normalization += targetdist_grid_weights_[l]*value;
+    if(value<grid_min_value) {grid_min_value=value;}
+    if(std::isnan(value) || std::isinf(value)) {nan_inf_found=true;}
+  }
+  //
+  if(check_normalization) {
     const double normalization_thrshold = 0.1;
     if(normalization < 1.0-normalization_thrshold || normalization > 1.0+normalization_thrshold) {
       std::string norm_str; Tools::convert(normalization,norm_str);
@@ -282,16 +341,14 @@ void TargetDistribution::updateTargetDist() {
   //
   if(check_nonnegative_) {
     const double nonnegative_thrshold = -0.02;
-    double grid_min_value = targetdist_grid_pntr_->getMinValue();
     if(grid_min_value<nonnegative_thrshold) {
       std::string grid_min_value_str; Tools::convert(grid_min_value,grid_min_value_str);
       std::string msg = "the target distribution grid has negative values, the lowest value is: " + grid_min_value_str + " - You can avoid this problem by using the SHIFT_TO_ZERO keyword";
       warning(msg);
     }
   }
-  //
-  if(check_nan_inf_) {checkNanAndInf();}
-  //
+  // only go through the grid again to find the point if there is a problem
+  if(check_nan_inf_ && nan_inf_found) {checkNanAndInf();}
 }
 
 
@@ -302,8 +359,9 @@ void TargetDistribution::updateBiasCutoffForTargetDistGrid() {
   // plumed_massert(log_targetdist_grid_pntr_!=NULL,"the grids have not been setup using setupGrids");
   plumed_massert(getBiasWithoutCutoffGridPntr()!=NULL,"the bias without cutoff grid has to be linked");
   //
-  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(targetdist_grid_pntr_);
+  const std::vector<double>& integration_weights = targetdist_grid_weights_;
   double norm = 0.0;
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads()) reduction(+:norm)
   for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++)
   {
     double value = targetdist_grid_pntr_->getValue(l);
@@ -327,35 +385,92 @@ void TargetDistribution::applyTargetDistModiferToGrid(TargetDistModifer* modifer
   // plumed_massert(targetdist_grid_pntr_!=NULL,"the grids have not been setup using setupGrids");
   // plumed_massert(log_targetdist_grid_pntr_!=NULL,"the grids have not been setup using setupGrids");
   //
-  std::vector<double> integration_weights = GridIntegrationWeights::getIntegrationWeights(targetdist_grid_pntr_);
   double norm = 0.0;
+  double log_min_value = std::numeric_limits<double>::max();
+  // as in calculateStaticDistributionGrid, errors are thrown after the parallel region
+  std::exception_ptr error = nullptr;
+  #pragma omp parallel num_threads(OpenMP::getNumThreads())
+  {
+    std::vector<unsigned int> indices(targetdist_grid_pntr_->getDimension());
+    std::vector<double> cv_values(targetdist_grid_pntr_->getDimension());
+    #pragma omp for reduction(+:norm) reduction(min:log_min_value)
+    for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++)
+    {
+      try {
+        double value = targetdist_grid_pntr_->getValue(l);
+        targetdist_grid_pntr_->getIndices(l,indices);
+        targetdist_grid_pntr_->getPoint(indices,cv_values);
+        value = modifer_pntr->getModifedTargetDistValue(value,cv_values);
+        norm += targetdist_grid_weights_[l]*value;
+        targetdist_grid_pntr_->setValue(l,value);
+        double log_value = -std::log(value);
+        log_targetdist_grid_pntr_->setValue(l,log_value);
+        if(log_value<log_min_value) {log_min_value=log_value;}
+      }
+      catch(...) {
+        #pragma omp critical
+        if(!error) {error = std::current_exception();}
+      }
+    }
+  }
+  if(error) {std::rethrow_exception(error);}
+  scaleTargetDistGridAndShiftLogGrid(1.0/norm,log_min_value);
+}
+
+
+void TargetDistribution::scaleTargetDistGridAndShiftLogGrid(const double targetdist_scalef, const double log_min_value) {
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads())
   for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++)
   {
-    double value = targetdist_grid_pntr_->getValue(l);
-    std::vector<double> cv_values = targetdist_grid_pntr_->getPoint(l);
-    value = modifer_pntr->getModifedTargetDistValue(value,cv_values);
-    norm += integration_weights[l]*value;
-    targetdist_grid_pntr_->setValue(l,value);
-    log_targetdist_grid_pntr_->setValue(l,-std::log(value));
+    targetdist_grid_pntr_->setValue(l,targetdist_scalef*targetdist_grid_pntr_->getValue(l));
+    log_targetdist_grid_pntr_->setValue(l,log_targetdist_grid_pntr_->getValue(l)-log_min_value);
   }
-  targetdist_grid_pntr_->scaleAllValuesAndDerivatives(1.0/norm);
-  log_targetdist_grid_pntr_->setMinToZero();
 }
 
 
 void TargetDistribution::updateLogTargetDistGrid() {
+  double log_min_value = std::numeric_limits<double>::max();
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads()) reduction(min:log_min_value)
   for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++)
   {
-    log_targetdist_grid_pntr_->setValue(l,-std::log(targetdist_grid_pntr_->getValue(l)));
+    double log_value = -std::log(targetdist_grid_pntr_->getValue(l));
+    log_targetdist_grid_pntr_->setValue(l,log_value);
+    if(log_value<log_min_value) {log_min_value=log_value;}
   }
-  log_targetdist_grid_pntr_->setMinToZero();
+  scaleTargetDistGridAndShiftLogGrid(1.0,log_min_value);
 }
 
 
+/*
+Shifts the minimum of the target distribution to zero, normalizes it and
+updates the log grid. The shift and the normalization integral are done in
+the same pass, and the scaling in the same pass as the log grid.
+*/
 void TargetDistribution::setMinimumOfTargetDistGridToZero() {
-  targetDistGrid().setMinToZero();
-  normalizeTargetDistGrid();
-  updateLogTargetDistGrid();
+  double min_value = std::numeric_limits<double>::max();
+  double max_value = -std::numeric_limits<double>::max();
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads()) reduction(min:min_value) reduction(max:max_value)
+  for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++) {
+    double value = targetdist_grid_pntr_->getValue(l);
+    if(value<min_value) {min_value=value;}
+    if(value>max_value) {max_value=value;}
+  }
+  double normalization = 0.0;
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads()) reduction(+:normalization)
+  for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++) {
+    normalization += targetdist_grid_weights_[l]*(targetdist_grid_pntr_->getValue(l)-min_value);
+  }
+  if(normalization<0.0) {plumed_merror(getName()+": something went wrong trying to normalize the target distribution, integrating over it gives a negative value.");}
+  const double scalef = 1.0/normalization;
+  // the largest value of the target distribution gives the minimum of the log grid,
+  // so the shift, the scaling and the log grid are all done in a single pass
+  const double log_min_value = -std::log(scalef*(max_value-min_value));
+  #pragma omp parallel for num_threads(OpenMP::getNumThreads())
+  for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++) {
+    double value = scalef*(targetdist_grid_pntr_->getValue(l)-min_value);
+    targetdist_grid_pntr_->setValue(l,value);
+    log_targetdist_grid_pntr_->setValue(l,-std::log(value)-log_min_value);
+  }
 }
 
 
@@ -374,6 +489,18 @@ void TargetDistribution::readInRestartTargetDistGrid(const std::string& grid_fna
   updateLogTargetDistGrid();
 }
 
+
+void TargetDistribution::restartTargetDistGrid(const std::vector<double>& targetdist_values) {
+  plumed_massert(isDynamic(),"this should only be used for dynamically updated target distributions!");
+  if(targetdist_values.size()!=targetdist_grid_pntr_->getSize()) {
+    plumed_merror(getName()+": problem with restarting the target distribution from a checkpoint, the grid is not of the correct size!");
+  }
+  for(Grid::index_t l=0; l<targetdist_grid_pntr_->getSize(); l++) {
+    targetdist_grid_pntr_->setValue(l,targetdist_values[l]);
+  }
+  updateLogTargetDistGrid();
+}
+
 void TargetDistribution::clearLogTargetDistGrid() {
   log_targetdist_grid_pntr_->clear();
 }
@@ -68,6 +68,9 @@ private:
   //
   Grid* targetdist_grid_pntr_;
   Grid* log_targetdist_grid_pntr_;
+  // integration weights of the target distribution grid, the grid is
+  // fixed after setupGrids so they are only calculated once
+  std::vector<double> targetdist_grid_weights_;
   //
   std::vector<TargetDistModifer*> targetdist_modifer_pntrs_;
   //
@@ -90,6 +93,7 @@ private:
   void calculateStaticDistributionGrid();
   void updateBiasCutoffForTargetDistGrid();
   void checkNanAndInf();
+  void checkTargetDistGrid();
 protected:
   void setStatic() {type_=static_targetdist;}
   void setDynamic() {type_=dynamic_targetdist;}
@@ -110,6 +114,10 @@ protected:
   //
   Grid& targetDistGrid() const {return *targetdist_grid_pntr_;}
   Grid& logTargetDistGrid() const {return *log_targetdist_grid_pntr_;}
+  const std::vector<double>& getTargetDistGridIntegrationWeights() const {return targetdist_grid_weights_;}
+  // scale the target distribution grid and shift the minimum of the log grid
+  // to zero in a single pass over the grids
+  void scaleTargetDistGridAndShiftLogGrid(const double targetdist_scalef, const double log_min_value);
   //
   Grid* getBiasGridPntr() const {return bias_grid_pntr_;}
   Grid* getBiasWithoutCutoffGridPntr() const {return bias_withoutcutoff_grid_pntr_;}
@@ -160,6 +168,8 @@ public:
   //
   void clearLogTargetDistGrid();
   // calculate the target distribution itself
+  // the grids are filled by calling getValue() from several OpenMP threads at
+  // the same time, so it must be thread-safe in all derived classes
   virtual double getValue(const std::vector<double>&) const = 0;
   //
   void setupGrids(const std::vector<Value*>&, const std::vector<std::string>&, const std::vector<std::string>&, const std::vector<unsigned int>&);
@@ -169,9 +179,12 @@ public:
   void updateTargetDist();
   //
   void readInRestartTargetDistGrid(const std::string&);
+  void restartTargetDistGrid(const std::vector<double>&);
   //
   static double integrateGrid(const Grid*);
+  static double integrateGrid(const Grid*, const std::vector<double>&);
   static double normalizeGrid(Grid*);
+  static double normalizeGrid(Grid*, const std::vector<double>&);
   static Grid getMarginalDistributionGrid(Grid*, const std::vector<std::string>&);
   // empty standard action stuff
   void update() {};
@@ -196,7 +209,7 @@ Action* TargetDistribution::getPntrToAction() const {
 
 inline
 void TargetDistribution::normalizeTargetDistGrid() {
-  double normalization = normalizeGrid(targetdist_grid_pntr_);
+  double normalization = normalizeGrid(targetdist_grid_pntr_,targetdist_grid_weights_);
   if(normalization<0.0) {plumed_merror(getName()+": something went wrong trying to normalize the target distribution, integrating over it gives a negative value.");}
 }
 
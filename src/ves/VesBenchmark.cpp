@@ -0,0 +1,382 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+
+#include "BasisFunctions.h"
+#include "LinearBasisSetExpansion.h"
+#include "CoeffsVector.h"
+
+#include "cltools/CLTool.h"
+#include "cltools/CLToolRegister.h"
+#include "tools/Vector.h"
+#include "tools/Random.h"
+#include "tools/Communicator.h"
+#include "tools/Exception.h"
+#include "tools/OpenMP.h"
+#include "tools/OFile.h"
+#include "core/PlumedMain.h"
+#include "core/ActionSet.h"
+#include "core/Value.h"
+
+#include <string>
+#include <cstdio>
+#include <vector>
+#include <chrono>
+
+
+namespace PLMD {
+namespace ves {
+
+//+PLUMEDOC VES_TOOLS ves_benchmark
+/*
+Benchmark the per-step and per-iteration cost of VES linear basis set expansions.
+
+This tool runs \ref VES_LINEAR_EXPANSION together with one or more optimizers
+on synthetic trajectories of a single particle that performs a random walk
+within the interval [-1,1] in one to three dimensions. It loops over all
+combinations of the dimensions, basis functions, orders of the basis functions,
+optimizers and types of Hessian given in the input and writes one line for
+each case to the output file. The following fields are written:
+- md_ns_per_step: the average wall time of a MD step without an update of the coefficients, in ns
+- opt_ms_per_iteration: the additional wall time of a MD step where the coefficients are updated, in ms
+- expansion_ns_per_eval: the wall time of a single evaluation of the bias and forces of the expansion, in ns
+- workspace_reallocations: the number of times the work buffers of the expansion had to be reallocated during these evaluations, this should be zero
+- grid_ms_per_refresh: the wall time of a refresh of the bias grid, in ms
+
+The last three fields do not depend on the optimizer and are measured directly
+on a \ref LinearBasisSetExpansion outside of the MD loop.
+
+The MPI parallelization is benchmarked by running the tool with several MPI
+processes, for example with mpirun, the number of ranks and OpenMP threads
+used are written to the output file. Cases that are not supported, for example
+the full Hessian with an optimizer that only supports the diagonal part, are
+skipped.
+
+\par Examples
+
+The following input benchmarks Legendre polynomials and cubic B-splines in one
+and two dimensions with the averaged stochastic gradient descent and the dummy
+optimizer
+\verbatim
+nstep              2000
+optimizer_stride   500
+dimensions         1,2
+basis_functions    BF_LEGENDRE,BF_CUBIC_B_SPLINES
+orders             10,20
+optimizer_1        {OPT_AVERAGED_SGD STEPSIZE=0.1}
+optimizer_2        {OPT_DUMMY}
+hessians           diagonal,full
+output             benchmark.data
+\endverbatim
+This input is then run by using the following command.
+\verbatim
+plumed ves_benchmark input
+\endverbatim
+
+*/
+//+ENDPLUMEDOC
+
+class VesBenchmark : public PLMD::CLTool {
+public:
+  std::string description() const {return "benchmark VES linear basis set expansions and optimizers";}
+  static void registerKeywords( Keywords& keys );
+  explicit VesBenchmark( const CLToolOptions& co );
+  int main( FILE* in, FILE* out, PLMD::Communicator& pc);
+private:
+  // timing of the expansion outside of the MD loop
+  struct ExpansionTimings {
+    size_t ncoeffs;
+    double ns_per_eval;
+    unsigned long int reallocations;
+    double ms_per_grid_refresh;
+  };
+  static std::vector<Vector> getTrajectory(const unsigned int, const unsigned int, const double, const int);
+  static std::vector<std::string> getBasisFunctionsLines(const std::string&, const unsigned int, const unsigned int);
+  static ExpansionTimings timeExpansion(PlumedMain&, const unsigned int, const std::vector<Vector>&, const unsigned int, const unsigned int, const int, Communicator&);
+};
+
+PLUMED_REGISTER_CLTOOL(VesBenchmark,"ves_benchmark")
+
+void VesBenchmark::registerKeywords( Keywords& keys ) {
+  CLTool::registerKeywords( keys );
+  keys.add("compulsory","nstep","2000","The number of MD steps that are performed for each case.");
+  keys.add("compulsory","optimizer_stride","500","How often the coefficients are updated, given as the number of MD steps.");
+  keys.add("compulsory","random_seed","5293818","Value of random number seed used for the synthetic trajectories.");
+  keys.add("compulsory","step_size","0.05","The standard deviation of the displacement of the random walk in each MD step.");
+  keys.add("compulsory","dimensions","1,2","Comma separated list of the number of dimensions to benchmark, supports 1 to 3.");
+  keys.add("compulsory","basis_functions","BF_LEGENDRE,BF_FOURIER,BF_CUBIC_B_SPLINES","Comma separated list of the basis functions to benchmark, the same basis functions are used for all dimensions.");
+  keys.add("compulsory","orders","10,20","Comma separated list of the orders of the basis functions to benchmark.");
+  keys.add("compulsory","grid_bins","100","The number of grid bins used in each dimension.");
+  keys.add("compulsory","grid_refreshes","5","The number of refreshes of the bias grid that are timed.");
+  keys.add("compulsory","optimizer_1","{OPT_AVERAGED_SGD STEPSIZE=0.1}","The first optimizer to benchmark given with its keywords, BIAS, STRIDE and COEFFS_FILE are set by the tool.");
+  keys.add("optional","optimizer_2","The second optimizer to benchmark if needed.");
+  keys.add("optional","optimizer_3","The third optimizer to benchmark if needed.");
+  keys.add("compulsory","hessians","diagonal","Comma separated list of the types of Hessian to benchmark, either diagonal or full.");
+  keys.add("compulsory","output","benchmark.data","Filename of the output file.");
+}
+
+
+VesBenchmark::VesBenchmark( const CLToolOptions& co ):
+  CLTool(co)
+{
+  inputdata=ifile; //commandline;
+}
+
+
+// random walk in [-1,1] with reflecting walls
+std::vector<Vector> VesBenchmark::getTrajectory(const unsigned int nstep, const unsigned int dim, const double step_size, const int seed) {
+  Random random;
+  random.setSeed(seed);
+  std::vector<Vector> trajectory(nstep+1);
+  Vector pos;
+  for(unsigned int i=0; i<nstep+1; i++) {
+    for(unsigned int k=0; k<dim; k++) {
+      pos[k] += step_size*random.Gaussian();
+      if(pos[k]>1.0) {pos[k] = 2.0-pos[k];}
+      if(pos[k]<-1.0) {pos[k] = -2.0-pos[k];}
+    }
+    trajectory[i] = pos;
+  }
+  return trajectory;
+}
+
+
+std::vector<std::string> VesBenchmark::getBasisFunctionsLines(const std::string& basisf, const unsigned int dim, const unsigned int order) {
+  std::string order_str; Tools::convert(order,order_str);
+  std::vector<std::string> lines(dim);
+  for(unsigned int k=0; k<dim; k++) {
+    std::string is; Tools::convert(k+1,is);
+    lines[k] = "bf"+is+": "+basisf+" ORDER="+order_str+" MINIMUM=-1.0 MAXIMUM=1.0";
+  }
+  return lines;
+}
+
+
+VesBenchmark::ExpansionTimings VesBenchmark::timeExpansion(PlumedMain& plumed, const unsigned int dim, const std::vector<Vector>& trajectory, const unsigned int grid_bins, const unsigned int grid_refreshes, const int seed, Communicator& pc) {
+  std::vector<BasisFunctions*> basisf_pntrs(dim);
+  std::vector<Value*> args(dim);
+  for(unsigned int k=0; k<dim; k++) {
+    std::string is; Tools::convert(k+1,is);
+    basisf_pntrs[k] = plumed.getActionSet().selectWithLabel<BasisFunctions*>("bf"+is);
+    args[k] = new Value(NULL,"arg"+is,false);
+    args[k]->setNotPeriodic();
+  }
+  CoeffsVector* coeffs_pntr = new CoeffsVector("bench.coeffs",args,basisf_pntrs,pc,false);
+  Random random;
+  random.setSeed(seed);
+  for(size_t i=0; i<coeffs_pntr->numberOfCoeffs(); i++) {
+    coeffs_pntr->setValue(i,0.1*random.Gaussian());
+  }
+  LinearBasisSetExpansion* expansion_pntr = new LinearBasisSetExpansion("bench",1.0,pc,args,basisf_pntrs,coeffs_pntr);
+  //
+  ExpansionTimings timings;
+  timings.ncoeffs = coeffs_pntr->numberOfCoeffs();
+  std::vector<double> cv_values(dim);
+  std::vector<double> forces(dim);
+  std::vector<double> coeffsderivs_values(timings.ncoeffs);
+  bool all_inside = true;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(unsigned int i=0; i<trajectory.size(); i++) {
+    for(unsigned int k=0; k<dim; k++) {cv_values[k] = trajectory[i][k];}
+    expansion_pntr->getBiasAndForces(cv_values,all_inside,forces,coeffsderivs_values);
+  }
+  std::chrono::duration<double,std::nano> eval_time = std::chrono::steady_clock::now()-start;
+  timings.ns_per_eval = eval_time.count()/trajectory.size();
+  timings.reallocations = expansion_pntr->getWorkspaceReallocationCounter();
+  //
+  expansion_pntr->setGridBins(grid_bins);
+  expansion_pntr->setupBiasGrid(true);
+  start = std::chrono::steady_clock::now();
+  for(unsigned int i=0; i<grid_refreshes; i++) {
+    expansion_pntr->updateBiasGrid();
+  }
+  std::chrono::duration<double,std::milli> grid_time = std::chrono::steady_clock::now()-start;
+  timings.ms_per_grid_refresh = grid_refreshes>0 ? grid_time.count()/grid_refreshes : 0.0;
+  //
+  delete expansion_pntr;
+  delete coeffs_pntr;
+  for(unsigned int k=0; k<dim; k++) {delete args[k];}
+  return timings;
+}
+
+
+int VesBenchmark::main( FILE* in, FILE* out, PLMD::Communicator& pc) {
+  unsigned int nsteps;
+  parse("nstep",nsteps);
+  unsigned int optimizer_stride;
+  parse("optimizer_stride",optimizer_stride);
+  if(optimizer_stride==0) {error("optimizer_stride should be larger than zero");}
+  int seed;
+  parse("random_seed",seed);
+  if(seed>0) {seed = -seed;}
+  double step_size;
+  parse("step_size",step_size);
+  std::vector<unsigned int> dimensions;
+  parseVector("dimensions",dimensions);
+  for(unsigned int i=0; i<dimensions.size(); i++) {
+    if(dimensions[i]<1 || dimensions[i]>3) {error("only one to three dimensions are supported");}
+  }
+  std::vector<std::string> basis_functions;
+  parseVector("basis_functions",basis_functions);
+  std::vector<unsigned int> orders;
+  parseVector("orders",orders);
+  unsigned int grid_bins;
+  parse("grid_bins",grid_bins);
+  unsigned int grid_refreshes;
+  parse("grid_refreshes",grid_refreshes);
+  std::vector<std::string> optimizers;
+  for(unsigned int i=1; i<=3; i++) {
+    std::string is; Tools::convert(i,is);
+    std::string optimizer;
+    parse("optimizer_"+is,optimizer);
+    if(optimizer.size()==0) {continue;}
+    if(optimizer.at(0)=='{' && optimizer.at(optimizer.size()-1)=='}') {
+      optimizer = optimizer.substr(1,optimizer.size()-2);
+    }
+    optimizers.push_back(optimizer);
+  }
+  std::vector<std::string> hessians;
+  parseVector("hessians",hessians);
+  for(unsigned int i=0; i<hessians.size(); i++) {
+    if(hessians[i]!="diagonal" && hessians[i]!="full") {error("the types of Hessian should be either diagonal or full");}
+  }
+  std::string output_fname;
+  parse("output",output_fname);
+
+  OFile ofile;
+  ofile.link(pc);
+  ofile.open(output_fname);
+  ofile.fmtField(" %.6e");
+
+  FILE* file_dummy = fopen("/dev/null","w+");
+  int nranks = pc.Get_size();
+  int nthreads = OpenMP::getNumThreads();
+
+  for(unsigned int id=0; id<dimensions.size(); id++) {
+    const unsigned int dim = dimensions[id];
+    const std::vector<Vector> trajectory = getTrajectory(nsteps,dim,step_size,seed);
+    std::string args_str = "p.x";
+    std::string basisf_str = "bf1";
+    if(dim>1) {args_str += ",p.y"; basisf_str += ",bf2";}
+    if(dim>2) {args_str += ",p.z"; basisf_str += ",bf3";}
+    for(unsigned int ib=0; ib<basis_functions.size(); ib++) {
+      for(unsigned int io=0; io<orders.size(); io++) {
+        const std::vector<std::string> basisf_lines = getBasisFunctionsLines(basis_functions[ib],dim,orders[io]);
+        bool expansion_timed = false;
+        ExpansionTimings timings;
+        for(unsigned int iopt=0; iopt<optimizers.size(); iopt++) {
+          for(unsigned int ih=0; ih<hessians.size(); ih++) {
+            std::string optimizer_name = optimizers[iopt].substr(0,optimizers[iopt].find(' '));
+            std::string stride_str; Tools::convert(optimizer_stride,stride_str);
+            std::string optimizer_line = optimizers[iopt]+" BIAS=ves STRIDE="+stride_str+" COEFFS_FILE=/dev/null LABEL=opt";
+            if(hessians[ih]=="full") {optimizer_line += " FULL_HESSIAN";}
+            //
+            PlumedMain* plumed = new PlumedMain;
+            int natoms = 1;
+            double timestep = 1.0;
+            plumed->cmd("setNoVirial");
+            plumed->cmd("setNatoms",&natoms);
+            plumed->cmd("setMDEngine","ves_benchmark");
+            plumed->cmd("setTimestep",&timestep);
+            plumed->cmd("setLog",file_dummy);
+            if(Communicator::initialized()) {plumed->cmd("setMPIComm",&pc.Get_comm());}
+            plumed->cmd("init");
+            try {
+              plumed->readInputLine("UNITS NATURAL");
+              plumed->readInputLine("p: POSITION ATOM=1 NOPBC");
+              for(unsigned int k=0; k<basisf_lines.size(); k++) {plumed->readInputLine(basisf_lines[k]);}
+              std::string grid_bins_str; Tools::convert(grid_bins,grid_bins_str);
+              std::string grid_str = grid_bins_str;
+              for(unsigned int k=1; k<dim; k++) {grid_str += ","+grid_bins_str;}
+              plumed->readInputLine("ves: VES_LINEAR_EXPANSION ARG="+args_str+" BASIS_FUNCTIONS="+basisf_str+" TEMP=1.0 GRID_BINS="+grid_str);
+              plumed->readInputLine(optimizer_line);
+            }
+            catch(const Exception& e) {
+              if(pc.Get_rank()==0) {
+                fprintf(out,"skipping %uD %s order %u with %s and %s Hessian as it is not supported\n",dim,basis_functions[ib].c_str(),orders[io],optimizer_name.c_str(),hessians[ih].c_str());
+              }
+              delete plumed;
+              continue;
+            }
+            //
+            if(!expansion_timed) {
+              timings = timeExpansion(*plumed,dim,trajectory,grid_bins,grid_refreshes,seed,pc);
+              expansion_timed = true;
+            }
+            //
+            std::vector<double> masses(1,1.0);
+            std::vector<Vector> positions(1), forces(1);
+            double energy = 0.0;
+            double md_time = 0.0;
+            double opt_time = 0.0;
+            unsigned int n_md = 0;
+            unsigned int n_opt = 0;
+            for(unsigned int istep=0; istep<trajectory.size(); istep++) {
+              int step = istep;
+              positions[0] = trajectory[istep];
+              forces[0].zero();
+              std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+              plumed->cmd("setStep",&step);
+              plumed->cmd("setMasses",&masses[0]);
+              plumed->cmd("setForces",&forces[0]);
+              plumed->cmd("setEnergy",&energy);
+              plumed->cmd("setPositions",&positions[0]);
+              plumed->cmd("calc");
+              std::chrono::duration<double,std::nano> step_time = std::chrono::steady_clock::now()-start;
+              if(istep>0 && istep%optimizer_stride==0) {
+                opt_time += step_time.count();
+                n_opt++;
+              }
+              else {
+                md_time += step_time.count();
+                n_md++;
+              }
+            }
+            delete plumed;
+            //
+            double md_ns_per_step = n_md>0 ? md_time/n_md : 0.0;
+            double opt_ms_per_iteration = n_opt>0 ? (opt_time/n_opt-md_ns_per_step)*1.0e-6 : 0.0;
+            ofile.printField("dimensions",static_cast<int>(dim));
+            ofile.printField("basis_functions"," "+basis_functions[ib]);
+            ofile.printField("order",static_cast<int>(orders[io]));
+            ofile.printField("ncoeffs",static_cast<int>(timings.ncoeffs));
+            ofile.printField("optimizer"," "+optimizer_name);
+            ofile.printField("hessian"," "+hessians[ih]);
+            ofile.printField("mpi_ranks",nranks);
+            ofile.printField("openmp_threads",nthreads);
+            ofile.printField("md_ns_per_step",md_ns_per_step);
+            ofile.printField("opt_ms_per_iteration",opt_ms_per_iteration);
+            ofile.printField("expansion_ns_per_eval",timings.ns_per_eval);
+            ofile.printField("workspace_reallocations",static_cast<int>(timings.reallocations));
+            ofile.printField("grid_ms_per_refresh",timings.ms_per_grid_refresh);
+            ofile.printField();
+          }
+        }
+      }
+    }
+  }
+  ofile.close();
+  fclose(file_dummy);
+  return 0;
+}
+
+}
+}
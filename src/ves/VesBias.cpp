@@ -21,19 +21,26 @@
 +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
 
 #include "VesBias.h"
+#include "AsyncOutputWriter.h"
 #include "BasisFunctions.h"
 #include "CoeffsVector.h"
 #include "CoeffsMatrix.h"
+#include "CoeffsBinaryFile.h"
 #include "Optimizer.h"
 #include "FermiSwitchingFunction.h"
 #include "VesTools.h"
 #include "TargetDistribution.h"
+#include "VesCheckpoint.h"
 
 #include "tools/Communicator.h"
+#include "tools/OpenMP.h"
 #include "core/ActionSet.h"
 #include "core/PlumedMain.h"
 #include "core/Atoms.h"
 #include "tools/File.h"
+#include "tools/Grid.h"
+
+#include <memory>
 
 
 namespace PLMD {
@@ -60,6 +67,18 @@ VesBias::VesBias(const ActionOptions&ao):
   compute_hessian_(false),
   diagonal_hessian_(true),
   aver_counters(0),
+  hessian_batch_size_(16),
+  sampled_batch_(0),
+  batch_counters_(0),
+  deferred_averages_(false),
+  sampled_averages_compensation_(0),
+  sampled_cross_averages_compensation_(0),
+  hessian_rows_begin_(0),
+  hessian_rows_end_(0),
+  mwalkers_send_buffers_(0),
+  mwalkers_recv_buffers_(0),
+  mwalkers_requests_(0),
+  mwalkers_sum_pending_(0),
   kbt_(0.0),
   targetdist_pntrs_(0),
   dynamic_targetdist_(false),
@@ -107,6 +126,11 @@ VesBias::VesBias(const ActionOptions&ao):
     parseVector("COEFFS",coeffs_fnames);
   }
 
+  parseFlag("DEFERRED_AVERAGES",deferred_averages_);
+  if(deferred_averages_) {
+    log.printf("  the sampled averages are accumulated as compensated sums and normalized when the coefficients are updated\n");
+  }
+
 
   if(keywords.exists("ARG_SET") && !keywords.exists("ARG")) {
     std::vector<Value*> arg;
@@ -276,6 +300,9 @@ VesBias::VesBias(const ActionOptions&ao):
 
 
 VesBias::~VesBias() {
+  for(unsigned int i=0; i<mwalkers_sum_pending_.size(); i++) {
+    if(mwalkers_sum_pending_[i]) {mwalkers_requests_[i].wait();}
+  }
   for(unsigned int i=0; i<coeffs_pntrs_.size(); i++) {
     delete coeffs_pntrs_[i];
   }
@@ -298,6 +325,7 @@ void VesBias::registerKeywords( Keywords& keys ) {
   Bias::registerKeywords(keys);
   keys.reserve("numbered","ARG_SET","similar as ARG for other biases but allows to define different argument sets that will be used");
   keys.add("optional","TEMP","the system temperature - this is needed if the MD code does not pass the temperature to PLUMED.");
+  keys.addFlag("DEFERRED_AVERAGES",false,"accumulate the sampled averages of the basis functions as compensated (Kahan) sums and only normalize them when the coefficients are updated. This avoids a division per coefficient at every step.");
   //
   keys.reserve("optional","COEFFS","read in the coefficients from files.");
   //
@@ -433,6 +461,17 @@ void VesBias::initializeCoeffs(CoeffsVector* coeffs_pntr_in) {
   //
   aver_counters.push_back(0);
   //
+  sampled_averages_compensation_.push_back(std::vector<double>(coeffs_pntr_in->numberOfCoeffs(),0.0));
+  sampled_cross_averages_compensation_.push_back(std::vector<double>(coeffs_pntr_in->numberOfCoeffs(),0.0));
+  sampled_batch_.push_back(std::vector<double>(0));
+  batch_counters_.push_back(0);
+  hessian_rows_begin_.push_back(0);
+  hessian_rows_end_.push_back(0);
+  mwalkers_send_buffers_.push_back(std::vector<double>(0));
+  mwalkers_recv_buffers_.push_back(std::vector<double>(0));
+  mwalkers_requests_.push_back(Communicator::Request());
+  mwalkers_sum_pending_.push_back(false);
+  //
   ncoeffssets_++;
 }
 
@@ -453,11 +492,17 @@ bool VesBias::readCoeffsFromFiles() {
       IFile ifile;
       ifile.link(*this);
       ifile.open(coeffs_fnames[i]);
-      if(!ifile.FieldExist(coeffs_pntrs_[i]->getDataLabel())) {
-        std::string error_msg = "Problem with reading coefficients from file " + ifile.getPath() + ": no field with name " + coeffs_pntrs_[i]->getDataLabel() + "\n";
-        plumed_merror(error_msg);
+      size_t ncoeffs_read = 0;
+      if(CoeffsBinaryFile::isBinaryFile(ifile.getPath())) {
+        ncoeffs_read = coeffs_pntrs_[i]->readFromBinaryFile(ifile.getPath());
+      }
+      else {
+        if(!ifile.FieldExist(coeffs_pntrs_[i]->getDataLabel())) {
+          std::string error_msg = "Problem with reading coefficients from file " + ifile.getPath() + ": no field with name " + coeffs_pntrs_[i]->getDataLabel() + "\n";
+          plumed_merror(error_msg);
+        }
+        ncoeffs_read = coeffs_pntrs_[i]->readFromFile(ifile,false,false);
       }
-      size_t ncoeffs_read = coeffs_pntrs_[i]->readFromFile(ifile,false,false);
       coeffs_pntrs_[i]->setIterationCounterAndTime(0,getTime());
       if(ncoeffssets_==1) {
         log.printf("%s (read %zu of %zu values)\n", ifile.getPath().c_str(),ncoeffs_read,coeffs_pntrs_[i]->numberOfCoeffs());
@@ -473,9 +518,11 @@ bool VesBias::readCoeffsFromFiles() {
 }
 
 
-void VesBias::updateGradientAndHessian(const bool use_mwalkers_mpi) {
+void VesBias::updateGradientAndHessian(const bool use_mwalkers_mpi, const bool mwalkers_nonblocking) {
   for(unsigned int k=0; k<ncoeffssets_; k++) {
     //
+    if(deferred_averages_) {normalizeDeferredAverages(k);}
+    if(!diagonal_hessian_) {addBatchToSampledCrossAverages(k);}
     comm.Sum(sampled_averages[k]);
     comm.Sum(sampled_cross_averages[k]);
     unsigned int total_samples = aver_counters[k];
@@ -483,9 +530,14 @@ void VesBias::updateGradientAndHessian(const bool use_mwalkers_mpi) {
     if(use_mwalkers_mpi) {
       double walker_weight=1.0;
       if(aver_counters[k]==0) {walker_weight=0.0;}
-      multiSimSumAverages(k,walker_weight);
-      if(comm.Get_rank()==0) {multi_sim_comm.Sum(total_samples);}
-      comm.Bcast(total_samples,0);
+      if(mwalkers_nonblocking) {
+        multiSimSumAveragesNonBlocking(k,walker_weight,total_samples);
+      }
+      else {
+        multiSimSumAverages(k,walker_weight);
+        if(comm.Get_rank()==0) {multi_sim_comm.Sum(total_samples);}
+        comm.Bcast(total_samples,0);
+      }
     }
     // NOTE: this assumes that all walkers have the same TargetDist, might change later on!!
     Gradient(k).setValues( TargetDistAverages(k) - sampled_averages[k] );
@@ -540,6 +592,92 @@ void VesBias::multiSimSumAverages(const unsigned int c_id, const double walker_w
 }
 
 
+/*
+Start the sum of the averages of this iteration over the multiple walkers and
+replace them with the result of the sum started at the previous iteration, so
+the walkers do not wait for each other at every iteration. At the first
+iteration there is no previous sum and the number of samples is set to zero,
+so the gradient is deactivated.
+*/
+void VesBias::multiSimSumAveragesNonBlocking(const unsigned int c_id, const double walker_weight, unsigned int& total_samples) {
+  plumed_massert(walker_weight>=0.0,"the weight of the walker cannot be negative!");
+  const size_t naverages = sampled_averages[c_id].size();
+  const size_t ncross = sampled_cross_averages[c_id].size();
+  unsigned int previous_samples = 0;
+  if(comm.Get_rank()==0) {
+    // buffers contain the weighted averages, the weighted cross averages, the weight and the number of samples
+    std::vector<double>& send_buffer = mwalkers_send_buffers_[c_id];
+    std::vector<double>& recv_buffer = mwalkers_recv_buffers_[c_id];
+    if(mwalkers_sum_pending_[c_id]) {mwalkers_requests_[c_id].wait();}
+    send_buffer.resize(naverages+ncross+2);
+    recv_buffer.resize(naverages+ncross+2);
+    for(size_t i=0; i<naverages; i++) {
+      send_buffer[i] = walker_weight*sampled_averages[c_id][i];
+    }
+    for(size_t i=0; i<ncross; i++) {
+      send_buffer[naverages+i] = walker_weight*sampled_cross_averages[c_id][i];
+    }
+    send_buffer[naverages+ncross] = walker_weight;
+    send_buffer[naverages+ncross+1] = static_cast<double>(total_samples);
+    //
+    if(mwalkers_sum_pending_[c_id]) {
+      double norm_weights = recv_buffer[naverages+ncross];
+      if(norm_weights>0.0) {norm_weights=1.0/norm_weights;}
+      for(size_t i=0; i<naverages; i++) {
+        sampled_averages[c_id][i] = norm_weights*recv_buffer[i];
+      }
+      for(size_t i=0; i<ncross; i++) {
+        sampled_cross_averages[c_id][i] = norm_weights*recv_buffer[naverages+i];
+      }
+      previous_samples = static_cast<unsigned int>(recv_buffer[naverages+ncross+1]);
+    }
+    else {
+      std::fill(sampled_averages[c_id].begin(), sampled_averages[c_id].end(), 0.0);
+      std::fill(sampled_cross_averages[c_id].begin(), sampled_cross_averages[c_id].end(), 0.0);
+    }
+    mwalkers_requests_[c_id] = multi_sim_comm.Isum(send_buffer,recv_buffer);
+    mwalkers_sum_pending_[c_id] = true;
+  }
+  comm.Bcast(sampled_averages[c_id],0);
+  comm.Bcast(sampled_cross_averages[c_id],0);
+  comm.Bcast(previous_samples,0);
+  total_samples = previous_samples;
+}
+
+
+/*
+The sum started at the last iteration is completed before the checkpoint is
+written, such that a restart continues with the averages of that iteration.
+*/
+void VesBias::writeMultiWalkersSumToCheckpoint(VesCheckpoint& checkpoint, const std::string& prefix) {
+  if(comm.Get_rank()!=0) {return;}
+  for(unsigned int i=0; i<ncoeffssets_; i++) {
+    if(!mwalkers_sum_pending_[i]) {continue;}
+    mwalkers_requests_[i].wait();
+    std::string is; Tools::convert(i,is);
+    checkpoint.add(prefix+"set"+is+".mwalkers_sum",mwalkers_recv_buffers_[i]);
+  }
+}
+
+
+void VesBias::restartMultiWalkersSum(const VesCheckpoint& checkpoint, const std::string& prefix) {
+  if(comm.Get_rank()!=0) {return;}
+  for(unsigned int i=0; i<ncoeffssets_; i++) {
+    std::string is; Tools::convert(i,is);
+    const std::string name = prefix+"set"+is+".mwalkers_sum";
+    if(!checkpoint.has(name)) {continue;}
+    const size_t nvalues = sampled_averages[i].size()+sampled_cross_averages[i].size()+2;
+    mwalkers_recv_buffers_[i] = checkpoint.get(name,nvalues);
+    mwalkers_send_buffers_[i].resize(nvalues);
+#ifdef __PLUMED_HAS_MPI
+    // the sum is already completed, so waiting on the request returns immediately
+    mwalkers_requests_[i].r = MPI_REQUEST_NULL;
+#endif
+    mwalkers_sum_pending_[i] = true;
+  }
+}
+
+
 void VesBias::addToSampledAverages(const std::vector<double>& values, const unsigned int c_id) {
   /*
   use the following online equation to calculate the average and covariance
@@ -550,23 +688,152 @@ void VesBias::addToSampledAverages(const std::vector<double>& values, const unsi
   size_t ncoeffs = numberOfCoeffs(c_id);
   size_t stride = comm.Get_size();
   size_t rank = comm.Get_rank();
+  // only accumulate the sums, they are normalized in normalizeDeferredAverages
+  if(deferred_averages_) {
+    double* sum = sampled_averages[c_id].data();
+    double* comp = sampled_averages_compensation_[c_id].data();
+    for(size_t i=rank; i<ncoeffs; i+=stride) {
+      VesTools::kahanSum(sum[i],comp[i],values[i]);
+    }
+    if(diagonal_hessian_) {
+      double* cross_sum = sampled_cross_averages[c_id].data();
+      double* cross_comp = sampled_cross_averages_compensation_[c_id].data();
+      for(size_t i=rank; i<ncoeffs; i+=stride) {
+        VesTools::kahanSum(cross_sum[i],cross_comp[i],values[i]*values[i]);
+      }
+    }
+  }
   // update average and diagonal part of Hessian
-  for(size_t i=rank; i<ncoeffs; i+=stride) {
-    size_t midx = getHessianIndex(i,i,c_id);
-    sampled_averages[c_id][i] += (values[i]-sampled_averages[c_id][i])/(counter_dbl+1); // (x[n+1]-xm[n])/(n+1)
-    sampled_cross_averages[c_id][midx] += (values[i]*values[i]-sampled_cross_averages[c_id][midx])/(counter_dbl+1);
+  else if(diagonal_hessian_) {
+    for(size_t i=rank; i<ncoeffs; i+=stride) {
+      size_t midx = getHessianIndex(i,i,c_id);
+      sampled_averages[c_id][i] += (values[i]-sampled_averages[c_id][i])/(counter_dbl+1); // (x[n+1]-xm[n])/(n+1)
+      sampled_cross_averages[c_id][midx] += (values[i]*values[i]-sampled_cross_averages[c_id][midx])/(counter_dbl+1);
+    }
   }
-  // update off-diagonal part of the Hessian
-  if(!diagonal_hessian_) {
+  else {
     for(size_t i=rank; i<ncoeffs; i+=stride) {
-      for(size_t j=(i+1); j<ncoeffs; j++) {
-        size_t midx = getHessianIndex(i,j,c_id);
-        sampled_cross_averages[c_id][midx] += (values[i]*values[j]-sampled_cross_averages[c_id][midx])/(counter_dbl+1);
-      }
+      sampled_averages[c_id][i] += (values[i]-sampled_averages[c_id][i])/(counter_dbl+1); // (x[n+1]-xm[n])/(n+1)
     }
   }
+  // for the full Hessian the samples are collected and then
+  // added to the cross averages with a rank-K update
+  if(!diagonal_hessian_) {
+    std::copy(values.begin(),values.begin()+ncoeffs,sampled_batch_[c_id].begin()+batch_counters_[c_id]*ncoeffs);
+    batch_counters_[c_id] += 1;
+  }
   // NOTE: the MPI sum for sampled_averages and sampled_cross_averages is done later
   aver_counters[c_id] += 1;
+  if(!diagonal_hessian_ && batch_counters_[c_id]==hessian_batch_size_) {
+    addBatchToSampledCrossAverages(c_id);
+  }
+}
+
+
+void VesBias::addToSampledAverages(const std::vector<double>& values, const std::vector<size_t>& indices, const unsigned int c_id) {
+  // the running means and the batch of the full Hessian change for all the
+  // coefficients at every step, only the deferred sums can be updated sparsely
+  if(!deferred_averages_ || !diagonal_hessian_) {
+    addToSampledAverages(values,c_id);
+    return;
+  }
+  size_t stride = comm.Get_size();
+  size_t rank = comm.Get_rank();
+  double* sum = sampled_averages[c_id].data();
+  double* comp = sampled_averages_compensation_[c_id].data();
+  double* cross_sum = sampled_cross_averages[c_id].data();
+  double* cross_comp = sampled_cross_averages_compensation_[c_id].data();
+  for(size_t j=0; j<indices.size(); j++) {
+    const size_t i = indices[j];
+    if(i%stride!=rank) {continue;}
+    VesTools::kahanSum(sum[i],comp[i],values[i]);
+    VesTools::kahanSum(cross_sum[i],cross_comp[i],values[i]*values[i]);
+  }
+  aver_counters[c_id] += 1;
+}
+
+
+void VesBias::normalizeDeferredAverages(const unsigned int c_id) {
+  // the diagonal of a diagonal Hessian is stored at the same index as the averages
+  const size_t ncoeffs = numberOfCoeffs(c_id);
+  double inv_counter = 0.0;
+  if(aver_counters[c_id]>0) {inv_counter = 1.0/static_cast<double>(aver_counters[c_id]);}
+  double* sum = sampled_averages[c_id].data();
+  double* cross_sum = sampled_cross_averages[c_id].data();
+  for(size_t i=0; i<ncoeffs; i++) {
+    sum[i] *= inv_counter;
+  }
+  if(diagonal_hessian_) {
+    for(size_t i=0; i<ncoeffs; i++) {
+      cross_sum[i] *= inv_counter;
+    }
+  }
+  std::fill(sampled_averages_compensation_[c_id].begin(), sampled_averages_compensation_[c_id].end(), 0.0);
+  std::fill(sampled_cross_averages_compensation_[c_id].begin(), sampled_cross_averages_compensation_[c_id].end(), 0.0);
+}
+
+
+void VesBias::setupCrossAveragesBatch(const unsigned int c_id) {
+  size_t ncoeffs = numberOfCoeffs(c_id);
+  sampled_batch_[c_id].assign(hessian_batch_size_*ncoeffs,0.0);
+  batch_counters_[c_id] = 0;
+  // the rows of the upper triangle have different lengths so the rows
+  // are split between the ranks such that each rank gets the same number of elements
+  size_t stride = comm.Get_size();
+  size_t rank = comm.Get_rank();
+  size_t nelements_total = 0;
+  for(size_t i=0; i<ncoeffs; i++) {nelements_total += Hessian(c_id).getRowLength(i);}
+  size_t nelements = 0;
+  hessian_rows_begin_[c_id] = ncoeffs;
+  hessian_rows_end_[c_id] = ncoeffs;
+  for(size_t i=0; i<ncoeffs; i++) {
+    if(hessian_rows_begin_[c_id]==ncoeffs && nelements>=(rank*nelements_total)/stride) {
+      hessian_rows_begin_[c_id] = i;
+    }
+    if(nelements>=((rank+1)*nelements_total)/stride) {
+      hessian_rows_end_[c_id] = i;
+      break;
+    }
+    nelements += Hessian(c_id).getRowLength(i);
+  }
+}
+
+
+void VesBias::addBatchToSampledCrossAverages(const unsigned int c_id) {
+  /*
+  the K samples x[k] in the batch are added at once to the average of n samples
+      xm[n+K] = xm[n]*n/(n+K) + sum_k x[k]*x[k]^T/(n+K)
+  the stored elements of row i of the upper triangle are contiguous in
+  CoeffsMatrix, so each row is updated with K axpy operations
+  */
+  const unsigned int nbatch = batch_counters_[c_id];
+  if(nbatch==0) {return;}
+  const size_t ncoeffs = numberOfCoeffs(c_id);
+  const double counter_dbl = static_cast<double>(aver_counters[c_id]-nbatch);
+  const double inv_counter = 1.0/(counter_dbl+nbatch);
+  const double scale_old = counter_dbl*inv_counter;
+  const double* batch = sampled_batch_[c_id].data();
+  double* cross = sampled_cross_averages[c_id].data();
+  const long int row_begin = hessian_rows_begin_[c_id];
+  const long int row_end = hessian_rows_end_[c_id];
+  const size_t stride = Hessian(c_id).getRowStride();
+  #pragma omp parallel for schedule(dynamic) num_threads(OpenMP::getNumThreads())
+  for(long int i=row_begin; i<row_end; i++) {
+    double* row = cross + getHessianIndex(i,i,c_id);
+    const size_t nrow = Hessian(c_id).getRowLength(i);
+    for(size_t j=0; j<nrow; j++) {row[j] *= scale_old;}
+    for(unsigned int k=0; k<nbatch; k++) {
+      const double* x = batch + k*ncoeffs + i;
+      const double a = x[0]*inv_counter;
+      if(stride==1) {
+        for(size_t j=0; j<nrow; j++) {row[j] += a*x[j];}
+      }
+      else {
+        for(size_t j=0; j<nrow; j++) {row[j] += a*x[j*stride];}
+      }
+    }
+  }
+  batch_counters_[c_id] = 0;
 }
 
 
@@ -623,18 +890,32 @@ void VesBias::linkOptimizer(Optimizer* optimizer_pntr_in) {
 }
 
 
-void VesBias::enableHessian(const bool diagonal_hessian) {
+void VesBias::enableHessian(const bool diagonal_hessian, const unsigned int hessian_bandwidth, const unsigned int hessian_block_dimension) {
+  // hessian_block_dimension counts the dimensions from one, zero means no blocks
+  plumed_massert(hessian_bandwidth==0 || hessian_block_dimension==0,"a Hessian cannot be both banded and block-diagonal");
   compute_hessian_=true;
   diagonal_hessian_=diagonal_hessian;
+  if(hessian_bandwidth>0 || hessian_block_dimension>0) {diagonal_hessian_=false;}
   sampled_cross_averages.clear();
   for (unsigned int i=0; i<ncoeffssets_; i++) {
     delete hessian_pntrs_[i];
     std::string label = getCoeffsSetLabelString("hessian",i);
     hessian_pntrs_[i] = new CoeffsMatrix(label,coeffs_pntrs_[i],comm,diagonal_hessian_);
+    if(hessian_bandwidth>0) {
+      hessian_pntrs_[i]->setBandedStorage(hessian_bandwidth);
+    }
+    else if(hessian_block_dimension>0) {
+      if(hessian_block_dimension>coeffs_pntrs_[i]->numberOfDimensions()) {
+        plumed_merror(getName()+" with label "+getLabel()+": the dimension of the blocks of the Hessian is larger than the number of arguments");
+      }
+      hessian_pntrs_[i]->setBlockDiagonalStorage(hessian_block_dimension-1);
+    }
     //
     std::vector<double> cross_aver_sampled_tmp;
     cross_aver_sampled_tmp.assign(hessian_pntrs_[i]->getSize(),0.0);
     sampled_cross_averages.push_back(cross_aver_sampled_tmp);
+    //
+    if(!diagonal_hessian_) {setupCrossAveragesBatch(i);}
   }
 }
 
@@ -688,6 +969,32 @@ OFile* VesBias::getOFile(const std::string& filepath, const bool multi_sim_singl
 }
 
 
+AsyncOutputWriter* VesBias::getAsyncOutputWriter() const {
+  if(optimizer_pntr_==NULL) {return NULL;}
+  return optimizer_pntr_->getAsyncOutputWriter();
+}
+
+
+void VesBias::writeGridToFile(Grid* grid_pntr, const std::string& filepath, const std::function<Grid(Grid&)>& transform) {
+  plumed_massert(grid_pntr!=NULL,"the grid to be written to "+filepath+" is not defined");
+  AsyncOutputWriter* async_output_writer = getAsyncOutputWriter();
+  if(async_output_writer==NULL) {
+    OFile* ofile_pntr = getOFile(filepath,useMultipleWalkers());
+    if(transform) {transform(*grid_pntr).writeToFile(*ofile_pntr);}
+    else {grid_pntr->writeToFile(*ofile_pntr);}
+    ofile_pntr->close(); delete ofile_pntr;
+    return;
+  }
+  OFile* ofile_pntr = AsyncOutputWriter::openFile(*this,filepath,useMultipleWalkers(),true);
+  if(ofile_pntr==NULL) {return;}
+  std::shared_ptr<Grid> grid_copy(new Grid(*grid_pntr));
+  async_output_writer->submit(ofile_pntr,[grid_copy,transform](OFile& ofile) {
+    if(transform) {transform(*grid_copy).writeToFile(ofile);}
+    else {grid_copy->writeToFile(ofile);}
+  });
+}
+
+
 void VesBias::setGridBins(const std::vector<unsigned int>& grid_bins_in) {
   plumed_massert(grid_bins_in.size()==getNumberOfArgumentsPerSet(),"the number of grid bins given doesn't match the number of arguments");
   grid_bins_=grid_bins_in;
@@ -29,26 +29,31 @@
 #include "core/ActionWithValue.h"
 #include "core/ActionWithArguments.h"
 #include "bias/Bias.h"
+#include "tools/Communicator.h"
 
 #include <vector>
 #include <string>
 #include <cmath>
+#include <functional>
 
 
 #define PLUMED_VES_VESBIAS_INIT(ao) Action(ao),VesBias(ao)
 
 namespace PLMD {
 
+class Grid;
 class Value;
 
 namespace ves {
 
+class AsyncOutputWriter;
 class CoeffsVector;
 class CoeffsMatrix;
 class BasisFunctions;
 class Optimizer;
 class TargetDistribution;
 class FermiSwitchingFunction;
+class VesCheckpoint;
 
 /**
 \ingroup INHERIT
@@ -84,6 +89,22 @@ private:
   bool diagonal_hessian_;
   //
   std::vector<unsigned int> aver_counters;
+  // samples kept for the rank-K update of the non-diagonal Hessian
+  unsigned int hessian_batch_size_;
+  std::vector<std::vector<double> > sampled_batch_;
+  std::vector<unsigned int> batch_counters_;
+  // sampled averages kept as compensated sums until the coefficients are updated
+  bool deferred_averages_;
+  std::vector<std::vector<double> > sampled_averages_compensation_;
+  std::vector<std::vector<double> > sampled_cross_averages_compensation_;
+  // rows of the Hessian that are updated by this rank
+  std::vector<size_t> hessian_rows_begin_;
+  std::vector<size_t> hessian_rows_end_;
+  // non-blocking sum of the averages over the multiple walkers, only used on rank 0
+  std::vector<std::vector<double> > mwalkers_send_buffers_;
+  std::vector<std::vector<double> > mwalkers_recv_buffers_;
+  std::vector<Communicator::Request> mwalkers_requests_;
+  std::vector<bool> mwalkers_sum_pending_;
   //
   double kbt_;
   //
@@ -126,6 +147,10 @@ private:
   void initializeCoeffs(CoeffsVector*);
   std::vector<double> computeCovarianceFromAverages(const unsigned int) const;
   void multiSimSumAverages(const unsigned int, const double walker_weight=1.0);
+  void multiSimSumAveragesNonBlocking(const unsigned int, const double, unsigned int&);
+  void setupCrossAveragesBatch(const unsigned int);
+  void addBatchToSampledCrossAverages(const unsigned int);
+  void normalizeDeferredAverages(const unsigned int);
 protected:
   //
   void checkThatTemperatureIsGiven();
@@ -137,6 +162,8 @@ protected:
   std::string getCoeffsSetLabelString(const std::string&, const unsigned int coeffs_id = 0) const;
   void clearCoeffsPntrsVector() {coeffs_pntrs_.clear();}
   void addToSampledAverages(const std::vector<double>&, const unsigned int c_id = 0);
+  // same as above for values that are only non-zero at the given indices
+  void addToSampledAverages(const std::vector<double>&, const std::vector<size_t>&, const unsigned int c_id = 0);
   void setTargetDistAverages(const std::vector<double>&, const unsigned int coeffs_id = 0);
   void setTargetDistAverages(const CoeffsVector&, const unsigned int coeffs_id= 0);
   void setTargetDistAveragesToZero(const unsigned int coeffs_id= 0);
@@ -210,14 +237,20 @@ public:
   //
   unsigned int getIterationCounter() const;
   //
-  void updateGradientAndHessian(const bool);
+  void updateGradientAndHessian(const bool, const bool mwalkers_nonblocking=false);
   void clearGradientAndHessian() {};
   //
   virtual void updateTargetDistributions() {};
   virtual void restartTargetDistributions() {};
+  // store the dynamic target distributions in a checkpoint and restart them from it
+  virtual void writeTargetDistributionsToCheckpoint(VesCheckpoint&, const std::string&) const {};
+  virtual void restartTargetDistributions(const VesCheckpoint&, const std::string&) {};
+  // store the pending sum of the multiple walkers in a checkpoint and restore it from one
+  void writeMultiWalkersSumToCheckpoint(VesCheckpoint&, const std::string&);
+  void restartMultiWalkersSum(const VesCheckpoint&, const std::string&);
   //
   void linkOptimizer(Optimizer*);
-  void enableHessian(const bool diagonal_hessian=true);
+  void enableHessian(const bool diagonal_hessian=true, const unsigned int hessian_bandwidth=0, const unsigned int hessian_block_dimension=0);
   void disableHessian();
   //
   void enableMultipleCoeffsSets() {use_multiple_coeffssets_=true;}
@@ -286,6 +319,10 @@ public:
   void applyBiasCutoff(double&, std::vector<double>&, std::vector<double>&) const;
   //
   OFile* getOFile(const std::string& filename, const bool multi_sim_single_file=false, const bool enforce_backup=true);
+  AsyncOutputWriter* getAsyncOutputWriter() const;
+  // the transform (e.g. a projection) is applied to the grid before it is written out,
+  // both are done in the background if the optimizer uses asynchronous output
+  void writeGridToFile(Grid*, const std::string&, const std::function<Grid(Grid&)>& transform=nullptr);
   //
   virtual void setupBiasFileOutput() {};
   virtual void writeBiasToFile() {};
@@ -381,10 +418,13 @@ std::vector<double> VesBias::computeCovarianceFromAverages(const unsigned int c_
     covariance[midx] = sampled_cross_averages[c_id][midx] - sampled_averages[c_id][i]*sampled_averages[c_id][i];
   }
   if(!diagonal_hessian_) {
+    const size_t stride = hessian_pntrs_[c_id]->getRowStride();
     for(size_t i=0; i<ncoeffs; i++) {
-      for(size_t j=(i+1); j<ncoeffs; j++) {
-        size_t midx = getHessianIndex(i,j,c_id);
-        covariance[midx] = sampled_cross_averages[c_id][midx] - sampled_averages[c_id][i]*sampled_averages[c_id][j];
+      size_t midx = getHessianIndex(i,i,c_id);
+      const size_t nrow = hessian_pntrs_[c_id]->getRowLength(i);
+      for(size_t k=1; k<nrow; k++) {
+        size_t j = i+k*stride;
+        covariance[midx+k] = sampled_cross_averages[c_id][midx+k] - sampled_averages[c_id][i]*sampled_averages[c_id][j];
       }
     }
   }
@@ -0,0 +1,220 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+
+#include "VesCheckpoint.h"
+
+#include "tools/Exception.h"
+#include "tools/Tools.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define __PLUMED_ves_checkpoint_fsync
+#include <unistd.h>
+#endif
+
+
+namespace PLMD {
+namespace ves {
+
+
+const char VesCheckpoint::magic_[8] = {'V','E','S','C','H','K','P','T'};
+const unsigned int VesCheckpoint::version_ = 1;
+
+
+namespace {
+
+// size of the fixed part of the header
+const size_t fixed_header_size = 16;
+
+
+void putUInt32(std::vector<char>& buffer, const uint32_t value) {
+  for(unsigned int k=0; k<4; k++) {buffer.push_back(static_cast<char>((value>>(8*k)) & 0xff));}
+}
+
+
+void putUInt64(std::vector<char>& buffer, const uint64_t value) {
+  for(unsigned int k=0; k<8; k++) {buffer.push_back(static_cast<char>((value>>(8*k)) & 0xff));}
+}
+
+
+uint32_t getUInt32(const char* p) {
+  uint32_t value = 0;
+  for(unsigned int k=0; k<4; k++) {value |= static_cast<uint32_t>(static_cast<unsigned char>(p[k])) << (8*k);}
+  return value;
+}
+
+
+uint64_t getUInt64(const char* p) {
+  uint64_t value = 0;
+  for(unsigned int k=0; k<8; k++) {value |= static_cast<uint64_t>(static_cast<unsigned char>(p[k])) << (8*k);}
+  return value;
+}
+
+}
+
+
+void VesCheckpoint::clear() {
+  names_.clear();
+  values_.clear();
+}
+
+
+int VesCheckpoint::findEntry(const std::string& name) const {
+  for(unsigned int i=0; i<names_.size(); i++) {
+    if(names_[i]==name) {return static_cast<int>(i);}
+  }
+  return -1;
+}
+
+
+void VesCheckpoint::add(const std::string& name, const std::vector<double>& values) {
+  int i = findEntry(name);
+  if(i>=0) {
+    values_[i] = values;
+  }
+  else {
+    names_.push_back(name);
+    values_.push_back(values);
+  }
+}
+
+
+void VesCheckpoint::add(const std::string& name, const double value) {
+  add(name,std::vector<double>(1,value));
+}
+
+
+bool VesCheckpoint::has(const std::string& name) const {
+  return findEntry(name)>=0;
+}
+
+
+const std::vector<double>& VesCheckpoint::get(const std::string& name) const {
+  int i = findEntry(name);
+  plumed_massert(i>=0,"the entry " + name + " is not present in the checkpoint file");
+  return values_[i];
+}
+
+
+const std::vector<double>& VesCheckpoint::get(const std::string& name, const size_t nvalues) const {
+  const std::vector<double>& values = get(name);
+  if(values.size()!=nvalues) {
+    std::string s1; Tools::convert(values.size(),s1);
+    std::string s2; Tools::convert(nvalues,s2);
+    plumed_merror("the entry " + name + " in the checkpoint file has " + s1 + " values while " + s2 + " are expected, the checkpoint is not from the same setup");
+  }
+  return values;
+}
+
+
+double VesCheckpoint::getScalar(const std::string& name) const {
+  return get(name,1)[0];
+}
+
+
+void VesCheckpoint::write(const std::string& path) const {
+  std::vector<char> buffer;
+  buffer.insert(buffer.end(),magic_,magic_+8);
+  putUInt32(buffer,version_);
+  putUInt32(buffer,static_cast<uint32_t>(names_.size()));
+  for(unsigned int i=0; i<names_.size(); i++) {
+    putUInt32(buffer,static_cast<uint32_t>(names_[i].size()));
+    buffer.insert(buffer.end(),names_[i].begin(),names_[i].end());
+    putUInt64(buffer,values_[i].size());
+    for(size_t k=0; k<values_[i].size(); k++) {
+      uint64_t u;
+      std::memcpy(&u,&values_[i][k],8);
+      putUInt64(buffer,u);
+    }
+  }
+  //
+  // the file is written to a temporary file that is flushed to disk before it
+  // replaces the old checkpoint, such that a crash leaves either of them intact
+  const std::string tmp_path = path + ".tmp";
+  FILE* fp = std::fopen(tmp_path.c_str(),"wb");
+  plumed_massert(fp!=NULL,"cannot open checkpoint file " + tmp_path + " for writing");
+  bool ok = std::fwrite(buffer.data(),1,buffer.size(),fp)==buffer.size();
+  ok = std::fflush(fp)==0 && ok;
+#ifdef __PLUMED_ves_checkpoint_fsync
+  ok = fsync(fileno(fp))==0 && ok;
+#endif
+  ok = std::fclose(fp)==0 && ok;
+  plumed_massert(ok,"problem when writing checkpoint file " + tmp_path);
+  if(std::rename(tmp_path.c_str(),path.c_str())!=0) {
+    plumed_merror("cannot rename the checkpoint file " + tmp_path + " to " + path);
+  }
+}
+
+
+void VesCheckpoint::read(const std::string& path) {
+  clear();
+  const std::string msg_header = "Error when reading checkpoint file " + path + ": ";
+  std::ifstream ifs(path.c_str(),std::ios::binary);
+  plumed_massert(ifs,"cannot open checkpoint file " + path);
+  std::vector<char> buffer((std::istreambuf_iterator<char>(ifs)),std::istreambuf_iterator<char>());
+  const char* p = buffer.data();
+  const size_t size = buffer.size();
+  if(size<fixed_header_size || std::memcmp(p,magic_,8)!=0) {
+    plumed_merror(msg_header + "not a checkpoint file or the file is corrupted");
+  }
+  if(getUInt32(p+8)>version_) {
+    std::string s1; Tools::convert(getUInt32(p+8),s1);
+    plumed_merror(msg_header + "the version " + s1 + " of the format is not supported");
+  }
+  const unsigned int nentries = getUInt32(p+12);
+  size_t pos = fixed_header_size;
+  for(unsigned int i=0; i<nentries; i++) {
+    plumed_massert(pos+4<=size,msg_header + "the file is truncated");
+    size_t len = getUInt32(p+pos); pos += 4;
+    plumed_massert(pos+len+8<=size,msg_header + "the file is truncated");
+    std::string name(p+pos,len); pos += len;
+    size_t nvalues = getUInt64(p+pos); pos += 8;
+    // pos<=size here, and the division avoids an overflow for a corrupted nvalues
+    plumed_massert(nvalues<=(size-pos)/8,msg_header + "the file is truncated");
+    std::vector<double> values(nvalues);
+    for(size_t k=0; k<nvalues; k++) {
+      uint64_t u = getUInt64(p+pos); pos += 8;
+      std::memcpy(&values[k],&u,8);
+    }
+    add(name,values);
+  }
+  plumed_massert(pos==size,msg_header + "the file has trailing data");
+}
+
+
+bool VesCheckpoint::isCheckpointFile(const std::string& path) {
+  FILE* fp = std::fopen(path.c_str(),"rb");
+  if(fp==NULL) {return false;}
+  char buffer[8];
+  size_t nread = std::fread(buffer,1,8,fp);
+  std::fclose(fp);
+  return nread==8 && std::memcmp(buffer,magic_,8)==0;
+}
+
+
+}
+}
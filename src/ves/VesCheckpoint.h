@@ -0,0 +1,85 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+#ifndef __PLUMED_ves_VesCheckpoint_h
+#define __PLUMED_ves_VesCheckpoint_h
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+
+namespace PLMD {
+namespace ves {
+
+/*
+Binary checkpoint of the state of an optimization.
+
+A checkpoint is a set of named arrays of doubles, for example the
+coefficients, the auxiliary coefficients, the averaged gradient or the
+values of a target distribution grid. The file has a small header followed
+by the entries:
+
+  offset  type       content
+       0  char[8]    magic string VESCHKPT
+       8  uint32     version of the format
+      12  uint32     number of entries
+          entries    each given as the name (an uint32 length and the
+                     characters), an uint64 number of values and the
+                     values as raw little-endian doubles
+
+The file is written to a temporary file that is then renamed, so an
+existing checkpoint is replaced atomically and a checkpoint file is never
+left partially written.
+*/
+
+class VesCheckpoint {
+private:
+  static const char magic_[8];
+  static const unsigned int version_;
+  std::vector<std::string> names_;
+  std::vector<std::vector<double> > values_;
+  //
+  int findEntry(const std::string&) const;
+public:
+  VesCheckpoint() {}
+  void clear();
+  size_t numberOfEntries() const {return names_.size();}
+  // add an entry, an existing entry with the same name is replaced
+  void add(const std::string&, const std::vector<double>&);
+  void add(const std::string&, const double);
+  bool has(const std::string&) const;
+  const std::vector<double>& get(const std::string&) const;
+  // get an entry and check that it has the given number of values
+  const std::vector<double>& get(const std::string&, const size_t) const;
+  double getScalar(const std::string&) const;
+  //
+  void write(const std::string&) const;
+  void read(const std::string&);
+  // check for the magic string at the start of the file
+  static bool isCheckpointFile(const std::string&);
+};
+
+
+}
+}
+
+#endif
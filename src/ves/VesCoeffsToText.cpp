@@ -0,0 +1,157 @@
+/* +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+   Copyright (c) 2016-2018 The VES code team
+   (see the PEOPLE-VES file at the root of this folder for a list of names)
+
+   See http://www.ves-code.org for more information.
+
+   This file is part of VES code module.
+
+   The VES code module is free software: you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   The VES code module is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with the VES code module.  If not, see <http://www.gnu.org/licenses/>.
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+
+#include "CoeffsBinaryFile.h"
+#include "CoeffsVector.h"
+#include "CoeffsMatrix.h"
+
+#include "cltools/CLTool.h"
+#include "cltools/CLToolRegister.h"
+#include "tools/Communicator.h"
+#include "tools/Exception.h"
+#include "tools/File.h"
+
+#include <string>
+#include <vector>
+
+
+namespace PLMD {
+namespace ves {
+
+//+PLUMEDOC VES_TOOLS ves_coeffs_to_text
+/*
+Convert a binary file of coefficients to the text format.
+
+The files of coefficients, gradients and Hessians written by the optimizers
+can be written in a binary format by using the COEFFS_FILE_FORMAT keyword
+(and the corresponding keywords for the other files). This tool converts such
+a binary file to the text format that is normally used for these files. All
+the records in the binary file are converted, that is one block for each time
+the file was written out, unless the --last flag is given.
+
+\par Examples
+
+The following command converts all the coefficients in the binary file
+coeffs.data to the text file coeffs.text.data
+\verbatim
+plumed ves_coeffs_to_text --input coeffs.data --output coeffs.text.data
+\endverbatim
+
+*/
+//+ENDPLUMEDOC
+
+class VesCoeffsToText : public PLMD::CLTool {
+public:
+  std::string description() const {return "convert a binary file of VES coefficients to the text format";}
+  static void registerKeywords( Keywords& keys );
+  explicit VesCoeffsToText( const CLToolOptions& co );
+  int main( FILE* in, FILE* out, PLMD::Communicator& pc);
+private:
+  static void writeRecord(OFile&, const CoeffsBinaryFile&, const CoeffsBinaryFile::Record&, const std::string&, Communicator&);
+};
+
+PLUMED_REGISTER_CLTOOL(VesCoeffsToText,"ves_coeffs_to_text")
+
+void VesCoeffsToText::registerKeywords( Keywords& keys ) {
+  CLTool::registerKeywords( keys );
+  keys.add("compulsory","--input","the name of the binary file");
+  keys.add("compulsory","--output","the name of the text file that is written");
+  keys.add("compulsory","--fmt","%30.16e","the format used for the values");
+  keys.addFlag("--last",false,"only convert the last record in the file");
+}
+
+
+VesCoeffsToText::VesCoeffsToText( const CLToolOptions& co ):
+  CLTool(co)
+{
+  inputdata=commandline;
+}
+
+
+void VesCoeffsToText::writeRecord(OFile& ofile, const CoeffsBinaryFile& binfile, const CoeffsBinaryFile::Record& record, const std::string& fmt, Communicator& pc) {
+  std::vector<double> values;
+  if(record.storage==CoeffsBinaryFile::Vector) {
+    std::vector<CoeffsVector*> coeffsvecSet(record.data_labels.size());
+    for(unsigned int l=0; l<record.data_labels.size(); l++) {
+      coeffsvecSet[l] = new CoeffsVector(record.label,record.dimension_labels,record.shape,pc,record.iteration_and_time_active);
+      coeffsvecSet[l]->setTypeFromStr(record.type);
+      coeffsvecSet[l]->setLabels(record.label,record.data_labels[l]);
+      coeffsvecSet[l]->setIterationCounterAndTime(record.iteration,record.time);
+      coeffsvecSet[l]->setOutputFmt(fmt);
+      binfile.getValues(record,l,values);
+      coeffsvecSet[l]->setValues(values);
+    }
+    CoeffsVector::writeToFile(ofile,coeffsvecSet,false);
+    for(unsigned int l=0; l<coeffsvecSet.size(); l++) {
+      delete coeffsvecSet[l];
+    }
+  }
+  else if(record.storage==CoeffsBinaryFile::DiagonalMatrix || record.storage==CoeffsBinaryFile::SymmetricMatrix ||
+          record.storage==CoeffsBinaryFile::BandedMatrix || record.storage==CoeffsBinaryFile::BlockDiagonalMatrix) {
+    plumed_massert(record.data_labels.size()==1,"a record of a matrix should only contain a single data set");
+    const bool diagonal = record.storage==CoeffsBinaryFile::DiagonalMatrix;
+    CoeffsMatrix coeffsmat(record.label,record.dimension_labels,record.shape,pc,diagonal,record.iteration_and_time_active);
+    if(record.storage==CoeffsBinaryFile::BandedMatrix) {coeffsmat.setBandedStorage(record.storage_parameter);}
+    else if(record.storage==CoeffsBinaryFile::BlockDiagonalMatrix) {coeffsmat.setBlockDiagonalStorage(record.storage_parameter);}
+    coeffsmat.setTypeFromStr(record.type);
+    coeffsmat.setLabels(record.label,record.data_labels[0]);
+    coeffsmat.setIterationCounterAndTime(record.iteration,record.time);
+    coeffsmat.setOutputFmt(fmt);
+    binfile.getValues(record,0,values);
+    plumed_massert(values.size()==coeffsmat.getSize(),"the number of values in the record does not match the size of the matrix");
+    coeffsmat.setValues(values);
+    coeffsmat.writeToFile(ofile);
+  }
+  else {
+    plumed_merror("unknown storage of the values in file " + binfile.getPath());
+  }
+}
+
+
+int VesCoeffsToText::main( FILE* in, FILE* out, PLMD::Communicator& pc) {
+  std::string input;
+  parse("--input",input);
+  std::string output;
+  parse("--output",output);
+  std::string fmt;
+  parse("--fmt",fmt);
+  bool only_last;
+  parseFlag("--last",only_last);
+  //
+  if(!CoeffsBinaryFile::isBinaryFile(input)) {
+    plumed_merror("the file " + input + " is not a binary file of coefficients");
+  }
+  CoeffsBinaryFile binfile(input);
+  OFile ofile;
+  ofile.link(pc);
+  ofile.open(output);
+  size_t first = only_last ? binfile.numberOfRecords()-1 : 0;
+  for(size_t i=first; i<binfile.numberOfRecords(); i++) {
+    writeRecord(ofile,binfile,binfile.getRecord(i),fmt,pc);
+  }
+  ofile.close();
+  return 0;
+}
+
+
+}
+}
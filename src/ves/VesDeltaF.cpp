@@ -28,6 +28,7 @@
 #include "tools/Grid.h"
 #include "tools/File.h"
 //#include <algorithm> //std::fill
+#include <array>
 
 namespace PLMD {
 namespace ves {
@@ -115,9 +116,25 @@ private:
   unsigned NumWalkers_;
   bool isFirstStep_;
 
-//local basins
-  std::vector< std::unique_ptr<Grid> > grid_p_; //pointers because of GridBase::create
+//local basins, stored as a single grid with one channel per basin:
+//the probabilities of all the basins at a grid point are contiguous, and so are their derivatives
+  std::unique_ptr<Grid> grid_; //geometry of the basins grids, pointer because of GridBase::create
+  unsigned n_basins_;
+  std::vector<double> basins_prob_;
+  std::vector<double> basins_der_prob_;
   std::vector<double> norm_;
+  std::vector<unsigned> nbin_;
+  std::vector<bool> periodic_;
+  std::vector<double> dx_;
+//work buffers, allocated once
+  std::vector<double> cv_;
+  std::vector<unsigned> indices_;
+  std::vector<unsigned> neigh_indices_;
+  std::vector<double> xfloor_;
+  std::vector<double> prob_;
+  std::vector<double> der_prob_;
+  std::vector<double> dV_dAlpha_;
+  std::vector<double> d2V_dAlpha2_;
 
 //optimizer-related stuff
   long unsigned mean_counter_;
@@ -152,6 +169,8 @@ private:
 //functions
   void update_alpha();
   void update_tg_and_rct();
+  void interpolate_basins(const std::vector<double>&);
+  void calculate_dV_dAlpha(const double);
   inline unsigned get_index(const unsigned, const unsigned) const;
 
 public:
@@ -225,6 +244,7 @@ VesDeltaF::VesDeltaF(const ActionOptions&ao)
   std::string funcl="file.free"; //typical name given by sum_hills
 
   std::vector<std::string> fes_names;
+  std::vector< std::unique_ptr<Grid> > grid_p; //pointers because of GridBase::create
   for(unsigned n=0;; n++)//NB: here we start from FILE_F0 not from FILE_F1
   {
     std::string filename;
@@ -241,53 +261,79 @@ VesDeltaF::VesDeltaF(const ActionOptions&ao)
     plumed_assert(gg);
 // release ownership in order to transfer it to emplaced pointer
     g.release();
-    grid_p_.emplace_back(gg);
+    grid_p.emplace_back(gg);
   }
-  plumed_massert(grid_p_.size()>1,"at least 2 basins must be defined, starting from FILE_F0");
-  alpha_size_=grid_p_.size()-1;
+  plumed_massert(grid_p.size()>1,"at least 2 basins must be defined, starting from FILE_F0");
+  alpha_size_=grid_p.size()-1;
   sym_alpha_size_=alpha_size_*(alpha_size_+1)/2; //useful for symmetric matrix [alpha_size_]x[alpha_size_]
   //check for consistency with first local free energy
-  for(unsigned n=1; n<grid_p_.size(); n++)
+  for(unsigned n=1; n<grid_p.size(); n++)
   {
     std::string error_tag="FILE_F"+std::to_string(n)+" '"+fes_names[n]+"' not compatible with reference one, FILE_F0";
-    plumed_massert(grid_p_[n]->getSize()==grid_p_[0]->getSize(),error_tag);
-    plumed_massert(grid_p_[n]->getMin()==grid_p_[0]->getMin(),error_tag);
-    plumed_massert(grid_p_[n]->getMax()==grid_p_[0]->getMax(),error_tag);
-    plumed_massert(grid_p_[n]->getBinVolume()==grid_p_[0]->getBinVolume(),error_tag);
+    plumed_massert(grid_p[n]->getSize()==grid_p[0]->getSize(),error_tag);
+    plumed_massert(grid_p[n]->getMin()==grid_p[0]->getMin(),error_tag);
+    plumed_massert(grid_p[n]->getMax()==grid_p[0]->getMax(),error_tag);
+    plumed_massert(grid_p[n]->getBinVolume()==grid_p[0]->getBinVolume(),error_tag);
   }
 
   bool no_mintozero=false;
   parseFlag("NO_MINTOZERO",no_mintozero);
   if(!no_mintozero)
   {
-    for(unsigned n=0; n<grid_p_.size(); n++)
-      grid_p_[n]->setMinToZero();
+    for(unsigned n=0; n<grid_p.size(); n++)
+      grid_p[n]->setMinToZero();
   }
   bool normalize=false;
   parseFlag("NORMALIZE",normalize);
-  norm_.resize(grid_p_.size(),0);
-  std::vector<double> c_norm(grid_p_.size());
+  norm_.resize(grid_p.size(),0);
+  std::vector<double> c_norm(grid_p.size());
   //convert the FESs to probability distributions
   //NB: the spline interpolation will be done on the probability distributions, not on the given FESs
   const unsigned ncv=getNumberOfArguments(); //just for ease
-  for(unsigned n=0; n<grid_p_.size(); n++)
+  for(unsigned n=0; n<grid_p.size(); n++)
   {
-    for(Grid::index_t t=0; t<grid_p_[n]->getSize(); t++)
+    for(Grid::index_t t=0; t<grid_p[n]->getSize(); t++)
     {
       std::vector<double> der(ncv);
-      const double val=std::exp(-beta_*grid_p_[n]->getValueAndDerivatives(t,der));
+      const double val=std::exp(-beta_*grid_p[n]->getValueAndDerivatives(t,der));
       for(unsigned s=0; s<ncv; s++)
         der[s]*=-beta_*val;
-      grid_p_[n]->setValueAndDerivatives(t,val,der);
+      grid_p[n]->setValueAndDerivatives(t,val,der);
       norm_[n]+=val;
     }
     c_norm[n]=1./beta_*std::log(norm_[n]);
     if(normalize)
     {
-      grid_p_[n]->scaleAllValuesAndDerivatives(1./norm_[n]);
+      grid_p[n]->scaleAllValuesAndDerivatives(1./norm_[n]);
       norm_[n]=1;
     }
   }
+//interleave the probability grids, only the first grid is kept for its geometry
+  n_basins_=grid_p.size();
+  const Grid::index_t grid_size=grid_p[0]->getSize();
+  basins_prob_.resize(grid_size*n_basins_);
+  basins_der_prob_.resize(grid_size*n_basins_*ncv);
+  std::vector<double> der(ncv);
+  for(unsigned n=0; n<n_basins_; n++)
+  {
+    for(Grid::index_t t=0; t<grid_size; t++)
+    {
+      basins_prob_[t*n_basins_+n]=grid_p[n]->getValueAndDerivatives(t,der);
+      for(unsigned s=0; s<ncv; s++)
+        basins_der_prob_[(t*n_basins_+n)*ncv+s]=der[s];
+    }
+  }
+  grid_=std::move(grid_p[0]);
+  grid_p.clear();
+  nbin_=grid_->getNbin();
+  periodic_=grid_->getIsPeriodic();
+  dx_=grid_->getDx();
+  cv_.resize(ncv);
+  indices_.resize(ncv);
+  neigh_indices_.resize(ncv);
+  xfloor_.resize(ncv);
+  prob_.resize(n_basins_);
+  der_prob_.resize(n_basins_*ncv);
 
 //get target
   double biasfactor=0;
@@ -302,6 +348,8 @@ VesDeltaF::VesDeltaF(const ActionOptions&ao)
   parse("TG_STRIDE",tg_stride_);
   tg_dV_dAlpha_.resize(alpha_size_,0);
   tg_d2V_dAlpha2_.resize(sym_alpha_size_,0);
+  dV_dAlpha_.resize(alpha_size_);
+  d2V_dAlpha2_.resize(sym_alpha_size_);
 
 //setup optimization stuff
   minimization_step_=1;
@@ -437,7 +485,7 @@ VesDeltaF::VesDeltaF(const ActionOptions&ao)
   log.printf("  Temperature T: %g\n",1./(Kb*beta_));
   log.printf("  Beta (1/Kb*T): %g\n",beta_);
   log.printf("  Local free energy basins files and normalization constants:\n");
-  for(unsigned n=0; n<grid_p_.size(); n++)
+  for(unsigned n=0; n<n_basins_; n++)
     log.printf("    F_%d filename: %s  c_%d=%g\n",n,fes_names[n].c_str(),n,c_norm[n]);
   if(no_mintozero)
     log.printf(" -- NO_MINTOZERO: local free energies are not shifted to be zero at minimum\n");
@@ -486,25 +534,21 @@ void VesDeltaF::calculate()
 {
 //get CVs
   const unsigned ncv=getNumberOfArguments(); //just for ease
-  std::vector<double> cv(ncv);
   for(unsigned s=0; s<ncv; s++)
-    cv[s]=getArgument(s);
+    cv_[s]=getArgument(s);
 //get probabilities for each basin, and total one
-  std::vector<double> prob(grid_p_.size());
-  std::vector< std::vector<double> > der_prob(grid_p_.size(),std::vector<double>(ncv));
-  for(unsigned n=0; n<grid_p_.size(); n++)
-    prob[n]=grid_p_[n]->getValueAndDerivatives(cv,der_prob[n]);
-  double tot_prob=prob[0];
+  interpolate_basins(cv_);
+  double tot_prob=prob_[0];
   for(unsigned i=0; i<alpha_size_; i++)
-    tot_prob+=prob[i+1]*exp_alpha_[i];
+    tot_prob+=prob_[i+1]*exp_alpha_[i];
 
 //update bias and forces: V=-(1-inv_gamma_)*fes
   setBias((1-inv_gamma_)/beta_*std::log(tot_prob));
   for(unsigned s=0; s<ncv; s++)
   {
-    double dProb_dCV_s=der_prob[0][s];
+    double dProb_dCV_s=der_prob_[s];
     for(unsigned i=0; i<alpha_size_; i++)
-      dProb_dCV_s+=der_prob[i+1][s]*exp_alpha_[i];
+      dProb_dCV_s+=der_prob_[(i+1)*ncv+s]*exp_alpha_[i];
     setOutputForce(s,-(1-inv_gamma_)/beta_/tot_prob*dProb_dCV_s);
   }
 //skip first step to sync getTime() and av_counter_, as in METAD
@@ -515,32 +559,23 @@ void VesDeltaF::calculate()
   }
 
 //calculate derivatives for ensemble averages
-  std::vector<double> dV_dAlpha(alpha_size_);
-  std::vector<double> d2V_dAlpha2(sym_alpha_size_);
-  for(unsigned i=0; i<alpha_size_; i++)
-    dV_dAlpha[i]=-(1-inv_gamma_)/tot_prob*prob[i+1]*exp_alpha_[i];
-  for(unsigned i=0; i<alpha_size_; i++)
-  {
-    d2V_dAlpha2[get_index(i,i)]=-beta_*dV_dAlpha[i];
-    for(unsigned j=i; j<alpha_size_; j++)
-      d2V_dAlpha2[get_index(i,j)]-=beta_/(1-inv_gamma_)*dV_dAlpha[i]*dV_dAlpha[j];
-  }
+  calculate_dV_dAlpha(tot_prob);
 //update ensemble averages
   av_counter_++;
   for(unsigned i=0; i<alpha_size_; i++)
   {
-    av_dV_dAlpha_[i]+=(dV_dAlpha[i]-av_dV_dAlpha_[i])/av_counter_;
+    av_dV_dAlpha_[i]+=(dV_dAlpha_[i]-av_dV_dAlpha_[i])/av_counter_;
     for(unsigned j=i; j<alpha_size_; j++)
     {
       const unsigned ij=get_index(i,j);
-      av_dV_dAlpha_prod_[ij]+=(dV_dAlpha[i]*dV_dAlpha[j]-av_dV_dAlpha_prod_[ij])/av_counter_;
-      av_d2V_dAlpha2_[ij]+=(d2V_dAlpha2[ij]-av_d2V_dAlpha2_[ij])/av_counter_;
+      av_dV_dAlpha_prod_[ij]+=(dV_dAlpha_[i]*dV_dAlpha_[j]-av_dV_dAlpha_prod_[ij])/av_counter_;
+      av_d2V_dAlpha2_[ij]+=(d2V_dAlpha2_[ij]-av_d2V_dAlpha2_[ij])/av_counter_;
     }
   }
 //update work
-  double prev_tot_prob=prob[0];
+  double prev_tot_prob=prob_[0];
   for(unsigned i=0; i<alpha_size_; i++)
-    prev_tot_prob+=prob[i+1]*prev_exp_alpha_[i];
+    prev_tot_prob+=prob_[i+1]*prev_exp_alpha_[i];
   work_+=(1-inv_gamma_)/beta_*std::log(tot_prob/prev_tot_prob);
 }
 
@@ -572,30 +607,20 @@ void VesDeltaF::update_tg_and_rct()
   double Z_tg=0;
   std::fill(tg_dV_dAlpha_.begin(),tg_dV_dAlpha_.end(),0);
   std::fill(tg_d2V_dAlpha2_.begin(),tg_d2V_dAlpha2_.end(),0);
-  for(Grid::index_t t=rank_; t<grid_p_[0]->getSize(); t+=NumParallel_)
-  { //TODO can we recycle some code?
-    std::vector<double> prob(grid_p_.size());
-    for(unsigned n=0; n<grid_p_.size(); n++)
-      prob[n]=grid_p_[n]->getValue(t);
-    double tot_prob=prob[0];
-    for(unsigned i=0; i<alpha_size_; i++)
-      tot_prob+=prob[i+1]*exp_alpha_[i];
-    std::vector<double> dV_dAlpha(alpha_size_);
-    std::vector<double> d2V_dAlpha2(sym_alpha_size_);
-    for(unsigned i=0; i<alpha_size_; i++)
-      dV_dAlpha[i]=-(1-inv_gamma_)/tot_prob*prob[i+1]*exp_alpha_[i];
+  for(Grid::index_t t=rank_; t<grid_->getSize(); t+=NumParallel_)
+  {
+    for(unsigned n=0; n<n_basins_; n++)
+      prob_[n]=basins_prob_[t*n_basins_+n];
+    double tot_prob=prob_[0];
     for(unsigned i=0; i<alpha_size_; i++)
-    {
-      d2V_dAlpha2[get_index(i,i)]=-beta_*dV_dAlpha[i];
-      for(unsigned j=i; j<alpha_size_; j++)
-        d2V_dAlpha2[get_index(i,j)]-=beta_/(1-inv_gamma_)*dV_dAlpha[i]*dV_dAlpha[j];
-    }
+      tot_prob+=prob_[i+1]*exp_alpha_[i];
+    calculate_dV_dAlpha(tot_prob);
     const double unnorm_tg_p=std::pow(tot_prob,inv_gamma_);
     Z_tg+=unnorm_tg_p;
     for(unsigned i=0; i<alpha_size_; i++)
-      tg_dV_dAlpha_[i]+=unnorm_tg_p*dV_dAlpha[i];
+      tg_dV_dAlpha_[i]+=unnorm_tg_p*dV_dAlpha_[i];
     for(unsigned ij=0; ij<sym_alpha_size_; ij++)
-      tg_d2V_dAlpha2_[ij]+=unnorm_tg_p*d2V_dAlpha2[ij];
+      tg_d2V_dAlpha2_[ij]+=unnorm_tg_p*d2V_dAlpha2_[ij];
   }
   if(NumParallel_>1)
   {
@@ -686,6 +711,87 @@ void VesDeltaF::update_alpha()
   }
 }
 
+//derivatives of the bias with respect to alpha, given the basins probabilities in prob_
+void VesDeltaF::calculate_dV_dAlpha(const double tot_prob)
+{
+  for(unsigned i=0; i<alpha_size_; i++)
+    dV_dAlpha_[i]=-(1-inv_gamma_)/tot_prob*prob_[i+1]*exp_alpha_[i];
+  for(unsigned i=0; i<alpha_size_; i++)
+  {
+    d2V_dAlpha2_[get_index(i,i)]=-beta_*dV_dAlpha_[i];
+    for(unsigned j=i; j<alpha_size_; j++)
+      d2V_dAlpha2_[get_index(i,j)]-=beta_/(1-inv_gamma_)*dV_dAlpha_[i]*dV_dAlpha_[j];
+  }
+}
+
+//spline interpolation of all the basins probabilities and their derivatives, as in GridBase::getValueAndDerivatives.
+//The grid indices, the neighbors and the polynomials in the distance from the grid points are computed once for all the basins
+void VesDeltaF::interpolate_basins(const std::vector<double>& cv)
+{
+  const unsigned ncv=cv.size();
+  std::fill(prob_.begin(),prob_.end(),0);
+  std::fill(der_prob_.begin(),der_prob_.end(),0);
+  grid_->getIndices(cv,indices_);
+  grid_->getPoint(indices_,xfloor_);
+  std::array<double,GridBase::maxdim> sign, X, X2, X3, C, D;
+  const unsigned n_neigh=1u<<ncv;
+  for(unsigned ipoint=0; ipoint<n_neigh; ipoint++)
+  {
+    unsigned tmp=ipoint;
+    bool inside=true;
+    for(unsigned j=0; j<ncv; j++)
+    {
+      unsigned i0=tmp%2+indices_[j];
+      tmp/=2;
+      if(i0==nbin_[j])
+      {
+        if(!periodic_[j])
+        {
+          inside=false;
+          break;
+        }
+        i0=0;
+      }
+      neigh_indices_[j]=i0;
+    }
+    if(!inside)
+      continue;
+    const Grid::index_t neigh=grid_->getIndex(neigh_indices_);
+    for(unsigned j=0; j<ncv; j++)
+    {
+      const int x0=(neigh_indices_[j]==indices_[j] ? 0 : 1);
+      sign[j]=(x0?-1.0:1.0);
+      X[j]=std::fabs((cv[j]-xfloor_[j])/dx_[j]-(double)x0);
+      X2[j]=X[j]*X[j];
+      X3[j]=X2[j]*X[j];
+    }
+    for(unsigned n=0; n<n_basins_; n++)
+    {
+      const double grid=basins_prob_[neigh*n_basins_+n];
+      const double* dder=&basins_der_prob_[(neigh*n_basins_+n)*ncv];
+      double ff=1.0;
+      for(unsigned j=0; j<ncv; j++)
+      {
+        double yy;
+        if(std::fabs(grid)<0.0000001) yy=0.0;
+        else yy=-dder[j]/grid;
+        C[j]=(1.0-3.0*X2[j]+2.0*X3[j]) - sign[j]*yy*(X[j]-2.0*X2[j]+X3[j])*dx_[j];
+        D[j]=( -6.0*X[j] +6.0*X2[j]) - sign[j]*yy*(1.0-4.0*X[j] +3.0*X2[j])*dx_[j];
+        D[j]*=sign[j]/dx_[j];
+        ff*=C[j];
+      }
+      prob_[n]+=grid*ff;
+      for(unsigned j=0; j<ncv; j++)
+      {
+        double fd=D[j];
+        for(unsigned i=0; i<ncv; i++)
+          if(i!=j) fd*=C[i];
+        der_prob_[n*ncv+j]+=grid*fd;
+      }
+    }
+  }
+}
+
 //mapping of a [alpha_size_]x[alpha_size_] symmetric matrix into a vector of size sym_alpha_size_, useful for the communicator
 inline unsigned VesDeltaF::get_index(const unsigned i, const unsigned j) const
 {
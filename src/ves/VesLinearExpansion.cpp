@@ -27,7 +27,9 @@
 #include "BasisFunctions.h"
 #include "Optimizer.h"
 #include "TargetDistribution.h"
+#include "VesCheckpoint.h"
 #include "VesTools.h"
+#include "GridProjWeights.h"
 
 #include "bias/Bias.h"
 #include "core/ActionRegister.h"
@@ -158,6 +160,21 @@ where the parameter \f$\lambda\f$ controls how sharply the switchingfunction goe
 The default value is \f$\lambda=10\f$ but this can be changed by using the
 BIAS_CUTOFF_FERMI_LAMBDA keyword.
 
+\par Interpolating the Bias
+
+The coefficients only change when they are updated by the optimizer, but by
+default the full expansion is evaluated at every MD step. By using the
+INTERPOLATE_BIAS flag the bias and its derivatives are instead tabulated on a
+grid every time the coefficients are updated and the bias and the forces
+are then obtained during the MD steps by a cubic spline interpolation from this grid.
+The number of bins of this grid is given by the INTERPOLATION_GRID_BINS keyword,
+by default the same number of bins as for GRID_BINS is used.
+The exact values of the basis functions are then only calculated when they
+are needed by the optimizer.
+This is most useful for multidimensional expansions where the cost of evaluating
+the expansion grows quickly with the number of basis functions.
+The interpolation cannot be used together with the bias cutoff.
+
 \par Examples
 
 In the following example we run a VES_LINEAR_EXPANSION for one CV using
@@ -289,7 +306,12 @@ private:
   Value* valueForce2_;
   bool all_values_inside;
   std::vector<double> bf_values;
+  // indices of the non-zero entries of bf_values when the evaluation is sparse
+  std::vector<size_t> bf_active_indices_;
   bool bf_values_set;
+  std::vector<double> cv_values_;
+  std::vector<double> forces_;
+  bool interpolate_bias_;
 public:
   explicit VesLinearExpansion(const ActionOptions&);
   ~VesLinearExpansion();
@@ -297,6 +319,8 @@ public:
   void update();
   void updateTargetDistributions();
   void restartTargetDistributions();
+  void writeTargetDistributionsToCheckpoint(VesCheckpoint&, const std::string&) const;
+  void restartTargetDistributions(const VesCheckpoint&, const std::string&);
   //
   void setupBiasFileOutput();
   void writeBiasToFile();
@@ -330,6 +354,8 @@ void VesLinearExpansion::registerKeywords( Keywords& keys ) {
   //
   keys.use("ARG");
   keys.add("compulsory","BASIS_FUNCTIONS","the label of the one dimensional basis functions that should be used.");
+  keys.addFlag("INTERPOLATE_BIAS",false,"tabulate the bias on a grid each time the coefficients are updated and obtain the bias and the forces during MD by a spline interpolation from this grid.");
+  keys.add("optional","INTERPOLATION_GRID_BINS","the number of bins used for the grid used to interpolate the bias. By default the same number of bins as given by GRID_BINS is used.");
   keys.addOutputComponent("force2","default","the instantaneous value of the squared force due to this bias potential.");
 }
 
@@ -341,10 +367,23 @@ VesLinearExpansion::VesLinearExpansion(const ActionOptions&ao):
   valueForce2_(NULL),
   all_values_inside(true),
   bf_values(0),
-  bf_values_set(false)
+  bf_active_indices_(0),
+  bf_values_set(false),
+  cv_values_(nargs_,0.0),
+  forces_(nargs_,0.0),
+  interpolate_bias_(false)
 {
   std::vector<std::string> basisf_labels;
   parseMultipleValues("BASIS_FUNCTIONS",basisf_labels,nargs_);
+  parseFlag("INTERPOLATE_BIAS",interpolate_bias_);
+  std::vector<unsigned int> interpolation_grid_bins;
+  parseMultipleValues<unsigned int>("INTERPOLATION_GRID_BINS",interpolation_grid_bins,nargs_);
+  if(interpolation_grid_bins.size()>0 && !interpolate_bias_) {
+    plumed_merror("INTERPOLATION_GRID_BINS should only be used together with the INTERPOLATE_BIAS flag");
+  }
+  if(interpolate_bias_ && biasCutoffActive()) {
+    plumed_merror("the INTERPOLATE_BIAS flag cannot be used together with the bias cutoff");
+  }
   checkRead();
 
   std::string error_msg = "";
@@ -375,6 +414,10 @@ VesLinearExpansion::VesLinearExpansion(const ActionOptions&ao):
   bias_expansion_pntr_->setGridBins(this->getGridBins());
   //
   bf_values.assign(ncoeffs_,0.0);
+  if(bias_expansion_pntr_->sparseEvaluation()) {
+    bf_active_indices_.assign(bias_expansion_pntr_->getNumberOfActiveCoeffs(),0);
+    log.printf("  using the compact support of the basis functions: %zu of the %zu coefficients are evaluated at each step\n",bf_active_indices_.size(),ncoeffs_);
+  }
 
 
 
@@ -402,6 +445,14 @@ VesLinearExpansion::VesLinearExpansion(const ActionOptions&ao):
     writeBiasToFile();
   }
 
+  if(interpolate_bias_) {
+    if(interpolation_grid_bins.size()==0) {interpolation_grid_bins=this->getGridBins();}
+    bias_expansion_pntr_->setupBiasInterpolationGrid(interpolation_grid_bins);
+    log.printf("  bias and forces interpolated with splines from a grid with %u",interpolation_grid_bins[0]);
+    for(unsigned int k=1; k<nargs_; k++) {log.printf("x%u",interpolation_grid_bins[k]);}
+    log.printf(" bins that is updated each time the coefficients change\n");
+  }
+
   addComponent("force2"); componentIsNotPeriodic("force2");
   valueForce2_=getPntrToComponent("force2");
 }
@@ -416,29 +467,44 @@ VesLinearExpansion::~VesLinearExpansion() {
 
 void VesLinearExpansion::calculate() {
 
-  std::vector<double> cv_values(nargs_);
-  std::vector<double> forces(nargs_);
-
   for(unsigned int k=0; k<nargs_; k++) {
-    cv_values[k]=getArgument(k);
+    cv_values_[k]=getArgument(k);
   }
 
   all_values_inside = true;
-  double bias = bias_expansion_pntr_->getBiasAndForces(cv_values,all_values_inside,forces,bf_values);
+  double bias = 0.0;
+  if(interpolate_bias_) {
+    if(bias_expansion_pntr_->biasInterpolationGridOutdated()) {
+      bias_expansion_pntr_->updateBiasInterpolationGrid();
+    }
+    bias = bias_expansion_pntr_->getBiasAndForcesFromInterpolationGrid(cv_values_,all_values_inside,forces_);
+    // the exact values of the basis functions are only needed for the averages
+    if(optimizeCoeffs()) {
+      bias_expansion_pntr_->getBasisSetValues(cv_values_,bf_values);
+    }
+  }
+  else {
+    bias = bias_expansion_pntr_->getBiasAndForces(cv_values_,all_values_inside,forces_,bf_values);
+  }
+  if(bias_expansion_pntr_->sparseEvaluation()) {
+    bf_active_indices_ = bias_expansion_pntr_->getActiveCoeffsIndices();
+  }
   if(biasCutoffActive()) {
-    applyBiasCutoff(bias,forces,bf_values);
+    applyBiasCutoff(bias,forces_,bf_values);
     bf_values[0]=1.0;
   }
   double totalForce2 = 0.0;
   for(unsigned int k=0; k<nargs_; k++) {
-    setOutputForce(k,forces[k]);
-    totalForce2 += forces[k]*forces[k];
+    setOutputForce(k,forces_[k]);
+    totalForce2 += forces_[k]*forces_[k];
   }
 
   setBias(bias);
   valueForce2_->set(totalForce2);
 
   bf_values_set = true;
+  // the work buffers are sized in the setup so the evaluation should never allocate
+  plumed_dbg_massert(bias_expansion_pntr_->getWorkspaceReallocationCounter()==0,"the evaluation of the bias expansion should not allocate memory");
 }
 
 
@@ -446,10 +512,21 @@ void VesLinearExpansion::update() {
   if(!bf_values_set) {
     warning("VesLinearExpansion::update() is being called without calling VesLinearExpansion::calculate() first to calculate the basis function values. This can lead to incorrect behavior.");
   }
-  if(all_values_inside && bf_values_set) {
-    addToSampledAverages(bf_values);
+  // the basis function values are not calculated when interpolating a static bias
+  if(!interpolate_bias_ || optimizeCoeffs()) {
+    if(bias_expansion_pntr_->sparseEvaluation()) {
+      if(all_values_inside && bf_values_set) {
+        addToSampledAverages(bf_values,bf_active_indices_);
+      }
+      for(size_t j=0; j<bf_active_indices_.size(); j++) {bf_values[bf_active_indices_[j]]=0.0;}
+    }
+    else {
+      if(all_values_inside && bf_values_set) {
+        addToSampledAverages(bf_values);
+      }
+      std::fill(bf_values.begin(), bf_values.end(), 0.0);
+    }
   }
-  std::fill(bf_values.begin(), bf_values.end(), 0.0);
   bf_values_set = false;
 }
 
@@ -471,6 +548,25 @@ void VesLinearExpansion::restartTargetDistributions() {
 }
 
 
+void VesLinearExpansion::writeTargetDistributionsToCheckpoint(VesCheckpoint& checkpoint, const std::string& prefix) const {
+  const Grid* targetdist_grid = bias_expansion_pntr_->getPntrToTargetDistGrid();
+  std::vector<double> targetdist_values(targetdist_grid->getSize());
+  for(Grid::index_t l=0; l<targetdist_grid->getSize(); l++) {
+    targetdist_values[l] = targetdist_grid->getValue(l);
+  }
+  checkpoint.add(prefix+"targetdist",targetdist_values);
+  checkpoint.add(prefix+"targetdist_averages",bias_expansion_pntr_->TargetDistAverages().getDataAsVector());
+}
+
+
+void VesLinearExpansion::restartTargetDistributions(const VesCheckpoint& checkpoint, const std::string& prefix) {
+  const std::vector<double>& targetdist_values = checkpoint.get(prefix+"targetdist",bias_expansion_pntr_->getPntrToTargetDistGrid()->getSize());
+  const std::vector<double>& targetdist_averages = checkpoint.get(prefix+"targetdist_averages",numberOfCoeffs());
+  bias_expansion_pntr_->restartTargetDistribution(targetdist_values,targetdist_averages);
+  setTargetDistAverages(bias_expansion_pntr_->TargetDistAverages());
+}
+
+
 void VesLinearExpansion::setupBiasFileOutput() {
   bias_expansion_pntr_->setupBiasGrid(true);
 }
@@ -478,14 +574,12 @@ void VesLinearExpansion::setupBiasFileOutput() {
 
 void VesLinearExpansion::writeBiasToFile() {
   bias_expansion_pntr_->updateBiasGrid();
-  OFile* ofile_pntr = getOFile(getCurrentBiasOutputFilename(),useMultipleWalkers());
-  bias_expansion_pntr_->writeBiasGridToFile(*ofile_pntr);
-  ofile_pntr->close(); delete ofile_pntr;
+  plumed_massert(bias_expansion_pntr_->getPntrToBiasGrid()!=NULL,"the bias grid is not defined");
+  writeGridToFile(bias_expansion_pntr_->getPntrToBiasGrid(),getCurrentBiasOutputFilename());
   if(biasCutoffActive()) {
     bias_expansion_pntr_->updateBiasWithoutCutoffGrid();
-    OFile* ofile_pntr2 = getOFile(getCurrentBiasOutputFilename("without-cutoff"),useMultipleWalkers());
-    bias_expansion_pntr_->writeBiasWithoutCutoffGridToFile(*ofile_pntr2);
-    ofile_pntr2->close(); delete ofile_pntr2;
+    plumed_massert(bias_expansion_pntr_->getPntrToBiasWithoutCutoffGrid()!=NULL,"the bias without cutoff grid is not defined");
+    writeGridToFile(bias_expansion_pntr_->getPntrToBiasWithoutCutoffGrid(),getCurrentBiasOutputFilename("without-cutoff"));
   }
 }
 
@@ -502,9 +596,8 @@ void VesLinearExpansion::setupFesFileOutput() {
 
 void VesLinearExpansion::writeFesToFile() {
   bias_expansion_pntr_->updateFesGrid();
-  OFile* ofile_pntr = getOFile(getCurrentFesOutputFilename(),useMultipleWalkers());
-  bias_expansion_pntr_->writeFesGridToFile(*ofile_pntr);
-  ofile_pntr->close(); delete ofile_pntr;
+  plumed_massert(bias_expansion_pntr_->getPntrToFesGrid()!=NULL,"the FES grid is not defined");
+  writeGridToFile(bias_expansion_pntr_->getPntrToFesGrid(),getCurrentFesOutputFilename());
 }
 
 
@@ -522,25 +615,26 @@ void VesLinearExpansion::setupFesProjFileOutput() {
 
 void VesLinearExpansion::writeFesProjToFile() {
   bias_expansion_pntr_->updateFesGrid();
+  plumed_massert(bias_expansion_pntr_->getPntrToFesGrid()!=NULL,"the FES grid is not defined");
+  const double beta = bias_expansion_pntr_->getBeta();
   for(unsigned int i=0; i<getNumberOfProjectionArguments(); i++) {
     std::string suffix;
     Tools::convert(i+1,suffix);
     suffix = "proj-" + suffix;
-    OFile* ofile_pntr = getOFile(getCurrentFesOutputFilename(suffix),useMultipleWalkers());
     std::vector<std::string> args = getProjectionArgument(i);
-    bias_expansion_pntr_->writeFesProjGridToFile(args,*ofile_pntr);
-    ofile_pntr->close(); delete ofile_pntr;
+    writeGridToFile(bias_expansion_pntr_->getPntrToFesGrid(),getCurrentFesOutputFilename(suffix),[args,beta](Grid& fes_grid) {
+      FesWeight Fw(beta);
+      Grid proj_grid = fes_grid.project(args,&Fw);
+      proj_grid.setMinToZero();
+      return proj_grid;
+    });
   }
 }
 
 
 void VesLinearExpansion::writeTargetDistToFile() {
-  OFile* ofile1_pntr = getOFile(getCurrentTargetDistOutputFilename(),useMultipleWalkers());
-  OFile* ofile2_pntr = getOFile(getCurrentTargetDistOutputFilename("log"),useMultipleWalkers());
-  bias_expansion_pntr_->writeTargetDistGridToFile(*ofile1_pntr);
-  bias_expansion_pntr_->writeLogTargetDistGridToFile(*ofile2_pntr);
-  ofile1_pntr->close(); delete ofile1_pntr;
-  ofile2_pntr->close(); delete ofile2_pntr;
+  writeGridToFile(bias_expansion_pntr_->getPntrToTargetDistGrid(),getCurrentTargetDistOutputFilename());
+  writeGridToFile(bias_expansion_pntr_->getPntrToLogTargetDistGrid(),getCurrentTargetDistOutputFilename("log"));
 }
 
 
@@ -549,10 +643,10 @@ void VesLinearExpansion::writeTargetDistProjToFile() {
     std::string suffix;
     Tools::convert(i+1,suffix);
     suffix = "proj-" + suffix;
-    OFile* ofile_pntr = getOFile(getCurrentTargetDistOutputFilename(suffix),useMultipleWalkers());
     std::vector<std::string> args = getProjectionArgument(i);
-    bias_expansion_pntr_->writeTargetDistProjGridToFile(args,*ofile_pntr);
-    ofile_pntr->close(); delete ofile_pntr;
+    writeGridToFile(bias_expansion_pntr_->getPntrToTargetDistGrid(),getCurrentTargetDistOutputFilename(suffix),[args](Grid& targetdist_grid) {
+      return TargetDistribution::getMarginalDistributionGrid(&targetdist_grid,args);
+    });
   }
 }
 
@@ -25,6 +25,10 @@
 #include "tools/Grid.h"
 #include "tools/IFile.h"
 #include "tools/Exception.h"
+#include "tools/OpenMP.h"
+
+#include <algorithm>
+#include <cmath>
 
 
 namespace PLMD {
@@ -44,6 +48,58 @@ void VesTools::copyGridValues(GridBase* grid_pntr_orig, GridBase* grid_pntr_copy
 }
 
 
+/*
+Each grid point with value one is the center of a Gaussian that is truncated
+at five standard deviations, and the new value at each grid point is the largest
+of the Gaussians reaching it (or the old value if it is larger). The Gaussians
+are products of one dimensional Gaussians, so the largest value is found one
+dimension at a time by a one dimensional max-filter along each grid line.
+A standard deviation of zero means that there is no smoothing along that
+dimension.
+*/
+void VesTools::smoothGridWithGaussians(Grid* grid_pntr, const std::vector<double>& sigma) {
+  const unsigned int dimension = grid_pntr->getDimension();
+  plumed_massert(sigma.size()==dimension,"the number of standard deviations does not match the dimension of the grid");
+  const std::vector<unsigned int> nbin = grid_pntr->getNbin();
+  const std::vector<double> dx = grid_pntr->getDx();
+  const Grid::index_t size = grid_pntr->getSize();
+  //
+  std::vector<double> values(size);
+  for(Grid::index_t l=0; l<size; l++) {values[l] = grid_pntr->getValue(l);}
+  std::vector<double> smoothed(size);
+  // the grid index runs fastest along the first dimension
+  Grid::index_t stride = 1;
+  for(unsigned int k=0; k<dimension; k++) {
+    if(sigma[k]>0.0) {
+      const int nk = static_cast<int>(nbin[k]);
+      const int delta_bin = std::min(static_cast<int>(std::floor(5*sigma[k]/dx[k])),nk-1);
+      std::vector<double> kernel(delta_bin+1);
+      for(int d=0; d<=delta_bin; d++) {
+        const double arg = d*dx[k]/sigma[k];
+        kernel[d] = std::exp(-0.5*arg*arg);
+      }
+      const Grid::index_t nlines = size/nbin[k];
+      #pragma omp parallel for num_threads(OpenMP::getNumThreads())
+      for(Grid::index_t line=0; line<nlines; line++) {
+        const Grid::index_t first = (line/stride)*stride*nbin[k] + line%stride;
+        for(int i=0; i<nk; i++) {
+          const int jmin = std::max(i-delta_bin,0);
+          const int jmax = std::min(i+delta_bin,nk-1);
+          double value = 0.0;
+          for(int j=jmin; j<=jmax; j++) {
+            value = std::max(value,kernel[std::abs(i-j)]*values[first+j*stride]);
+          }
+          smoothed[first+i*stride] = value;
+        }
+      }
+      values.swap(smoothed);
+    }
+    stride *= nbin[k];
+  }
+  for(Grid::index_t l=0; l<size; l++) {grid_pntr->setValue(l,values[l]);}
+}
+
+
 unsigned int VesTools::getGridFileInfo(const std::string& filepath, std::string& grid_label, std::vector<std::string>& arg_labels, std::vector<std::string>& arg_min, std::vector<std::string>& arg_max, std::vector<bool>& arg_periodic, std::vector<unsigned int>& arg_nbins, bool& derivatives) {
 
   IFile ifile; ifile.open(filepath);
@@ -34,6 +34,7 @@
 namespace PLMD {
 
 class GridBase;
+class Grid;
 
 namespace ves {
 
@@ -42,8 +43,12 @@ public:
   // Convert double into a string with more digits
   static void convertDbl2Str(const double value,std::string& str, unsigned int precision);
   static void convertDbl2Str(const double value,std::string& str);
+  // compensated (Kahan) summation of a value into a sum
+  static void kahanSum(double& sum, double& compensation, const double value);
   // copy grid values
   static void copyGridValues(GridBase* grid_pntr_orig, GridBase* grid_pntr_copy);
+  // smooth a grid of zeros and ones by placing a truncated Gaussian on each point with value one
+  static void smoothGridWithGaussians(Grid* grid_pntr, const std::vector<double>& sigma);
   static unsigned int getGridFileInfo(const std::string&, std::string&, std::vector<std::string>&, std::vector<std::string>&, std::vector<std::string>&, std::vector<bool>&, std::vector<unsigned int>&, bool&);
   //
   template<typename T> static std::vector<std::string> getLabelsOfAvailableActions(const ActionSet&);
@@ -67,6 +72,15 @@ void VesTools::convertDbl2Str(const double value,std::string& str) {
 }
 
 
+inline
+void VesTools::kahanSum(double& sum, double& compensation, const double value) {
+  const double y = value - compensation;
+  const double t = sum + y;
+  compensation = (t - sum) - y;
+  sum = t;
+}
+
+
 template<typename T>
 std::vector<std::string> VesTools::getLabelsOfAvailableActions(const ActionSet& actionset) {
   std::vector<std::string> avail_action_str(0);